@@ -12,9 +12,14 @@ from werkzeug.utils import secure_filename
 import cv2
 import numpy as np
 import json
+import contextlib
+import threading
+import queue
+import time
+from collections import OrderedDict
 import ctypes
 from ctypes import Structure, c_long, c_ubyte, POINTER
-from src.video_wrapper import video_processor, VIDEO_PROCESSING_AVAILABLE
+from src.video_wrapper import video_processor, VIDEO_PROCESSING_AVAILABLE, ContextPool, VideoScheduler, ResultCache, CheckpointStore, DecodedCache, DaemonClient, FrameServer, is_standard_format, program_from_operations, proxy_operations, make_roi
 import src.image_functions as image_processor
 
 app = Flask(__name__)
@@ -29,9 +34,104 @@ app.config['PROCESSED_FOLDER'] = 'processed'
 os.makedirs(app.config['UPLOAD_FOLDER'], exist_ok=True)
 os.makedirs(app.config['PROCESSED_FOLDER'], exist_ok=True)
 
+# Video jobs run through a scheduler that admits them against VIDEO_WORKERS
+# CPU slots (each on its own cores) and VIDEO_MEMORY_BUDGET_MB of decoded
+# video, shortest job first. Requests naming an explicit 'mode' bypass it and
+# borrow a context from the pool, to compare the memory layouts directly.
+#
+# Scheduled results are cached by content in VIDEO_CACHE_DIR, keeping up to
+# VIDEO_CACHE_MB, so re-running a chain on the same upload is a lookup.
+# Intermediate videos are checkpointed (VIDEO_CHECKPOINT_MB in memory, then
+# up to VIDEO_CHECKPOINT_DISK_MB on disk) so editing the end of a chain only
+# recomputes the ops that changed.
+#
+# VIDEO_DETERMINISTIC=1 makes every output bit-identical across runs and
+# hosts (single-threaded FFmpeg, exact colour conversion).
+#
+# With VIDEO_SPILL_DIR set, a scheduled job bigger than VIDEO_MEMORY_BUDGET_MB
+# keeps the excess in scratch files there instead of in RAM.
+#
+# Uploads decoded for in-process requests are kept in VIDEO_CACHE_DIR/decoded
+# (up to VIDEO_DECODED_CACHE_MB) and mapped copy-on-write by every worker
+# process, so repeated edits on an upload skip decoding it.
+video_contexts = None
+video_scheduler = None
+result_cache = None
+video_checkpoints = None
+decoded_cache = None
+if VIDEO_PROCESSING_AVAILABLE:
+    video_workers = int(os.environ.get('VIDEO_WORKERS', '2'))
+    video_deterministic = os.environ.get('VIDEO_DETERMINISTIC', '0') == '1'
+    video_spill_dir = os.environ.get('VIDEO_SPILL_DIR') or None
+    if video_spill_dir:
+        os.makedirs(video_spill_dir, exist_ok=True)
+    video_contexts = ContextPool(video_processor, slots=video_workers,
+                                 deterministic=video_deterministic)
+    video_scheduler = VideoScheduler(
+        video_processor, slots=video_workers,
+        memory_budget=int(os.environ.get('VIDEO_MEMORY_BUDGET_MB', '0')) << 20,
+        deterministic=video_deterministic, spill_dir=video_spill_dir)
+    result_cache = ResultCache(
+        video_processor, os.environ.get('VIDEO_CACHE_DIR', 'cache'),
+        budget_bytes=int(os.environ.get('VIDEO_CACHE_MB', '2048')) << 20)
+    video_checkpoints = CheckpointStore(
+        video_processor, int(os.environ.get('VIDEO_CHECKPOINT_MB', '512')) << 20,
+        spill=ResultCache(
+            video_processor,
+            os.path.join(os.environ.get('VIDEO_CACHE_DIR', 'cache'), 'checkpoints'),
+            budget_bytes=int(os.environ.get('VIDEO_CHECKPOINT_DISK_MB', '4096')) << 20))
+    decoded_cache = DecodedCache(
+        video_processor, os.path.join(os.environ.get('VIDEO_CACHE_DIR', 'cache'), 'decoded'),
+        budget_bytes=int(os.environ.get('VIDEO_DECODED_CACHE_MB', '4096')) << 20)
+
+# The scrubber's frames come from a frame server, which keeps recent uploads
+# open and caches VIDEO_FRAME_CACHE_MB of decoded frames
+frame_server = None
+if VIDEO_PROCESSING_AVAILABLE and video_processor.has_standard_format_support:
+    frame_server = FrameServer(
+        video_processor, int(os.environ.get('VIDEO_FRAME_CACHE_MB', '256')) << 20)
+
+# Video uploads are prepared in the background as soon as they arrive (idle
+# priority, one decode at a time): opened in the frame server, decoded into
+# the decoded cache, with per-frame stats and thumbnails kept for the last
+# VIDEO_PREPARED_UPLOADS uploads
+VIDEO_PREPARED_UPLOADS = int(os.environ.get('VIDEO_PREPARED_UPLOADS', '32'))
+video_preparer = None
+if VIDEO_PROCESSING_AVAILABLE:
+    prepare_context = video_processor.create_context()
+    if video_deterministic:
+        prepare_context.set_deterministic()  # same decoded-cache keys as the pool
+    video_preparer = video_processor.with_context(prepare_context)
+video_preparations = OrderedDict()
+video_preparations_lock = threading.Lock()
+
+# Preview requests ({"preview": true}) run on a cached proxy of the upload,
+# at most VIDEO_PREVIEW_SIDE pixels a side and VIDEO_PREVIEW_FRAMES frames,
+# waiting at most VIDEO_PREVIEW_WAIT seconds for a context; the last
+# VIDEO_PREVIEW_CHAINS op chains are kept for /export_video to replay
+VIDEO_PREVIEW_SIDE = int(os.environ.get('VIDEO_PREVIEW_SIDE', '96'))
+VIDEO_PREVIEW_FRAMES = int(os.environ.get('VIDEO_PREVIEW_FRAMES', '150'))
+VIDEO_PREVIEW_WAIT = float(os.environ.get('VIDEO_PREVIEW_WAIT', '5'))
+VIDEO_PREVIEW_CHAINS = int(os.environ.get('VIDEO_PREVIEW_CHAINS', '256'))
+video_previews = OrderedDict()
+video_previews_lock = threading.Lock()
+
+# With FILMMASTER_SOCKET set, synchronous video requests run on lib/video_daemon
+video_daemon = DaemonClient() if os.environ.get('FILMMASTER_SOCKET') else None
+
+# Asynchronous video jobs by job id: {'job': VideoJob, 'file_id': ..., 'output': ...,
+# 'polled': time of the last poll}. Jobs nobody has polled for VIDEO_JOB_ABANDON
+# seconds are cancelled, and finished ones are forgotten after VIDEO_JOB_TTL.
+VIDEO_JOB_TTL = float(os.environ.get('VIDEO_JOB_TTL', '600'))
+VIDEO_JOB_ABANDON = float(os.environ.get('VIDEO_JOB_ABANDON', '120'))
+video_jobs = {}
+video_jobs_lock = threading.Lock()
+
 # Allowed file extensions
 ALLOWED_IMAGE_EXTENSIONS = {'png', 'jpg', 'jpeg', 'gif', 'bmp', 'tiff'}
 ALLOWED_VIDEO_EXTENSIONS = {'mp4', 'avi', 'mov', 'mkv', 'wmv'}
+# Files of a rendition ladder: playlists and their MPEG-TS segments
+HLS_SUFFIXES = ('.m3u8', '.ts')
 
 def allowed_file(filename, file_type):
     """Check if uploaded file is allowed"""
@@ -68,6 +168,8 @@ def upload_file():
         
         filepath = os.path.join(app.config['UPLOAD_FOLDER'], unique_filename)
         file.save(filepath)
+        if file_type == 'video' and video_preparer:
+            _prepare_upload(file_id, filepath)
         
         return jsonify({
             'success': True,
@@ -79,6 +181,24 @@ def upload_file():
     
     return jsonify({'error': 'File type not allowed'}), 400
 
+def _prepare_upload(file_id, filepath):
+    """Start preparing a video upload, dropping the oldest preparation over the limit"""
+    try:
+        prepared = video_preparer.prepare_video(
+            filepath, decoded_cache=decoded_cache,
+            frame_server=frame_server if is_standard_format(filepath) else None,
+            num_thumbnails=8, proxy=(VIDEO_PREVIEW_SIDE, VIDEO_PREVIEW_FRAMES))
+    except RuntimeError as e:
+        app.logger.warning("Could not prepare %s: %s", filepath, e)
+        return
+    with video_preparations_lock:
+        video_preparations[file_id] = prepared
+        evicted = []
+        while len(video_preparations) > VIDEO_PREPARED_UPLOADS:
+            evicted.append(video_preparations.popitem(last=False)[1])
+    for old in evicted:
+        old.close()
+
 @app.route('/process_image', methods=['POST'])
 def process_image():
     """Process image using Python functions from main.py"""
@@ -300,16 +420,154 @@ def get_image_operations():
     ]
     return jsonify(operations)
 
+def _decode_upload(processor, input_path, mode):
+    """Decode an upload, through the shared decoded cache for SVideos"""
+    if mode == 'structured' and decoded_cache:
+        return processor.decode_video_cached(decoded_cache, input_path)
+    return processor.decode_video(input_path, mode)
+
+def _process_video_file(processor, file_id, input_path, operations, mode):
+    """Decode, process and encode one video with a context-bound processor"""
+    # Decode video
+    video_ptr = _decode_upload(processor, input_path, mode)
+    if not video_ptr:
+        return jsonify({'error': 'Could not decode video'}), 400
+    return _process_decoded_video(processor, file_id, video_ptr, operations, mode)
+
+def _apply_video_operations(processor, video_ptr, operations, mode):
+    """Run the request's operations on a decoded video"""
+    for operation in operations:
+        op_name = operation.get('name')
+        params = operation.get('params', {})
+        roi = make_roi(**operation['roi']) if operation.get('roi') else None
+        
+        if op_name == 'reverse':
+            processor.reverse_video(video_ptr, mode)
+        elif op_name == 'swap_channels':
+            channel1 = params.get('channel1', 0)
+            channel2 = params.get('channel2', 1)
+            processor.swap_channels(video_ptr, channel1, channel2, mode, roi)
+        elif op_name == 'clip_channel':
+            channel = params.get('channel', 0)
+            min_val = params.get('min_val', 0)
+            max_val = params.get('max_val', 255)
+            processor.clip_channel(video_ptr, channel, min_val, max_val, mode, roi)
+        elif op_name == 'scale_channel':
+            channel = params.get('channel', 0)
+            scale_factor = params.get('scale_factor', 1.0)
+            processor.scale_channel(video_ptr, channel, scale_factor, mode, roi)
+
+def _remove_old_outputs(file_id, keep, suffix='_processed.mp4'):
+    """
+    Clean up earlier outputs for this file_id ending with suffix (a string or
+    tuple), except those named keep or starting with it, to prevent accumulation
+    """
+    for existing_file in os.listdir(app.config['PROCESSED_FOLDER']):
+        if existing_file.startswith(f"{file_id}_") and existing_file.endswith(suffix) \
+                and not existing_file.startswith(keep):
+            try:
+                os.remove(os.path.join(app.config['PROCESSED_FOLDER'], existing_file))
+            except OSError:
+                pass  # Ignore errors if file is in use
+
+def _remove_outputs(prefix):
+    """Remove every output whose name starts with prefix, e.g. a failed encode's files"""
+    for existing_file in os.listdir(app.config['PROCESSED_FOLDER']):
+        if existing_file.startswith(prefix):
+            try:
+                os.remove(os.path.join(app.config['PROCESSED_FOLDER'], existing_file))
+            except OSError:
+                pass
+
+def _process_decoded_video(processor, file_id, video_ptr, operations, mode):
+    """Process and encode a decoded video, freeing it"""
+    _apply_video_operations(processor, video_ptr, operations, mode)
+    
+    # Save processed video with unique filename to prevent caching
+    unique_id = str(uuid.uuid4())
+    output_filename = f"{file_id}_{unique_id}_processed.mp4"
+    output_path = os.path.join(app.config['PROCESSED_FOLDER'], output_filename)
+    
+    result = processor.encode_video(output_path, video_ptr, mode)
+    
+    # Free memory
+    processor.free_video(video_ptr, mode)
+    
+    if result == 0:  # Success
+        _remove_old_outputs(file_id, output_filename)
+        return jsonify({
+            'success': True,
+            'processed_file': output_filename,
+            'operations_applied': len(operations)
+        })
+    else:
+        return jsonify({'error': 'Failed to encode processed video'}), 500
+
+@app.route('/process_video_stream', methods=['POST'])
+def process_video_stream():
+    """
+    Process a video sent as the raw request body, decoding it while it
+    arrives instead of saving an upload first. Operations are a JSON list in
+    the 'operations' query parameter; MP4/MOV bodies must be faststart.
+    """
+    if not VIDEO_PROCESSING_AVAILABLE or not video_contexts \
+            or not video_processor.has_standard_format_support:
+        return jsonify({'error': 'Streamed video processing needs FFmpeg support'}), 500
+    try:
+        operations = json.loads(request.args.get('operations', '[]'))
+    except ValueError:
+        return jsonify({'error': 'Invalid operations'}), 400
+    
+    if request.args.get('stream') == '1':
+        return _stream_processed_video(operations)
+    
+    file_id = str(uuid.uuid4())
+    try:
+        with video_contexts.processor_for_job() as processor:
+            video_ptr = processor.decode_video_stream(request.stream)
+            return _process_decoded_video(processor, file_id, video_ptr, operations,
+                                          'structured')
+    except Exception as e:
+        return jsonify({'error': str(e)}), 400
+
+def _stream_processed_video(operations):
+    """
+    Respond with the processed video as fragmented MP4, sent fragment by
+    fragment while it encodes so the client can start playing after the
+    first one
+    """
+    # The context and the video are held until the response is closed, which
+    # also happens when the client disconnects before the first fragment
+    held = contextlib.ExitStack()
+    processor = held.enter_context(video_contexts.processor_for_job())
+    try:
+        video_ptr = processor.decode_video_stream(request.stream)
+        held.callback(processor.free_video, video_ptr, 'structured')
+        _apply_video_operations(processor, video_ptr, operations, 'structured')
+    except Exception as e:
+        held.close()
+        return jsonify({'error': str(e)}), 400
+    
+    def generate():
+        try:
+            yield from processor.encode_video_chunks(
+                video_ptr, fragment_seconds=float(os.environ.get('VIDEO_FRAGMENT_SECONDS', '1')))
+        finally:
+            held.close()
+    response = app.response_class(generate(), mimetype='video/mp4')
+    response.call_on_close(held.close)
+    return response
+
 @app.route('/process_video', methods=['POST'])
 def process_video():
     """Process video using C functions from libFilmMaster2000"""
-    if not VIDEO_PROCESSING_AVAILABLE:
+    if not VIDEO_PROCESSING_AVAILABLE and not video_daemon:
         return jsonify({'error': 'Video processing not available. Please compile libFilmMaster2000.c to a DLL.'}), 500
     
     data = request.json
     file_id = data.get('file_id')
     operations = data.get('operations', [])
-    mode = data.get('mode', 'memory')  # Default to memory mode for better performance
+    mode = data.get('mode')
     
     if not file_id:
         return jsonify({'error': 'No file ID provided'}), 400
@@ -322,62 +580,334 @@ def process_video():
         
         input_path = os.path.join(app.config['UPLOAD_FOLDER'], upload_files[0])
         
-        # Decode video
-        video_ptr = video_processor.decode_video(input_path, mode)
-        if not video_ptr:
-            return jsonify({'error': 'Could not decode video'}), 400
+        if data.get('preview'):
+            return _process_video_preview(file_id, input_path, operations)
         
-        # Process video based on operations
-        for operation in operations:
-            op_name = operation.get('name')
-            params = operation.get('params', {})
-            
-            if op_name == 'reverse':
-                video_processor.reverse_video(video_ptr, mode)
-            elif op_name == 'swap_channels':
-                channel1 = params.get('channel1', 0)
-                channel2 = params.get('channel2', 1)
-                video_processor.swap_channels(video_ptr, channel1, channel2, mode)
-            elif op_name == 'clip_channel':
-                channel = params.get('channel', 0)
-                min_val = params.get('min_val', 0)
-                max_val = params.get('max_val', 255)
-                video_processor.clip_channel(video_ptr, channel, min_val, max_val, mode)
-            elif op_name == 'scale_channel':
-                channel = params.get('channel', 0)
-                scale_factor = params.get('scale_factor', 1.0)
-                video_processor.scale_channel(video_ptr, channel, scale_factor, mode)
+        if 'renditions' in data:
+            return _process_video_renditions(file_id, input_path, operations,
+                                             data['renditions'])
         
-        # Clean up old processed files for this file_id to prevent accumulation
-        for existing_file in os.listdir(app.config['PROCESSED_FOLDER']):
-            if existing_file.startswith(f"{file_id}_") and existing_file.endswith("_processed.mp4"):
-                try:
-                    os.remove(os.path.join(app.config['PROCESSED_FOLDER'], existing_file))
-                except:
-                    pass  # Ignore errors if file is in use
+        if video_daemon and not data.get('async'):
+            return _process_video_on_daemon(file_id, input_path, operations)
         
-        # Save processed video with unique filename to prevent caching
-        unique_id = str(uuid.uuid4())
-        output_filename = f"{file_id}_{unique_id}_processed.mp4"
-        output_path = os.path.join(app.config['PROCESSED_FOLDER'], output_filename)
+        if data.get('async'):
+            return _submit_video_job(file_id, input_path, operations)
         
-        result = video_processor.encode_video(output_path, video_ptr, mode)
+        if not mode:
+            return _process_video_scheduled(file_id, input_path, operations)
         
-        # Free memory
-        video_processor.free_video(video_ptr, mode)
+        # Standard formats (MP4, MOV, ...) always decode to SVideo
+        if video_processor.has_standard_format_support and is_standard_format(input_path):
+            mode = 'structured'
         
-        if result == 0:  # Success
-            return jsonify({
-                'success': True,
-                'processed_file': output_filename,
-                'operations_applied': len(operations)
-            })
-        else:
-            return jsonify({'error': 'Failed to encode processed video'}), 500
+        with video_contexts.processor_for_job() as processor:
+            return _process_video_file(processor, file_id, input_path, operations, mode)
         
     except Exception as e:
         return jsonify({'error': f'Video processing failed: {str(e)}'}), 500
 
+def _process_video_preview(file_id, input_path, operations):
+    """
+    Run the operations on the upload's proxy with the fastest encoder
+    settings, and keep the chain for a full-quality export
+    """
+    if not VIDEO_PROCESSING_AVAILABLE or not video_contexts or not decoded_cache:
+        return jsonify({'error': 'Previews need the video library'}), 500
+    try:
+        program_from_operations(operations)  # the export has to be able to replay it
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    
+    output_filename = f"{file_id}_{uuid.uuid4()}_preview.mp4"
+    output_path = os.path.join(app.config['PROCESSED_FOLDER'], output_filename)
+    try:
+        with video_contexts.processor_for_job(timeout=VIDEO_PREVIEW_WAIT) as processor:
+            video_ptr, step, scale = processor.decode_video_proxy(
+                decoded_cache, input_path, VIDEO_PREVIEW_SIDE, VIDEO_PREVIEW_FRAMES)
+            try:
+                _apply_video_operations(processor, video_ptr,
+                                        proxy_operations(operations, step, scale), 'structured')
+                # Every step-th frame, so the preview lasts as long as the source
+                fps = max(1, round(30 / step))
+                if processor.has_standard_format_support:
+                    processor.encode_video_preview(output_path, video_ptr, fps=fps)
+                else:
+                    processor.encode_video(output_path, video_ptr, 'structured', fps=fps)
+            finally:
+                processor.free_video(video_ptr, 'structured')
+    except queue.Empty:
+        return jsonify({'error': 'Server busy, try the preview again'}), 503
+    
+    _remove_old_outputs(file_id, output_filename, '_preview.mp4')
+    
+    preview_id = str(uuid.uuid4())
+    with video_previews_lock:
+        video_previews[preview_id] = {'file_id': file_id, 'operations': operations}
+        while len(video_previews) > VIDEO_PREVIEW_CHAINS:
+            video_previews.popitem(last=False)
+    return jsonify({
+        'success': True,
+        'processed_file': output_filename,
+        'preview_id': preview_id,
+        'operations_applied': len(operations)
+    })
+
+@app.route('/export_video', methods=['POST'])
+def export_video():
+    """Replay a preview's op chain at full quality as a job to poll"""
+    if not VIDEO_PROCESSING_AVAILABLE or not video_scheduler:
+        return jsonify({'error': 'Video processing not available'}), 500
+    preview_id = (request.json or {}).get('preview_id')
+    with video_previews_lock:
+        preview = video_previews.get(preview_id)
+    if not preview:
+        return jsonify({'error': 'Preview not found'}), 404
+    input_path = _find_upload(preview['file_id'])
+    if not input_path:
+        return jsonify({'error': 'File not found'}), 404
+    return _submit_video_job(preview['file_id'], input_path, preview['operations'])
+
+def _process_video_renditions(file_id, input_path, operations, heights):
+    """
+    Process a video once and publish it as an HLS ladder, one rendition per
+    height in heights, behind a master playlist
+    """
+    if not VIDEO_PROCESSING_AVAILABLE or not video_contexts \
+            or not video_processor.has_standard_format_support:
+        return jsonify({'error': 'Renditions need FFmpeg support'}), 500
+    if not isinstance(heights, list) or not heights \
+            or any(type(height) is not int or height <= 0 for height in heights) \
+            or len(set(heights)) != len(heights):
+        return jsonify({'error': 'renditions must be a list of distinct positive heights'}), 400
+    
+    base = f"{file_id}_{uuid.uuid4()}"
+    folder = app.config['PROCESSED_FOLDER']
+    playlists = [f"{base}_{height}p.m3u8" for height in heights]
+    master = f"{base}.m3u8"
+    with video_contexts.processor_for_job() as processor:
+        video_ptr = _decode_upload(processor, input_path, 'structured')
+        if not video_ptr:
+            return jsonify({'error': 'Could not decode video'}), 400
+        try:
+            source_height = video_ptr.contents.height
+            if max(heights) > source_height:
+                return jsonify({'error': f'Rendition heights cannot exceed the '
+                                         f'source height of {source_height}'}), 400
+            _apply_video_operations(processor, video_ptr, operations, 'structured')
+            processor.encode_video_renditions(
+                video_ptr,
+                [(os.path.join(folder, name), height) for name, height in zip(playlists, heights)],
+                master_playlist=os.path.join(folder, master))
+        except RuntimeError:
+            # Playlists and segments written before the failure
+            _remove_outputs(base)
+            return jsonify({'error': 'Failed to encode renditions'}), 500
+        finally:
+            processor.free_video(video_ptr, 'structured')
+    
+    # Earlier ladders' playlists and segments all start with their own base
+    _remove_old_outputs(file_id, base, suffix=HLS_SUFFIXES)
+    return jsonify({
+        'success': True,
+        'processed_file': master,
+        'renditions': playlists,
+        'operations_applied': len(operations)
+    })
+
+def _process_video_on_daemon(file_id, input_path, operations):
+    """Run the operations on the video daemon and wait for the result"""
+    try:
+        program = program_from_operations(operations)
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    
+    output_filename = f"{file_id}_{uuid.uuid4()}_processed.mp4"
+    output_path = os.path.join(app.config['PROCESSED_FOLDER'], output_filename)
+    state = video_daemon.run_job(os.path.abspath(input_path), os.path.abspath(output_path), program)
+    if state != 'done':
+        return jsonify({'error': f'Video processing {state}'}), 500
+    
+    _remove_old_outputs(file_id, output_filename)
+    return jsonify({
+        'success': True,
+        'processed_file': output_filename,
+        'operations_applied': len(operations)
+    })
+
+def _process_video_scheduled(file_id, input_path, operations):
+    """Run the operations as a scheduled job and wait for the result"""
+    if not video_scheduler:
+        return jsonify({'error': 'Scheduled video jobs need the video library'}), 500
+    try:
+        program = program_from_operations(operations)
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    
+    output_filename = f"{file_id}_{uuid.uuid4()}_processed.mp4"
+    output_path = os.path.join(app.config['PROCESSED_FOLDER'], output_filename)
+    job = video_scheduler.submit_job(input_path, output_path, program, cache=result_cache,
+                                     checkpoints=video_checkpoints)
+    try:
+        state = job.wait()
+        error = job.error
+    finally:
+        job.close()
+    
+    if state != 'done':
+        return jsonify({'error': f'Video processing failed: {error or state}'}), 500
+    _remove_old_outputs(file_id, output_filename)
+    return jsonify({
+        'success': True,
+        'processed_file': output_filename,
+        'operations_applied': len(operations)
+    })
+
+def _submit_video_job(file_id, input_path, operations):
+    """Queue processing on the scheduler and return a job id to poll"""
+    if not video_scheduler:
+        # Only the daemon is configured; it runs requests synchronously
+        return jsonify({'error': 'Asynchronous video jobs need the video library'}), 500
+    try:
+        program = program_from_operations(operations)
+    except ValueError as e:
+        return jsonify({'error': str(e)}), 400
+    
+    output_filename = f"{file_id}_{uuid.uuid4()}_processed.mp4"
+    output_path = os.path.join(app.config['PROCESSED_FOLDER'], output_filename)
+    job = video_scheduler.submit_job(input_path, output_path, program, cache=result_cache,
+                                     checkpoints=video_checkpoints)
+    
+    job_id = str(uuid.uuid4())
+    _expire_video_jobs()
+    with video_jobs_lock:
+        video_jobs[job_id] = {'job': job, 'file_id': file_id, 'output': output_filename,
+                              'polled': time.monotonic()}
+    return jsonify({'success': True, 'job_id': job_id}), 202
+
+def _expire_video_jobs():
+    """Cancel jobs nobody is polling any more and forget old finished ones"""
+    now = time.monotonic()
+    expired = []
+    with video_jobs_lock:
+        for job_id, entry in list(video_jobs.items()):
+            idle = now - entry['polled']
+            if entry['job'].poll()['state'] in ('queued', 'running'):
+                if idle > VIDEO_JOB_ABANDON:
+                    entry['job'].cancel()
+            elif idle > VIDEO_JOB_TTL:
+                expired.append(video_jobs.pop(job_id))
+    for entry in expired:
+        entry['job'].close()
+
+@app.route('/video_jobs/<job_id>', methods=['GET'])
+def video_job_status(job_id):
+    """Report progress of an asynchronous video job"""
+    _expire_video_jobs()
+    with video_jobs_lock:
+        entry = video_jobs.get(job_id)
+        if entry:
+            entry['polled'] = time.monotonic()
+    if not entry:
+        return jsonify({'error': 'Job not found'}), 404
+    
+    status = entry['job'].poll()
+    if status['state'] == 'done':
+        status['processed_file'] = entry['output']
+        _remove_old_outputs(entry['file_id'], entry['output'])
+    elif status['state'] == 'failed':
+        status['error'] = entry['job'].error
+    return jsonify(status)
+
+@app.route('/video_jobs/<job_id>', methods=['DELETE'])
+def cancel_video_job(job_id):
+    """Cancel an asynchronous video job and forget it"""
+    with video_jobs_lock:
+        entry = video_jobs.pop(job_id, None)
+    if not entry:
+        return jsonify({'error': 'Job not found'}), 404
+    
+    entry['job'].close()
+    return jsonify({'success': True})
+
+def _find_upload(file_id):
+    """Path of an uploaded file by id, or None"""
+    upload_files = [f for f in os.listdir(app.config['UPLOAD_FOLDER']) if f.startswith(file_id)]
+    return os.path.join(app.config['UPLOAD_FOLDER'], upload_files[0]) if upload_files else None
+
+@app.route('/video_frames/<file_id>', methods=['GET'])
+def video_frames_info(file_id):
+    """Frame count and size of an uploaded video, for the scrubber"""
+    if not frame_server:
+        return jsonify({'error': 'Frame access needs FFmpeg support'}), 500
+    input_path = _find_upload(file_id)
+    if not input_path or not is_standard_format(input_path):
+        return jsonify({'error': 'File not found'}), 404
+    try:
+        return jsonify(frame_server.info(input_path))
+    except RuntimeError as e:
+        return jsonify({'error': str(e)}), 500
+
+@app.route('/video_frames/<file_id>/<int:index>', methods=['GET'])
+def video_frame(file_id, index):
+    """One frame of an uploaded video as a JPEG"""
+    if not frame_server:
+        return jsonify({'error': 'Frame access needs FFmpeg support'}), 500
+    input_path = _find_upload(file_id)
+    if not input_path or not is_standard_format(input_path):
+        return jsonify({'error': 'File not found'}), 404
+    try:
+        rgb, width, height = frame_server.get_frame(input_path, index)
+    except RuntimeError as e:
+        return jsonify({'error': str(e)}), 404
+    
+    image = np.frombuffer(rgb, dtype=np.uint8).reshape(height, width, 3)
+    ok, jpeg = cv2.imencode('.jpg', cv2.cvtColor(image, cv2.COLOR_RGB2BGR))
+    if not ok:
+        return jsonify({'error': 'Could not encode frame'}), 500
+    return app.response_class(jpeg.tobytes(), mimetype='image/jpeg')
+
+@app.route('/video_stats/<file_id>', methods=['GET'])
+def video_stats(file_id):
+    """Size, length and per-frame channel stats of an upload, once prepared"""
+    with video_preparations_lock:
+        prepared = video_preparations.get(file_id)
+    if not prepared:
+        return jsonify({'error': 'Video not prepared'}), 404
+    # An upload evicting this one closes it only once the reads are done
+    with prepared.use() as alive:
+        if not alive:
+            return jsonify({'error': 'Video not prepared'}), 404
+        info = prepared.info()
+        if not prepared.done():
+            return jsonify({'ready': False, 'info': info}), 202
+        stats = prepared.stats()
+    if stats is None:
+        return jsonify({'error': 'Could not decode video'}), 500
+    return jsonify({'ready': True, 'info': info, 'frames': stats})
+
+@app.route('/video_thumbnails/<file_id>/<int:index>', methods=['GET'])
+def video_thumbnail(file_id, index):
+    """One of an upload's prepared thumbnails as a JPEG"""
+    with video_preparations_lock:
+        prepared = video_preparations.get(file_id)
+    if not prepared:
+        return jsonify({'error': 'Video not prepared'}), 404
+    with prepared.use() as alive:
+        if not alive:
+            return jsonify({'error': 'Video not prepared'}), 404
+        if not prepared.done():
+            return jsonify({'ready': False}), 202
+        thumbnail = prepared.thumbnail(index)
+    if not thumbnail:
+        return jsonify({'error': 'Thumbnail not found'}), 404
+    rgb, width, height = thumbnail
+    
+    image = np.frombuffer(rgb, dtype=np.uint8).reshape(height, width, 3)
+    ok, jpeg = cv2.imencode('.jpg', cv2.cvtColor(image, cv2.COLOR_RGB2BGR))
+    if not ok:
+        return jsonify({'error': 'Could not encode thumbnail'}), 500
+    return app.response_class(jpeg.tobytes(), mimetype='image/jpeg')
+
 @app.route('/get_video_operations')
 def get_video_operations():
     """Return available video processing operations"""
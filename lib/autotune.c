@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <immintrin.h>
+#include "autotune.h"
+#include "video_kernels.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#ifdef _WIN32
+#include <direct.h>
+#define MKDIR(path) _mkdir(path)
+#else
+#include <unistd.h>
+#define MKDIR(path) mkdir(path, 0755)
+#endif
+
+#define TUNE_REPS 3
+#define STREAMING_MIN_BYTES (32u * 1024 * 1024)
+
+static TuneParams g_params;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static char g_cache_path[1024];
+
+void autotune_defaults(TuneParams *params) {
+    // The values the kernels were hardcoded with before tuning existed
+    params->tile_bytes = 32;
+    params->prefetch_distance = 32;
+    params->chunk_bytes = 64 * 1024;
+    params->streaming_stores = 0;
+    params->small_video_bytes = 1024 * 1024;
+    params->small_video_threads = 1;
+}
+
+static int max_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static void cpu_signature(char *out, size_t out_size) {
+    char brand[49] = "unknown";
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int regs[12];
+    if (__get_cpuid_max(0x80000000, NULL) >= 0x80000004) {
+        __get_cpuid(0x80000002, &regs[0], &regs[1], &regs[2], &regs[3]);
+        __get_cpuid(0x80000003, &regs[4], &regs[5], &regs[6], &regs[7]);
+        __get_cpuid(0x80000004, &regs[8], &regs[9], &regs[10], &regs[11]);
+        memcpy(brand, regs, 48);
+        brand[48] = '\0';
+    }
+#endif
+    // Trim leading spaces some vendors pad the brand string with
+    char *start = brand;
+    while (*start == ' ') start++;
+    snprintf(out, out_size, "%s|%d", start, max_threads());
+    for (char *p = out; *p; p++) {
+        if (*p == '\n' || *p == '=') *p = ' ';
+    }
+}
+
+static uint32_t signature_hash(const char *s) {
+    // FNV-1a, only used to give each CPU model its own cache file
+    uint32_t h = 2166136261u;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+const char *autotune_cache_path(void) {
+    if (g_cache_path[0]) return g_cache_path;
+
+    const char *override = getenv("FILMMASTER_TUNE_CACHE");
+    if (override && *override) {
+        snprintf(g_cache_path, sizeof(g_cache_path), "%s", override);
+        return g_cache_path;
+    }
+
+    char dir[900];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    const char *local = getenv("LOCALAPPDATA");
+    if (xdg && *xdg) {
+        snprintf(dir, sizeof(dir), "%s/filmmaster", xdg);
+    } else if (home && *home) {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        MKDIR(dir);
+        snprintf(dir, sizeof(dir), "%s/.cache/filmmaster", home);
+    } else if (local && *local) {
+        snprintf(dir, sizeof(dir), "%s/filmmaster", local);
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+    }
+    MKDIR(dir);
+
+    char sig[128];
+    cpu_signature(sig, sizeof(sig));
+    snprintf(g_cache_path, sizeof(g_cache_path), "%s/tune-%08x.cfg",
+             dir, signature_hash(sig));
+    return g_cache_path;
+}
+
+int autotune_load(const char *path, TuneParams *params) {
+    FILE *file = fopen(path, "r");
+    if (!file) return -1;
+
+    char sig[128];
+    cpu_signature(sig, sizeof(sig));
+
+    TuneParams loaded;
+    autotune_defaults(&loaded);
+    int sig_ok = 0;
+    char line[256];
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *eq = strchr(line, '=');
+        if (line[0] == '#' || !eq) continue;
+        *eq = '\0';
+        const char *key = line;
+        const char *value = eq + 1;
+
+        if (strcmp(key, "cpu") == 0) {
+            sig_ok = strcmp(value, sig) == 0;
+        } else if (strcmp(key, "tile_bytes") == 0) {
+            loaded.tile_bytes = strtoul(value, NULL, 10);
+        } else if (strcmp(key, "prefetch_distance") == 0) {
+            loaded.prefetch_distance = strtoul(value, NULL, 10);
+        } else if (strcmp(key, "chunk_bytes") == 0) {
+            loaded.chunk_bytes = strtoul(value, NULL, 10);
+        } else if (strcmp(key, "streaming_stores") == 0) {
+            loaded.streaming_stores = atoi(value) != 0;
+        } else if (strcmp(key, "small_video_bytes") == 0) {
+            loaded.small_video_bytes = strtoul(value, NULL, 10);
+        } else if (strcmp(key, "small_video_threads") == 0) {
+            loaded.small_video_threads = atoi(value);
+        }
+    }
+    fclose(file);
+
+    if (!sig_ok || loaded.tile_bytes == 0 || loaded.chunk_bytes == 0 ||
+        loaded.small_video_threads < 1) {
+        return -1;
+    }
+
+    *params = loaded;
+    return 0;
+}
+
+int autotune_save(const char *path, const TuneParams *params) {
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not write tuning cache '%s': %s\n",
+                tmp_path, strerror(errno));
+        return -1;
+    }
+
+    char sig[128];
+    cpu_signature(sig, sizeof(sig));
+
+    fprintf(file, "# FilmMaster kernel tuning cache, delete to re-tune\n");
+    fprintf(file, "cpu=%s\n", sig);
+    fprintf(file, "tile_bytes=%zu\n", params->tile_bytes);
+    fprintf(file, "prefetch_distance=%zu\n", params->prefetch_distance);
+    fprintf(file, "chunk_bytes=%zu\n", params->chunk_bytes);
+    fprintf(file, "streaming_stores=%d\n", params->streaming_stores);
+    fprintf(file, "small_video_bytes=%zu\n", params->small_video_bytes);
+    fprintf(file, "small_video_threads=%d\n", params->small_video_threads);
+
+    if (fclose(file) != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+
+    // Rename so concurrent processes never read a half-written file
+    remove(path);
+    if (rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_pattern(unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)(i * 131 + 7);
+    }
+}
+
+static void clip_plane_any(unsigned char *data, size_t size, int streaming) {
+    // The autotuner runs before any context exists, so dispatch on the CPU
+    if (video_cpu_has_avx2()) {
+        clip_plane_avx2(data, size, 16, 235, streaming);
+    } else {
+        clip_plane_scalar(data, size, 16, 235);
+    }
+}
+
+static double bench_scale_tiled(unsigned char *buf, size_t size,
+                                size_t tile, size_t prefetch) {
+    double best = 1e30;
+    for (int rep = 0; rep < TUNE_REPS; rep++) {
+        double t0 = now_seconds();
+        scale_plane_tiled(buf, size, 1.01f, tile, prefetch);
+        double t = now_seconds() - t0;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+static double bench_clip_stream(unsigned char *buf, size_t size, int streaming) {
+    double best = 1e30;
+    for (int rep = 0; rep < TUNE_REPS; rep++) {
+        double t0 = now_seconds();
+        clip_plane_any(buf, size, streaming);
+        double t = now_seconds() - t0;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+static double bench_clip_parallel(unsigned char *buf, long num_planes,
+                                  size_t plane_bytes, int chunk, int threads) {
+    double best = 1e30;
+    for (int rep = 0; rep < TUNE_REPS; rep++) {
+        double t0 = now_seconds();
+        #pragma omp parallel for schedule(dynamic, chunk) num_threads(threads)
+        for (long i = 0; i < num_planes; i++) {
+            clip_plane_any(buf + i * plane_bytes, plane_bytes, 0);
+        }
+        double t = now_seconds() - t0;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+int autotune_run(TuneParams *params) {
+    static const size_t tiles[] = {16, 32, 64, 128};
+    static const size_t prefetches[] = {0, 64, 256, 512, 1024};
+    static const size_t chunks[] = {16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024};
+
+    autotune_defaults(params);
+
+    // Large enough to fall out of the last level cache for the store test
+    const size_t big_size = STREAMING_MIN_BYTES;
+    unsigned char *buf = (unsigned char *)_mm_malloc(big_size, 64);
+    if (!buf) {
+        fprintf(stderr, "Error allocating autotune buffer\n");
+        return -1;
+    }
+    fill_pattern(buf, big_size);
+
+    // Tile first with the default prefetch, then prefetch with the best tile
+    const size_t scale_size = 2u * 1024 * 1024;
+    double best = 1e30;
+    for (size_t i = 0; i < sizeof(tiles) / sizeof(tiles[0]); i++) {
+        double t = bench_scale_tiled(buf, scale_size, tiles[i],
+                                     params->prefetch_distance);
+        if (t < best) {
+            best = t;
+            params->tile_bytes = tiles[i];
+        }
+    }
+    best = 1e30;
+    for (size_t i = 0; i < sizeof(prefetches) / sizeof(prefetches[0]); i++) {
+        double t = bench_scale_tiled(buf, scale_size, params->tile_bytes,
+                                     prefetches[i]);
+        if (t < best) {
+            best = t;
+            params->prefetch_distance = prefetches[i];
+        }
+    }
+
+    // Non-temporal stores only pay off if they win clearly
+    if (video_cpu_has_avx2()) {
+        double temporal = bench_clip_stream(buf, big_size, 0);
+        double streaming = bench_clip_stream(buf, big_size, 1);
+        params->streaming_stores = streaming < temporal * 0.95;
+    }
+
+    // Chunk granularity on a video-shaped workload of 16 KB planes
+    const size_t plane_bytes = 16 * 1024;
+    const long num_planes = (long)(8u * 1024 * 1024 / plane_bytes);
+    best = 1e30;
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        int chunk = (int)(chunks[i] / plane_bytes);
+        if (chunk < 1) chunk = 1;
+        double t = bench_clip_parallel(buf, num_planes, plane_bytes, chunk,
+                                       max_threads());
+        if (t < best) {
+            best = t;
+            params->chunk_bytes = chunks[i];
+        }
+    }
+
+    // Thread count for small videos, where team start-up dominates
+    const size_t small_plane = 1024;
+    const long small_planes = 256;
+    best = 1e30;
+    for (int threads = 1; threads <= max_threads(); threads *= 2) {
+        double t = bench_clip_parallel(buf, small_planes, small_plane, 1, threads);
+        if (t < best) {
+            best = t;
+            params->small_video_threads = threads;
+        }
+    }
+
+    // Crossover: the smallest video the full team clips faster than the
+    // small-video thread count, doubling from the size timed above
+    params->small_video_bytes = small_plane * small_planes;
+    if (params->small_video_threads < max_threads()) {
+        while (params->small_video_bytes < big_size) {
+            long planes = (long)(params->small_video_bytes / small_plane);
+            double few = bench_clip_parallel(buf, planes, small_plane, 1,
+                                             params->small_video_threads);
+            double all = bench_clip_parallel(buf, planes, small_plane, 1,
+                                             max_threads());
+            if (all < few) break;
+            params->small_video_bytes *= 2;
+        }
+    }
+
+    _mm_free(buf);
+    return 0;
+}
+
+static void autotune_init(void) {
+    const char *disabled = getenv("FILMMASTER_NO_AUTOTUNE");
+    if (disabled && strcmp(disabled, "1") == 0) {
+        autotune_defaults(&g_params);
+        return;
+    }
+
+    const char *path = autotune_cache_path();
+    if (autotune_load(path, &g_params) == 0) return;
+
+    if (autotune_run(&g_params) != 0) {
+        autotune_defaults(&g_params);
+        return;
+    }
+    autotune_save(path, &g_params);
+}
+
+const TuneParams *autotune_get(void) {
+    pthread_once(&g_once, autotune_init);
+    return &g_params;
+}
+
+int autotune_threads_for(const TuneParams *params, size_t total_bytes) {
+    int threads = max_threads();
+    if (total_bytes < params->small_video_bytes &&
+        params->small_video_threads < threads) {
+        threads = params->small_video_threads;
+    }
+    return threads < 1 ? 1 : threads;
+}
+
+int autotune_chunk_frames(const TuneParams *params, size_t plane_bytes) {
+    if (plane_bytes == 0) return 1;
+    size_t chunk = params->chunk_bytes / plane_bytes;
+    return chunk < 1 ? 1 : (int)chunk;
+}
+
+int autotune_use_streaming(const TuneParams *params, size_t total_bytes) {
+    return params->streaming_stores && total_bytes >= STREAMING_MIN_BYTES;
+}
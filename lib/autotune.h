@@ -0,0 +1,114 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stddef.h>
+
+/**
+ * @brief Per-host kernel tuning parameters
+ * Measured once per machine by micro-benchmarking the -S mode kernels and
+ * persisted in a local cache file, so every host in a mixed fleet runs the
+ * configuration that is fastest on its own CPU.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    size_t tile_bytes;          // Inner unrolled tile of the scalar scale kernel
+    size_t prefetch_distance;   // Prefetch distance in bytes (0 disables prefetch)
+    size_t chunk_bytes;         // Bytes of work per OpenMP scheduling chunk
+    int streaming_stores;       // 1 to use non-temporal stores on large videos
+    size_t small_video_bytes;   // Channel bytes below which a video counts as small
+    int small_video_threads;    // Thread count used for small videos
+} TuneParams;
+
+/**
+ * @brief Get the tuning parameters for this host
+ * On first use the parameters are loaded from the cache file, or measured
+ * and written to it if the file is missing or was produced on another CPU.
+ * Thread-safe; later calls return the same pointer.
+ *
+ * Environment:
+ *   FILMMASTER_TUNE_CACHE  overrides the cache file path
+ *   FILMMASTER_NO_AUTOTUNE set to 1 to skip benchmarking and use defaults
+ *
+ * @return const TuneParams* Parameters, never NULL
+ */
+const TuneParams *autotune_get(void);
+
+/**
+ * @brief Fill in the built-in defaults (the values the kernels used before tuning)
+ *
+ * @param params Output parameters
+ */
+void autotune_defaults(TuneParams *params);
+
+/**
+ * @brief Run the micro-benchmarks on this host
+ *
+ * @param params Output parameters
+ * @return int 0 on success, -1 on error
+ */
+int autotune_run(TuneParams *params);
+
+/**
+ * @brief Load parameters from a cache file
+ * Fails if the file was written on a host with a different CPU signature.
+ *
+ * @param path Path to the cache file
+ * @param params Output parameters
+ * @return int 0 on success, -1 on error or signature mismatch
+ */
+int autotune_load(const char *path, TuneParams *params);
+
+/**
+ * @brief Save parameters to a cache file, tagged with this host's CPU signature
+ *
+ * @param path Path to the cache file
+ * @param params Parameters to save
+ * @return int 0 on success, -1 on error
+ */
+int autotune_save(const char *path, const TuneParams *params);
+
+/**
+ * @brief Get the cache file path used by autotune_get()
+ *
+ * @return const char* Path (static storage)
+ */
+const char *autotune_cache_path(void);
+
+/**
+ * @brief Number of OpenMP threads to use for a kernel touching total_bytes
+ *
+ * @param params Tuning parameters
+ * @param total_bytes Bytes the kernel will touch
+ * @return int Thread count (>= 1)
+ */
+int autotune_threads_for(const TuneParams *params, size_t total_bytes);
+
+/**
+ * @brief OpenMP chunk size in frames for planes of plane_bytes
+ *
+ * @param params Tuning parameters
+ * @param plane_bytes Bytes in one channel plane
+ * @return int Frames per chunk (>= 1)
+ */
+int autotune_chunk_frames(const TuneParams *params, size_t plane_bytes);
+
+/**
+ * @brief Whether a kernel touching total_bytes should use non-temporal stores
+ * Only videos that cannot stay in cache qualify, and only on hosts where the
+ * benchmark showed streaming stores to be faster.
+ *
+ * @param params Tuning parameters
+ * @param total_bytes Bytes the kernel will touch
+ * @return int 1 to stream, 0 for regular stores
+ */
+int autotune_use_streaming(const TuneParams *params, size_t total_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "video_batch.h"
+#include "video_sched.h"
+#include "video_ops.h"
+
+#ifdef VIDEO_WITH_FFMPEG
+#include "video_codec.h"
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Freed buffers a worker keeps for its next clip, beyond its largest clip
+#define WORKER_POOL_SLACK (8u << 20)
+
+typedef struct {
+    int index;
+    double seconds;         // Estimated cost, 0 if it could not be estimated
+    size_t memory_bytes;
+} BatchClip;
+
+typedef struct {
+    VideoContext *ctx;
+    const char *const *inputs;
+    const char *const *outputs;
+    const VideoProgram *program;
+    const char *codec;
+    int fps;
+    int *results;
+    pthread_mutex_t lock;   // Serialises progress reports
+    long done;
+    long count;
+    int failed;
+} Batch;
+
+static int compare_cost(const void *a, const void *b) {
+    double ca = ((const BatchClip *)a)->seconds;
+    double cb = ((const BatchClip *)b)->seconds;
+    return (ca < cb) - (ca > cb);
+}
+
+static int clip_run(Batch *batch, VideoContext *ctx, int index) {
+    const char *input = batch->inputs[index];
+    const char *output = batch->outputs[index];
+    SVideo *video;
+#ifdef VIDEO_WITH_FFMPEG
+    if (video_is_standard_format(input)) {
+        video = decode_standard_video_ctx(ctx, input);
+    } else
+#endif
+    video = decode_S_ctx(ctx, input);
+    if (!video) return -1;
+
+    int result = video_program_run_S(ctx, video, batch->program);
+    if (result == 0) {
+#ifdef VIDEO_WITH_FFMPEG
+        if (video_is_standard_format(output)) {
+            result = encode_standard_video_ctx(ctx, output, video, batch->codec, batch->fps);
+        } else
+#endif
+        result = encode_S_ctx(ctx, output, video);
+    }
+    free_video_S_ctx(ctx, video);
+    return result;
+}
+
+// Do not leave a partial output behind, as jobs do; never remove the
+// clip's input, or anything but a regular file
+static void remove_output(const char *input, const char *output) {
+    struct stat in_stat, out_stat;
+    if (stat(output, &out_stat) != 0 || !S_ISREG(out_stat.st_mode)) return;
+    if (stat(input, &in_stat) == 0 && in_stat.st_dev == out_stat.st_dev &&
+        in_stat.st_ino == out_stat.st_ino) {
+        return;
+    }
+    remove(output);
+}
+
+static void clip_finish(Batch *batch, int index, int result) {
+    if (batch->results) batch->results[index] = result;
+    if (result != 0) remove_output(batch->inputs[index], batch->outputs[index]);
+
+    pthread_mutex_lock(&batch->lock);
+    if (result != 0) batch->failed++;
+    long done = ++batch->done;
+    video_ctx_progress(batch->ctx, VIDEO_STAGE_PROCESS, done, batch->count);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+int video_batch_run(VideoContext *ctx, const char *const *inputs, const char *const *outputs,
+                    int count, const char *program_text, const char *codec, int fps,
+                    int *results) {
+    if (!ctx) ctx = video_default_context();
+    if ((count > 0 && (!inputs || !outputs)) || count < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to video_batch_run function.\n");
+        return -1;
+    }
+
+    VideoProgram *program = video_program_parse(ctx, program_text);
+    if (!program) return -1;
+
+    Batch batch = {ctx, inputs, outputs, program, codec ? codec : "libx264",
+                   fps > 0 ? fps : 30, results, PTHREAD_MUTEX_INITIALIZER, 0, count, 0};
+
+    // Cost each clip from its header; one that cannot be read has failed
+    BatchClip *clips = (BatchClip *)calloc(count ? count : 1, sizeof(BatchClip));
+    if (!clips) {
+        video_ctx_log_errno(ctx, "Error allocating batch");
+        video_program_free(ctx, program);
+        return -1;
+    }
+    int num_clips = 0;
+    double total_seconds = 0.0;
+    size_t total_bytes = 0;
+    for (int i = 0; i < count; i++) {
+        VideoJobSpec spec = {inputs[i], outputs[i], program_text, codec, fps, NULL, NULL};
+        VideoJobCost cost;
+        if (video_estimate_cost(ctx, &spec, &cost) != 0) {
+            clip_finish(&batch, i, -1);
+            continue;
+        }
+        clips[num_clips].index = i;
+        clips[num_clips].seconds = cost.seconds;
+        clips[num_clips].memory_bytes = cost.memory_bytes;
+        num_clips++;
+        total_seconds += cost.seconds;
+        total_bytes += cost.memory_bytes;
+    }
+
+    // Longest first, so the small clips left at the end even out the workers
+    qsort(clips, num_clips, sizeof(BatchClip), compare_cost);
+    int threads = video_ctx_threads(ctx, total_bytes);
+
+    // A clip over one thread's share of the batch would leave the other
+    // workers idle at the end; those run alone, split across all threads,
+    // if they are big enough for the kernels to use more than one
+    int num_large = 0;
+    while (threads > 1 && num_large < num_clips &&
+           clips[num_large].seconds * threads > total_seconds &&
+           video_ctx_threads(ctx, clips[num_large].memory_bytes) > 1) {
+        num_large++;
+    }
+    BatchClip *small = clips + num_large;
+    int num_small = num_clips - num_large;
+    int workers = threads < num_small ? threads : num_small;
+    if (workers < 1) workers = 1;
+    size_t largest_small = num_small ? small[0].memory_bytes : 0;
+
+    for (int i = 0; i < num_large; i++) {
+        int result = -1;
+        if (!video_context_cancelled(ctx)) result = clip_run(&batch, ctx, clips[i].index);
+        clip_finish(&batch, clips[i].index, result);
+    }
+
+    #pragma omp parallel num_threads(workers)
+    {
+        int worker = 0;
+#ifdef _OPENMP
+        worker = omp_get_thread_num();
+#endif
+        VideoContext *worker_ctx = video_ctx_create_worker(ctx, worker, workers);
+        if (worker_ctx) video_context_set_pool(worker_ctx, 2 * largest_small + WORKER_POOL_SLACK);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int i = 0; i < num_small; i++) {
+            int result = -1;
+            if (worker_ctx && !video_context_cancelled(ctx)) {
+                result = clip_run(&batch, worker_ctx, small[i].index);
+            }
+            clip_finish(&batch, small[i].index, result);
+        }
+
+        video_ctx_destroy_worker(ctx, worker_ctx);
+    }
+
+    free(clips);
+    video_program_free(ctx, program);
+    pthread_mutex_destroy(&batch.lock);
+    return batch.failed;
+}
@@ -0,0 +1,44 @@
+#ifndef VIDEO_BATCH_H
+#define VIDEO_BATCH_H
+
+#include "video_context.h"
+
+/**
+ * @brief Batches: one op program over many clips
+ * Each clip is decoded, processed and encoded as by a job, but the batch
+ * parses the program once and schedules clips by their estimated cost:
+ * clips small enough to share the CPU run one per worker thread, each
+ * worker single-threaded with a context that keeps freed buffers for the
+ * next clip; a clip bigger than a worker's share of the batch runs on its
+ * own with all of the context's threads.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Run an op program over many clips
+ * Blocks until every clip is done. Progress is reported through the
+ * context as clips done out of count (stage VIDEO_STAGE_PROCESS);
+ * cancelling the context skips the clips not yet started. The output of a
+ * clip that fails or is skipped is removed, unless it is the clip's input.
+ *
+ * @param ctx Library context (threads, CPUs, allocator, limits), or NULL for the default
+ * @param inputs Input paths, raw (.bin) or, with FFmpeg, standard format
+ * @param outputs Output paths, format chosen by extension as for jobs
+ * @param count Number of clips
+ * @param program Op program, see video_ops.h
+ * @param codec Encoder for standard format outputs, NULL for libx264
+ * @param fps Frame rate for standard format outputs, 0 for 30
+ * @param results Optional output, 0 or -1 per clip
+ * @return int Number of clips that failed or were skipped, -1 if the program is invalid
+ */
+int video_batch_run(VideoContext *ctx, const char *const *inputs, const char *const *outputs,
+                    int count, const char *program, const char *codec, int fps, int *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_BATCH_H
@@ -0,0 +1,565 @@
+/**
+ * @brief CPython extension exposing video planes through the buffer protocol
+ * A VideoFrames object exports a Video, SVideo or MVideo as a uint8 array
+ * of shape (frames, channels, height, width) without copying, so
+ * numpy.asarray() and OpenCV see the library's memory directly. It can own
+ * the video, freeing it when the last array using it is gone, and
+ * from_array() builds a video over an existing array for the library's
+ * kernels to work on in place.
+ *
+ * The extension does not link the library: src/video_wrapper.py passes the
+ * addresses of the video and of free_*_ctx from ctypes.
+ *
+ * Arrays alias the planes as laid out when they were exported; a later
+ * reverse or swap is not reflected. Planes must outlive every array on
+ * them: a view of a plane shared with a snapshot holds the library's share
+ * count for it (so kernels copy the plane rather than write it), and while
+ * a video has arrays over planes of its own, exports() reports them so
+ * src/video_wrapper.py refuses to snapshot it, which would hand those
+ * planes to the snapshot to free.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "video_functions.h"
+
+typedef void (*VideoFreeFn)(void *ctx, void *video);
+typedef void (*VideoPlaneFn)(void *ref);
+
+typedef enum { KIND_STANDARD, KIND_STRUCTURED, KIND_MEMORY } VideoKind;
+
+static const char *kind_names[] = { "standard", "structured", "memory" };
+
+typedef struct {
+    PyObject_HEAD
+    void *video;                // Video, SVideo or MVideo, per kind
+    VideoKind kind;
+    VideoFreeFn free_fn;        // Frees the video with this object, NULL if not owned
+    void *ctx;                  // Context for free_fn
+    Py_buffer source;           // Array the video was built over by from_array()
+    PyObject *parent;           // VideoFrames a plane view points into
+    unsigned char *plane;       // Plane view data, NULL for a whole video
+    int shared;                 // Plane view of a plane snapshots may share; read-only
+    void *ref;                  // Share count a plane view holds, NULL if none
+    VideoPlaneFn retain_fn;     // retain_plane_S and release_plane_S, for plane views
+    VideoPlaneFn release_fn;
+    int counted;                // Plane view counted in exports()
+} VideoFramesObject;
+
+// Layout of an export; kept in Py_buffer.internal
+typedef struct {
+    Py_ssize_t shape[4];
+    Py_ssize_t strides[4];
+} FramesLayout;
+
+static PyTypeObject VideoFramesType;
+
+// Arrays and plane views on planes a video owns, by video address; a
+// snapshot of the video then would take those planes from under them
+static PyObject *g_exports;
+
+static int exports_add(void *video, long delta) {
+    PyObject *key = PyLong_FromVoidPtr(video);
+    if (!key) return -1;
+    PyObject *count = PyDict_GetItemWithError(g_exports, key);
+    long total = (count ? PyLong_AsLong(count) : 0) + delta;
+    int result = -1;
+    if (!PyErr_Occurred()) {
+        if (total > 0) {
+            PyObject *value = PyLong_FromLong(total);
+            result = value ? PyDict_SetItem(g_exports, key, value) : -1;
+            Py_XDECREF(value);
+        } else {
+            result = count ? PyDict_DelItem(g_exports, key) : 0;
+        }
+    }
+    Py_DECREF(key);
+    return result;
+}
+
+static int parse_kind(const char *name, VideoKind *kind) {
+    for (int k = 0; k < 3; k++) {
+        if (strcmp(name, kind_names[k]) == 0) {
+            *kind = (VideoKind)k;
+            return 0;
+        }
+    }
+    PyErr_Format(PyExc_ValueError,
+                 "kind must be 'standard', 'structured' or 'memory', not '%s'", name);
+    return -1;
+}
+
+// Header fields shared by the three video structs
+static void video_dims(const VideoFramesObject *self, long *frames, int *channels,
+                       int *height, int *width) {
+    if (self->kind == KIND_STRUCTURED) {
+        const SVideo *video = (const SVideo *)self->video;
+        *frames = video->num_frames;
+        *channels = video->channels;
+        *height = video->height;
+        *width = video->width;
+    } else if (self->kind == KIND_MEMORY) {
+        const MVideo *video = (const MVideo *)self->video;
+        *frames = video->num_frames;
+        *channels = video->channels;
+        *height = video->height;
+        *width = video->width;
+    } else {
+        const Video *video = (const Video *)self->video;
+        *frames = video->num_frames;
+        *channels = video->channels;
+        *height = video->height;
+        *width = video->width;
+    }
+}
+
+// Find base and strides for a whole video. SVideo planes are reached
+// through pointers; they export only while evenly strided (as decoded,
+// copied or reversed) and not shared with snapshots.
+static int video_layout(const VideoFramesObject *self, unsigned char **base,
+                        FramesLayout *layout, int *readonly) {
+    long frames;
+    int channels, height, width;
+    video_dims(self, &frames, &channels, &height, &width);
+
+    Py_ssize_t plane = (Py_ssize_t)height * width;
+    layout->shape[0] = frames;
+    layout->shape[1] = channels;
+    layout->shape[2] = height;
+    layout->shape[3] = width;
+    layout->strides[0] = plane * channels;
+    layout->strides[1] = plane;
+    layout->strides[2] = width;
+    layout->strides[3] = 1;
+    *readonly = self->source.obj ? self->source.readonly : 0;
+
+    if (self->kind != KIND_STRUCTURED) {
+        *base = self->kind == KIND_MEMORY ? ((MVideo *)self->video)->data :
+                                            ((Video *)self->video)->data;
+        return 0;
+    }
+
+    const SVideo *video = (const SVideo *)self->video;
+    static unsigned char empty;
+    if (frames <= 0 || channels <= 0) {
+        *base = &empty;
+        return 0;
+    }
+
+    *base = video->frames[0].channels[0].data;
+    if (frames > 1) layout->strides[0] = video->frames[1].channels[0].data - *base;
+    if (channels > 1) layout->strides[1] = video->frames[0].channels[1].data - *base;
+
+    for (long f = 0; f < frames; f++) {
+        for (int c = 0; c < channels; c++) {
+            const Channel *channel = &video->frames[f].channels[c];
+            if (channel->ref) {
+                PyErr_SetString(PyExc_BufferError,
+                                "Video shares planes with a snapshot; copy it before exporting");
+                return -1;
+            }
+            if (channel->data != *base + f * layout->strides[0] + c * layout->strides[1]) {
+                PyErr_SetString(PyExc_BufferError,
+                                "Video planes are not evenly strided (e.g. after a channel swap); "
+                                "export planes with plane() or copy the video first");
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int frames_getbuffer(VideoFramesObject *self, Py_buffer *view, int flags) {
+    FramesLayout *layout = (FramesLayout *)PyMem_Malloc(sizeof(FramesLayout));
+    if (!layout) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    unsigned char *base;
+    int ndim, readonly;
+    if (self->plane) {
+        VideoFramesObject *parent = (VideoFramesObject *)self->parent;
+        long frames;
+        int channels, height, width;
+        video_dims(parent, &frames, &channels, &height, &width);
+        base = self->plane;
+        ndim = 2;
+        layout->shape[0] = height;
+        layout->shape[1] = width;
+        layout->strides[0] = width;
+        layout->strides[1] = 1;
+        readonly = (parent->source.obj ? parent->source.readonly : 0) || self->shared;
+    } else {
+        if (video_layout(self, &base, layout, &readonly) != 0) {
+            PyMem_Free(layout);
+            return -1;
+        }
+        ndim = 4;
+    }
+
+    if ((flags & PyBUF_WRITABLE) && readonly) {
+        PyErr_SetString(PyExc_BufferError, "Video memory is read-only");
+        PyMem_Free(layout);
+        return -1;
+    }
+
+    Py_ssize_t len = 1;
+    for (int d = 0; d < ndim; d++) len *= layout->shape[d];
+
+    view->obj = (PyObject *)self;
+    view->buf = base;
+    view->len = len;
+    view->itemsize = 1;
+    view->readonly = readonly;
+    view->format = (flags & PyBUF_FORMAT) ? "B" : NULL;
+    view->ndim = ndim;
+    view->shape = layout->shape;
+    view->strides = layout->strides;
+    view->suboffsets = NULL;
+    view->internal = layout;
+
+    // Consumers that do not take strides need C order, and the
+    // contiguity requests must hold as exported
+    int c_order = PyBuffer_IsContiguous(view, 'C');
+    int wants_strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES;
+    if ((!wants_strides && !c_order) ||
+        ((flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS && !c_order) ||
+        ((flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS && !PyBuffer_IsContiguous(view, 'F')) ||
+        ((flags & PyBUF_ANY_CONTIGUOUS) == PyBUF_ANY_CONTIGUOUS && !PyBuffer_IsContiguous(view, 'A'))) {
+        PyErr_SetString(PyExc_BufferError, "Video layout does not match the requested contiguity");
+        view->obj = NULL;
+        PyMem_Free(layout);
+        return -1;
+    }
+    if (!wants_strides) view->strides = NULL;
+    if ((flags & PyBUF_ND) != PyBUF_ND) view->shape = NULL;
+    if (!self->plane && exports_add(self->video, 1) != 0) {
+        view->obj = NULL;
+        PyMem_Free(layout);
+        return -1;
+    }
+
+    Py_INCREF(self);
+    return 0;
+}
+
+static void frames_releasebuffer(VideoFramesObject *self, Py_buffer *view) {
+    if (!self->plane && exports_add(self->video, -1) != 0) PyErr_WriteUnraisable((PyObject *)self);
+    PyMem_Free(view->internal);
+}
+
+static void frames_dealloc(VideoFramesObject *self) {
+    if (self->ref) self->release_fn(self->ref);
+    if (self->counted && exports_add(self->video, -1) != 0) {
+        PyErr_WriteUnraisable((PyObject *)self);
+    }
+    if (self->parent) {
+        Py_DECREF(self->parent);
+    } else if (self->source.obj) {
+        // Built by from_array(): the struct is ours, the pixels the array's
+        PyMem_Free(self->video);
+        PyBuffer_Release(&self->source);
+    } else if (self->free_fn && self->video) {
+        self->free_fn(self->ctx, self->video);
+    }
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int frames_init(VideoFramesObject *self, PyObject *args, PyObject *kwds) {
+    static char *keywords[] = { "address", "kind", "free", "ctx", "retain", "release", NULL };
+    unsigned long long address, free_address = 0, ctx_address = 0;
+    unsigned long long retain_address = 0, release_address = 0;
+    const char *kind = "structured";
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "K|sKKKK", keywords, &address, &kind,
+                                     &free_address, &ctx_address, &retain_address,
+                                     &release_address)) {
+        return -1;
+    }
+    if (!address) {
+        PyErr_SetString(PyExc_ValueError, "Video address is NULL");
+        return -1;
+    }
+    if (self->video) {
+        PyErr_SetString(PyExc_TypeError, "VideoFrames is already initialised");
+        return -1;
+    }
+    if (parse_kind(kind, &self->kind) != 0) return -1;
+
+    self->video = (void *)(uintptr_t)address;
+    self->free_fn = (VideoFreeFn)(uintptr_t)free_address;
+    self->ctx = (void *)(uintptr_t)ctx_address;
+    self->retain_fn = (VideoPlaneFn)(uintptr_t)retain_address;
+    self->release_fn = (VideoPlaneFn)(uintptr_t)release_address;
+    return 0;
+}
+
+static PyObject *frames_plane(VideoFramesObject *self, PyObject *args) {
+    long frame;
+    int channel;
+    if (!PyArg_ParseTuple(args, "li", &frame, &channel)) return NULL;
+    if (self->plane || !self->video) {
+        PyErr_SetString(PyExc_TypeError, "plane() needs a whole video");
+        return NULL;
+    }
+
+    long frames;
+    int channels, height, width;
+    video_dims(self, &frames, &channels, &height, &width);
+    if (frame < 0 || frame >= frames || channel < 0 || channel >= channels) {
+        PyErr_SetString(PyExc_IndexError, "Frame or channel out of range");
+        return NULL;
+    }
+
+    size_t plane_size = (size_t)height * width;
+    unsigned char *data;
+    VideoPlaneRef *ref = NULL;
+    if (self->kind == KIND_STRUCTURED) {
+        // Writing a plane shared with a snapshot would change both videos;
+        // the kernels copy it first, a view can only read it. The share
+        // count is the library's, so any plane with one counts as shared,
+        // and the view holds one so the plane outlives it.
+        const Channel *plane = &((SVideo *)self->video)->frames[frame].channels[channel];
+        data = plane->data;
+        ref = plane->ref;
+        if (ref && (!self->retain_fn || !self->release_fn)) {
+            PyErr_SetString(PyExc_BufferError,
+                            "Plane is shared with a snapshot; viewing it needs retain and release");
+            return NULL;
+        }
+    } else {
+        unsigned char *base = self->kind == KIND_MEMORY ? ((MVideo *)self->video)->data :
+                                                          ((Video *)self->video)->data;
+        data = base + ((size_t)frame * channels + channel) * plane_size;
+    }
+
+    // Planes the video owns are counted instead, as the view cannot hold them
+    int counted = self->kind == KIND_STRUCTURED && !ref;
+    if (counted && exports_add(self->video, 1) != 0) return NULL;
+    VideoFramesObject *view = PyObject_New(VideoFramesObject, &VideoFramesType);
+    if (!view) {
+        if (counted) exports_add(self->video, -1);
+        return NULL;
+    }
+    view->video = self->video;
+    view->kind = self->kind;
+    view->free_fn = NULL;
+    view->ctx = NULL;
+    memset(&view->source, 0, sizeof(view->source));
+    Py_INCREF(self);
+    view->parent = (PyObject *)self;
+    view->plane = data;
+    view->shared = ref != NULL;
+    view->ref = ref;
+    view->retain_fn = self->retain_fn;
+    view->release_fn = self->release_fn;
+    view->counted = counted;
+    if (ref) self->retain_fn(ref);
+    return (PyObject *)view;
+}
+
+static PyObject *frames_get_address(VideoFramesObject *self, void *closure) {
+    (void)closure;
+    return PyLong_FromVoidPtr(self->video);
+}
+
+static PyObject *frames_get_kind(VideoFramesObject *self, void *closure) {
+    (void)closure;
+    return PyUnicode_FromString(kind_names[self->kind]);
+}
+
+static PyObject *frames_get_shape(VideoFramesObject *self, void *closure) {
+    (void)closure;
+    if (!self->video) Py_RETURN_NONE;
+    VideoFramesObject *video = self->plane ? (VideoFramesObject *)self->parent : self;
+    long frames;
+    int channels, height, width;
+    video_dims(video, &frames, &channels, &height, &width);
+    if (self->plane) return Py_BuildValue("(ii)", height, width);
+    return Py_BuildValue("(liii)", frames, channels, height, width);
+}
+
+static PyObject *from_array(PyObject *module, PyObject *args) {
+    (void)module;
+    PyObject *array;
+    const char *kind_name = "structured";
+    if (!PyArg_ParseTuple(args, "O|s", &array, &kind_name)) return NULL;
+
+    VideoKind kind;
+    if (parse_kind(kind_name, &kind) != 0) return NULL;
+
+    // Kernels write in place, so the array must be writable; Video and
+    // MVideo hold one contiguous block, SVideo only needs each plane
+    // contiguous
+    int flags = PyBUF_WRITABLE | PyBUF_FORMAT |
+                (kind == KIND_STRUCTURED ? PyBUF_STRIDES : PyBUF_C_CONTIGUOUS);
+    VideoFramesObject *self = PyObject_New(VideoFramesObject, &VideoFramesType);
+    if (!self) return NULL;
+    self->video = NULL;
+    self->kind = kind;
+    self->free_fn = NULL;
+    self->ctx = NULL;
+    self->parent = NULL;
+    self->plane = NULL;
+    self->shared = 0;
+    self->ref = NULL;
+    self->retain_fn = NULL;
+    self->release_fn = NULL;
+    self->counted = 0;
+    memset(&self->source, 0, sizeof(self->source));
+    if (PyObject_GetBuffer(array, &self->source, flags) != 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    Py_buffer *source = &self->source;
+    const Py_ssize_t *shape = source->shape;
+    if (source->ndim != 4 || source->itemsize != 1 ||
+        (source->format && strcmp(source->format, "B") != 0)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Expected a uint8 array of shape (frames, channels, height, width)");
+        Py_DECREF(self);
+        return NULL;
+    }
+    if (shape[1] < 1 || shape[1] > 255 || shape[2] < 1 || shape[2] > 255 ||
+        shape[3] < 1 || shape[3] > 255) {
+        PyErr_SetString(PyExc_ValueError, "Channels, height and width must be 1-255");
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    long frames = (long)shape[0];
+    unsigned char *base = (unsigned char *)source->buf;
+    if (kind != KIND_STRUCTURED) {
+        // Same header layout for Video and MVideo
+        Video *video = (Video *)PyMem_Malloc(sizeof(Video));
+        if (!video) {
+            Py_DECREF(self);
+            return PyErr_NoMemory();
+        }
+        video->num_frames = frames;
+        video->channels = (unsigned char)shape[1];
+        video->height = (unsigned char)shape[2];
+        video->width = (unsigned char)shape[3];
+        video->data = base;
+        self->video = video;
+        return (PyObject *)self;
+    }
+
+    const Py_ssize_t *strides = source->strides;
+    if (strides[3] != 1 || strides[2] != shape[3]) {
+        PyErr_SetString(PyExc_ValueError, "Each (height, width) plane must be contiguous");
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    // SVideo, Frame and Channel arrays in one block
+    unsigned char channels = (unsigned char)shape[1];
+    SVideo *video = (SVideo *)PyMem_Malloc(sizeof(SVideo) +
+        frames * (sizeof(Frame) + channels * sizeof(Channel)));
+    if (!video) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    video->num_frames = frames;
+    video->channels = channels;
+    video->height = (unsigned char)shape[2];
+    video->width = (unsigned char)shape[3];
+    video->frames = (Frame *)(video + 1);
+    Channel *channel_block = (Channel *)(video->frames + frames);
+    for (long f = 0; f < frames; f++) {
+        video->frames[f].channels = channel_block + f * channels;
+        for (unsigned char c = 0; c < channels; c++) {
+            video->frames[f].channels[c].data = base + f * strides[0] + c * strides[1];
+            video->frames[f].channels[c].ref = NULL;
+        }
+    }
+    self->video = video;
+    return (PyObject *)self;
+}
+
+static PyObject *exports(PyObject *module, PyObject *args) {
+    (void)module;
+    unsigned long long address;
+    if (!PyArg_ParseTuple(args, "K", &address)) return NULL;
+    PyObject *key = PyLong_FromVoidPtr((void *)(uintptr_t)address);
+    if (!key) return NULL;
+    PyObject *count = PyDict_GetItemWithError(g_exports, key);
+    Py_DECREF(key);
+    if (!count && PyErr_Occurred()) return NULL;
+    return count ? Py_NewRef(count) : PyLong_FromLong(0);
+}
+
+static PyBufferProcs frames_as_buffer = {
+    (getbufferproc)frames_getbuffer,
+    (releasebufferproc)frames_releasebuffer,
+};
+
+static PyMethodDef frames_methods[] = {
+    {"plane", (PyCFunction)frames_plane, METH_VARARGS,
+     "plane(frame, channel) -> (height, width) view of one plane, "
+     "read-only if the plane has been shared with a snapshot"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef frames_getset[] = {
+    {"address", (getter)frames_get_address, NULL, "Address of the video struct", NULL},
+    {"kind", (getter)frames_get_kind, NULL, "'standard', 'structured' or 'memory'", NULL},
+    {"shape", (getter)frames_get_shape, NULL, "Shape of the exported array", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject VideoFramesType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "video_buffers.VideoFrames",
+    .tp_doc = "VideoFrames(address, kind='structured', free=0, ctx=0, retain=0, release=0)\n\n"
+              "Buffer over a video's planes as (frames, channels, height, width) "
+              "uint8. With free set to the address of free_*_ctx, the video is "
+              "freed with ctx once the object and every array using it are gone. "
+              "retain and release, the addresses of retain_plane_S and "
+              "release_plane_S, let plane() view planes shared with snapshots.",
+    .tp_basicsize = sizeof(VideoFramesObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)frames_init,
+    .tp_dealloc = (destructor)frames_dealloc,
+    .tp_as_buffer = &frames_as_buffer,
+    .tp_methods = frames_methods,
+    .tp_getset = frames_getset,
+};
+
+static PyMethodDef module_methods[] = {
+    {"from_array", from_array, METH_VARARGS,
+     "from_array(array, kind='structured') -> VideoFrames over a writable uint8 "
+     "(frames, channels, height, width) array, without copying. Pass its address "
+     "to the library; never free it there."},
+    {"exports", exports, METH_VARARGS,
+     "exports(address) -> number of arrays and plane views on planes the video "
+     "at address owns; snapshotting it is unsafe while non-zero."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef video_buffers_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "video_buffers",
+    .m_doc = "Zero-copy buffer-protocol access to video planes",
+    .m_size = -1,
+    .m_methods = module_methods,
+};
+
+PyMODINIT_FUNC PyInit_video_buffers(void) {
+    if (PyType_Ready(&VideoFramesType) < 0) return NULL;
+    g_exports = PyDict_New();
+    if (!g_exports) return NULL;
+
+    PyObject *module = PyModule_Create(&video_buffers_module);
+    if (!module) return NULL;
+
+    Py_INCREF(&VideoFramesType);
+    if (PyModule_AddObject(module, "VideoFrames", (PyObject *)&VideoFramesType) < 0) {
+        Py_DECREF(&VideoFramesType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
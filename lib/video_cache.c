@@ -0,0 +1,711 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <immintrin.h>
+#include "video_cache.h"
+#include "video_kernels.h"
+#include "video_ops.h"
+#include "video_jobs.h"
+
+#ifdef VIDEO_WITH_FFMPEG
+#include "video_codec.h"
+#endif
+
+/*
+ * Hash: eight 64-bit lanes, each 64-byte stripe mixed in with a key that
+ * depends on the stripe's position in its 1 KB block, and the lanes
+ * scrambled after every block so reordering stripes or blocks changes the
+ * result. Each lane only needs a 32x32->64 multiply and adds, so the AVX2
+ * version does four lanes per instruction and matches the scalar one bit
+ * for bit.
+ */
+#define HASH_LANES 8
+#define HASH_STRIPE 64
+#define HASH_BLOCK_STRIPES 16
+#define HASH_BLOCK (HASH_STRIPE * HASH_BLOCK_STRIPES)
+#define HASH_SECRET_LANES (HASH_LANES + HASH_BLOCK_STRIPES)
+
+// Bytes read per call while hashing a file
+#define HASH_READ_BYTES (1u << 20)
+
+#define PRIME32_1 0x9E3779B1u
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+
+typedef struct {
+    uint64_t acc[HASH_LANES];
+    unsigned char buffer[HASH_BLOCK];
+    size_t buffered;
+    uint64_t length;
+    int avx2;
+} HashState;
+
+typedef struct CacheEntry {
+    char key[VIDEO_CACHE_KEY_SIZE];
+    size_t bytes;
+    struct CacheEntry *prev;    // Towards the most recently used
+    struct CacheEntry *next;
+} CacheEntry;
+
+struct VideoCache {
+    pthread_mutex_t lock;
+    char *dir;
+    size_t budget;
+    size_t total;
+    CacheEntry *head;           // Most recently used
+    CacheEntry *tail;
+    unsigned long sequence;     // For unique temporary names
+};
+
+static uint64_t g_secret[HASH_SECRET_LANES];
+static pthread_once_t g_secret_once = PTHREAD_ONCE_INIT;
+
+static void init_secret(void) {
+    // splitmix64, so the key lanes are fixed but unrelated to each other
+    uint64_t state = PRIME64_3;
+    for (int i = 0; i < HASH_SECRET_LANES; i++) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        g_secret[i] = z ^ (z >> 31);
+    }
+}
+
+static uint64_t rotl64(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Stripe s is keyed with secret lanes [first + s, first + s + 8)
+static void hash_stripes_scalar(uint64_t *acc, const unsigned char *data, size_t stripes,
+                                size_t first) {
+    for (size_t s = first; s < first + stripes; s++) {
+        for (int i = 0; i < HASH_LANES; i++) {
+            uint64_t value;
+            memcpy(&value, data + (s - first) * HASH_STRIPE + i * 8, 8);
+            uint64_t keyed = value ^ g_secret[s + i];
+            acc[i ^ 1] += value;
+            acc[i] += (keyed & 0xFFFFFFFFu) * (keyed >> 32);
+        }
+    }
+}
+
+VIDEO_TARGET_AVX2
+static void hash_stripes_avx2(uint64_t *acc, const unsigned char *data, size_t stripes) {
+    __m256i acc0 = _mm256_loadu_si256((const __m256i *)acc);
+    __m256i acc1 = _mm256_loadu_si256((const __m256i *)(acc + 4));
+
+    for (size_t s = 0; s < stripes; s++) {
+        const unsigned char *stripe = data + s * HASH_STRIPE;
+        __m256i data0 = _mm256_loadu_si256((const __m256i *)stripe);
+        __m256i data1 = _mm256_loadu_si256((const __m256i *)(stripe + 32));
+        __m256i keyed0 = _mm256_xor_si256(data0, _mm256_loadu_si256((const __m256i *)(g_secret + s)));
+        __m256i keyed1 = _mm256_xor_si256(data1, _mm256_loadu_si256((const __m256i *)(g_secret + s + 4)));
+
+        // Low half times high half of each keyed lane, plus the neighbouring
+        // lane's input (swapping 64-bit pairs gives lane i^1)
+        __m256i product0 = _mm256_mul_epu32(keyed0, _mm256_srli_epi64(keyed0, 32));
+        __m256i product1 = _mm256_mul_epu32(keyed1, _mm256_srli_epi64(keyed1, 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(product0,
+                                _mm256_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2))));
+        acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(product1,
+                                _mm256_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+
+    _mm256_storeu_si256((__m256i *)acc, acc0);
+    _mm256_storeu_si256((__m256i *)(acc + 4), acc1);
+}
+
+static void hash_stripes(HashState *state, const unsigned char *data, size_t stripes) {
+    if (state->avx2) {
+        hash_stripes_avx2(state->acc, data, stripes);
+    } else {
+        hash_stripes_scalar(state->acc, data, stripes, 0);
+    }
+}
+
+static void hash_block(HashState *state, const unsigned char *data) {
+    hash_stripes(state, data, HASH_BLOCK_STRIPES);
+    for (int i = 0; i < HASH_LANES; i++) {
+        uint64_t lane = state->acc[i];
+        lane ^= lane >> 47;
+        lane ^= g_secret[HASH_BLOCK_STRIPES + i];
+        state->acc[i] = lane * PRIME32_1;
+    }
+}
+
+static void hash_init(HashState *state, VideoContext *ctx) {
+    pthread_once(&g_secret_once, init_secret);
+    static const uint64_t initial[HASH_LANES] = {
+        PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3,
+        ~PRIME64_1, ~PRIME64_2, ~PRIME64_3, ~(uint64_t)PRIME32_1
+    };
+    memcpy(state->acc, initial, sizeof(initial));
+    state->buffered = 0;
+    state->length = 0;
+    state->avx2 = video_ctx_use_avx2(ctx);
+}
+
+static void hash_update(HashState *state, const unsigned char *data, size_t size) {
+    state->length += size;
+
+    if (state->buffered) {
+        size_t take = HASH_BLOCK - state->buffered;
+        if (take > size) take = size;
+        memcpy(state->buffer + state->buffered, data, take);
+        state->buffered += take;
+        data += take;
+        size -= take;
+        if (state->buffered < HASH_BLOCK) return;
+        hash_block(state, state->buffer);
+        state->buffered = 0;
+    }
+
+    for (; size >= HASH_BLOCK; data += HASH_BLOCK, size -= HASH_BLOCK) {
+        hash_block(state, data);
+    }
+    memcpy(state->buffer, data, size);
+    state->buffered = size;
+}
+
+static uint64_t avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void hash_final(HashState *state, VideoHash *hash) {
+    // The tail: whole stripes, then the last partial stripe zero-padded
+    // (the length is mixed in below, so padding cannot collide)
+    size_t stripes = state->buffered / HASH_STRIPE;
+    hash_stripes(state, state->buffer, stripes);
+    size_t rest = state->buffered % HASH_STRIPE;
+    if (rest) {
+        unsigned char last[HASH_STRIPE] = {0};
+        memcpy(last, state->buffer + stripes * HASH_STRIPE, rest);
+        hash_stripes_scalar(state->acc, last, 1, stripes);
+    }
+
+    uint64_t lo = state->length * PRIME64_1;
+    uint64_t hi = ~state->length * PRIME64_2;
+    for (int i = 0; i < HASH_LANES; i++) {
+        lo = rotl64(lo + (state->acc[i] ^ g_secret[i]), 31) * PRIME64_1;
+        hi = rotl64(hi + (state->acc[HASH_LANES - 1 - i] ^ g_secret[HASH_LANES + i]), 27) * PRIME64_2;
+    }
+    hash->lo = avalanche(lo);
+    hash->hi = avalanche(hi ^ lo);
+}
+
+void video_hash_bytes(VideoContext *ctx, const void *data, size_t size, VideoHash *hash) {
+    if (!ctx) ctx = video_default_context();
+    HashState state;
+    hash_init(&state, ctx);
+    hash_update(&state, (const unsigned char *)data, size);
+    hash_final(&state, hash);
+}
+
+static int hash_file_into(VideoContext *ctx, const char *path, HashState *state) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        video_ctx_log_errno(ctx, "Error opening file");
+        return -1;
+    }
+
+    unsigned char *buffer = (unsigned char *)video_ctx_alloc(ctx, HASH_READ_BYTES);
+    if (!buffer) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error allocating hash buffer\n");
+        fclose(file);
+        return -1;
+    }
+
+    int result = 0;
+    size_t n;
+    while ((n = fread(buffer, 1, HASH_READ_BYTES, file)) > 0) {
+        hash_update(state, buffer, n);
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Hashing cancelled\n");
+            result = -1;
+            break;
+        }
+    }
+    if (result == 0 && ferror(file)) {
+        video_ctx_log_errno(ctx, "Error reading file");
+        result = -1;
+    }
+
+    video_ctx_free(ctx, buffer);
+    fclose(file);
+    return result;
+}
+
+int video_hash_file(VideoContext *ctx, const char *path, VideoHash *hash) {
+    if (!ctx) ctx = video_default_context();
+    HashState state;
+    hash_init(&state, ctx);
+    if (hash_file_into(ctx, path, &state) != 0) return -1;
+    hash_final(&state, hash);
+    return 0;
+}
+
+int video_cache_key_hashed(VideoContext *ctx, const VideoHash *input,
+                           const VideoProgram *program, const char *profile, char *key) {
+    if (!ctx) ctx = video_default_context();
+
+    size_t length = video_program_format(program, NULL, 0);
+    char *canonical = (char *)video_ctx_alloc(ctx, length + 1);
+    if (!canonical) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error allocating cache key\n");
+        return -1;
+    }
+    video_program_format(program, canonical, length + 1);
+
+    // Fields are NUL-separated so no two (program, profile) pairs run together
+    HashState state;
+    hash_init(&state, ctx);
+    hash_update(&state, (const unsigned char *)input, sizeof(*input));
+    hash_update(&state, (const unsigned char *)canonical, length + 1);
+    hash_update(&state, (const unsigned char *)(profile ? profile : ""),
+                strlen(profile ? profile : "") + 1);
+    VideoHash hash;
+    hash_final(&state, &hash);
+    video_ctx_free(ctx, canonical);
+
+    snprintf(key, VIDEO_CACHE_KEY_SIZE, "%016llx%016llx",
+             (unsigned long long)hash.hi, (unsigned long long)hash.lo);
+    return 0;
+}
+
+int video_cache_key(VideoContext *ctx, const char *input_path, const char *program,
+                    const char *profile, char *key) {
+    if (!ctx) ctx = video_default_context();
+
+    VideoProgram *parsed = video_program_parse(ctx, program);
+    if (!parsed) return -1;
+
+    VideoHash input;
+    int result = video_hash_file(ctx, input_path, &input);
+    if (result == 0) result = video_cache_key_hashed(ctx, &input, parsed, profile, key);
+    video_program_free(ctx, parsed);
+    return result;
+}
+
+static int is_key(const char *name) {
+    size_t i;
+    for (i = 0; name[i]; i++) {
+        if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f'))) return 0;
+    }
+    return i == VIDEO_CACHE_KEY_SIZE - 1;
+}
+
+static void entry_unlink(VideoCache *cache, CacheEntry *entry) {
+    if (entry->prev) entry->prev->next = entry->next; else cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev; else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void entry_push_front(VideoCache *cache, CacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry; else cache->tail = entry;
+    cache->head = entry;
+}
+
+static CacheEntry *entry_find(VideoCache *cache, const char *key) {
+    for (CacheEntry *entry = cache->head; entry; entry = entry->next) {
+        if (strcmp(entry->key, key) == 0) return entry;
+    }
+    return NULL;
+}
+
+// Record key as most recently used with the given size; call with the lock held
+static void entry_touch(VideoCache *cache, const char *key, size_t bytes) {
+    CacheEntry *entry = entry_find(cache, key);
+    if (entry) {
+        cache->total -= entry->bytes;
+        entry_unlink(cache, entry);
+    } else {
+        entry = (CacheEntry *)calloc(1, sizeof(CacheEntry));
+        if (!entry) return;
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+    }
+    entry->bytes = bytes;
+    cache->total += bytes;
+    entry_push_front(cache, entry);
+}
+
+static void entry_forget(VideoCache *cache, const char *key) {
+    CacheEntry *entry = entry_find(cache, key);
+    if (!entry) return;
+    cache->total -= entry->bytes;
+    entry_unlink(cache, entry);
+    free(entry);
+}
+
+// Evict least recently used files until within budget; call with the lock held
+static void cache_evict(VideoCache *cache) {
+    while (cache->budget && cache->total > cache->budget && cache->tail) {
+        CacheEntry *victim = cache->tail;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, victim->key);
+        unlink(path);
+        cache->total -= victim->bytes;
+        entry_unlink(cache, victim);
+        free(victim);
+    }
+}
+
+typedef struct {
+    char key[VIDEO_CACHE_KEY_SIZE];
+    size_t bytes;
+    double mtime;
+} ScannedEntry;
+
+static int compare_mtime(const void *a, const void *b) {
+    double ta = ((const ScannedEntry *)a)->mtime;
+    double tb = ((const ScannedEntry *)b)->mtime;
+    return (ta > tb) - (ta < tb);
+}
+
+static int cache_scan(VideoCache *cache) {
+    DIR *dir = opendir(cache->dir);
+    if (!dir) return -1;
+
+    ScannedEntry *scanned = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL) {
+        if (!is_key(item->d_name)) continue;
+
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, item->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            ScannedEntry *grown = (ScannedEntry *)realloc(scanned, capacity * sizeof(ScannedEntry));
+            if (!grown) break;
+            scanned = grown;
+        }
+        memcpy(scanned[count].key, item->d_name, VIDEO_CACHE_KEY_SIZE);
+        scanned[count].bytes = (size_t)st.st_size;
+        scanned[count].mtime = st.st_mtim.tv_sec + st.st_mtim.tv_nsec * 1e-9;
+        count++;
+    }
+    closedir(dir);
+
+    // Oldest first, so the newest ends up at the head
+    qsort(scanned, count, sizeof(ScannedEntry), compare_mtime);
+    for (size_t i = 0; i < count; i++) {
+        entry_touch(cache, scanned[i].key, scanned[i].bytes);
+    }
+    free(scanned);
+    return 0;
+}
+
+VideoCache *video_cache_open(const char *dir, size_t budget_bytes) {
+    if (!dir || !*dir) {
+        video_ctx_log(video_default_context(), VIDEO_LOG_ERROR,
+                      "Invalid input to video_cache_open function.\n");
+        return NULL;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        video_ctx_log_errno(video_default_context(), "Error creating cache directory");
+        return NULL;
+    }
+
+    VideoCache *cache = (VideoCache *)calloc(1, sizeof(VideoCache));
+    if (!cache || !(cache->dir = strdup(dir))) {
+        perror("Error allocating VideoCache");
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->budget = budget_bytes;
+
+    if (cache_scan(cache) != 0) {
+        video_ctx_log_errno(video_default_context(), "Error reading cache directory");
+        video_cache_close(cache);
+        return NULL;
+    }
+    cache_evict(cache);
+    return cache;
+}
+
+static int copy_file(const char *src, const char *dst) {
+    FILE *in = fopen(src, "rb");
+    if (!in) return -1;
+    FILE *out = fopen(dst, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    char buffer[1 << 16];
+    size_t n;
+    int result = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) {
+            result = -1;
+            break;
+        }
+    }
+    if (ferror(in)) result = -1;
+    fclose(in);
+    if (fclose(out) != 0) result = -1;
+    if (result != 0) unlink(dst);
+    return result;
+}
+
+// Make dst a copy of src, by hard link when both are on one file system
+static int place_file(const char *src, const char *dst) {
+    if (unlink(dst) != 0 && errno != ENOENT) return -1;
+    if (link(src, dst) == 0) return 0;
+    if (errno == ENOENT) return -1;
+    return copy_file(src, dst);
+}
+
+int video_cache_lookup(VideoCache *cache, const char *key, char *path, size_t size) {
+    snprintf(path, size, "%s/%s", cache->dir, key);
+
+    // The index may be stale (another process can add or evict files), so
+    // the file system decides hit or miss
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        pthread_mutex_lock(&cache->lock);
+        entry_forget(cache, key);
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+
+    // Bump the modification time so recency survives a restart
+    utimensat(AT_FDCWD, path, NULL, 0);
+
+    pthread_mutex_lock(&cache->lock);
+    entry_touch(cache, key, (size_t)st.st_size);
+    pthread_mutex_unlock(&cache->lock);
+    return 1;
+}
+
+const char *video_cache_dir(const VideoCache *cache) {
+    return cache->dir;
+}
+
+int video_cache_fetch(VideoCache *cache, VideoContext *ctx, const char *key,
+                      const char *dest_path) {
+    if (!ctx) ctx = video_default_context();
+    char path[PATH_MAX];
+    if (!video_cache_lookup(cache, key, path, sizeof(path))) return 0;
+
+    if (place_file(path, dest_path) != 0) {
+        if (errno == ENOENT) return 0;
+        video_ctx_log_errno(ctx, "Error placing cached result");
+        return -1;
+    }
+    return 1;
+}
+
+int video_cache_store(VideoCache *cache, VideoContext *ctx, const char *key,
+                      const char *path) {
+    if (!ctx) ctx = video_default_context();
+    char final_path[PATH_MAX];
+    char temp_path[PATH_MAX];
+
+    pthread_mutex_lock(&cache->lock);
+    unsigned long sequence = cache->sequence++;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Build under a temporary name and rename, so readers never see a
+    // partial file
+    snprintf(final_path, sizeof(final_path), "%s/%s", cache->dir, key);
+    snprintf(temp_path, sizeof(temp_path), "%s/.%s.%ld.%lu.tmp", cache->dir, key,
+             (long)getpid(), sequence);
+    if (place_file(path, temp_path) != 0 || rename(temp_path, final_path) != 0) {
+        video_ctx_log_errno(ctx, "Error storing result in cache");
+        unlink(temp_path);
+        return -1;
+    }
+    // rename() leaves both names if they were already the same file
+    unlink(temp_path);
+
+    struct stat st;
+    if (stat(final_path, &st) != 0) return -1;
+
+    pthread_mutex_lock(&cache->lock);
+    entry_touch(cache, key, (size_t)st.st_size);
+    cache_evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+// Key of a decoded input, from the file's identity and version rather
+// than its contents, so a hit costs a stat instead of a hash of the file.
+// The decode parameters are hashed as their own field, whatever their length
+static int decoded_key(VideoContext *ctx, const struct stat *st, const char *params,
+                       const char *profile, char *key) {
+    uint64_t identity[5] = {(uint64_t)st->st_dev, (uint64_t)st->st_ino, (uint64_t)st->st_size,
+                            (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec};
+    if (!params) params = "";
+    HashState state;
+    hash_init(&state, ctx);
+    hash_update(&state, (const unsigned char *)identity, sizeof(identity));
+    hash_update(&state, (const unsigned char *)params, strlen(params) + 1);
+    VideoHash input;
+    hash_final(&state, &input);
+
+    char full_profile[96];
+    snprintf(full_profile, sizeof(full_profile), "decoded;%s%s", profile,
+             video_ctx_deterministic(ctx) ? ";bitexact" : "");
+    VideoProgram none = {0, NULL};
+    return video_cache_key_hashed(ctx, &input, &none, full_profile, key);
+}
+
+// Written beside the cache and linked in, as results are; a failed store
+// only costs a future decode
+static void store_decoded(VideoCache *cache, VideoContext *ctx, const char *key,
+                          const SVideo *video) {
+    char path[PATH_MAX];
+    pthread_mutex_lock(&cache->lock);
+    unsigned long sequence = cache->sequence++;
+    pthread_mutex_unlock(&cache->lock);
+    snprintf(path, sizeof(path), "%s/.decoded.%ld.%lu.tmp", cache->dir, (long)getpid(), sequence);
+    if (encode_S_ctx(ctx, path, video) == 0) video_cache_store(cache, ctx, key, path);
+    unlink(path);
+}
+
+SVideo *video_cache_decode_S(VideoCache *cache, VideoContext *ctx, const char *input_path,
+                             const char *params) {
+    if (!ctx) ctx = video_default_context();
+    if (!cache || !input_path) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to video_cache_decode_S function.\n");
+        return NULL;
+    }
+    if (!video_is_standard_format(input_path)) return map_video_S_ctx(ctx, input_path);
+
+#ifdef VIDEO_WITH_FFMPEG
+    struct stat st;
+    char key[VIDEO_CACHE_KEY_SIZE];
+    char path[PATH_MAX];
+    if (stat(input_path, &st) != 0) {
+        video_ctx_log_errno(ctx, "Error opening file");
+        return NULL;
+    }
+    int keyed = decoded_key(ctx, &st, params, "full", key) == 0;
+
+    // Another process may evict the file between the lookup and the map,
+    // which then decodes as on a miss
+    if (keyed && video_cache_lookup(cache, key, path, sizeof(path))) {
+        SVideo *video = map_video_S_ctx(ctx, path);
+        if (video) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Decoded %s found in cache\n", input_path);
+            return video;
+        }
+    }
+
+    SVideo *video = decode_standard_video_ctx(ctx, input_path);
+    if (video && keyed) store_decoded(cache, ctx, key, video);
+    return video;
+#else
+    (void)params;
+    return NULL;
+#endif
+}
+
+// Frame count and longest side of a video by its header, without decoding
+// it; 0 where unknown
+static void header_size(VideoContext *ctx, const char *input_path, long *num_frames,
+                        int *side) {
+    *num_frames = 0;
+    *side = 0;
+#ifdef VIDEO_WITH_FFMPEG
+    if (video_is_standard_format(input_path)) {
+        int width, height;
+        double fps;
+        if (get_video_info_ctx(ctx, input_path, &width, &height, num_frames, &fps) == 0) {
+            *side = width > height ? width : height;
+        }
+        if (*num_frames < 0) *num_frames = 0;
+        return;
+    }
+#else
+    (void)ctx;
+#endif
+    unsigned char header[sizeof(long) + 3];
+    FILE *file = fopen(input_path, "rb");
+    if (file && fread(header, 1, sizeof(header), file) == sizeof(header)) {
+        memcpy(num_frames, header, sizeof(long));
+        int height = header[sizeof(long) + 1];
+        int width = header[sizeof(long) + 2];
+        *side = width > height ? width : height;
+    }
+    if (file) fclose(file);
+    if (*num_frames < 0) *num_frames = 0;
+}
+
+SVideo *video_cache_proxy_S(VideoCache *cache, VideoContext *ctx, const char *input_path,
+                            const char *params, int max_side, long max_frames,
+                            long *frame_step, int *scale) {
+    if (!ctx) ctx = video_default_context();
+    if (!cache || !input_path || max_side < 0 || max_frames < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to video_cache_proxy_S function.\n");
+        return NULL;
+    }
+
+    // Step and scale come from the header alone, so they are the same on a
+    // hit as when the proxy was built
+    long frames;
+    int side;
+    header_size(ctx, input_path, &frames, &side);
+    long step = max_frames && frames > max_frames ? (frames + max_frames - 1) / max_frames : 1;
+    if (frame_step) *frame_step = step;
+    if (scale) *scale = max_side && side > max_side ? (side + max_side - 1) / max_side : 1;
+
+    struct stat st;
+    char key[VIDEO_CACHE_KEY_SIZE];
+    char path[PATH_MAX];
+    char limits[48];
+    if (stat(input_path, &st) != 0) {
+        video_ctx_log_errno(ctx, "Error opening file");
+        return NULL;
+    }
+    snprintf(limits, sizeof(limits), "proxy;%d;%ld", max_side, max_frames);
+    int keyed = decoded_key(ctx, &st, params, limits, key) == 0;
+    if (keyed && video_cache_lookup(cache, key, path, sizeof(path))) {
+        SVideo *proxy = map_video_S_ctx(ctx, path);
+        if (proxy) return proxy;
+    }
+
+    // Built from the full decode, which goes through the cache as well
+    SVideo *video = video_cache_decode_S(cache, ctx, input_path, params);
+    if (!video) return NULL;
+    SVideo *proxy = proxy_video_S_ctx(ctx, video, max_side, step, max_frames);
+    free_video_S_ctx(ctx, video);
+    if (proxy && keyed) store_decoded(cache, ctx, key, proxy);
+    return proxy;
+}
+
+void video_cache_close(VideoCache *cache) {
+    if (!cache) return;
+    while (cache->head) {
+        CacheEntry *entry = cache->head;
+        cache->head = entry->next;
+        free(entry);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->dir);
+    free(cache);
+}
@@ -0,0 +1,192 @@
+#ifndef VIDEO_CACHE_H
+#define VIDEO_CACHE_H
+
+#include <stdint.h>
+#include "video_ops.h"
+
+/**
+ * @brief Content-addressed cache of job results
+ * Results are keyed by a hash of the input file's bytes, the canonical op
+ * program and the encode profile, and kept as files in a local directory
+ * with least-recently-used eviction under a size budget. A repeated job
+ * costs a hash of its input and a hard link instead of a transcode.
+ *
+ * The directory may be shared by several processes; each keeps its own
+ * index, so the size budget is enforced per process and a file evicted by
+ * another process is simply a miss.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VIDEO_CACHE_KEY_SIZE 33     // 32 hex digits and the terminator
+
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} VideoHash;
+
+typedef struct VideoCache VideoCache;
+
+/**
+ * @brief Hash a buffer (128-bit, non-cryptographic)
+ * Uses AVX2 when the context allows it; the result does not depend on the
+ * instruction set.
+ *
+ * @param ctx Library context (ISA selection), or NULL for the default
+ * @param data Bytes to hash
+ * @param size Number of bytes
+ * @param hash Output hash
+ */
+void video_hash_bytes(VideoContext *ctx, const void *data, size_t size, VideoHash *hash);
+
+/**
+ * @brief Hash a file's contents, equal to video_hash_bytes() of its bytes
+ * Checks for cancellation between blocks.
+ *
+ * @param ctx Library context, or NULL for the default
+ * @param path File to hash
+ * @param hash Output hash
+ * @return int 0 on success, -1 on read error or cancellation
+ */
+int video_hash_file(VideoContext *ctx, const char *path, VideoHash *hash);
+
+/**
+ * @brief Compute the cache key of a job result
+ *
+ * @param ctx Library context, or NULL for the default
+ * @param input_path Input file, hashed by content
+ * @param program Op program text, canonicalised before hashing
+ * @param profile Encode settings that affect the output (codec, fps, format)
+ * @param key Output key, VIDEO_CACHE_KEY_SIZE bytes
+ * @return int 0 on success, -1 if the input cannot be read or the program is invalid
+ */
+int video_cache_key(VideoContext *ctx, const char *input_path, const char *program,
+                    const char *profile, char *key);
+
+/**
+ * @brief Compute a cache key from an input already hashed and a parsed program
+ *
+ * @param ctx Library context, or NULL for the default
+ * @param input Hash of the input file from video_hash_file()
+ * @param program Op program, canonicalised before hashing
+ * @param profile Encode settings that affect the output
+ * @param key Output key, VIDEO_CACHE_KEY_SIZE bytes
+ * @return int 0 on success, -1 on allocation failure
+ */
+int video_cache_key_hashed(VideoContext *ctx, const VideoHash *input,
+                           const VideoProgram *program, const char *profile, char *key);
+
+/**
+ * @brief Open a cache directory, creating it if needed
+ * Existing entries are indexed, oldest modification time least recent.
+ *
+ * @param dir Cache directory
+ * @param budget_bytes Total size of cached files to keep, 0 for unlimited
+ * @return VideoCache* Cache, or NULL on error
+ */
+VideoCache *video_cache_open(const char *dir, size_t budget_bytes);
+
+/**
+ * @brief Place a cached result at dest_path
+ * The result is hard linked when possible (copied otherwise), so dest_path
+ * must be treated as read-only.
+ *
+ * @param cache Cache
+ * @param ctx Library context (error reporting), or NULL for the default
+ * @param key Key from video_cache_key()
+ * @param dest_path Where to put the result; replaced if it exists
+ * @return int 1 on a hit, 0 on a miss, -1 on error
+ */
+int video_cache_fetch(VideoCache *cache, VideoContext *ctx, const char *key,
+                      const char *dest_path);
+
+/**
+ * @brief Find the cached file for a key, marking it recently used
+ * The file may be evicted at any time; open it promptly and treat a
+ * failure to open as a miss.
+ *
+ * @param cache Cache
+ * @param key Key from video_cache_key()
+ * @param path Output path of the cached file
+ * @param size Size of the path buffer
+ * @return int 1 on a hit, 0 on a miss
+ */
+int video_cache_lookup(VideoCache *cache, const char *key, char *path, size_t size);
+
+/**
+ * @brief Get the cache directory, e.g. to write files to store on the same
+ *        file system
+ *
+ * @param cache Cache
+ * @return const char* Directory path
+ */
+const char *video_cache_dir(const VideoCache *cache);
+
+/**
+ * @brief Add a result to the cache, evicting old entries over the budget
+ *
+ * @param cache Cache
+ * @param ctx Library context (error reporting), or NULL for the default
+ * @param key Key from video_cache_key()
+ * @param path Result file; linked or copied, left in place
+ * @return int 0 on success, -1 on error
+ */
+int video_cache_store(VideoCache *cache, VideoContext *ctx, const char *key,
+                      const char *path);
+
+/**
+ * @brief Decode a video through a cache of decoded videos
+ * Standard format inputs are decoded once and kept in the cache directory
+ * in the raw -S format, keyed by the input file's identity (device, inode,
+ * size and modification time) and params; later calls, from any process
+ * sharing the directory, map that file copy-on-write (map_video_S_ctx())
+ * instead of decoding. Raw inputs already have that layout and are mapped
+ * directly. The returned video can be processed like any other; pages it
+ * writes become private to it.
+ *
+ * @param cache Cache, e.g. a directory of its own
+ * @param ctx Library context, or NULL for the default
+ * @param input_path Video to decode
+ * @param params Anything else that changes the decoded frames, or NULL
+ * @return SVideo* Video to free with free_video_S_ctx(), or NULL on error
+ */
+SVideo *video_cache_decode_S(VideoCache *cache, VideoContext *ctx, const char *input_path,
+                             const char *params);
+
+/**
+ * @brief Get a small stand-in for a video through a cache of decoded videos
+ * The proxy (proxy_video_S_ctx()) keeps every frame_step-th frame, at most
+ * max_frames of them, box-filtered down to fit max_side, so the work done
+ * on it is bounded whatever the size of the input. It is built from
+ * video_cache_decode_S() and kept in the cache beside the full decode,
+ * keyed by the input's identity, params and limits; later calls map it.
+ *
+ * @param cache Cache, e.g. a directory of its own
+ * @param ctx Library context, or NULL for the default
+ * @param input_path Video to decode
+ * @param params Anything else that changes the decoded frames, or NULL
+ * @param max_side Longest side of a proxy frame, 0 to keep the size
+ * @param max_frames Most frames to keep, 0 for all
+ * @param frame_step Output input frames per proxy frame, from the header's
+ *                   frame count, or NULL
+ * @param scale Output input pixels per proxy pixel along each side, or NULL
+ * @return SVideo* Proxy to free with free_video_S_ctx(), or NULL on error
+ */
+SVideo *video_cache_proxy_S(VideoCache *cache, VideoContext *ctx, const char *input_path,
+                            const char *params, int max_side, long max_frames,
+                            long *frame_step, int *scale);
+
+/**
+ * @brief Close a cache, keeping its files
+ *
+ * @param cache Cache
+ */
+void video_cache_close(VideoCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_CACHE_H
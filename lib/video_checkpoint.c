@@ -0,0 +1,248 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "video_checkpoint.h"
+
+typedef struct Checkpoint {
+    char key[VIDEO_CACHE_KEY_SIZE];
+    SVideo *video;
+    size_t bytes;
+    double work;                // Seconds it took to produce the video
+    int pins;                   // Restores copying the video outside the lock
+    int evicted;                // Off the list; the last unpin frees it
+    struct Checkpoint *prev;    // Towards the most recently used
+    struct Checkpoint *next;
+} Checkpoint;
+
+struct VideoCheckpoints {
+    pthread_mutex_t lock;
+    VideoContext *ctx;          // Owns the copies held in memory
+    VideoCache *spill;
+    size_t budget;
+    size_t total;
+    Checkpoint *head;           // Most recently used
+    Checkpoint *tail;
+    unsigned long sequence;     // For unique spill file names
+    double copy_rate;           // Measured seconds per byte to copy, 0 until measured
+    double spill_rate;          // Measured seconds per byte to spill
+};
+
+static void update_rate(double *rate, double seconds, size_t bytes) {
+    double sample = seconds / (bytes ? bytes : 1);
+    *rate = *rate ? 0.75 * *rate + 0.25 * sample : sample;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Copy a video, timing it to learn what a checkpoint costs; call without
+// the lock, so other jobs can use the store while a large video copies
+static SVideo *timed_copy(VideoCheckpoints *store, VideoContext *ctx, const SVideo *video,
+                          size_t bytes) {
+    double start = now_seconds();
+    SVideo *copy = copy_video_S_ctx(ctx, video);
+    double seconds = now_seconds() - start;
+    pthread_mutex_lock(&store->lock);
+    update_rate(&store->copy_rate, seconds, bytes);
+    pthread_mutex_unlock(&store->lock);
+    return copy;
+}
+
+static void checkpoint_free(VideoCheckpoints *store, Checkpoint *entry) {
+    free_video_S_ctx(store->ctx, entry->video);
+    free(entry);
+}
+
+static size_t video_bytes(const SVideo *video) {
+    size_t plane = (size_t)video->height * video->width;
+    return video->num_frames * (sizeof(Frame) + video->channels * (sizeof(Channel) + plane));
+}
+
+static void checkpoint_unlink(VideoCheckpoints *store, Checkpoint *entry) {
+    if (entry->prev) entry->prev->next = entry->next; else store->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev; else store->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void checkpoint_push_front(VideoCheckpoints *store, Checkpoint *entry) {
+    entry->prev = NULL;
+    entry->next = store->head;
+    if (store->head) store->head->prev = entry; else store->tail = entry;
+    store->head = entry;
+}
+
+static Checkpoint *checkpoint_find(VideoCheckpoints *store, const char *key) {
+    for (Checkpoint *entry = store->head; entry; entry = entry->next) {
+        if (strcmp(entry->key, key) == 0) return entry;
+    }
+    return NULL;
+}
+
+// Write a video to the spill cache through a temporary file beside it, if
+// writing and reading it back costs less than the work it saves. Uses the
+// store's context, so the job's progress and cancellation do not apply.
+static int spill_video(VideoCheckpoints *store, const char *key, const SVideo *video,
+                       size_t bytes, double work) {
+    if (!store->spill) return -1;
+
+    pthread_mutex_lock(&store->lock);
+    unsigned long sequence = store->sequence++;
+    int pays = work > 2.0 * store->spill_rate * bytes;
+    pthread_mutex_unlock(&store->lock);
+    if (!pays) return 1;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.spill.%ld.%lu.tmp", video_cache_dir(store->spill),
+             (long)getpid(), sequence);
+    double start = now_seconds();
+    int result = encode_S_ctx(store->ctx, path, video);
+    if (result == 0) result = video_cache_store(store->spill, store->ctx, key, path);
+    unlink(path);
+
+    pthread_mutex_lock(&store->lock);
+    update_rate(&store->spill_rate, now_seconds() - start, bytes);
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+VideoCheckpoints *video_checkpoints_create(size_t memory_budget, VideoCache *spill) {
+    VideoCheckpoints *store = (VideoCheckpoints *)calloc(1, sizeof(VideoCheckpoints));
+    if (!store) {
+        perror("Error allocating VideoCheckpoints");
+        return NULL;
+    }
+    store->ctx = video_context_create();
+    if (!store->ctx) {
+        free(store);
+        return NULL;
+    }
+    pthread_mutex_init(&store->lock, NULL);
+    store->spill = spill;
+    store->budget = memory_budget;
+    return store;
+}
+
+int video_checkpoints_save(VideoCheckpoints *store, const char *key, const SVideo *video,
+                           double work) {
+    size_t bytes = video_bytes(video);
+
+    pthread_mutex_lock(&store->lock);
+    Checkpoint *entry = checkpoint_find(store, key);
+    if (entry) {
+        checkpoint_unlink(store, entry);
+        checkpoint_push_front(store, entry);
+    }
+    // Saving and restoring cost a copy each
+    int pays = work > 2.0 * store->copy_rate * bytes;
+    pthread_mutex_unlock(&store->lock);
+    if (entry) return 0;
+    if (!pays) return 1;
+
+    if (bytes > store->budget) return spill_video(store, key, video, bytes, work);
+
+    entry = (Checkpoint *)calloc(1, sizeof(Checkpoint));
+    if (!entry) return -1;
+    snprintf(entry->key, sizeof(entry->key), "%s", key);
+    entry->bytes = bytes;
+    entry->work = work;
+
+    entry->video = timed_copy(store, store->ctx, video, bytes);
+    if (!entry->video) {
+        free(entry);
+        return -1;
+    }
+
+    // Detach what no longer fits under the lock; spill it outside, as
+    // writing can take a while
+    Checkpoint *evicted = NULL;
+    pthread_mutex_lock(&store->lock);
+    if (checkpoint_find(store, key)) {
+        // Another job saved the same video while this one copied it
+        pthread_mutex_unlock(&store->lock);
+        checkpoint_free(store, entry);
+        return 0;
+    }
+    checkpoint_push_front(store, entry);
+    store->total += bytes;
+    while (store->total > store->budget && store->tail != entry) {
+        Checkpoint *victim = store->tail;
+        checkpoint_unlink(store, victim);
+        store->total -= victim->bytes;
+        victim->next = evicted;
+        evicted = victim;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    while (evicted) {
+        Checkpoint *next = evicted->next;
+        spill_video(store, evicted->key, evicted->video, evicted->bytes, evicted->work);
+        pthread_mutex_lock(&store->lock);
+        evicted->evicted = 1;
+        int pinned = evicted->pins > 0;
+        pthread_mutex_unlock(&store->lock);
+        if (!pinned) checkpoint_free(store, evicted);
+        evicted = next;
+    }
+    return 0;
+}
+
+SVideo *video_checkpoints_restore(VideoCheckpoints *store, VideoContext *ctx, const char *key,
+                                  double *work) {
+    // Pin the entry so it is not freed if evicted mid-copy, and copy
+    // outside the lock
+    pthread_mutex_lock(&store->lock);
+    Checkpoint *entry = checkpoint_find(store, key);
+    SVideo *video = NULL;
+    if (entry) {
+        checkpoint_unlink(store, entry);
+        checkpoint_push_front(store, entry);
+        *work = entry->work;
+        entry->pins++;
+    }
+    pthread_mutex_unlock(&store->lock);
+    if (entry) {
+        video = timed_copy(store, ctx, entry->video, entry->bytes);
+        pthread_mutex_lock(&store->lock);
+        int orphaned = --entry->pins == 0 && entry->evicted;
+        pthread_mutex_unlock(&store->lock);
+        if (orphaned) checkpoint_free(store, entry);
+        return video;
+    }
+    if (!store->spill) return NULL;
+
+    char path[PATH_MAX];
+    if (!video_cache_lookup(store->spill, key, path, sizeof(path))) return NULL;
+    double start = now_seconds();
+    video = decode_S_ctx(ctx, path);
+    if (!video) return NULL;
+
+    // How long the spilled video took to make is not kept; reading it back
+    // is a lower bound. Back into memory if that alone pays, as the next
+    // edit will likely resume from it again.
+    *work = now_seconds() - start;
+    video_checkpoints_save(store, key, video, *work);
+    return video;
+}
+
+void video_checkpoints_destroy(VideoCheckpoints *store) {
+    if (!store) return;
+    while (store->head) {
+        Checkpoint *entry = store->head;
+        store->head = entry->next;
+        checkpoint_free(store, entry);
+    }
+    video_context_destroy(store->ctx);
+    pthread_mutex_destroy(&store->lock);
+    free(store);
+}
@@ -0,0 +1,71 @@
+#ifndef VIDEO_CHECKPOINT_H
+#define VIDEO_CHECKPOINT_H
+
+#include "video_cache.h"
+
+/**
+ * @brief Checkpoints of partly processed videos, for incremental re-runs
+ * A job with a checkpoint store saves the decoded input and the video after
+ * prefixes of its op program, keyed by the input's hash and the canonical
+ * prefix, and a later job resumes from the longest prefix it shares. So
+ * appending or changing the last op of a chain only pays for that op.
+ *
+ * A checkpoint is only kept if producing the video took longer than saving
+ * and restoring a copy, as measured by the store; e.g. a raw input decodes
+ * about as fast as it copies. Checkpoints are kept in memory up to a
+ * budget; least recently used ones are spilled to a VideoCache directory in
+ * the raw -S format when one is given, and dropped otherwise.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct VideoCheckpoints VideoCheckpoints;
+
+/**
+ * @brief Create a checkpoint store
+ *
+ * @param memory_budget Bytes of checkpoints to keep in memory
+ * @param spill Cache to spill evicted checkpoints to, or NULL to drop them
+ * @return VideoCheckpoints* Store, or NULL on allocation failure
+ */
+VideoCheckpoints *video_checkpoints_create(size_t memory_budget, VideoCache *spill);
+
+/**
+ * @brief Save a copy of a video under key if that pays
+ * Does nothing if the key is already held in memory.
+ *
+ * @param store Checkpoint store
+ * @param key Key from video_cache_key_hashed()
+ * @param video Video to copy
+ * @param work Seconds it took to produce the video from the input
+ * @return int 0 if saved, 1 if not worth saving, -1 if the copy could not be kept
+ */
+int video_checkpoints_save(VideoCheckpoints *store, const char *key, const SVideo *video,
+                           double work);
+
+/**
+ * @brief Get a copy of the video saved under key
+ *
+ * @param store Checkpoint store
+ * @param ctx Library context; the copy is allocated from it
+ * @param key Key from video_cache_key_hashed()
+ * @param work Output seconds it took to produce the video, for later saves
+ * @return SVideo* Copy to free with free_video_S_ctx(), or NULL on a miss
+ */
+SVideo *video_checkpoints_restore(VideoCheckpoints *store, VideoContext *ctx, const char *key,
+                                  double *work);
+
+/**
+ * @brief Destroy a store, dropping the checkpoints held in memory
+ *
+ * @param store Checkpoint store
+ */
+void video_checkpoints_destroy(VideoCheckpoints *store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_CHECKPOINT_H
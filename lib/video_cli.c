@@ -0,0 +1,471 @@
+/**
+ * @brief Command-line batch tool
+ * Runs an op program over videos on a VideoScheduler in this process (the
+ * same slots, memory budget, result cache and checkpoints as the daemon),
+ * so batch jobs on worker nodes need neither Python nor the web layer.
+ *
+ * Inputs are paths or glob patterns, quoted so the shell leaves them to
+ * the tool; "-" reads one raw video from stdin. With one input, -o names
+ * the output, "-" to write it raw to stdout; with several, the outputs go
+ * to the directory -O, named after the inputs, with -x replacing their
+ * extension (e.g. -x .mp4 to encode raw inputs with -e/-r). Outputs that
+ * would overwrite an input or each other are refused up front. At most
+ * MAX_PENDING clips are handed to the scheduler at once, which runs the
+ * cheapest first.
+ *
+ * Each clip's time queued and per stage (decode, process, encode) is
+ * printed to stderr as it finishes, then a summary. Exits non-zero if any
+ * clip failed; SIGINT cancels the clips still running.
+ *
+ * Usage: video_cli [-p program] [-o output | -O output_dir [-x ext]] [-e codec] [-r fps]
+ *                  [-w slots] [-m memory_budget_mb] [-c cache_dir] [-C cache_budget_mb]
+ *                  [-k checkpoint_mb] [-d] [-S spill_dir] input...
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "video_sched.h"
+
+#define POLL_INTERVAL_MS 10
+
+// Clips submitted to the scheduler and not yet finished
+#define MAX_PENDING 64
+
+#define NUM_STAGES 3
+
+static const char *g_stage_names[NUM_STAGES] = {"decode", "process", "encode"};
+
+static volatile sig_atomic_t g_stop = 0;
+
+typedef struct {
+    const char *input;          // As given, for messages
+    char *input_path;           // Path the job reads; a spool file for stdin
+    char *output_path;          // Path the job writes; a spool file for stdout
+    VideoJob *job;
+    VideoJobState state;
+    char error[256];
+    double submitted;
+    double stage_start[NUM_STAGES];  // First progress report of each stage, 0 if none
+    double done;
+    long frames;                // Frames in the last stage reported
+} Clip;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void handle_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+// Called on the job's thread; read by the main thread once the job has
+// finished, which video_job_poll() orders after every call
+static void clip_progress(VideoJob *job, VideoStage stage, long done, long total, void *user) {
+    (void)job;
+    (void)done;
+    Clip *clip = (Clip *)user;
+    if (!clip->stage_start[stage]) clip->stage_start[stage] = now_seconds();
+    clip->frames = total;
+}
+
+static const char *temp_dir(void) {
+    const char *dir = getenv("TMPDIR");
+    return dir && *dir ? dir : "/tmp";
+}
+
+// New empty file in the temporary directory, for the job to read or write
+// in place of a pipe; returns its path, or NULL
+static char *temp_file(const char *tag) {
+    char *path;
+    if (asprintf(&path, "%s/filmmaster-%s-XXXXXX", temp_dir(), tag) < 0) return NULL;
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Error creating temporary file: %s\n", strerror(errno));
+        free(path);
+        return NULL;
+    }
+    close(fd);
+    return path;
+}
+
+static int copy_stream(FILE *in, FILE *out) {
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) return -1;
+    }
+    return ferror(in) ? -1 : 0;
+}
+
+// Raw input from stdin goes to a spool file, as jobs hash and seek their input
+static char *spool_stdin(void) {
+    char *path = temp_file("stdin");
+    if (!path) return NULL;
+    FILE *file = fopen(path, "wb");
+    if (!file || copy_stream(stdin, file) != 0 || fclose(file) != 0) {
+        fprintf(stderr, "Error reading video from stdin: %s\n", strerror(errno));
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+static int send_file(const char *path, FILE *out) {
+    FILE *file = fopen(path, "rb");
+    int result = file && copy_stream(file, out) == 0 && fflush(out) == 0 ? 0 : -1;
+    if (result != 0) fprintf(stderr, "Error writing video to stdout: %s\n", strerror(errno));
+    if (file) fclose(file);
+    return result;
+}
+
+// dir/<input's name>, with ext in place of its extension if given
+static char *output_for(const char *input, const char *dir, const char *ext) {
+    const char *name = strrchr(input, '/');
+    name = name ? name + 1 : input;
+    const char *dot = strrchr(name, '.');
+    int stem = (int)(ext && dot && dot != name ? dot - name : (long)strlen(name));
+    char *path;
+    if (asprintf(&path, "%s/%.*s%s", dir, stem, name, ext ? ext : "") < 0) return NULL;
+    return path;
+}
+
+// Identity of a path: device and inode once the file exists, else the path
+// with its directory resolved, so outputs not yet written compare too
+typedef struct {
+    int exists;
+    dev_t dev;
+    ino_t ino;
+    char *resolved;
+} PathId;
+
+static void path_id(const char *path, PathId *id) {
+    struct stat st;
+    memset(id, 0, sizeof(*id));
+    if (stat(path, &st) == 0) {
+        id->exists = 1;
+        id->dev = st.st_dev;
+        id->ino = st.st_ino;
+        return;
+    }
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+    char *real = dir ? realpath(dir, NULL) : NULL;
+    if (!real || asprintf(&id->resolved, "%s/%s", real, slash ? slash + 1 : path) < 0) {
+        id->resolved = strdup(path);
+    }
+    free(real);
+    free(dir);
+}
+
+static int same_path_id(const PathId *a, const PathId *b) {
+    if (a->exists || b->exists) {
+        return a->exists && b->exists && a->dev == b->dev && a->ino == b->ino;
+    }
+    return a->resolved && b->resolved && strcmp(a->resolved, b->resolved) == 0;
+}
+
+// Refuse, before anything is submitted, an output that would overwrite an
+// input or that two clips would both write
+static int check_outputs(const Clip *clips, int count) {
+    PathId *inputs = (PathId *)calloc(count, sizeof(PathId));
+    PathId *outputs = (PathId *)calloc(count, sizeof(PathId));
+    int result = inputs && outputs ? 0 : -1;
+    if (result != 0) perror("Error allocating clips");
+    for (int i = 0; i < count && result == 0; i++) {
+        path_id(clips[i].input_path, &inputs[i]);
+        path_id(clips[i].output_path, &outputs[i]);
+    }
+    for (int i = 0; i < count && result == 0; i++) {
+        for (int j = 0; j < count && result == 0; j++) {
+            if (same_path_id(&outputs[i], &inputs[j])) {
+                fprintf(stderr, "Error: output %s would overwrite input %s\n",
+                        clips[i].output_path, clips[j].input);
+                result = -1;
+            } else if (j < i && same_path_id(&outputs[i], &outputs[j])) {
+                fprintf(stderr, "Error: %s and %s would both write %s\n", clips[j].input,
+                        clips[i].input, clips[i].output_path);
+                result = -1;
+            }
+        }
+    }
+    for (int i = 0; inputs && outputs && i < count; i++) {
+        free(inputs[i].resolved);
+        free(outputs[i].resolved);
+    }
+    free(inputs);
+    free(outputs);
+    return result;
+}
+
+// A stage lasts from its first report to the next stage's, or the end
+static double stage_seconds(const Clip *clip, int stage) {
+    if (!clip->stage_start[stage]) return 0.0;
+    double end = clip->done;
+    for (int next = stage + 1; next < NUM_STAGES; next++) {
+        if (clip->stage_start[next]) {
+            end = clip->stage_start[next];
+            break;
+        }
+    }
+    return end - clip->stage_start[stage];
+}
+
+static void print_clip(const Clip *clip) {
+    static const char *state_names[] = {"queued", "running", "done", "failed", "cancelled"};
+    fprintf(stderr, "%s: %s", clip->input, state_names[clip->state]);
+    if (clip->state == VIDEO_JOB_FAILED && clip->error[0]) fprintf(stderr, " (%s)", clip->error);
+
+    double started = clip->done;
+    for (int s = 0; s < NUM_STAGES; s++) {
+        if (clip->stage_start[s] && clip->stage_start[s] < started) started = clip->stage_start[s];
+    }
+    fprintf(stderr, " in %.3f s, queued %.3f s", clip->done - clip->submitted,
+            started - clip->submitted);
+    for (int s = 0; s < NUM_STAGES; s++) {
+        if (clip->stage_start[s]) {
+            fprintf(stderr, ", %s %.3f s", g_stage_names[s], stage_seconds(clip, s));
+        }
+    }
+    if (clip->frames > 0) fprintf(stderr, ", %ld frames", clip->frames);
+    fputc('\n', stderr);
+}
+
+static void finish_clip(Clip *clip, VideoJobState state) {
+    clip->state = state;
+    clip->done = now_seconds();
+    if (clip->job) {
+        snprintf(clip->error, sizeof(clip->error), "%s", video_job_error(clip->job));
+        video_job_free(clip->job);
+        clip->job = NULL;
+    }
+    print_clip(clip);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-p program] [-o output | -O output_dir [-x ext]] [-e codec]"
+            " [-r fps] [-w slots] [-m memory_budget_mb] [-c cache_dir] [-C cache_budget_mb]"
+            " [-k checkpoint_mb] [-d] [-S spill_dir] input...\n", program);
+}
+
+int main(int argc, char **argv) {
+    VideoSchedulerConfig config = {2, 0, 0.0, 0, NULL};
+    const char *program = "";
+    const char *output = NULL;
+    const char *output_dir = NULL;
+    const char *extension = NULL;
+    const char *codec = NULL;
+    int fps = 0;
+    const char *cache_dir = NULL;
+    size_t cache_budget = 0;
+    size_t checkpoint_budget = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:o:O:x:e:r:w:m:c:C:k:dS:")) != -1) {
+        switch (opt) {
+        case 'p':
+            program = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'O':
+            output_dir = optarg;
+            break;
+        case 'x':
+            extension = optarg;
+            break;
+        case 'e':
+            codec = optarg;
+            break;
+        case 'r':
+            fps = atoi(optarg);
+            break;
+        case 'w':
+            config.num_slots = atoi(optarg);
+            break;
+        case 'm':
+            config.memory_budget = (size_t)atol(optarg) << 20;
+            break;
+        case 'c':
+            cache_dir = optarg;
+            break;
+        case 'C':
+            cache_budget = (size_t)atol(optarg) << 20;
+            break;
+        case 'k':
+            checkpoint_budget = (size_t)atol(optarg) << 20;
+            break;
+        case 'd':
+            config.deterministic = 1;
+            break;
+        case 'S':
+            config.spill_dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || !output == !output_dir) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Patterns that match nothing stay as given, and fail as missing files
+    int from_stdin = strcmp(argv[optind], "-") == 0;
+    glob_t matches;
+    memset(&matches, 0, sizeof(matches));
+    for (int i = optind; i < argc && !from_stdin; i++) {
+        if (strcmp(argv[i], "-") == 0 ||
+            glob(argv[i], GLOB_NOCHECK | (i > optind ? GLOB_APPEND : 0), NULL, &matches) != 0) {
+            fprintf(stderr, "Error: cannot expand %s\n", argv[i]);
+            return 1;
+        }
+    }
+    int count = from_stdin ? 1 : (int)matches.gl_pathc;
+    if ((from_stdin && argc - optind > 1) || (output && count > 1)) {
+        fprintf(stderr, "Error: -o takes one input; use -O for several\n");
+        return 1;
+    }
+    int to_stdout = output && strcmp(output, "-") == 0;
+
+    Clip *clips = (Clip *)calloc(count, sizeof(Clip));
+    if (!clips) {
+        perror("Error allocating clips");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        Clip *clip = &clips[i];
+        clip->input = from_stdin ? "(stdin)" : matches.gl_pathv[i];
+        clip->input_path = from_stdin ? spool_stdin() : strdup(matches.gl_pathv[i]);
+        clip->output_path = to_stdout ? temp_file("stdout") :
+                            output ? strdup(output) :
+                            output_for(from_stdin ? "stdin" : clip->input, output_dir, extension);
+        if (!clip->input_path || !clip->output_path) return 1;
+    }
+    if (!to_stdout && check_outputs(clips, count) != 0) return 1;
+
+    // The video goes to the original stdout; anything the library prints
+    // there goes to stderr instead
+    FILE *video_out = NULL;
+    if (to_stdout) {
+        video_out = fdopen(dup(STDOUT_FILENO), "wb");
+        if (!video_out || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            perror("Error redirecting stdout");
+            return 1;
+        }
+    }
+
+    VideoScheduler *sched = video_scheduler_create(&config);
+    if (!sched) return 1;
+    VideoCache *cache = NULL;
+    VideoCheckpoints *checkpoints = NULL;
+    if (cache_dir) {
+        cache = video_cache_open(cache_dir, cache_budget);
+        if (!cache) return 1;
+    }
+    if (checkpoint_budget) {
+        checkpoints = video_checkpoints_create(checkpoint_budget, cache);
+        if (!checkpoints) return 1;
+    }
+    autotune_get();
+    video_cost_model();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    double start = now_seconds();
+    int next = 0, pending = 0, finished = 0;
+    while (finished < count) {
+        // Clips not yet submitted are dropped on a signal; running ones are cancelled
+        while (next < count && (pending < MAX_PENDING || g_stop)) {
+            Clip *clip = &clips[next++];
+            clip->submitted = now_seconds();
+            if (g_stop) {
+                finish_clip(clip, VIDEO_JOB_CANCELLED);
+                finished++;
+                continue;
+            }
+            VideoJobSpec spec = {clip->input_path, clip->output_path, program, codec, fps,
+                                 cache, checkpoints};
+            clip->job = video_scheduler_submit(sched, &spec, clip_progress, clip);
+            if (!clip->job) {
+                snprintf(clip->error, sizeof(clip->error), "%s",
+                         video_context_last_error(video_default_context()));
+                finish_clip(clip, VIDEO_JOB_FAILED);
+                finished++;
+                continue;
+            }
+            pending++;
+        }
+
+        for (int i = 0; i < next; i++) {
+            Clip *clip = &clips[i];
+            if (!clip->job) continue;
+            if (g_stop) video_job_cancel(clip->job);
+            VideoJobState state = video_job_poll(clip->job, NULL, NULL, NULL);
+            if (state == VIDEO_JOB_QUEUED || state == VIDEO_JOB_RUNNING) continue;
+            finish_clip(clip, state);
+            pending--;
+            finished++;
+        }
+        if (finished < count) poll(NULL, 0, POLL_INTERVAL_MS);
+    }
+    double wall = now_seconds() - start;
+
+    int failed = 0;
+    long frames = 0;
+    double stage_total[NUM_STAGES] = {0.0, 0.0, 0.0};
+    for (int i = 0; i < count; i++) {
+        Clip *clip = &clips[i];
+        if (clip->state != VIDEO_JOB_DONE) {
+            failed++;
+        } else if (clip->frames > 0) {
+            frames += clip->frames;
+        }
+        for (int s = 0; s < NUM_STAGES; s++) stage_total[s] += stage_seconds(clip, s);
+    }
+    fprintf(stderr, "%d clips, %d failed, %ld frames in %.3f s (%.1f frames/s);"
+            " decode %.3f s, process %.3f s, encode %.3f s across jobs\n",
+            count, failed, frames, wall, wall > 0 ? frames / wall : 0.0,
+            stage_total[0], stage_total[1], stage_total[2]);
+
+    if (to_stdout && clips[0].state == VIDEO_JOB_DONE &&
+        send_file(clips[0].output_path, video_out) != 0) {
+        failed++;
+    }
+    for (int i = 0; i < count; i++) {
+        if (from_stdin) unlink(clips[i].input_path);
+        if (to_stdout) unlink(clips[i].output_path);
+        free(clips[i].input_path);
+        free(clips[i].output_path);
+    }
+    free(clips);
+    globfree(&matches);
+    if (video_out) fclose(video_out);
+
+    video_scheduler_destroy(sched);
+    if (checkpoints) video_checkpoints_destroy(checkpoints);
+    if (cache) video_cache_close(cache);
+    return failed ? 1 : 0;
+}
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "video_codec.h"
 
 // FFmpeg headers
@@ -9,21 +12,21 @@
 #include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
 
-int get_video_info(const char *filename, int *width, int *height, 
-                   long *num_frames, double *fps) {
+int get_video_info_ctx(VideoContext *ctx, const char *filename, int *width,
+                       int *height, long *num_frames, double *fps) {
     AVFormatContext *fmt_ctx = NULL;
     AVCodecParameters *codecpar = NULL;
     int video_stream_idx = -1;
 
     // Open input file
     if (avformat_open_input(&fmt_ctx, filename, NULL, NULL) < 0) {
-        fprintf(stderr, "Error: Could not open video file: %s\n", filename);
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not open video file: %s\n", filename);
         return -1;
     }
 
     // Retrieve stream information
     if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
-        fprintf(stderr, "Error: Could not find stream information\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not find stream information\n");
         avformat_close_input(&fmt_ctx);
         return -1;
     }
@@ -38,7 +41,7 @@ int get_video_info(const char *filename, int *width, int *height,
     }
 
     if (video_stream_idx == -1) {
-        fprintf(stderr, "Error: Could not find video stream\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not find video stream\n");
         avformat_close_input(&fmt_ctx);
         return -1;
     }
@@ -62,76 +65,268 @@ int get_video_info(const char *filename, int *width, int *height,
     return 0;
 }
 
-SVideo *decode_standard_video(const char *filename) {
-    AVFormatContext *fmt_ctx = NULL;
-    AVCodecContext *codec_ctx = NULL;
-    AVCodec *codec = NULL;
-    AVFrame *frame = NULL;
-    AVFrame *frame_rgb = NULL;
-    AVPacket *packet = NULL;
-    struct SwsContext *sws_ctx = NULL;
-    int video_stream_idx = -1;
-    SVideo *svideo = NULL;
+// Colour conversion flags; deterministic contexts skip the CPU-specific
+// SIMD paths, which round differently
+static int sws_flags(VideoContext *ctx) {
+    return video_ctx_deterministic(ctx) ? SWS_BILINEAR | SWS_BITEXACT | SWS_ACCURATE_RND
+                                        : SWS_BILINEAR;
+}
 
-    // Open input file
-    if (avformat_open_input(&fmt_ctx, filename, NULL, NULL) < 0) {
-        fprintf(stderr, "Error: Could not open video file: %s\n", filename);
-        return NULL;
+static void svideo_layout(SVideo *svideo, unsigned char *memory_block,
+                          size_t capacity, long first, long count) {
+    // Point frames [first, first + count) at their slots in a block sized
+    // for `capacity` frames: [Frame x cap][Channel x cap*C][data x cap*C]
+    size_t frame_size = (size_t)svideo->height * svideo->width;
+    unsigned char *channels_block = memory_block + capacity * sizeof(Frame);
+    unsigned char *data_block = channels_block +
+                                capacity * svideo->channels * sizeof(Channel);
+
+    svideo->frames = (Frame *)memory_block;
+    for (long f = first; f < first + count; f++) {
+        Frame *frame = &svideo->frames[f];
+        frame->channels = (Channel *)(channels_block +
+                                      f * svideo->channels * sizeof(Channel));
+        for (unsigned char c = 0; c < svideo->channels; c++) {
+            frame->channels[c].data = data_block +
+                                      (f * svideo->channels + c) * frame_size;
+            frame->channels[c].ref = NULL;
+        }
+    }
+}
+
+static unsigned char *svideo_grow(VideoContext *ctx, SVideo *svideo,
+                                  unsigned char *memory_block, size_t old_capacity,
+                                  size_t new_capacity, long frame_count) {
+    // The data region moves when the capacity changes, so copy the decoded
+    // planes into the new block and re-point every frame
+    size_t frame_size = (size_t)svideo->height * svideo->width;
+    size_t header_old = old_capacity * (sizeof(Frame) + svideo->channels * sizeof(Channel));
+    size_t header_new = new_capacity * (sizeof(Frame) + svideo->channels * sizeof(Channel));
+    size_t new_total = header_new + new_capacity * svideo->channels * frame_size;
+
+    unsigned char *new_block = (unsigned char *)video_ctx_alloc(ctx, new_total);
+    if (!new_block) return NULL;
+
+    memcpy(new_block + header_new, memory_block + header_old,
+           frame_count * svideo->channels * frame_size);
+    video_ctx_free(ctx, memory_block);
+    svideo_layout(svideo, new_block, new_capacity, 0, frame_count);
+    return new_block;
+}
+
+// Bytes FFmpeg reads or writes through custom I/O at a time
+#define IO_BUFFER_BYTES (64u << 10)
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+} MemoryInput;
+
+static int memory_read(void *opaque, uint8_t *buf, int size) {
+    MemoryInput *input = (MemoryInput *)opaque;
+    size_t left = input->size - input->pos;
+    if (!left) return AVERROR_EOF;
+    if ((size_t)size > left) size = (int)left;
+    memcpy(buf, input->data + input->pos, size);
+    input->pos += size;
+    return size;
+}
+
+static int64_t memory_seek(void *opaque, int64_t offset, int whence) {
+    MemoryInput *input = (MemoryInput *)opaque;
+    if (whence & AVSEEK_SIZE) return (int64_t)input->size;
+
+    int64_t base = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_CUR:
+        base = (int64_t)input->pos;
+        break;
+    case SEEK_END:
+        base = (int64_t)input->size;
+        break;
+    }
+    if (base + offset < 0 || base + offset > (int64_t)input->size) return AVERROR(EINVAL);
+    input->pos = (size_t)(base + offset);
+    return base + offset;
+}
+
+typedef struct {
+    VideoReadFn read_fn;
+    void *user;
+} CallbackInput;
+
+static int callback_read(void *opaque, uint8_t *buf, int size) {
+    CallbackInput *input = (CallbackInput *)opaque;
+    int n = input->read_fn(input->user, buf, size);
+    return n > 0 ? n : n == 0 ? AVERROR_EOF : AVERROR(EIO);
+}
+
+// FFmpeg 7 made the write callback's buffer const
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+#define AVIO_WRITE_CONST const
+#else
+#define AVIO_WRITE_CONST
+#endif
+
+// Custom I/O for reading (read_fn) or writing (write_fn)
+static AVIOContext *io_create(VideoContext *ctx, void *opaque,
+                              int (*read_fn)(void *, uint8_t *, int),
+                              int (*write_fn)(void *, AVIO_WRITE_CONST uint8_t *, int),
+                              int64_t (*seek_fn)(void *, int64_t, int)) {
+    unsigned char *buffer = (unsigned char *)av_malloc(IO_BUFFER_BYTES);
+    AVIOContext *io = buffer ? avio_alloc_context(buffer, IO_BUFFER_BYTES, write_fn != NULL,
+                                                  opaque, read_fn, write_fn, seek_fn) : NULL;
+    if (!io) {
+        av_free(buffer);
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not allocate I/O context\n");
+    }
+    return io;
+}
+
+// A file's first video stream, decoded and converted to out_format
+typedef struct {
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *codec_ctx;
+    AVFrame *frame;
+    AVPacket *packet;
+    struct SwsContext *sws_ctx;
+    AVIOContext *io;        // Custom input, NULL when reading a file by name
+    int stream_idx;
+} StreamDecoder;
+
+static void decoder_close(StreamDecoder *dec) {
+    if (dec->packet) av_packet_free(&dec->packet);
+    if (dec->frame) av_frame_free(&dec->frame);
+    if (dec->sws_ctx) sws_freeContext(dec->sws_ctx);
+    if (dec->codec_ctx) avcodec_free_context(&dec->codec_ctx);
+    if (dec->fmt_ctx) avformat_close_input(&dec->fmt_ctx);
+    // The demuxer leaves custom I/O, and the buffer it may have replaced,
+    // to the caller
+    if (dec->io) {
+        av_freep(&dec->io->buffer);
+        avio_context_free(&dec->io);
+    }
+}
+
+// Open a file by name, or read through io when it is not NULL (the decoder
+// takes it over; filename is then only used in messages)
+static int decoder_open(VideoContext *ctx, StreamDecoder *dec, const char *filename,
+                        AVIOContext *io, enum AVPixelFormat out_format) {
+    memset(dec, 0, sizeof(*dec));
+    dec->stream_idx = -1;
+    dec->io = io;
+    if (io) {
+        dec->fmt_ctx = avformat_alloc_context();
+        if (!dec->fmt_ctx) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not allocate format context\n");
+            goto fail;
+        }
+        dec->fmt_ctx->pb = io;
+        dec->fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    // Open input file; on failure this frees the format context
+    if (avformat_open_input(&dec->fmt_ctx, io ? NULL : filename, NULL, NULL) < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not open video file: %s\n", filename);
+        goto fail;
     }
 
     // Retrieve stream information
-    if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
-        fprintf(stderr, "Error: Could not find stream information\n");
-        goto cleanup;
+    if (avformat_find_stream_info(dec->fmt_ctx, NULL) < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not find stream information\n");
+        goto fail;
     }
 
     // Find video stream
-    for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++) {
-        if (fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            video_stream_idx = i;
+    for (unsigned int i = 0; i < dec->fmt_ctx->nb_streams; i++) {
+        if (dec->fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            dec->stream_idx = i;
             break;
         }
     }
 
-    if (video_stream_idx == -1) {
-        fprintf(stderr, "Error: Could not find video stream\n");
-        goto cleanup;
+    if (dec->stream_idx == -1) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not find video stream\n");
+        goto fail;
     }
 
     // Get codec parameters
-    AVCodecParameters *codecpar = fmt_ctx->streams[video_stream_idx]->codecpar;
-    
+    AVCodecParameters *codecpar = dec->fmt_ctx->streams[dec->stream_idx]->codecpar;
+
     // Find decoder
-    codec = avcodec_find_decoder(codecpar->codec_id);
+    const AVCodec *codec = avcodec_find_decoder(codecpar->codec_id);
     if (!codec) {
-        fprintf(stderr, "Error: Unsupported codec\n");
-        goto cleanup;
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Unsupported codec\n");
+        goto fail;
     }
 
     // Allocate codec context
-    codec_ctx = avcodec_alloc_context3(codec);
-    if (!codec_ctx) {
-        fprintf(stderr, "Error: Could not allocate codec context\n");
-        goto cleanup;
+    dec->codec_ctx = avcodec_alloc_context3(codec);
+    if (!dec->codec_ctx) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not allocate codec context\n");
+        goto fail;
     }
 
     // Copy codec parameters to context
-    if (avcodec_parameters_to_context(codec_ctx, codecpar) < 0) {
-        fprintf(stderr, "Error: Could not copy codec parameters\n");
-        goto cleanup;
+    if (avcodec_parameters_to_context(dec->codec_ctx, codecpar) < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not copy codec parameters\n");
+        goto fail;
+    }
+    if (video_ctx_deterministic(ctx)) {
+        dec->codec_ctx->thread_count = 1;
+        dec->codec_ctx->flags |= AV_CODEC_FLAG_BITEXACT;
     }
 
     // Open codec
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-        fprintf(stderr, "Error: Could not open codec\n");
-        goto cleanup;
+    if (avcodec_open2(dec->codec_ctx, codec, NULL) < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not open codec\n");
+        goto fail;
     }
 
-    // Allocate frames
-    frame = av_frame_alloc();
+    // Allocate frame and packet
+    dec->frame = av_frame_alloc();
+    dec->packet = av_packet_alloc();
+    if (!dec->frame || !dec->packet) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not allocate frames\n");
+        goto fail;
+    }
+
+    // Initialize SWScale context for color conversion
+    dec->sws_ctx = sws_getContext(dec->codec_ctx->width, dec->codec_ctx->height,
+                                  dec->codec_ctx->pix_fmt,
+                                  dec->codec_ctx->width, dec->codec_ctx->height, out_format,
+                                  sws_flags(ctx), NULL, NULL, NULL);
+    if (!dec->sws_ctx) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not initialize color conversion context\n");
+        goto fail;
+    }
+    return 0;
+
+fail:
+    decoder_close(dec);
+    return -1;
+}
+
+// Decode every frame of an opened decoder into an SVideo, then close it
+static SVideo *decode_all(VideoContext *ctx, StreamDecoder *opened, const char *filename) {
+    StreamDecoder dec = *opened;
+    AVFrame *frame_rgb = NULL;
+    uint8_t *buffer = NULL;
+    unsigned char *memory_block = NULL;
+    SVideo *svideo = NULL;
+    int failed = 1;
+
+    AVFormatContext *fmt_ctx = dec.fmt_ctx;
+    AVCodecContext *codec_ctx = dec.codec_ctx;
+    AVFrame *frame = dec.frame;
+    AVPacket *packet = dec.packet;
+    int video_stream_idx = dec.stream_idx;
+
+    // Allocate RGB frame
     frame_rgb = av_frame_alloc();
-    if (!frame || !frame_rgb) {
-        fprintf(stderr, "Error: Could not allocate frames\n");
+    if (!frame_rgb) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not allocate frames\n");
         goto cleanup;
     }
 
@@ -139,20 +334,15 @@ SVideo *decode_standard_video(const char *filename) {
     int num_bytes = av_image_get_buffer_size(AV_PIX_FMT_RGB24, 
                                               codec_ctx->width, 
                                               codec_ctx->height, 1);
-    uint8_t *buffer = (uint8_t *)av_malloc(num_bytes * sizeof(uint8_t));
+    buffer = (uint8_t *)av_malloc(num_bytes * sizeof(uint8_t));
+    if (!buffer) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not allocate RGB buffer\n");
+        goto cleanup;
+    }
 
     av_image_fill_arrays(frame_rgb->data, frame_rgb->linesize, buffer,
                         AV_PIX_FMT_RGB24, codec_ctx->width, codec_ctx->height, 1);
 
-    // Initialize SWScale context for color conversion
-    sws_ctx = sws_getContext(codec_ctx->width, codec_ctx->height, codec_ctx->pix_fmt,
-                             codec_ctx->width, codec_ctx->height, AV_PIX_FMT_RGB24,
-                             SWS_BILINEAR, NULL, NULL, NULL);
-    if (!sws_ctx) {
-        fprintf(stderr, "Error: Could not initialize color conversion context\n");
-        goto cleanup;
-    }
-
     // Get frame count
     long num_frames = fmt_ctx->streams[video_stream_idx]->nb_frames;
     if (num_frames == 0) {
@@ -168,9 +358,9 @@ SVideo *decode_standard_video(const char *filename) {
     }
 
     // Allocate SVideo structure
-    svideo = (SVideo *)malloc(sizeof(SVideo));
+    svideo = (SVideo *)video_ctx_alloc(ctx, sizeof(SVideo));
     if (!svideo) {
-        fprintf(stderr, "Error: Could not allocate SVideo\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not allocate SVideo\n");
         goto cleanup;
     }
 
@@ -179,42 +369,38 @@ SVideo *decode_standard_video(const char *filename) {
     svideo->height = codec_ctx->height;
     svideo->width = codec_ctx->width;
 
-    // Allocate memory for frames (we'll use a temporary buffer and reallocate)
+    // Allocate memory for frames, grown by doubling as we decode
     size_t frame_size = svideo->height * svideo->width;
-    size_t initial_capacity = num_frames > 0 ? num_frames : 1000;
+    size_t capacity = num_frames > 0 ? num_frames : 1000;
+    if (video_ctx_max_frames(ctx) && capacity > (size_t)video_ctx_max_frames(ctx)) {
+        capacity = video_ctx_max_frames(ctx);
+    }
     
-    size_t total_size = initial_capacity * sizeof(Frame) +
-                       initial_capacity * svideo->channels * sizeof(Channel) +
-                       initial_capacity * svideo->channels * frame_size;
+    size_t total_size = capacity * sizeof(Frame) +
+                       capacity * svideo->channels * sizeof(Channel) +
+                       capacity * svideo->channels * frame_size;
 
-    unsigned char *memory_block = (unsigned char *)malloc(total_size);
+    memory_block = (unsigned char *)video_ctx_alloc(ctx, total_size);
     if (!memory_block) {
-        fprintf(stderr, "Error: Could not allocate memory for frames\n");
-        free(svideo);
-        svideo = NULL;
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not allocate memory for frames\n");
         goto cleanup;
     }
-
     svideo->frames = (Frame *)memory_block;
-    unsigned char *channels_block = memory_block + initial_capacity * sizeof(Frame);
-    unsigned char *data_block = channels_block + 
-                                initial_capacity * svideo->channels * sizeof(Channel);
-
-    // Allocate packet
-    packet = av_packet_alloc();
-    if (!packet) {
-        fprintf(stderr, "Error: Could not allocate packet\n");
-        goto cleanup;
-    }
 
     // Decode frames
     long frame_count = 0;
     while (av_read_frame(fmt_ctx, packet) >= 0) {
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Decoding cancelled after %ld frames\n", frame_count);
+            av_packet_unref(packet);
+            goto cleanup;
+        }
+
         if (packet->stream_index == video_stream_idx) {
             // Send packet to decoder
             int ret = avcodec_send_packet(codec_ctx, packet);
             if (ret < 0) {
-                fprintf(stderr, "Error sending packet to decoder\n");
+                video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error sending packet to decoder\n");
                 break;
             }
 
@@ -224,45 +410,40 @@ SVideo *decode_standard_video(const char *filename) {
                 if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
                     break;
                 } else if (ret < 0) {
-                    fprintf(stderr, "Error during decoding\n");
+                    video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error during decoding\n");
+                    goto cleanup;
+                }
+
+                if (video_ctx_max_frames(ctx) && frame_count >= video_ctx_max_frames(ctx)) {
+                    video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Video exceeds the %ld frame limit\n",
+                                  video_ctx_max_frames(ctx));
                     goto cleanup;
                 }
 
                 // Check if we need to reallocate
-                if (frame_count >= (long)initial_capacity) {
-                    initial_capacity *= 2;
-                    size_t new_total_size = initial_capacity * sizeof(Frame) +
-                                           initial_capacity * svideo->channels * sizeof(Channel) +
-                                           initial_capacity * svideo->channels * frame_size;
-                    
-                    unsigned char *new_memory_block = (unsigned char *)realloc(memory_block, new_total_size);
-                    if (!new_memory_block) {
-                        fprintf(stderr, "Error: Could not reallocate memory\n");
+                if (frame_count >= (long)capacity) {
+                    unsigned char *new_block = svideo_grow(ctx, svideo, memory_block,
+                                                           capacity, capacity * 2,
+                                                           frame_count);
+                    if (!new_block) {
+                        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: Could not reallocate memory\n");
                         goto cleanup;
                     }
-                    
-                    memory_block = new_memory_block;
-                    svideo->frames = (Frame *)memory_block;
-                    channels_block = memory_block + initial_capacity * sizeof(Frame);
-                    data_block = channels_block + 
-                                initial_capacity * svideo->channels * sizeof(Channel);
+                    memory_block = new_block;
+                    capacity *= 2;
                 }
 
                 // Convert frame to RGB
-                sws_scale(sws_ctx, (const uint8_t * const *)frame->data,
+                sws_scale(dec.sws_ctx, (const uint8_t * const *)frame->data,
                          frame->linesize, 0, codec_ctx->height,
                          frame_rgb->data, frame_rgb->linesize);
 
                 // Set up frame structure
+                svideo_layout(svideo, memory_block, capacity, frame_count, 1);
                 Frame *current_frame = &svideo->frames[frame_count];
-                current_frame->channels = (Channel *)(channels_block + 
-                                         frame_count * svideo->channels * sizeof(Channel));
 
                 // Copy RGB data to separate channels
                 for (unsigned char c = 0; c < svideo->channels; c++) {
-                    current_frame->channels[c].data = data_block + 
-                                                     (frame_count * svideo->channels + c) * frame_size;
-                    
                     // Extract channel data from interleaved RGB
                     for (size_t y = 0; y < (size_t)svideo->height; y++) {
                         for (size_t x = 0; x < (size_t)svideo->width; x++) {
@@ -274,117 +455,301 @@ SVideo *decode_standard_video(const char *filename) {
                 }
 
                 frame_count++;
+                video_ctx_progress(ctx, VIDEO_STAGE_DECODE, frame_count,
+                                   frame_count > num_frames ? frame_count : num_frames);
             }
         }
         av_packet_unref(packet);
     }
 
     svideo->num_frames = frame_count;
-    printf("Decoded %ld frames from %s\n", frame_count, filename);
+    failed = 0;
+    video_ctx_count_decoded(ctx, frame_count);
+    video_ctx_log(ctx, VIDEO_LOG_INFO, "Decoded %ld frames from %s\n", frame_count, filename);
 
 cleanup:
-    if (packet) av_packet_free(&packet);
+    if (failed && svideo) {
+        video_ctx_free(ctx, memory_block);
+        video_ctx_free(ctx, svideo);
+        svideo = NULL;
+    }
     if (buffer) av_free(buffer);
     if (frame_rgb) av_frame_free(&frame_rgb);
-    if (frame) av_frame_free(&frame);
-    if (sws_ctx) sws_freeContext(sws_ctx);
-    if (codec_ctx) avcodec_free_context(&codec_ctx);
-    if (fmt_ctx) avformat_close_input(&fmt_ctx);
+    decoder_close(&dec);
 
     return svideo;
 }
 
-int encode_standard_video(const char *filename, const SVideo *video, 
-                         const char *codec_name, int fps) {
-    AVFormatContext *fmt_ctx = NULL;
-    AVCodecContext *codec_ctx = NULL;
-    AVCodec *codec = NULL;
-    AVStream *stream = NULL;
-    AVFrame *frame = NULL;
-    AVFrame *frame_yuv = NULL;
-    AVPacket *packet = NULL;
-    struct SwsContext *sws_ctx = NULL;
-    int ret = -1;
+SVideo *decode_standard_video_ctx(VideoContext *ctx, const char *filename) {
+    StreamDecoder dec;
+    if (decoder_open(ctx, &dec, filename, NULL, AV_PIX_FMT_RGB24) != 0) return NULL;
+    return decode_all(ctx, &dec, filename);
+}
 
-    if (!filename || !video || !codec_name) {
-        fprintf(stderr, "Invalid input to encode_standard_video\n");
-        return -1;
+SVideo *decode_standard_video_memory_ctx(VideoContext *ctx, const unsigned char *data,
+                                         size_t size) {
+    if (!data) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to decode_standard_video_memory\n");
+        return NULL;
     }
+    MemoryInput input = {data, size, 0};
+    AVIOContext *io = io_create(ctx, &input, memory_read, NULL, memory_seek);
+    StreamDecoder dec;
+    if (!io || decoder_open(ctx, &dec, "(memory)", io, AV_PIX_FMT_RGB24) != 0) return NULL;
+    return decode_all(ctx, &dec, "(memory)");
+}
 
-    // Allocate output format context
-    avformat_alloc_output_context2(&fmt_ctx, NULL, NULL, filename);
-    if (!fmt_ctx) {
-        fprintf(stderr, "Could not create output context\n");
-        return -1;
+SVideo *decode_standard_video_stream_ctx(VideoContext *ctx, VideoReadFn read_fn, void *user) {
+    if (!read_fn) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to decode_standard_video_stream\n");
+        return NULL;
+    }
+    CallbackInput input = {read_fn, user};
+    AVIOContext *io = io_create(ctx, &input, callback_read, NULL, NULL);
+    StreamDecoder dec;
+    if (!io || decoder_open(ctx, &dec, "(stream)", io, AV_PIX_FMT_RGB24) != 0) return NULL;
+    return decode_all(ctx, &dec, "(stream)");
+}
+
+// An output file with one video stream, encoded from YUV420P frames
+typedef struct {
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *codec_ctx;
+    AVStream *stream;
+    AVPacket *packet;
+    AVIOContext *io;        // Custom output, NULL when writing a file by name
+    long frames;            // Frames sent so far, the pts of the next
+} StreamEncoder;
+
+// Where and how an encoder writes; NULL for a regular file by name
+typedef struct {
+    AVIOContext *io;            // Custom output, taken over by the encoder
+    double fragment_seconds;    // > 0 for fragmented MP4 with GOPs this long
+    double segment_seconds;     // > 0 for GOPs, and HLS/DASH segments, this long
+    long bit_rate;              // 0 for 4 Mbps
+    int threads;                // Codec threads, 0 for the codec's default
+    int fast;                   // 1 for the codec's fastest settings, for previews
+} EncoderOutput;
+
+// Fragments start at keyframes; an empty moov up front makes the file
+// playable from the first fragment, and base-moof offsets are what CMAF
+// and MSE players expect
+#define FRAGMENT_MOVFLAGS "frag_keyframe+empty_moov+default_base_moof"
+
+static void encoder_close(StreamEncoder *enc) {
+    if (enc->packet) av_packet_free(&enc->packet);
+    if (enc->codec_ctx) avcodec_free_context(&enc->codec_ctx);
+    if (enc->fmt_ctx) {
+        if (!enc->io && !(enc->fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&enc->fmt_ctx->pb);
+        }
+        avformat_free_context(enc->fmt_ctx);
+    }
+    if (enc->io) {
+        av_freep(&enc->io->buffer);
+        avio_context_free(&enc->io);
+    }
+}
+
+static int encoder_open(VideoContext *ctx, StreamEncoder *enc, const char *filename,
+                        const EncoderOutput *out, const char *codec_name, int fps,
+                        int width, int height) {
+    memset(enc, 0, sizeof(*enc));
+    int fragmented = out && out->fragment_seconds > 0;
+    enc->io = out ? out->io : NULL;
+    AVDictionary *muxer_opts = NULL;
+
+    // Allocate output format context; custom output has no name to guess from
+    avformat_alloc_output_context2(&enc->fmt_ctx, NULL, fragmented ? "mp4" : NULL,
+                                   enc->io ? NULL : filename);
+    if (!enc->fmt_ctx) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not create output context\n");
+        goto fail;
     }
 
     // Find encoder
-    codec = avcodec_find_encoder_by_name(codec_name);
+    const AVCodec *codec = avcodec_find_encoder_by_name(codec_name);
     if (!codec) {
-        fprintf(stderr, "Codec '%s' not found\n", codec_name);
-        goto cleanup;
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Codec '%s' not found\n", codec_name);
+        goto fail;
     }
 
     // Create stream
-    stream = avformat_new_stream(fmt_ctx, NULL);
-    if (!stream) {
-        fprintf(stderr, "Could not create stream\n");
-        goto cleanup;
+    enc->stream = avformat_new_stream(enc->fmt_ctx, NULL);
+    if (!enc->stream) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not create stream\n");
+        goto fail;
     }
 
     // Allocate codec context
-    codec_ctx = avcodec_alloc_context3(codec);
+    AVCodecContext *codec_ctx = avcodec_alloc_context3(codec);
+    enc->codec_ctx = codec_ctx;
     if (!codec_ctx) {
-        fprintf(stderr, "Could not allocate codec context\n");
-        goto cleanup;
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not allocate codec context\n");
+        goto fail;
     }
 
     // Set codec parameters
-    codec_ctx->width = video->width;
-    codec_ctx->height = video->height;
+    codec_ctx->width = width;
+    codec_ctx->height = height;
     codec_ctx->time_base = (AVRational){1, fps};
     codec_ctx->framerate = (AVRational){fps, 1};
     codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    codec_ctx->bit_rate = 4000000; // 4 Mbps
+    codec_ctx->bit_rate = out && out->bit_rate > 0 ? out->bit_rate : 4000000; // 4 Mbps
+    double gop_seconds = fragmented ? out->fragment_seconds : out ? out->segment_seconds : 0;
+    if (gop_seconds > 0) {
+        // A keyframe, and so a fragment or segment, at least this often
+        int gop = (int)(fps * gop_seconds + 0.5);
+        codec_ctx->gop_size = gop > 0 ? gop : 1;
+    }
+    if (out && out->threads > 0) codec_ctx->thread_count = out->threads;
 
     // Some formats require global headers
-    if (fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+    if (enc->fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
         codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
+    // Single-threaded so rate control sees frames in one order, and no
+    // encoder or muxer version strings in the file
+    if (video_ctx_deterministic(ctx)) {
+        codec_ctx->thread_count = 1;
+        codec_ctx->flags |= AV_CODEC_FLAG_BITEXACT;
+        enc->fmt_ctx->flags |= AVFMT_FLAG_BITEXACT;
+    }
+
+    // Speed over size: no B-frames, and the fastest preset of encoders
+    // that have one (options a codec lacks are left unused)
+    AVDictionary *codec_opts = NULL;
+    if (out && out->fast) {
+        codec_ctx->max_b_frames = 0;
+        av_dict_set(&codec_opts, "preset", "ultrafast", 0);
+        av_dict_set(&codec_opts, "tune", "zerolatency", 0);
+    }
+
     // Open codec
-    if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
-        fprintf(stderr, "Could not open codec\n");
-        goto cleanup;
+    int opened = avcodec_open2(codec_ctx, codec, &codec_opts);
+    av_dict_free(&codec_opts);
+    if (opened < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not open codec\n");
+        goto fail;
     }
 
     // Copy codec parameters to stream
-    if (avcodec_parameters_from_context(stream->codecpar, codec_ctx) < 0) {
-        fprintf(stderr, "Could not copy codec parameters\n");
-        goto cleanup;
+    if (avcodec_parameters_from_context(enc->stream->codecpar, codec_ctx) < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not copy codec parameters\n");
+        goto fail;
     }
 
-    stream->time_base = codec_ctx->time_base;
+    enc->stream->time_base = codec_ctx->time_base;
 
     // Open output file
-    if (!(fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-        if (avio_open(&fmt_ctx->pb, filename, AVIO_FLAG_WRITE) < 0) {
-            fprintf(stderr, "Could not open output file '%s'\n", filename);
-            goto cleanup;
+    if (enc->io) {
+        enc->fmt_ctx->pb = enc->io;
+        enc->fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    } else if (!(enc->fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+        if (avio_open(&enc->fmt_ctx->pb, filename, AVIO_FLAG_WRITE) < 0) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not open output file '%s'\n", filename);
+            goto fail;
+        }
+    }
+
+    // Each fragment goes out as soon as it is complete rather than when
+    // the I/O buffer fills
+    if (fragmented) {
+        av_dict_set(&muxer_opts, "movflags", FRAGMENT_MOVFLAGS, 0);
+        enc->fmt_ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+    } else if (out && out->segment_seconds > 0) {
+        // Playlist outputs (chosen by the .m3u8 or .mpd extension) cut
+        // segments at the keyframes above
+        char seconds[32];
+        snprintf(seconds, sizeof(seconds), "%g", out->segment_seconds);
+        if (strcmp(enc->fmt_ctx->oformat->name, "hls") == 0) {
+            av_dict_set(&muxer_opts, "hls_time", seconds, 0);
+            av_dict_set(&muxer_opts, "hls_playlist_type", "vod", 0);
+        } else if (strcmp(enc->fmt_ctx->oformat->name, "dash") == 0) {
+            av_dict_set(&muxer_opts, "seg_duration", seconds, 0);
         }
     }
 
     // Write header
-    if (avformat_write_header(fmt_ctx, NULL) < 0) {
-        fprintf(stderr, "Error writing header\n");
-        goto cleanup;
+    if (avformat_write_header(enc->fmt_ctx, &muxer_opts) < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error writing header\n");
+        goto fail;
+    }
+    av_dict_free(&muxer_opts);
+
+    // Allocate packet
+    enc->packet = av_packet_alloc();
+    if (!enc->packet) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not allocate packet\n");
+        goto fail;
+    }
+    return 0;
+
+fail:
+    av_dict_free(&muxer_opts);
+    encoder_close(enc);
+    return -1;
+}
+
+// Encode the next frame, or flush the encoder when frame is NULL, and
+// write the packets that come out
+static int encoder_send(VideoContext *ctx, StreamEncoder *enc, AVFrame *frame) {
+    if (frame) frame->pts = enc->frames++;
+    int ret = avcodec_send_frame(enc->codec_ctx, frame);
+    if (ret < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error sending frame to encoder\n");
+        return -1;
     }
 
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(enc->codec_ctx, enc->packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            break;
+        } else if (ret < 0) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error encoding frame\n");
+            return -1;
+        }
+
+        // Write packet
+        av_packet_rescale_ts(enc->packet, enc->codec_ctx->time_base, enc->stream->time_base);
+        enc->packet->stream_index = enc->stream->index;
+
+        ret = av_interleaved_write_frame(enc->fmt_ctx, enc->packet);
+        av_packet_unref(enc->packet);
+
+        if (ret < 0) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error writing frame\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Flush the encoder and write the trailer
+static int encoder_finish(VideoContext *ctx, StreamEncoder *enc) {
+    if (encoder_send(ctx, enc, NULL) != 0) return -1;
+    if (av_write_trailer(enc->fmt_ctx) < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error writing trailer\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Encode every frame of a video with an opened encoder, then close it
+static int encode_all(VideoContext *ctx, StreamEncoder *opened, const SVideo *video,
+                      const char *filename) {
+    StreamEncoder enc = *opened;
+    AVFrame *frame = NULL;
+    AVFrame *frame_yuv = NULL;
+    struct SwsContext *sws_ctx = NULL;
+    int ret = -1;
+
     // Allocate frames
     frame = av_frame_alloc();
     frame_yuv = av_frame_alloc();
     if (!frame || !frame_yuv) {
-        fprintf(stderr, "Could not allocate frames\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not allocate frames\n");
         goto cleanup;
     }
 
@@ -392,36 +757,35 @@ int encode_standard_video(const char *filename, const SVideo *video,
     frame->width = video->width;
     frame->height = video->height;
 
-    frame_yuv->format = codec_ctx->pix_fmt;
+    frame_yuv->format = enc.codec_ctx->pix_fmt;
     frame_yuv->width = video->width;
     frame_yuv->height = video->height;
 
     // Allocate buffers
     if (av_frame_get_buffer(frame, 0) < 0 || 
         av_frame_get_buffer(frame_yuv, 0) < 0) {
-        fprintf(stderr, "Could not allocate frame data\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not allocate frame data\n");
         goto cleanup;
     }
 
     // Initialize SWScale context
     sws_ctx = sws_getContext(video->width, video->height, AV_PIX_FMT_RGB24,
-                             video->width, video->height, codec_ctx->pix_fmt,
-                             SWS_BILINEAR, NULL, NULL, NULL);
+                             video->width, video->height, enc.codec_ctx->pix_fmt,
+                             sws_flags(ctx), NULL, NULL, NULL);
     if (!sws_ctx) {
-        fprintf(stderr, "Could not initialize conversion context\n");
-        goto cleanup;
-    }
-
-    // Allocate packet
-    packet = av_packet_alloc();
-    if (!packet) {
-        fprintf(stderr, "Could not allocate packet\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not initialize conversion context\n");
         goto cleanup;
     }
 
     // Encode frames
     for (long frame_idx = 0; frame_idx < video->num_frames; frame_idx++) {
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Encoding cancelled after %ld frames\n", frame_idx);
+            goto cleanup;
+        }
+
         av_frame_make_writable(frame);
+        av_frame_make_writable(frame_yuv);
 
         // Convert from planar RGB to interleaved RGB
         for (int y = 0; y < video->height; y++) {
@@ -441,64 +805,1380 @@ int encode_standard_video(const char *filename, const SVideo *video,
                  frame->linesize, 0, video->height,
                  frame_yuv->data, frame_yuv->linesize);
 
-        frame_yuv->pts = frame_idx;
+        if (encoder_send(ctx, &enc, frame_yuv) != 0) goto cleanup;
 
-        // Encode frame
-        ret = avcodec_send_frame(codec_ctx, frame_yuv);
-        if (ret < 0) {
-            fprintf(stderr, "Error sending frame to encoder\n");
-            goto cleanup;
+        video_ctx_progress(ctx, VIDEO_STAGE_ENCODE, frame_idx + 1, video->num_frames);
+    }
+
+    if (encoder_finish(ctx, &enc) != 0) goto cleanup;
+    ret = 0;
+    video_ctx_count_encoded(ctx, video->num_frames);
+    video_ctx_log(ctx, VIDEO_LOG_INFO, "Encoded %ld frames to %s\n", video->num_frames, filename);
+
+cleanup:
+    if (frame) av_frame_free(&frame);
+    if (frame_yuv) av_frame_free(&frame_yuv);
+    if (sws_ctx) sws_freeContext(sws_ctx);
+    encoder_close(&enc);
+
+    return ret;
+}
+
+int encode_standard_video_ctx(VideoContext *ctx, const char *filename,
+                             const SVideo *video, const char *codec_name, int fps) {
+    if (!filename || !video || !codec_name) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to encode_standard_video\n");
+        return -1;
+    }
+
+    StreamEncoder enc;
+    if (encoder_open(ctx, &enc, filename, NULL, codec_name, fps,
+                     video->width, video->height) != 0) {
+        return -1;
+    }
+    return encode_all(ctx, &enc, video, filename);
+}
+
+int encode_preview_video_ctx(VideoContext *ctx, const char *filename, const SVideo *video,
+                             const char *codec_name, int fps) {
+    if (!filename || !video || !codec_name || fps <= 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to encode_preview_video\n");
+        return -1;
+    }
+
+    EncoderOutput out = {NULL, 0.0, 0.0, 0, 0, 1};
+    StreamEncoder enc;
+    if (encoder_open(ctx, &enc, filename, &out, codec_name, fps,
+                     video->width, video->height) != 0) {
+        return -1;
+    }
+    return encode_all(ctx, &enc, video, filename);
+}
+
+// Fragment length when the caller passes 0
+#define DEFAULT_FRAGMENT_SECONDS 1.0
+
+int encode_fragmented_video_ctx(VideoContext *ctx, const char *filename, const SVideo *video,
+                                const char *codec_name, int fps, double fragment_seconds) {
+    if (!filename || !video || !codec_name || fps <= 0 || fragment_seconds < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to encode_fragmented_video\n");
+        return -1;
+    }
+
+    EncoderOutput out = {NULL, fragment_seconds ? fragment_seconds : DEFAULT_FRAGMENT_SECONDS,
+                         0.0, 0, 0, 0};
+    StreamEncoder enc;
+    if (encoder_open(ctx, &enc, filename, &out, codec_name, fps,
+                     video->width, video->height) != 0) {
+        return -1;
+    }
+    return encode_all(ctx, &enc, video, filename);
+}
+
+typedef struct {
+    VideoWriteFn write_fn;
+    void *user;
+} CallbackOutput;
+
+static int callback_write(void *opaque, AVIO_WRITE_CONST uint8_t *buf, int size) {
+    CallbackOutput *output = (CallbackOutput *)opaque;
+    return output->write_fn(output->user, buf, size) < 0 ? AVERROR(EIO) : size;
+}
+
+int encode_fragmented_video_stream_ctx(VideoContext *ctx, VideoWriteFn write_fn, void *user,
+                                       const SVideo *video, const char *codec_name, int fps,
+                                       double fragment_seconds) {
+    if (!write_fn || !video || !codec_name || fps <= 0 || fragment_seconds < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to encode_fragmented_video_stream\n");
+        return -1;
+    }
+
+    CallbackOutput output = {write_fn, user};
+    EncoderOutput out = {io_create(ctx, &output, NULL, callback_write, NULL),
+                         fragment_seconds ? fragment_seconds : DEFAULT_FRAGMENT_SECONDS,
+                         0.0, 0, 0, 0};
+    if (!out.io) return -1;
+    StreamEncoder enc;
+    if (encoder_open(ctx, &enc, "(stream)", &out, codec_name, fps,
+                     video->width, video->height) != 0) {
+        return -1;
+    }
+    return encode_all(ctx, &enc, video, "(stream)");
+}
+
+/*
+ * Renditions: one processed video encoded at several sizes in one pass.
+ * Each frame is converted from planar RGB to YUV420P once, at the largest
+ * size, and every smaller size is scaled from the one above it (1080p to
+ * 720p to 360p), so a rendition costs a small YUV downscale on top of its
+ * encode. Every encoder runs on its own thread, with the context's codec
+ * threads shared out by area, and takes frames from a ring of slots that
+ * the converting thread fills ahead of the slowest encoder.
+ */
+
+// Frames each rendition keeps in flight between conversion and encoding
+#define RENDITION_RING 4
+
+// Keyframe interval, and segment length for playlists, when the caller passes 0
+#define DEFAULT_SEGMENT_SECONDS 4.0
+
+// Bit rate for a rendition without one: 4 Mbps at the source size,
+// scaled by area, but not below the floor
+#define RENDITION_BIT_RATE 4000000.0
+#define RENDITION_MIN_BIT_RATE 250000
+
+typedef struct RenditionLadder RenditionLadder;
+
+typedef struct {
+    RenditionLadder *ladder;
+    const VideoRendition *spec;
+    int width;
+    int height;
+    long bit_rate;
+    StreamEncoder enc;
+    int opened;
+    struct SwsContext *sws;         // From the level above, or from RGB for the first
+    AVFrame *slots[RENDITION_RING];
+    pthread_t thread;
+    int started;
+    long encoded;                   // Frames sent to the encoder
+    int result;
+} RenditionLevel;
+
+struct RenditionLadder {
+    VideoContext *ctx;
+    RenditionLevel *levels;         // Largest first
+    int count;
+    long num_frames;
+    long produced;                  // Frames converted at every level
+    int stop;                       // Set on error or cancellation
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static int compare_level(const void *a, const void *b) {
+    const RenditionLevel *la = (const RenditionLevel *)a;
+    const RenditionLevel *lb = (const RenditionLevel *)b;
+    long area_a = (long)la->width * la->height;
+    long area_b = (long)lb->width * lb->height;
+    return (area_a < area_b) - (area_a > area_b);
+}
+
+static void ladder_stop(RenditionLadder *ladder) {
+    pthread_mutex_lock(&ladder->lock);
+    ladder->stop = 1;
+    pthread_cond_broadcast(&ladder->changed);
+    pthread_mutex_unlock(&ladder->lock);
+}
+
+// Encoder thread: sends each frame as soon as its slot is filled
+static void *rendition_thread(void *arg) {
+    RenditionLevel *level = (RenditionLevel *)arg;
+    RenditionLadder *ladder = level->ladder;
+
+    for (long k = 0; k < ladder->num_frames; k++) {
+        pthread_mutex_lock(&ladder->lock);
+        while (ladder->produced <= k && !ladder->stop) {
+            pthread_cond_wait(&ladder->changed, &ladder->lock);
         }
+        int stop = ladder->stop;
+        pthread_mutex_unlock(&ladder->lock);
+        if (stop) return NULL;
 
-        while (ret >= 0) {
-            ret = avcodec_receive_packet(codec_ctx, packet);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            } else if (ret < 0) {
-                fprintf(stderr, "Error encoding frame\n");
-                goto cleanup;
+        int ok = encoder_send(ladder->ctx, &level->enc, level->slots[k % RENDITION_RING]) == 0;
+
+        pthread_mutex_lock(&ladder->lock);
+        if (ok) level->encoded = k + 1; else ladder->stop = 1;
+        pthread_cond_broadcast(&ladder->changed);
+        pthread_mutex_unlock(&ladder->lock);
+        if (!ok) return NULL;
+    }
+
+    if (encoder_finish(ladder->ctx, &level->enc) != 0) {
+        ladder_stop(ladder);
+        return NULL;
+    }
+    level->result = 0;
+    return NULL;
+}
+
+// Wait until every encoder has taken the frame that last used frame k's
+// slot; returns 0 if the ladder was stopped instead
+static int ladder_wait_slot(RenditionLadder *ladder, long k) {
+    pthread_mutex_lock(&ladder->lock);
+    for (;;) {
+        long slowest = ladder->num_frames;
+        for (int i = 0; i < ladder->count; i++) {
+            if (ladder->levels[i].encoded < slowest) slowest = ladder->levels[i].encoded;
+        }
+        if (ladder->stop || slowest > k - RENDITION_RING) break;
+        pthread_cond_wait(&ladder->changed, &ladder->lock);
+    }
+    int stop = ladder->stop;
+    pthread_mutex_unlock(&ladder->lock);
+    return !stop;
+}
+
+// Convert frame k at every level, each from the one above
+static void ladder_fill(RenditionLadder *ladder, const SVideo *video, AVFrame *rgb, long k,
+                        int gop) {
+    for (int y = 0; y < video->height; y++) {
+        unsigned char *row = rgb->data[0] + (size_t)y * rgb->linesize[0];
+        size_t pixel_idx = (size_t)y * video->width;
+        for (int x = 0; x < video->width; x++) {
+            for (int c = 0; c < 3; c++) {
+                row[x * 3 + c] = video->frames[k].channels[c].data[pixel_idx + x];
+            }
+        }
+    }
+
+    const AVFrame *src = rgb;
+    int src_height = video->height;
+    for (int i = 0; i < ladder->count; i++) {
+        RenditionLevel *level = &ladder->levels[i];
+        AVFrame *dst = level->slots[k % RENDITION_RING];
+        av_frame_make_writable(dst);
+        sws_scale(level->sws, (const uint8_t * const *)src->data, src->linesize, 0,
+                  src_height, dst->data, dst->linesize);
+        // Keyframes at the same frames in every rendition, so players can
+        // switch between them at any segment boundary
+        dst->pict_type = k % gop == 0 ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+        src = dst;
+        src_height = level->height;
+    }
+}
+
+// Size, bit rate, converter and frames of each level; the levels are in
+// ladder order
+static int ladder_setup(RenditionLadder *ladder, const SVideo *video, const char *codec_name,
+                        int fps, double segment_seconds) {
+    VideoContext *ctx = ladder->ctx;
+    double source_area = (double)video->width * video->height;
+    double total_area = 0.0;
+    for (int i = 0; i < ladder->count; i++) {
+        total_area += (double)ladder->levels[i].width * ladder->levels[i].height;
+    }
+    int threads = video_ctx_threads(ctx, (size_t)(source_area * 3) * video->num_frames);
+
+    for (int i = 0; i < ladder->count; i++) {
+        RenditionLevel *level = &ladder->levels[i];
+        double area = (double)level->width * level->height;
+        level->bit_rate = level->spec->bit_rate;
+        if (level->bit_rate <= 0) {
+            level->bit_rate = (long)(RENDITION_BIT_RATE * area / source_area);
+            if (level->bit_rate < RENDITION_MIN_BIT_RATE) level->bit_rate = RENDITION_MIN_BIT_RATE;
+        }
+
+        int level_threads = (int)(threads * area / total_area + 0.5);
+        EncoderOutput out = {NULL, 0.0, segment_seconds, level->bit_rate,
+                             level_threads > 0 ? level_threads : 1, 0};
+        if (encoder_open(ctx, &level->enc, level->spec->filename, &out, codec_name, fps,
+                         level->width, level->height) != 0) {
+            return -1;
+        }
+        level->opened = 1;
+
+        if (i == 0) {
+            level->sws = sws_getContext(video->width, video->height, AV_PIX_FMT_RGB24,
+                                        level->width, level->height, AV_PIX_FMT_YUV420P,
+                                        sws_flags(ctx), NULL, NULL, NULL);
+        } else {
+            const RenditionLevel *above = &ladder->levels[i - 1];
+            level->sws = sws_getContext(above->width, above->height, AV_PIX_FMT_YUV420P,
+                                        level->width, level->height, AV_PIX_FMT_YUV420P,
+                                        sws_flags(ctx), NULL, NULL, NULL);
+        }
+        if (!level->sws) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not initialize conversion context\n");
+            return -1;
+        }
+
+        for (int s = 0; s < RENDITION_RING; s++) {
+            AVFrame *frame = av_frame_alloc();
+            level->slots[s] = frame;
+            if (!frame) {
+                video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not allocate frames\n");
+                return -1;
+            }
+            frame->format = AV_PIX_FMT_YUV420P;
+            frame->width = level->width;
+            frame->height = level->height;
+            if (av_frame_get_buffer(frame, 0) < 0) {
+                video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not allocate frame data\n");
+                return -1;
             }
+        }
+    }
+    return 0;
+}
+
+static int write_master_playlist(VideoContext *ctx, const RenditionLadder *ladder,
+                                 const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        video_ctx_log_errno(ctx, "Error opening master playlist");
+        return -1;
+    }
+    fprintf(file, "#EXTM3U\n#EXT-X-VERSION:3\n");
+    for (int i = 0; i < ladder->count; i++) {
+        const RenditionLevel *level = &ladder->levels[i];
+        const char *name = strrchr(level->spec->filename, '/');
+        fprintf(file, "#EXT-X-STREAM-INF:BANDWIDTH=%ld,RESOLUTION=%dx%d\n%s\n",
+                level->bit_rate, level->width, level->height,
+                name ? name + 1 : level->spec->filename);
+    }
+    if (fclose(file) != 0) {
+        video_ctx_log_errno(ctx, "Error writing master playlist");
+        return -1;
+    }
+    return 0;
+}
 
-            // Write packet
-            av_packet_rescale_ts(packet, codec_ctx->time_base, stream->time_base);
-            packet->stream_index = stream->index;
+int encode_standard_video_renditions_ctx(VideoContext *ctx, const SVideo *video,
+                                         const VideoRendition *renditions, int count,
+                                         const char *codec_name, int fps,
+                                         double segment_seconds, const char *master_playlist) {
+    if (!video || !renditions || count <= 0 || !codec_name || fps <= 0 ||
+        segment_seconds < 0 || video->width <= 0 || video->height <= 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to encode_standard_video_renditions\n");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!renditions[i].filename) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR,
+                          "Invalid input to encode_standard_video_renditions\n");
+            return -1;
+        }
+    }
+    if (segment_seconds == 0) segment_seconds = DEFAULT_SEGMENT_SECONDS;
+
+    RenditionLadder ladder;
+    memset(&ladder, 0, sizeof(ladder));
+    ladder.ctx = ctx;
+    ladder.count = count;
+    ladder.num_frames = video->num_frames;
+    ladder.levels = (RenditionLevel *)calloc(count, sizeof(RenditionLevel));
+    if (!ladder.levels) {
+        video_ctx_log_errno(ctx, "Error allocating renditions");
+        return -1;
+    }
+
+    // Never upscale; scaled sizes keep the aspect ratio, rounded to the
+    // even sizes YUV420P needs
+    for (int i = 0; i < count; i++) {
+        RenditionLevel *level = &ladder.levels[i];
+        level->ladder = &ladder;
+        level->spec = &renditions[i];
+        level->result = -1;
+        int height = renditions[i].height;
+        if (height <= 0 || height >= video->height) {
+            level->width = video->width;
+            level->height = video->height;
+        } else {
+            level->height = height < 2 ? 2 : height & ~1;
+            level->width = (int)((long)video->width * level->height / video->height + 1) & ~1;
+            if (level->width < 2) level->width = 2;
+        }
+    }
+    qsort(ladder.levels, count, sizeof(RenditionLevel), compare_level);
+
+    AVFrame *rgb = av_frame_alloc();
+    int ret = -1;
+    if (!rgb) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not allocate frames\n");
+        goto cleanup;
+    }
+    rgb->format = AV_PIX_FMT_RGB24;
+    rgb->width = video->width;
+    rgb->height = video->height;
+    if (av_frame_get_buffer(rgb, 0) < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Could not allocate frame data\n");
+        goto cleanup;
+    }
+    if (ladder_setup(&ladder, video, codec_name, fps, segment_seconds) != 0) goto cleanup;
+
+    pthread_mutex_init(&ladder.lock, NULL);
+    pthread_cond_init(&ladder.changed, NULL);
+    int ok = 1;
+    for (int i = 0; i < count && ok; i++) {
+        ok = pthread_create(&ladder.levels[i].thread, NULL, rendition_thread,
+                            &ladder.levels[i]) == 0;
+        if (ok) ladder.levels[i].started = 1;
+        else video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error starting rendition encoder thread\n");
+    }
 
-            ret = av_interleaved_write_frame(fmt_ctx, packet);
+    int gop = (int)(fps * segment_seconds + 0.5);
+    if (gop < 1) gop = 1;
+    for (long k = 0; ok && k < video->num_frames; k++) {
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Encoding cancelled after %ld frames\n", k);
+            ok = 0;
+        } else if (!ladder_wait_slot(&ladder, k)) {
+            ok = 0;
+        } else {
+            ladder_fill(&ladder, video, rgb, k, gop);
+            pthread_mutex_lock(&ladder.lock);
+            ladder.produced = k + 1;
+            pthread_cond_broadcast(&ladder.changed);
+            pthread_mutex_unlock(&ladder.lock);
+            video_ctx_progress(ctx, VIDEO_STAGE_ENCODE, k + 1, video->num_frames);
+        }
+    }
+    if (!ok) ladder_stop(&ladder);
+
+    for (int i = 0; i < count; i++) {
+        if (ladder.levels[i].started) pthread_join(ladder.levels[i].thread, NULL);
+        if (ladder.levels[i].result != 0) ok = 0;
+    }
+    pthread_cond_destroy(&ladder.changed);
+    pthread_mutex_destroy(&ladder.lock);
+
+    if (ok && master_playlist && write_master_playlist(ctx, &ladder, master_playlist) != 0) {
+        ok = 0;
+    }
+    if (ok) {
+        ret = 0;
+        video_ctx_count_encoded(ctx, video->num_frames * count);
+        video_ctx_log(ctx, VIDEO_LOG_INFO, "Encoded %ld frames to %d renditions\n",
+                      video->num_frames, count);
+    }
+
+cleanup:
+    for (int i = 0; i < count; i++) {
+        RenditionLevel *level = &ladder.levels[i];
+        if (level->opened) encoder_close(&level->enc);
+        if (level->sws) sws_freeContext(level->sws);
+        for (int s = 0; s < RENDITION_RING; s++) {
+            if (level->slots[s]) av_frame_free(&level->slots[s]);
+        }
+    }
+    if (rgb) av_frame_free(&rgb);
+    free(ladder.levels);
+    return ret;
+}
+
+/*
+ * Reverse transcode, a GOP at a time. An index pass reads the packets
+ * (not decoding them) for the keyframes and the timestamp of every frame.
+ * The GOPs are then cut into segments of at most as many frames as fit a
+ * buffer, and a decoder thread works through the segments from the end of
+ * the video: it seeks to the segment's keyframe, decodes up to the end of
+ * the segment and keeps its frames, already converted to the encoder's
+ * YUV420P. Two buffers alternate, so the previous segment is decoded while
+ * the encoder takes this one's frames last to first. A GOP longer than a
+ * buffer is decoded once per segment, trading decode time for memory.
+ */
+
+// Bytes of decoded frames per buffer; two are in use
+#define GOP_BUFFER_BYTES (128u << 20)
+
+typedef struct {
+    int64_t start;          // Timestamp of the keyframe, first in display order
+    int64_t end;            // Start of the next GOP, INT64_MAX for the last
+    int64_t seek_ts;        // Timestamp to seek to for the keyframe
+    long frames;
+} StreamGop;
+
+typedef struct {
+    long gop;
+    long first;             // Frames [first, first + count) of the GOP in display order
+    long count;
+} ReverseSegment;
+
+typedef struct {
+    VideoContext *ctx;
+    StreamDecoder dec;
+    StreamGop *gops;
+    ReverseSegment *segments;
+    long num_segments;
+    size_t frame_bytes;
+    unsigned char *buffers[2];
+    long filled[2];         // Frames decoded into each buffer
+    int full[2];            // Buffer holds a segment not yet encoded
+    int stop;               // Set by the encoder to end the decoder early
+    int failed;             // Set by the decoder on error
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ReverseTranscode;
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_gop(const void *a, const void *b) {
+    return compare_int64(&((const StreamGop *)a)->start, &((const StreamGop *)b)->start);
+}
+
+static size_t yuv_frame_bytes(int width, int height) {
+    int bytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 1);
+    return bytes > 0 ? (size_t)bytes : 0;
+}
+
+static long segment_frames(size_t frame_bytes) {
+    long frames = frame_bytes ? (long)(GOP_BUFFER_BYTES / frame_bytes) : 1;
+    return frames < 1 ? 1 : frames;
+}
+
+size_t reverse_standard_video_memory(int width, int height, long num_frames) {
+    size_t frame_bytes = yuv_frame_bytes(width, height);
+    long frames = segment_frames(frame_bytes);
+    if (num_frames > 0 && frames > num_frames) frames = num_frames;
+    return 2 * frames * frame_bytes;
+}
+
+// Index pass: the GOPs of the stream and their frame counts. Returns the
+// number of GOPs, 0 if the stream cannot be indexed (no keyframes or no
+// timestamps) or -1 on error.
+static long index_gops(VideoContext *ctx, StreamDecoder *dec, StreamGop **gops_out,
+                       long *total_frames) {
+    StreamGop *gops = NULL;
+    int64_t *stamps = NULL;
+    long num_gops = 0, gop_capacity = 0;
+    long num_stamps = 0, stamp_capacity = 0;
+    long result = -1;
+
+    while (av_read_frame(dec->fmt_ctx, dec->packet) >= 0) {
+        AVPacket *packet = dec->packet;
+        if (packet->stream_index != dec->stream_idx) {
             av_packet_unref(packet);
+            continue;
+        }
+        int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        int64_t seek_ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : ts;
+        int key = packet->flags & AV_PKT_FLAG_KEY;
+        av_packet_unref(packet);
+        if (ts == AV_NOPTS_VALUE) {
+            result = 0;
+            goto cleanup;
+        }
 
+        if (num_stamps == stamp_capacity) {
+            stamp_capacity = stamp_capacity ? 2 * stamp_capacity : 1024;
+            int64_t *grown = (int64_t *)video_ctx_realloc(ctx, stamps,
+                                                          stamp_capacity * sizeof(int64_t));
+            if (!grown) goto cleanup;
+            stamps = grown;
+        }
+        stamps[num_stamps++] = ts;
+
+        if (key) {
+            if (num_gops == gop_capacity) {
+                gop_capacity = gop_capacity ? 2 * gop_capacity : 64;
+                StreamGop *grown = (StreamGop *)video_ctx_realloc(
+                    ctx, gops, gop_capacity * sizeof(StreamGop));
+                if (!grown) goto cleanup;
+                gops = grown;
+            }
+            gops[num_gops].start = ts;
+            gops[num_gops].seek_ts = seek_ts;
+            gops[num_gops].frames = 0;
+            num_gops++;
+        }
+    }
+    if (!num_gops) {
+        result = 0;
+        goto cleanup;
+    }
+
+    // A GOP holds the frames displayed from its keyframe to the next one,
+    // including the leading frames of an open GOP that are stored after it
+    qsort(gops, num_gops, sizeof(StreamGop), compare_gop);
+    qsort(stamps, num_stamps, sizeof(int64_t), compare_int64);
+    for (long g = 0; g < num_gops; g++) {
+        gops[g].end = g + 1 < num_gops ? gops[g + 1].start : INT64_MAX;
+    }
+    long g = 0;
+    *total_frames = 0;
+    for (long i = 0; i < num_stamps; i++) {
+        if (stamps[i] < gops[0].start) continue;
+        while (stamps[i] >= gops[g].end) g++;
+        gops[g].frames++;
+        (*total_frames)++;
+    }
+    if (num_stamps > *total_frames) {
+        video_ctx_log(ctx, VIDEO_LOG_INFO, "Dropping %ld frames before the first keyframe\n",
+                      num_stamps - *total_frames);
+    }
+
+    *gops_out = gops;
+    gops = NULL;
+    result = num_gops;
+
+cleanup:
+    if (result < 0) video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error allocating GOP index\n");
+    video_ctx_free(ctx, gops);
+    video_ctx_free(ctx, stamps);
+    return result;
+}
+
+// Convert a decoded frame into its slot of a buffer
+static void store_yuv(ReverseTranscode *rt, const AVFrame *frame, unsigned char *slot) {
+    AVCodecContext *codec_ctx = rt->dec.codec_ctx;
+    uint8_t *data[4];
+    int linesize[4];
+    av_image_fill_arrays(data, linesize, slot, AV_PIX_FMT_YUV420P,
+                         codec_ctx->width, codec_ctx->height, 1);
+    sws_scale(rt->dec.sws_ctx, (const uint8_t * const *)frame->data, frame->linesize, 0,
+              codec_ctx->height, data, linesize);
+}
+
+// Decode one segment into a buffer; returns the number of frames stored,
+// or -1 on error
+static long decode_segment(ReverseTranscode *rt, const ReverseSegment *segment,
+                           unsigned char *buffer) {
+    StreamDecoder *dec = &rt->dec;
+    const StreamGop *gop = &rt->gops[segment->gop];
+    if (av_seek_frame(dec->fmt_ctx, dec->stream_idx, gop->seek_ts, AVSEEK_FLAG_BACKWARD) < 0) {
+        video_ctx_log(rt->ctx, VIDEO_LOG_ERROR, "Error seeking to keyframe\n");
+        return -1;
+    }
+    avcodec_flush_buffers(dec->codec_ctx);
+
+    long index = 0;         // Frames of the GOP seen, in display order
+    long stored = 0;
+    int draining = 0;
+    while (index < segment->first + segment->count) {
+        if (!draining) {
+            int ret = av_read_frame(dec->fmt_ctx, dec->packet);
+            if (ret >= 0 && dec->packet->stream_index != dec->stream_idx) {
+                av_packet_unref(dec->packet);
+                continue;
+            }
+            draining = ret < 0;
+            ret = avcodec_send_packet(dec->codec_ctx, draining ? NULL : dec->packet);
+            if (!draining) av_packet_unref(dec->packet);
             if (ret < 0) {
-                fprintf(stderr, "Error writing frame\n");
-                goto cleanup;
+                video_ctx_log(rt->ctx, VIDEO_LOG_ERROR, "Error sending packet to decoder\n");
+                return -1;
             }
         }
+
+        int ret;
+        while ((ret = avcodec_receive_frame(dec->codec_ctx, dec->frame)) == 0) {
+            AVFrame *frame = dec->frame;
+            int64_t ts = frame->best_effort_timestamp != AV_NOPTS_VALUE ?
+                         frame->best_effort_timestamp : frame->pts;
+            // Leading frames of an open GOP belong to the previous one
+            if (ts != AV_NOPTS_VALUE && ts < gop->start) continue;
+            if (ts != AV_NOPTS_VALUE && ts >= gop->end) return stored;
+            if (index >= segment->first) {
+                store_yuv(rt, frame, buffer + stored * rt->frame_bytes);
+                stored++;
+            }
+            if (++index == segment->first + segment->count) return stored;
+        }
+        if (ret == AVERROR_EOF || (draining && ret == AVERROR(EAGAIN))) return stored;
+        if (ret != AVERROR(EAGAIN)) {
+            video_ctx_log(rt->ctx, VIDEO_LOG_ERROR, "Error during decoding\n");
+            return -1;
+        }
     }
+    return stored;
+}
 
-    // Flush encoder
-    avcodec_send_frame(codec_ctx, NULL);
-    while (avcodec_receive_packet(codec_ctx, packet) == 0) {
-        av_packet_rescale_ts(packet, codec_ctx->time_base, stream->time_base);
-        packet->stream_index = stream->index;
-        av_interleaved_write_frame(fmt_ctx, packet);
-        av_packet_unref(packet);
+// Decoder thread: fills the two buffers alternately with segments from the
+// end of the video, each as soon as the encoder has emptied it
+static void *reverse_decode_thread(void *arg) {
+    ReverseTranscode *rt = (ReverseTranscode *)arg;
+
+    for (long s = 0; s < rt->num_segments; s++) {
+        int slot = s & 1;
+        pthread_mutex_lock(&rt->lock);
+        while (rt->full[slot] && !rt->stop) {
+            pthread_cond_wait(&rt->changed, &rt->lock);
+        }
+        int stop = rt->stop;
+        pthread_mutex_unlock(&rt->lock);
+        if (stop) break;
+
+        long stored = decode_segment(rt, &rt->segments[s], rt->buffers[slot]);
+
+        pthread_mutex_lock(&rt->lock);
+        if (stored >= 0) {
+            rt->filled[slot] = stored;
+            rt->full[slot] = 1;
+        } else {
+            rt->failed = 1;
+        }
+        pthread_cond_broadcast(&rt->changed);
+        pthread_mutex_unlock(&rt->lock);
+        if (stored < 0) break;
     }
+    return NULL;
+}
 
-    // Write trailer
-    av_write_trailer(fmt_ctx);
-    ret = 0;
-    printf("Encoded %ld frames to %s\n", video->num_frames, filename);
+// Encode the decoder thread's segments as they arrive, each last frame
+// first; returns the number of frames encoded, or -1
+static long encode_segments(ReverseTranscode *rt, StreamEncoder *enc, AVFrame *view,
+                            long total_frames) {
+    VideoContext *ctx = rt->ctx;
+    long encoded = 0;
+    for (long s = 0; s < rt->num_segments; s++) {
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Reverse cancelled after %ld frames\n", encoded);
+            return -1;
+        }
+
+        int slot = s & 1;
+        pthread_mutex_lock(&rt->lock);
+        while (!rt->full[slot] && !rt->failed) {
+            pthread_cond_wait(&rt->changed, &rt->lock);
+        }
+        int failed = !rt->full[slot];
+        long filled = rt->filled[slot];
+        pthread_mutex_unlock(&rt->lock);
+        if (failed) return -1;
+
+        // The encoder copies frames it keeps, as the view is not reference
+        // counted, so the buffer is free once the segment is sent
+        for (long i = filled - 1; i >= 0; i--) {
+            av_image_fill_arrays(view->data, view->linesize,
+                                 rt->buffers[slot] + i * rt->frame_bytes,
+                                 AV_PIX_FMT_YUV420P, view->width, view->height, 1);
+            if (encoder_send(ctx, enc, view) != 0) return -1;
+            encoded++;
+            video_ctx_progress(ctx, VIDEO_STAGE_ENCODE, encoded,
+                               encoded > total_frames ? encoded : total_frames);
+        }
+
+        pthread_mutex_lock(&rt->lock);
+        rt->full[slot] = 0;
+        pthread_cond_broadcast(&rt->changed);
+        pthread_mutex_unlock(&rt->lock);
+    }
+    return encoded;
+}
+
+// Cut the GOPs into segments no larger than a buffer, in the order they
+// are encoded: last GOP first, and within a GOP its last frames first
+static ReverseSegment *plan_segments(VideoContext *ctx, const StreamGop *gops, long num_gops,
+                                     long max_frames, long *num_segments) {
+    long count = 0;
+    for (long g = 0; g < num_gops; g++) {
+        count += (gops[g].frames + max_frames - 1) / max_frames;
+    }
+    ReverseSegment *segments = (ReverseSegment *)video_ctx_alloc(
+        ctx, (count ? count : 1) * sizeof(ReverseSegment));
+    if (!segments) return NULL;
+
+    long s = 0;
+    for (long g = num_gops - 1; g >= 0; g--) {
+        for (long last = gops[g].frames; last > 0; last -= max_frames) {
+            long first = last > max_frames ? last - max_frames : 0;
+            segments[s].gop = g;
+            segments[s].first = first;
+            segments[s].count = last - first;
+            s++;
+        }
+    }
+    *num_segments = count;
+    return segments;
+}
+
+// Reverse through memory, for streams that cannot be indexed
+static int reverse_in_memory(VideoContext *ctx, const char *input, const char *output,
+                             const char *codec_name, int fps) {
+    SVideo *video = decode_standard_video_ctx(ctx, input);
+    if (!video) return -1;
+    reverse_S_ctx(ctx, video);
+    int result = encode_standard_video_ctx(ctx, output, video, codec_name, fps);
+    free_video_S_ctx(ctx, video);
+    return result;
+}
+
+int reverse_standard_video_ctx(VideoContext *ctx, const char *input, const char *output,
+                               const char *codec_name, int fps) {
+    if (!input || !output || !codec_name || fps <= 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to reverse_standard_video\n");
+        return -1;
+    }
+
+    ReverseTranscode rt;
+    memset(&rt, 0, sizeof(rt));
+    rt.ctx = ctx;
+    if (decoder_open(ctx, &rt.dec, input, NULL, AV_PIX_FMT_YUV420P) != 0) return -1;
+
+    long total_frames = 0;
+    long num_gops = index_gops(ctx, &rt.dec, &rt.gops, &total_frames);
+    if (num_gops <= 0) {
+        decoder_close(&rt.dec);
+        if (num_gops < 0) return -1;
+        video_ctx_log(ctx, VIDEO_LOG_INFO, "No keyframe index in %s, reversing in memory\n", input);
+        return reverse_in_memory(ctx, input, output, codec_name, fps);
+    }
+
+    int width = rt.dec.codec_ctx->width;
+    int height = rt.dec.codec_ctx->height;
+    rt.frame_bytes = yuv_frame_bytes(width, height);
+    long max_gop = 0;
+    for (long g = 0; g < num_gops; g++) {
+        if (rt.gops[g].frames > max_gop) max_gop = rt.gops[g].frames;
+    }
+    long max_frames = segment_frames(rt.frame_bytes);
+    if (max_gop > 0 && max_frames > max_gop) max_frames = max_gop;
+
+    StreamEncoder enc;
+    AVFrame *view = NULL;
+    long encoded = -1;
+    int threaded = 0;
+    pthread_t thread;
+    pthread_mutex_init(&rt.lock, NULL);
+    pthread_cond_init(&rt.changed, NULL);
+
+    rt.segments = plan_segments(ctx, rt.gops, num_gops, max_frames, &rt.num_segments);
+    rt.buffers[0] = (unsigned char *)video_ctx_alloc(ctx, max_frames * rt.frame_bytes);
+    rt.buffers[1] = (unsigned char *)video_ctx_alloc(ctx, max_frames * rt.frame_bytes);
+    view = av_frame_alloc();
+    if (!rt.segments || !rt.buffers[0] || !rt.buffers[1] || !view) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error allocating reverse buffers\n");
+        goto cleanup;
+    }
+    view->format = AV_PIX_FMT_YUV420P;
+    view->width = width;
+    view->height = height;
+
+    if (encoder_open(ctx, &enc, output, NULL, codec_name, fps, width, height) != 0) goto cleanup;
+
+    if (pthread_create(&thread, NULL, reverse_decode_thread, &rt) != 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error starting reverse decoder thread\n");
+    } else {
+        threaded = 1;
+        encoded = encode_segments(&rt, &enc, view, total_frames);
+    }
+
+    if (threaded) {
+        pthread_mutex_lock(&rt.lock);
+        rt.stop = 1;
+        pthread_cond_broadcast(&rt.changed);
+        pthread_mutex_unlock(&rt.lock);
+        pthread_join(thread, NULL);
+    }
+    if (encoded >= 0 && encoder_finish(ctx, &enc) != 0) encoded = -1;
+    encoder_close(&enc);
 
 cleanup:
-    if (packet) av_packet_free(&packet);
-    if (frame) av_frame_free(&frame);
-    if (frame_yuv) av_frame_free(&frame_yuv);
-    if (sws_ctx) sws_freeContext(sws_ctx);
-    if (codec_ctx) avcodec_free_context(&codec_ctx);
-    if (fmt_ctx) {
-        if (!(fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-            avio_closep(&fmt_ctx->pb);
+    if (view) av_frame_free(&view);
+    video_ctx_free(ctx, rt.buffers[0]);
+    video_ctx_free(ctx, rt.buffers[1]);
+    video_ctx_free(ctx, rt.segments);
+    video_ctx_free(ctx, rt.gops);
+    pthread_cond_destroy(&rt.changed);
+    pthread_mutex_destroy(&rt.lock);
+    decoder_close(&rt.dec);
+    if (encoded < 0) return -1;
+
+    video_ctx_count_decoded(ctx, encoded);
+    video_ctx_count_encoded(ctx, encoded);
+    video_ctx_log(ctx, VIDEO_LOG_INFO, "Reversed %ld frames of %s in %ld segments\n",
+                  encoded, input, rt.num_segments);
+    return 0;
+}
+
+/*
+ * Random access for scrubbing. A frame server keeps recently used inputs
+ * open, each with the GOP index the reverse builds and the position of its
+ * decoder, plus an LRU cache of frames converted to RGB24. A frame is
+ * served from the cache; failing that, by decoding on from the decoder's
+ * position when it lies ahead in the same GOP (playback); and otherwise by
+ * seeking to its keyframe and decoding forward. The frames just before it,
+ * which the seek decodes anyway, are cached too for scrubbing backwards.
+ */
+
+// Frames before the requested one cached on the way to it
+#define SCRUB_BEHIND 16
+
+#define SERVER_DEFAULT_CACHE (256u << 20)
+#define SERVER_DEFAULT_OPEN 4
+
+typedef struct LruNode {
+    struct LruNode *prev;   // Towards the most recently used
+    struct LruNode *next;
+} LruNode;
+
+typedef struct {
+    LruNode *head;          // Most recently used
+    LruNode *tail;
+} LruList;
+
+// What identifies a version of a file, so replacing it invalidates its
+// cached frames and open decoders
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+} FileStamp;
+
+typedef struct {
+    LruNode node;
+    char *path;
+    FileStamp stamp;
+    int opened;             // Decoder and index ready
+    int busy;               // In use by a request
+    StreamDecoder dec;
+    StreamGop *gops;
+    long *gop_first;        // Index of each GOP's first frame
+    long num_gops;
+    long num_frames;
+    long pos_gop;           // GOP the decoder is in, -1 if it must seek
+    long pos_index;         // Frames of that GOP it has returned
+    int draining;
+} ServerFile;
+
+typedef struct {
+    LruNode node;
+    char *path;
+    FileStamp stamp;
+    long index;
+    unsigned char *rgb;
+    size_t bytes;
+} ServerFrame;
+
+struct VideoFrameServer {
+    VideoContext *ctx;      // Allocator for cached frames, error reporting
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // A file was released
+    size_t cache_budget;
+    size_t cache_total;
+    int max_open;
+    int num_open;
+    LruList files;
+    LruList frames;
+};
+
+static void lru_unlink(LruList *list, LruNode *node) {
+    if (node->prev) node->prev->next = node->next; else list->head = node->next;
+    if (node->next) node->next->prev = node->prev; else list->tail = node->prev;
+    node->prev = node->next = NULL;
+}
+
+static void lru_push_front(LruList *list, LruNode *node) {
+    node->prev = NULL;
+    node->next = list->head;
+    if (list->head) list->head->prev = node; else list->tail = node;
+    list->head = node;
+}
+
+static int file_stamp(const char *path, FileStamp *stamp) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    stamp->dev = st.st_dev;
+    stamp->ino = st.st_ino;
+    stamp->size = st.st_size;
+    stamp->mtime = st.st_mtime;
+    return 0;
+}
+
+static int stamp_equal(const FileStamp *a, const FileStamp *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size && a->mtime == b->mtime;
+}
+
+static ServerFrame *frame_find(VideoFrameServer *server, const char *path,
+                               const FileStamp *stamp, long index) {
+    for (LruNode *node = server->frames.head; node; node = node->next) {
+        ServerFrame *frame = (ServerFrame *)node;
+        if (frame->index == index && stamp_equal(&frame->stamp, stamp) &&
+            strcmp(frame->path, path) == 0) {
+            return frame;
         }
-        avformat_free_context(fmt_ctx);
     }
+    return NULL;
+}
 
-    return ret;
-}
\ No newline at end of file
+// Call with the lock held
+static void frame_drop(VideoFrameServer *server, ServerFrame *frame) {
+    lru_unlink(&server->frames, &frame->node);
+    server->cache_total -= frame->bytes;
+    video_ctx_free(server->ctx, frame->rgb);
+    free(frame->path);
+    free(frame);
+}
+
+// Take ownership of a converted frame and cache it, evicting the least
+// recently used frames to stay in budget
+static void frame_insert(VideoFrameServer *server, const ServerFile *file, long index,
+                         unsigned char *rgb, size_t bytes) {
+    pthread_mutex_lock(&server->lock);
+    ServerFrame *frame = NULL;
+    if (!frame_find(server, file->path, &file->stamp, index)) {
+        frame = (ServerFrame *)calloc(1, sizeof(ServerFrame));
+        if (frame && !(frame->path = strdup(file->path))) {
+            free(frame);
+            frame = NULL;
+        }
+    }
+    if (frame) {
+        while (server->frames.tail && server->cache_total + bytes > server->cache_budget) {
+            frame_drop(server, (ServerFrame *)server->frames.tail);
+        }
+        frame->stamp = file->stamp;
+        frame->index = index;
+        frame->rgb = rgb;
+        frame->bytes = bytes;
+        lru_push_front(&server->frames, &frame->node);
+        server->cache_total += bytes;
+    }
+    pthread_mutex_unlock(&server->lock);
+    if (!frame) video_ctx_free(server->ctx, rgb);
+}
+
+static void file_close(VideoFrameServer *server, ServerFile *file) {
+    decoder_close(&file->dec);
+    video_ctx_free(server->ctx, file->gops);
+    video_ctx_free(server->ctx, file->gop_first);
+    free(file->path);
+    free(file);
+}
+
+// Call with the lock held
+static void file_drop(VideoFrameServer *server, ServerFile *file) {
+    lru_unlink(&server->files, &file->node);
+    server->num_open--;
+    file_close(server, file);
+}
+
+// Copy the frame from the cache into rgb (returns 1), or claim an idle
+// entry for the file, waiting while requests for it use every entry, or a
+// new one for the caller to open (returns 0); -1 on error. Call with the
+// lock held; index -1 skips the cache.
+static int server_claim(VideoFrameServer *server, const char *path, const FileStamp *stamp,
+                        long index, unsigned char *rgb, size_t size, ServerFile **claimed) {
+    for (;;) {
+        ServerFrame *frame = index >= 0 ? frame_find(server, path, stamp, index) : NULL;
+        if (frame) {
+            if (frame->bytes > size) {
+                video_ctx_log(server->ctx, VIDEO_LOG_ERROR,
+                              "Error: frame buffer of %zu bytes is too small, %zu needed\n",
+                              size, frame->bytes);
+                return -1;
+            }
+            memcpy(rgb, frame->rgb, frame->bytes);
+            lru_unlink(&server->frames, &frame->node);
+            lru_push_front(&server->frames, &frame->node);
+            return 1;
+        }
+
+        int in_use = 0;
+        for (LruNode *node = server->files.head; node;) {
+            ServerFile *file = (ServerFile *)node;
+            node = node->next;
+            if (strcmp(file->path, path) != 0) continue;
+            if (!stamp_equal(&file->stamp, stamp)) {
+                // Replaced on disk since it was opened
+                if (!file->busy) file_drop(server, file);
+                continue;
+            }
+            if (file->busy) {
+                in_use = 1;
+                continue;
+            }
+            file->busy = 1;
+            lru_unlink(&server->files, &file->node);
+            lru_push_front(&server->files, &file->node);
+            *claimed = file;
+            return 0;
+        }
+        if (!in_use) break;
+        pthread_cond_wait(&server->changed, &server->lock);
+    }
+
+    ServerFile *file = (ServerFile *)calloc(1, sizeof(ServerFile));
+    if (!file || !(file->path = strdup(path))) {
+        free(file);
+        video_ctx_log(server->ctx, VIDEO_LOG_ERROR, "Error allocating frame server entry\n");
+        return -1;
+    }
+    file->stamp = *stamp;
+    file->busy = 1;
+    file->pos_gop = -1;
+    lru_push_front(&server->files, &file->node);
+    server->num_open++;
+
+    // Close the least recently used idle inputs over the limit
+    for (LruNode *node = server->files.tail; node && server->num_open > server->max_open;) {
+        ServerFile *victim = (ServerFile *)node;
+        node = node->prev;
+        if (!victim->busy) file_drop(server, victim);
+    }
+    *claimed = file;
+    return 0;
+}
+
+static void server_release(VideoFrameServer *server, ServerFile *file) {
+    pthread_mutex_lock(&server->lock);
+    file->busy = 0;
+    if (!file->opened) file_drop(server, file);
+    pthread_cond_broadcast(&server->changed);
+    pthread_mutex_unlock(&server->lock);
+}
+
+// Open a claimed entry's decoder and index its keyframes
+static int file_open(VideoFrameServer *server, ServerFile *file) {
+    VideoContext *ctx = server->ctx;
+    if (decoder_open(ctx, &file->dec, file->path, NULL, AV_PIX_FMT_RGB24) != 0) return -1;
+
+    long num_frames = 0;
+    file->num_gops = index_gops(ctx, &file->dec, &file->gops, &num_frames);
+    if (file->num_gops == 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: %s has no keyframe index to seek in\n",
+                      file->path);
+    }
+    if (file->num_gops > 0) {
+        file->gop_first = (long *)video_ctx_alloc(ctx, file->num_gops * sizeof(long));
+        if (!file->gop_first) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error allocating GOP index\n");
+        }
+    }
+    if (!file->gop_first) {
+        file->num_gops = 0;
+        return -1;
+    }
+
+    long first = 0;
+    for (long g = 0; g < file->num_gops; g++) {
+        file->gop_first[g] = first;
+        first += file->gops[g].frames;
+    }
+    file->num_frames = num_frames;
+    file->opened = 1;
+    return 0;
+}
+
+static void convert_rgb(StreamDecoder *dec, const AVFrame *frame, unsigned char *rgb) {
+    uint8_t *data[4];
+    int linesize[4];
+    av_image_fill_arrays(data, linesize, rgb, AV_PIX_FMT_RGB24,
+                         dec->codec_ctx->width, dec->codec_ctx->height, 1);
+    sws_scale(dec->sws_ctx, (const uint8_t * const *)frame->data, frame->linesize, 0,
+              dec->codec_ctx->height, data, linesize);
+}
+
+// Decode frame index of a claimed, open file into rgb
+static int file_decode(VideoFrameServer *server, ServerFile *file, long index,
+                       unsigned char *rgb) {
+    VideoContext *ctx = server->ctx;
+    StreamDecoder *dec = &file->dec;
+    size_t bytes = (size_t)dec->codec_ctx->width * dec->codec_ctx->height * 3;
+
+    // The frame's GOP is the last one starting at or before it
+    long lo = 0, hi = file->num_gops - 1;
+    while (lo < hi) {
+        long mid = (lo + hi + 1) / 2;
+        if (file->gop_first[mid] <= index) lo = mid; else hi = mid - 1;
+    }
+    const StreamGop *gop = &file->gops[lo];
+    long offset = index - file->gop_first[lo];
+
+    if (file->pos_gop != lo || file->pos_index > offset) {
+        if (av_seek_frame(dec->fmt_ctx, dec->stream_idx, gop->seek_ts, AVSEEK_FLAG_BACKWARD) < 0) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error seeking to keyframe\n");
+            file->pos_gop = -1;
+            return -1;
+        }
+        avcodec_flush_buffers(dec->codec_ctx);
+        file->pos_gop = lo;
+        file->pos_index = 0;
+        file->draining = 0;
+    }
+
+    long decoded = 0;
+    int result = -1;
+    for (;;) {
+        int ret = avcodec_receive_frame(dec->codec_ctx, dec->frame);
+        if (ret == 0) {
+            AVFrame *frame = dec->frame;
+            int64_t ts = frame->best_effort_timestamp != AV_NOPTS_VALUE ?
+                         frame->best_effort_timestamp : frame->pts;
+            // Leading frames of an open GOP belong to the previous one
+            if (ts != AV_NOPTS_VALUE && ts < gop->start) continue;
+            if (ts != AV_NOPTS_VALUE && ts >= gop->end) break;
+            decoded++;
+            long at = file->pos_index++;
+            if (at < offset - SCRUB_BEHIND) continue;
+
+            unsigned char *cached = bytes <= server->cache_budget ?
+                                    (unsigned char *)video_ctx_alloc(ctx, bytes) : NULL;
+            if (at == offset) {
+                convert_rgb(dec, frame, rgb);
+                if (cached) memcpy(cached, rgb, bytes);
+            } else if (cached) {
+                convert_rgb(dec, frame, cached);
+            }
+            if (cached) frame_insert(server, file, file->gop_first[lo] + at, cached, bytes);
+            if (at == offset) {
+                result = 0;
+                break;
+            }
+            continue;
+        }
+        if (ret == AVERROR(EAGAIN) && !file->draining) {
+            ret = av_read_frame(dec->fmt_ctx, dec->packet);
+            if (ret >= 0 && dec->packet->stream_index != dec->stream_idx) {
+                av_packet_unref(dec->packet);
+                continue;
+            }
+            file->draining = ret < 0;
+            ret = avcodec_send_packet(dec->codec_ctx, file->draining ? NULL : dec->packet);
+            if (!file->draining) av_packet_unref(dec->packet);
+            if (ret >= 0) continue;
+        }
+        break;
+    }
+
+    video_ctx_count_decoded(ctx, decoded);
+    if (result != 0) {
+        file->pos_gop = -1;
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error: could not decode frame %ld of %s\n",
+                      index, file->path);
+    }
+    return result;
+}
+
+VideoFrameServer *video_frame_server_create(VideoContext *ctx, size_t cache_bytes,
+                                            int max_open) {
+    VideoFrameServer *server = (VideoFrameServer *)calloc(1, sizeof(VideoFrameServer));
+    if (!server) {
+        perror("Error allocating VideoFrameServer");
+        return NULL;
+    }
+    server->ctx = ctx ? ctx : video_default_context();
+    server->cache_budget = cache_bytes ? cache_bytes : SERVER_DEFAULT_CACHE;
+    server->max_open = max_open > 0 ? max_open : SERVER_DEFAULT_OPEN;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->changed, NULL);
+    return server;
+}
+
+void video_frame_server_destroy(VideoFrameServer *server) {
+    if (!server) return;
+    while (server->frames.head) frame_drop(server, (ServerFrame *)server->frames.head);
+    while (server->files.head) file_drop(server, (ServerFile *)server->files.head);
+    pthread_cond_destroy(&server->changed);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+}
+
+// Claim and if need be open the file; returns 1 when the frame came from
+// the cache, 0 with *claimed set, -1 on error
+static int server_acquire(VideoFrameServer *server, const char *filename, long index,
+                          unsigned char *rgb, size_t size, ServerFile **claimed) {
+    FileStamp stamp;
+    if (file_stamp(filename, &stamp) != 0) {
+        video_ctx_log_errno(server->ctx, "Error opening file");
+        return -1;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    int found = server_claim(server, filename, &stamp, index, rgb, size, claimed);
+    pthread_mutex_unlock(&server->lock);
+    if (found != 0) return found;
+
+    if (!(*claimed)->opened && file_open(server, *claimed) != 0) {
+        server_release(server, *claimed);
+        return -1;
+    }
+    return 0;
+}
+
+int video_frame_server_info(VideoFrameServer *server, const char *filename, int *width,
+                            int *height, long *num_frames, double *fps) {
+    if (!server || !filename || !width || !height || !num_frames || !fps) return -1;
+
+    ServerFile *file;
+    if (server_acquire(server, filename, -1, NULL, 0, &file) != 0) return -1;
+    StreamDecoder *dec = &file->dec;
+    AVRational rate = dec->fmt_ctx->streams[dec->stream_idx]->avg_frame_rate;
+    *width = dec->codec_ctx->width;
+    *height = dec->codec_ctx->height;
+    *num_frames = file->num_frames;
+    *fps = rate.den ? (double)rate.num / rate.den : 0.0;
+    server_release(server, file);
+    return 0;
+}
+
+int video_frame_server_get(VideoFrameServer *server, const char *filename, long index,
+                           unsigned char *rgb, size_t size) {
+    if (!server || !filename || !rgb || index < 0) {
+        if (server) {
+            video_ctx_log(server->ctx, VIDEO_LOG_ERROR,
+                          "Invalid input to video_frame_server_get function.\n");
+        }
+        return -1;
+    }
+
+    ServerFile *file;
+    int found = server_acquire(server, filename, index, rgb, size, &file);
+    if (found != 0) return found > 0 ? 0 : -1;
+
+    int result = -1;
+    size_t bytes = (size_t)file->dec.codec_ctx->width * file->dec.codec_ctx->height * 3;
+    if (size < bytes) {
+        video_ctx_log(server->ctx, VIDEO_LOG_ERROR,
+                      "Error: frame buffer of %zu bytes is too small, %zu needed\n", size, bytes);
+    } else if (index >= file->num_frames) {
+        video_ctx_log(server->ctx, VIDEO_LOG_ERROR, "Error: %s has %ld frames, not %ld\n",
+                      filename, file->num_frames, index + 1);
+    } else {
+        result = file_decode(server, file, index, rgb);
+    }
+    server_release(server, file);
+    return result;
+}
+
+// Default-context API, kept for existing callers
+
+int get_video_info(const char *filename, int *width, int *height,
+                   long *num_frames, double *fps) {
+    return get_video_info_ctx(video_default_context(), filename, width, height,
+                              num_frames, fps);
+}
+
+SVideo *decode_standard_video(const char *filename) {
+    return decode_standard_video_ctx(video_default_context(), filename);
+}
+
+SVideo *decode_standard_video_memory(const unsigned char *data, size_t size) {
+    return decode_standard_video_memory_ctx(video_default_context(), data, size);
+}
+
+SVideo *decode_standard_video_stream(VideoReadFn read_fn, void *user) {
+    return decode_standard_video_stream_ctx(video_default_context(), read_fn, user);
+}
+
+int encode_standard_video(const char *filename, const SVideo *video,
+                          const char *codec_name, int fps) {
+    return encode_standard_video_ctx(video_default_context(), filename, video,
+                                     codec_name, fps);
+}
+
+int encode_preview_video(const char *filename, const SVideo *video, const char *codec_name,
+                         int fps) {
+    return encode_preview_video_ctx(video_default_context(), filename, video, codec_name, fps);
+}
+
+int encode_fragmented_video(const char *filename, const SVideo *video, const char *codec_name,
+                            int fps, double fragment_seconds) {
+    return encode_fragmented_video_ctx(video_default_context(), filename, video, codec_name,
+                                       fps, fragment_seconds);
+}
+
+int encode_fragmented_video_stream(VideoWriteFn write_fn, void *user, const SVideo *video,
+                                   const char *codec_name, int fps, double fragment_seconds) {
+    return encode_fragmented_video_stream_ctx(video_default_context(), write_fn, user, video,
+                                              codec_name, fps, fragment_seconds);
+}
+
+int encode_standard_video_renditions(const SVideo *video, const VideoRendition *renditions,
+                                     int count, const char *codec_name, int fps,
+                                     double segment_seconds, const char *master_playlist) {
+    return encode_standard_video_renditions_ctx(video_default_context(), video, renditions, count,
+                                                codec_name, fps, segment_seconds,
+                                                master_playlist);
+}
+
+int reverse_standard_video(const char *input, const char *output, const char *codec_name,
+                           int fps) {
+    return reverse_standard_video_ctx(video_default_context(), input, output, codec_name, fps);
+}
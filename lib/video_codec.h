@@ -20,6 +20,38 @@ extern "C" {
  */
 SVideo *decode_standard_video(const char *filename);
 
+/**
+ * @brief Read callback for decode_standard_video_stream()
+ * Fills buf with up to size bytes of the input.
+ *
+ * @return int Bytes read, 0 at the end of the input, negative on error
+ */
+typedef int (*VideoReadFn)(void *user, unsigned char *buf, int size);
+
+/**
+ * @brief Decode a standard video held in memory, e.g. an upload not yet saved
+ * The buffer is read in place and must stay valid during the call. Any
+ * container works, as the demuxer can seek in it.
+ *
+ * @param data Video file contents
+ * @param size Bytes of data
+ * @return SVideo* Pointer to decoded video, or NULL on error
+ */
+SVideo *decode_standard_video_memory(const unsigned char *data, size_t size);
+
+/**
+ * @brief Decode a standard video as its bytes arrive from a callback
+ * Decoding starts with the first bytes, so a video can be decoded while it
+ * is still being received. The input cannot be seeked: MP4 and MOV files
+ * need their index at the front (ffmpeg -movflags +faststart); MKV, WebM
+ * and MPEG-TS stream as they are.
+ *
+ * @param read_fn Called from this thread for more input until it returns 0
+ * @param user Passed through to read_fn
+ * @return SVideo* Pointer to decoded video, or NULL on error
+ */
+SVideo *decode_standard_video_stream(VideoReadFn read_fn, void *user);
+
 /**
  * @brief Encode an SVideo structure to a standard video file
  * 
@@ -32,6 +64,94 @@ SVideo *decode_standard_video(const char *filename);
 int encode_standard_video(const char *filename, const SVideo *video, 
                          const char *codec_name, int fps);
 
+/**
+ * @brief Encode an SVideo with the codec's fastest settings, for previews
+ * As encode_standard_video(), trading file size and quality for speed:
+ * no B-frames, and the ultrafast preset and zerolatency tune for encoders
+ * that have them (libx264, libx265).
+ *
+ * @param filename Output filename (e.g., "output.mp4")
+ * @param video Pointer to the SVideo structure
+ * @param codec_name Codec name (e.g., "libx264")
+ * @param fps Frames per second
+ * @return int 0 on success, -1 on error
+ */
+int encode_preview_video(const char *filename, const SVideo *video, const char *codec_name,
+                         int fps);
+
+/**
+ * @brief Write callback for encode_fragmented_video_stream()
+ * Receives the output in order, a fragment at a time.
+ *
+ * @return int 0 or more on success, negative to abort the encode
+ */
+typedef int (*VideoWriteFn)(void *user, const unsigned char *buf, int size);
+
+/**
+ * @brief Encode an SVideo as fragmented MP4, playable while it is written
+ * The file starts with an empty moov and is then a series of fragments
+ * (CMAF-style moof/mdat pairs), one per GOP of fragment_seconds, each
+ * written out as soon as its last frame is encoded. A player can start
+ * after the first fragment instead of waiting for the whole encode.
+ *
+ * @param filename Path to the output file
+ * @param video Pointer to the SVideo structure
+ * @param codec_name Codec name (e.g., "libx264")
+ * @param fps Frames per second
+ * @param fragment_seconds Fragment (and GOP) length, 0 for 1 second
+ * @return int 0 on success, -1 on error
+ */
+int encode_fragmented_video(const char *filename, const SVideo *video, const char *codec_name,
+                            int fps, double fragment_seconds);
+
+/**
+ * @brief Encode an SVideo as fragmented MP4 through a write callback
+ * As encode_fragmented_video(), with the bytes handed to write_fn, from
+ * this thread, as each fragment completes; e.g. to stream an HTTP response.
+ *
+ * @param write_fn Output callback
+ * @param user Passed through to write_fn
+ * @param video Pointer to the SVideo structure
+ * @param codec_name Codec name (e.g., "libx264")
+ * @param fps Frames per second
+ * @param fragment_seconds Fragment (and GOP) length, 0 for 1 second
+ * @return int 0 on success, -1 on error or if write_fn failed
+ */
+int encode_fragmented_video_stream(VideoWriteFn write_fn, void *user, const SVideo *video,
+                                   const char *codec_name, int fps, double fragment_seconds);
+
+/**
+ * @brief One output of encode_standard_video_renditions()
+ */
+typedef struct {
+    const char *filename;   // Output path; .m3u8 for HLS, .mpd for DASH
+    int height;             // Output height, width following the aspect ratio; 0 for the source's
+    long bit_rate;          // Bits per second, 0 for 4 Mbps at the source size scaled by area
+} VideoRendition;
+
+/**
+ * @brief Encode an SVideo at several sizes in one pass (an ABR ladder)
+ * Each frame is converted to YUV once, at the largest size, and each
+ * smaller size is downscaled from the next larger one (1080p to 720p to
+ * 360p). The encoders run in parallel on their own threads, so the ladder
+ * costs little more than its largest rendition. Renditions are never
+ * upscaled. All renditions get keyframes at the same frames, every
+ * segment_seconds, so HLS/DASH outputs have aligned segments.
+ *
+ * @param video Pointer to the SVideo structure
+ * @param renditions Outputs, in any order
+ * @param count Number of renditions
+ * @param codec_name Codec name (e.g., "libx264")
+ * @param fps Frames per second
+ * @param segment_seconds Keyframe interval and playlist segment length, 0 for 4 seconds
+ * @param master_playlist Optional HLS master playlist to write, listing the
+ *                        renditions by file name (so in the same directory)
+ * @return int 0 on success, -1 on error
+ */
+int encode_standard_video_renditions(const SVideo *video, const VideoRendition *renditions,
+                                     int count, const char *codec_name, int fps,
+                                     double segment_seconds, const char *master_playlist);
+
 /**
  * @brief Get video information without full decoding
  * 
@@ -45,6 +165,129 @@ int encode_standard_video(const char *filename, const SVideo *video,
 int get_video_info(const char *filename, int *width, int *height, 
                    long *num_frames, double *fps);
 
+/**
+ * @brief Reverse a standard video file into another, a GOP at a time
+ * Instead of decoding the whole video, walks its keyframes from the end:
+ * a decoder thread decodes one GOP (or, for long GOPs, one buffer's worth
+ * of it) while the encoder takes the previous one's frames last to first.
+ * Memory is two buffers of at most 128 MB of frames whatever the video's
+ * length. Streams without keyframe timestamps are reversed in memory.
+ *
+ * @param input Path to the input video file
+ * @param output Path to the output video file
+ * @param codec_name Encoder name (e.g., "libx264")
+ * @param fps Output frames per second
+ * @return int 0 on success, -1 on error
+ */
+int reverse_standard_video(const char *input, const char *output, const char *codec_name,
+                           int fps);
+
+/**
+ * @brief Bytes of frame buffers reverse_standard_video() needs at most
+ *
+ * @param width Frame width
+ * @param height Frame height
+ * @param num_frames Frames in the video, 0 if unknown
+ * @return size_t Buffer bytes
+ */
+size_t reverse_standard_video_memory(int width, int height, long num_frames);
+
+/**
+ * @brief Random access to the frames of standard video files
+ * For scrubbing: a server keeps up to max_open inputs open, each with an
+ * index of its keyframes and its decoder's position, and an LRU cache of
+ * decoded frames. An uncached frame is decoded forward from the decoder's
+ * position when it lies ahead in the same GOP, as in playback, or else
+ * from its keyframe after a seek; the frames just before it are cached on
+ * the way. The first access to a file costs an index pass over its
+ * packets. Files replaced on disk are reopened.
+ *
+ * Safe to call from many threads at once; requests for one file take turns
+ * on its decoder. Frames are allocated through ctx.
+ */
+typedef struct VideoFrameServer VideoFrameServer;
+
+/**
+ * @brief Create a frame server
+ *
+ * @param ctx Library context (allocator, limits, logger), or NULL for the default
+ * @param cache_bytes Bytes of decoded frames to keep, 0 for 256 MB
+ * @param max_open Inputs to keep open, 0 for 4
+ * @return VideoFrameServer* New server, or NULL on allocation failure
+ */
+VideoFrameServer *video_frame_server_create(VideoContext *ctx, size_t cache_bytes,
+                                            int max_open);
+
+/**
+ * @brief Close the server's files and free its cache
+ *
+ * @param server Server to destroy; no calls may be running on it
+ */
+void video_frame_server_destroy(VideoFrameServer *server);
+
+/**
+ * @brief Get a file's dimensions and exact frame count, as frames are numbered by the server
+ *
+ * @param server Frame server
+ * @param filename Path to the video file
+ * @param width Output frame width
+ * @param height Output frame height
+ * @param num_frames Output number of frames
+ * @param fps Output frames per second
+ * @return int 0 on success, -1 on error
+ */
+int video_frame_server_info(VideoFrameServer *server, const char *filename, int *width,
+                            int *height, long *num_frames, double *fps);
+
+/**
+ * @brief Get frame index of a file as packed RGB24
+ *
+ * @param server Frame server
+ * @param filename Path to the video file
+ * @param index Frame number in display order, from 0
+ * @param rgb Output buffer of at least width * height * 3 bytes
+ * @param size Size of rgb in bytes
+ * @return int 0 on success, -1 on error
+ */
+int video_frame_server_get(VideoFrameServer *server, const char *filename, long index,
+                           unsigned char *rgb, size_t size);
+
+/**
+ * @brief Context-taking variants of the functions above
+ * Memory comes from the context's allocator, so the returned SVideo must be
+ * freed with free_video_S_ctx() on the same context.
+ */
+SVideo *decode_standard_video_ctx(VideoContext *ctx, const char *filename);
+
+SVideo *decode_standard_video_memory_ctx(VideoContext *ctx, const unsigned char *data,
+                                         size_t size);
+
+SVideo *decode_standard_video_stream_ctx(VideoContext *ctx, VideoReadFn read_fn, void *user);
+
+int encode_standard_video_ctx(VideoContext *ctx, const char *filename,
+                              const SVideo *video, const char *codec_name, int fps);
+
+int encode_preview_video_ctx(VideoContext *ctx, const char *filename, const SVideo *video,
+                             const char *codec_name, int fps);
+
+int encode_fragmented_video_ctx(VideoContext *ctx, const char *filename, const SVideo *video,
+                                const char *codec_name, int fps, double fragment_seconds);
+
+int encode_fragmented_video_stream_ctx(VideoContext *ctx, VideoWriteFn write_fn, void *user,
+                                       const SVideo *video, const char *codec_name, int fps,
+                                       double fragment_seconds);
+
+int encode_standard_video_renditions_ctx(VideoContext *ctx, const SVideo *video,
+                                         const VideoRendition *renditions, int count,
+                                         const char *codec_name, int fps,
+                                         double segment_seconds, const char *master_playlist);
+
+int get_video_info_ctx(VideoContext *ctx, const char *filename, int *width,
+                       int *height, long *num_frames, double *fps);
+
+int reverse_standard_video_ctx(VideoContext *ctx, const char *input, const char *output,
+                               const char *codec_name, int fps);
+
 #ifdef __cplusplus
 }
 #endif
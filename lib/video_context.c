@@ -0,0 +1,747 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include "video_context.h"
+#include "video_kernels.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Spill files are mapped with mmap, so spilling is POSIX-only
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+// Allocations carry their size in front so frees can be accounted for;
+// one cache line keeps the returned pointer 64-byte aligned
+#define ALLOC_HEADER 64
+
+// Freed blocks kept for reuse by video_context_set_pool(); small blocks are
+// cheap to get from malloc and are not pooled
+#define POOL_SLOTS 16
+#define POOL_MIN_BYTES (64u << 10)
+
+// Allocations over the memory limit go to a scratch file when the context
+// has a spill directory; the second header word marks them. Small blocks
+// are not worth a mapping and fail as before.
+#define SPILL_MARK ((size_t)0x5350494c4cu)
+#define SPILL_MIN_BYTES (1u << 20)
+
+// Spilled blocks whose ranges get paging hints; more can be spilled, they
+// just page without hints
+#define SPILL_SLOTS 32
+
+typedef struct {
+    unsigned char *base;
+    size_t size;
+} SpillSpan;
+
+struct VideoContext {
+    pthread_mutex_t lock;
+    int num_threads;
+    int first_cpu;
+    int num_cpus;
+    VideoAllocFn alloc_fn;
+    VideoFreeFn free_fn;
+    void *alloc_user;
+    VideoLogFn log_fn;
+    void *log_user;
+    VideoProgressFn progress_fn;
+    void *progress_user;
+    int cancel_requested;
+    VideoISA isa;
+    int deterministic;
+    size_t max_bytes;
+    long max_frames;
+    int has_tuning;
+    TuneParams tuning;
+    VideoStats stats;
+    char last_error[256];
+    size_t pool_max;
+    size_t pool_bytes;
+    int pool_count;
+    unsigned char *pool_blocks[POOL_SLOTS];    // Oldest first
+    char *spill_dir;
+    size_t spill_max;
+    int spill_count;
+    SpillSpan spill_spans[SPILL_SLOTS];
+};
+
+static VideoContext g_default_ctx;
+static pthread_once_t g_default_once = PTHREAD_ONCE_INIT;
+
+static void context_init(VideoContext *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    pthread_mutex_init(&ctx->lock, NULL);
+    ctx->isa = VIDEO_ISA_AUTO;
+}
+
+static void default_context_init(void) {
+    context_init(&g_default_ctx);
+}
+
+VideoContext *video_default_context(void) {
+    pthread_once(&g_default_once, default_context_init);
+    return &g_default_ctx;
+}
+
+VideoContext *video_context_create(void) {
+    VideoContext *ctx = (VideoContext *)malloc(sizeof(VideoContext));
+    if (!ctx) {
+        perror("Error allocating VideoContext");
+        return NULL;
+    }
+    context_init(ctx);
+    return ctx;
+}
+
+static void block_release(VideoContext *ctx, unsigned char *block) {
+    if (ctx->free_fn) {
+        ctx->free_fn(block, ctx->alloc_user);
+    } else {
+        _mm_free(block);
+    }
+}
+
+// Free pooled blocks until they fit in max_bytes; call with the lock
+// held. Returns the blocks to release once the lock is dropped.
+static int pool_trim(VideoContext *ctx, size_t max_bytes, unsigned char **evicted) {
+    int count = 0;
+    while (ctx->pool_count && ctx->pool_bytes > max_bytes) {
+        unsigned char *block = ctx->pool_blocks[0];
+        ctx->pool_bytes -= *(size_t *)block;
+        memmove(ctx->pool_blocks, ctx->pool_blocks + 1,
+                --ctx->pool_count * sizeof(ctx->pool_blocks[0]));
+        evicted[count++] = block;
+    }
+    return count;
+}
+
+static void pool_flush(VideoContext *ctx) {
+    unsigned char *evicted[POOL_SLOTS];
+    pthread_mutex_lock(&ctx->lock);
+    int count = pool_trim(ctx, 0, evicted);
+    pthread_mutex_unlock(&ctx->lock);
+    for (int i = 0; i < count; i++) block_release(ctx, evicted[i]);
+}
+
+void video_context_destroy(VideoContext *ctx) {
+    if (!ctx || ctx == &g_default_ctx) return;
+    pool_flush(ctx);
+    if (ctx->stats.bytes_live) {
+        fprintf(stderr, "Warning: destroying context with %zu bytes still allocated\n",
+                ctx->stats.bytes_live);
+    }
+    free(ctx->spill_dir);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+int video_context_set_threads(VideoContext *ctx, int num_threads) {
+    if (!ctx || num_threads < 0) return -1;
+    ctx->num_threads = num_threads;
+    return 0;
+}
+
+int video_context_set_cpus(VideoContext *ctx, int first_cpu, int num_cpus) {
+    if (!ctx || first_cpu < 0 || num_cpus < 0) return -1;
+    ctx->first_cpu = first_cpu;
+    ctx->num_cpus = num_cpus;
+    return 0;
+}
+
+int video_context_set_allocator(VideoContext *ctx, VideoAllocFn alloc_fn,
+                                VideoFreeFn free_fn, void *user) {
+    if (!ctx) return -1;
+    pool_flush(ctx);
+    if (!alloc_fn || !free_fn) {
+        alloc_fn = NULL;
+        free_fn = NULL;
+        user = NULL;
+    }
+    // Live blocks must go back to the free function that matches their allocator
+    pthread_mutex_lock(&ctx->lock);
+    size_t live = ctx->stats.bytes_live;
+    if (!live) {
+        ctx->alloc_fn = alloc_fn;
+        ctx->free_fn = free_fn;
+        ctx->alloc_user = user;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    if (live) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR,
+                      "Cannot replace the allocator with %zu bytes still allocated\n", live);
+        return -1;
+    }
+    return 0;
+}
+
+void video_context_set_logger(VideoContext *ctx, VideoLogFn log_fn, void *user) {
+    if (!ctx) return;
+    ctx->log_fn = log_fn;
+    ctx->log_user = log_fn ? user : NULL;
+}
+
+int video_context_set_isa(VideoContext *ctx, VideoISA isa) {
+    if (!ctx || isa < VIDEO_ISA_AUTO || isa > VIDEO_ISA_AVX2) return -1;
+    ctx->isa = isa;
+    return 0;
+}
+
+void video_context_set_deterministic(VideoContext *ctx, int enabled) {
+    if (!ctx) return;
+    ctx->deterministic = enabled != 0;
+}
+
+void video_context_set_limits(VideoContext *ctx, size_t max_bytes, long max_frames) {
+    if (!ctx) return;
+    ctx->max_bytes = max_bytes;
+    ctx->max_frames = max_frames;
+}
+
+void video_context_set_pool(VideoContext *ctx, size_t max_bytes) {
+    if (!ctx) return;
+    unsigned char *evicted[POOL_SLOTS];
+    pthread_mutex_lock(&ctx->lock);
+    ctx->pool_max = max_bytes;
+    int count = pool_trim(ctx, max_bytes, evicted);
+    pthread_mutex_unlock(&ctx->lock);
+    for (int i = 0; i < count; i++) block_release(ctx, evicted[i]);
+}
+
+int video_context_set_spill(VideoContext *ctx, const char *dir, size_t max_bytes) {
+    if (!ctx) return -1;
+#ifdef _WIN32
+    if (dir) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Spilling to disk is not supported on Windows\n");
+        return -1;
+    }
+#endif
+    char *copy = NULL;
+    if (dir && !(copy = strdup(dir))) {
+        video_ctx_log_errno(ctx, "Error setting spill directory");
+        return -1;
+    }
+    free(ctx->spill_dir);
+    ctx->spill_dir = copy;
+    ctx->spill_max = max_bytes;
+    return 0;
+}
+
+void video_context_set_tuning(VideoContext *ctx, const TuneParams *params) {
+    if (!ctx) return;
+    ctx->has_tuning = params != NULL;
+    if (params) ctx->tuning = *params;
+}
+
+void video_context_get_stats(VideoContext *ctx, VideoStats *stats) {
+    if (!ctx || !stats) return;
+    pthread_mutex_lock(&ctx->lock);
+    *stats = ctx->stats;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void video_context_reset_stats(VideoContext *ctx) {
+    if (!ctx) return;
+    pthread_mutex_lock(&ctx->lock);
+    size_t live = ctx->stats.bytes_live;
+    size_t spilled = ctx->stats.bytes_spilled;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->stats.bytes_live = live;
+    ctx->stats.bytes_peak = live;
+    ctx->stats.bytes_spilled = spilled;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void video_context_set_progress(VideoContext *ctx, VideoProgressFn progress_fn, void *user) {
+    if (!ctx) return;
+    ctx->progress_fn = progress_fn;
+    ctx->progress_user = progress_fn ? user : NULL;
+}
+
+void video_context_cancel(VideoContext *ctx) {
+    if (!ctx) return;
+    __atomic_store_n(&ctx->cancel_requested, 1, __ATOMIC_RELEASE);
+}
+
+void video_context_clear_cancel(VideoContext *ctx) {
+    if (!ctx) return;
+    __atomic_store_n(&ctx->cancel_requested, 0, __ATOMIC_RELEASE);
+}
+
+int video_context_cancelled(VideoContext *ctx) {
+    return ctx ? __atomic_load_n(&ctx->cancel_requested, __ATOMIC_ACQUIRE) : 0;
+}
+
+const char *video_context_last_error(VideoContext *ctx) {
+    return ctx ? ctx->last_error : "";
+}
+
+// Take the smallest pooled block holding full_size bytes, if it is at most
+// twice that; call with the lock held
+static unsigned char *pool_take(VideoContext *ctx, size_t full_size) {
+    int best = -1;
+    for (int i = 0; i < ctx->pool_count; i++) {
+        size_t capacity = *(size_t *)ctx->pool_blocks[i];
+        if (capacity >= full_size && capacity / 2 <= full_size &&
+            (best < 0 || capacity < *(size_t *)ctx->pool_blocks[best])) {
+            best = i;
+        }
+    }
+    if (best < 0) return NULL;
+
+    unsigned char *block = ctx->pool_blocks[best];
+    ctx->pool_bytes -= *(size_t *)block;
+    memmove(ctx->pool_blocks + best, ctx->pool_blocks + best + 1,
+            (--ctx->pool_count - best) * sizeof(ctx->pool_blocks[0]));
+    return block;
+}
+
+// Map a block of a new scratch file in the spill directory. The file is
+// unlinked at once, so the mapping is all that keeps it, and its space is
+// reserved up front: running out of disk later would be a SIGBUS on write.
+static unsigned char *spill_map(VideoContext *ctx, size_t full_size) {
+#ifdef _WIN32
+    // Unreachable: video_context_set_spill() refuses a directory
+    (void)ctx;
+    (void)full_size;
+    return NULL;
+#else
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/.filmmaster-spill-XXXXXX", ctx->spill_dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        video_ctx_log_errno(ctx, "Error creating spill file");
+        return NULL;
+    }
+    unlink(path);
+
+    void *block = MAP_FAILED;
+    int err = posix_fallocate(fd, 0, (off_t)full_size);
+    if (err == 0) {
+        block = mmap(NULL, full_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (block == MAP_FAILED) err = errno;
+    }
+    close(fd);
+    if (block == MAP_FAILED) {
+        errno = err;
+        video_ctx_log_errno(ctx, "Error allocating spill file");
+        return NULL;
+    }
+    return (unsigned char *)block;
+#endif
+}
+
+static void *spill_alloc(VideoContext *ctx, size_t size) {
+    size_t full_size = size + ALLOC_HEADER;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->spill_max && ctx->stats.bytes_spilled + full_size > ctx->spill_max) {
+        pthread_mutex_unlock(&ctx->lock);
+        video_ctx_log(ctx, VIDEO_LOG_ERROR,
+                      "Spill limit exceeded: %zu bytes requested, %zu of %zu in use\n",
+                      size, ctx->stats.bytes_spilled, ctx->spill_max);
+        return NULL;
+    }
+    ctx->stats.bytes_spilled += full_size;
+    ctx->stats.allocations++;
+    pthread_mutex_unlock(&ctx->lock);
+
+    unsigned char *block = spill_map(ctx, full_size);
+    pthread_mutex_lock(&ctx->lock);
+    if (!block) {
+        ctx->stats.bytes_spilled -= full_size;
+    } else if (ctx->spill_count < SPILL_SLOTS) {
+        ctx->spill_spans[ctx->spill_count].base = block;
+        ctx->spill_spans[ctx->spill_count].size = full_size;
+        ctx->spill_count++;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    if (!block) return NULL;
+
+    ((size_t *)block)[0] = full_size;
+    ((size_t *)block)[1] = SPILL_MARK;
+    return block + ALLOC_HEADER;
+}
+
+static void spill_free(VideoContext *ctx, unsigned char *block) {
+    size_t full_size = *(size_t *)block;
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stats.bytes_spilled -= full_size;
+    for (int i = 0; i < ctx->spill_count; i++) {
+        if (ctx->spill_spans[i].base == block) {
+            ctx->spill_spans[i] = ctx->spill_spans[--ctx->spill_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+#ifndef _WIN32
+    munmap(block, full_size);
+#endif
+}
+
+void *video_ctx_alloc(VideoContext *ctx, size_t size) {
+    size_t full_size = size + ALLOC_HEADER;
+
+    pthread_mutex_lock(&ctx->lock);
+    // A pooled block is accounted at its full capacity, which its header
+    // already records
+    unsigned char *pooled = full_size >= POOL_MIN_BYTES ? pool_take(ctx, full_size) : NULL;
+    if (pooled) full_size = *(size_t *)pooled;
+    if (ctx->max_bytes && ctx->stats.bytes_live + full_size > ctx->max_bytes) {
+        if (pooled) {
+            ctx->pool_blocks[ctx->pool_count++] = pooled;
+            ctx->pool_bytes += full_size;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+        if (ctx->spill_dir && size >= SPILL_MIN_BYTES) return spill_alloc(ctx, size);
+        video_ctx_log(ctx, VIDEO_LOG_ERROR,
+                      "Memory limit exceeded: %zu bytes requested, %zu of %zu in use\n",
+                      size, ctx->stats.bytes_live, ctx->max_bytes);
+        return NULL;
+    }
+    ctx->stats.bytes_live += full_size;
+    if (ctx->stats.bytes_live > ctx->stats.bytes_peak) {
+        ctx->stats.bytes_peak = ctx->stats.bytes_live;
+    }
+    ctx->stats.allocations++;
+    pthread_mutex_unlock(&ctx->lock);
+    if (pooled) return pooled + ALLOC_HEADER;
+
+    unsigned char *block = ctx->alloc_fn ?
+        (unsigned char *)ctx->alloc_fn(full_size, ctx->alloc_user) :
+        (unsigned char *)_mm_malloc(full_size, 64);
+    if (!block) {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->stats.bytes_live -= full_size;
+        pthread_mutex_unlock(&ctx->lock);
+        return NULL;
+    }
+
+    ((size_t *)block)[0] = full_size;
+    ((size_t *)block)[1] = 0;
+    return block + ALLOC_HEADER;
+}
+
+void video_ctx_free(VideoContext *ctx, void *ptr) {
+    if (!ptr) return;
+    unsigned char *block = (unsigned char *)ptr - ALLOC_HEADER;
+    if (((size_t *)block)[1] == SPILL_MARK) {
+        spill_free(ctx, block);
+        return;
+    }
+    size_t full_size = *(size_t *)block;
+    unsigned char *evicted[POOL_SLOTS];
+    int count = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stats.bytes_live -= full_size;
+    if (full_size >= POOL_MIN_BYTES && full_size <= ctx->pool_max) {
+        // Make room, oldest first, then keep the block
+        count = pool_trim(ctx, ctx->pool_max - full_size, evicted);
+        if (ctx->pool_count == POOL_SLOTS) {
+            ctx->pool_bytes -= *(size_t *)ctx->pool_blocks[0];
+            evicted[count++] = ctx->pool_blocks[0];
+            memmove(ctx->pool_blocks, ctx->pool_blocks + 1,
+                    --ctx->pool_count * sizeof(ctx->pool_blocks[0]));
+        }
+        ctx->pool_blocks[ctx->pool_count++] = block;
+        ctx->pool_bytes += full_size;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (int i = 0; i < count; i++) block_release(ctx, evicted[i]);
+    if (block) block_release(ctx, block);
+}
+
+void *video_ctx_realloc(VideoContext *ctx, void *ptr, size_t size) {
+    if (!ptr) return video_ctx_alloc(ctx, size);
+
+    size_t old_size = *(size_t *)((unsigned char *)ptr - ALLOC_HEADER) - ALLOC_HEADER;
+    void *new_ptr = video_ctx_alloc(ctx, size);
+    if (!new_ptr) return NULL;
+
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    video_ctx_free(ctx, ptr);
+    return new_ptr;
+}
+
+void video_ctx_log(VideoContext *ctx, VideoLogLevel level, const char *fmt, ...) {
+    char message[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+
+    if (level == VIDEO_LOG_ERROR) {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->stats.errors++;
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "%.*s",
+                 (int)sizeof(ctx->last_error) - 1, message);
+        ctx->last_error[strcspn(ctx->last_error, "\n")] = '\0';
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    if (ctx->log_fn) {
+        ctx->log_fn(level, message, ctx->log_user);
+    } else if (level == VIDEO_LOG_ERROR) {
+        fputs(message, stderr);
+    } else {
+        fputs(message, stdout);
+    }
+}
+
+void video_ctx_log_errno(VideoContext *ctx, const char *message) {
+    int err = errno;
+    video_ctx_log(ctx, VIDEO_LOG_ERROR, "%s: %s\n", message, strerror(err));
+}
+
+VideoContext *video_ctx_create_worker(VideoContext *parent, int worker, int num_workers) {
+    // Single-threaded, on one CPU of the parent's partition, with an equal
+    // share of its memory limit
+    VideoContext *ctx = video_context_create();
+    if (!ctx) return NULL;
+
+    ctx->num_threads = 1;
+    if (parent->num_cpus > 0) {
+        ctx->first_cpu = parent->first_cpu + worker % parent->num_cpus;
+        ctx->num_cpus = 1;
+    }
+    ctx->alloc_fn = parent->alloc_fn;
+    ctx->free_fn = parent->free_fn;
+    ctx->alloc_user = parent->alloc_user;
+    ctx->log_fn = parent->log_fn;
+    ctx->log_user = parent->log_user;
+    ctx->isa = parent->isa;
+    ctx->deterministic = parent->deterministic;
+    ctx->max_bytes = parent->max_bytes / (num_workers > 0 ? num_workers : 1);
+    ctx->max_frames = parent->max_frames;
+    if (parent->spill_dir) {
+        ctx->spill_dir = strdup(parent->spill_dir);
+        ctx->spill_max = parent->spill_max / (num_workers > 0 ? num_workers : 1);
+    }
+    ctx->has_tuning = parent->has_tuning;
+    ctx->tuning = parent->tuning;
+    return ctx;
+}
+
+void video_ctx_destroy_worker(VideoContext *parent, VideoContext *worker) {
+    if (!worker) return;
+    pool_flush(worker);
+
+    pthread_mutex_lock(&parent->lock);
+    VideoStats *stats = &parent->stats;
+    if (stats->bytes_live + worker->stats.bytes_peak > stats->bytes_peak) {
+        stats->bytes_peak = stats->bytes_live + worker->stats.bytes_peak;
+    }
+    stats->allocations += worker->stats.allocations;
+    stats->kernel_calls += worker->stats.kernel_calls;
+    stats->kernel_frames += worker->stats.kernel_frames;
+    stats->kernel_seconds += worker->stats.kernel_seconds;
+    stats->frames_decoded += worker->stats.frames_decoded;
+    stats->frames_encoded += worker->stats.frames_encoded;
+    stats->errors += worker->stats.errors;
+    if (worker->stats.errors) {
+        memcpy(parent->last_error, worker->last_error, sizeof(parent->last_error));
+    }
+    pthread_mutex_unlock(&parent->lock);
+
+    video_context_destroy(worker);
+}
+
+const TuneParams *video_ctx_tuning(VideoContext *ctx) {
+    return ctx->has_tuning ? &ctx->tuning : autotune_get();
+}
+
+int video_ctx_threads(VideoContext *ctx, size_t total_bytes) {
+    const TuneParams *tune = video_ctx_tuning(ctx);
+    int threads;
+
+    if (ctx->num_threads > 0) {
+        threads = ctx->num_threads;
+    } else if (ctx->num_cpus > 0) {
+        threads = ctx->num_cpus;
+    } else {
+        return autotune_threads_for(tune, total_bytes);
+    }
+
+    if (total_bytes < tune->small_video_bytes &&
+        tune->small_video_threads < threads) {
+        threads = tune->small_video_threads;
+    }
+    return threads < 1 ? 1 : threads;
+}
+
+#ifdef __linux__
+// Partition the thread currently has applied; OpenMP reuses pool threads
+// across regions, so they are re-pinned only when the partition changes
+static __thread int t_pinned_first = -1;
+static __thread int t_pinned_count = 0;
+#endif
+
+void video_ctx_enter_thread(VideoContext *ctx) {
+#ifdef __linux__
+    if (ctx->num_cpus == t_pinned_count &&
+        (ctx->num_cpus == 0 || ctx->first_cpu == t_pinned_first)) {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (ctx->num_cpus > 0) {
+        for (int i = 0; i < ctx->num_cpus && ctx->first_cpu + i < CPU_SETSIZE; i++) {
+            CPU_SET(ctx->first_cpu + i, &set);
+        }
+    } else {
+        // Leaving a partitioned context: give the thread every CPU back
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        for (long i = 0; i < cpus && i < CPU_SETSIZE; i++) {
+            CPU_SET(i, &set);
+        }
+    }
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        t_pinned_first = ctx->first_cpu;
+        t_pinned_count = ctx->num_cpus;
+    }
+#else
+    (void)ctx;
+#endif
+}
+
+int video_cpu_has_avx2(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    static int has_avx2 = -1;
+    if (has_avx2 < 0) {
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return has_avx2;
+#elif defined(_M_X64)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int video_ctx_use_avx2(VideoContext *ctx) {
+    // Deterministic mode pins the scalar kernels, so no output depends on
+    // the two paths agreeing
+    return ctx->isa != VIDEO_ISA_SCALAR && !ctx->deterministic && video_cpu_has_avx2();
+}
+
+int video_ctx_deterministic(VideoContext *ctx) {
+    return ctx->deterministic;
+}
+
+int video_ctx_spilled(VideoContext *ctx) {
+    return __atomic_load_n(&ctx->spill_count, __ATOMIC_RELAXED) > 0;
+}
+
+#ifdef _WIN32
+// Nothing is ever spilled, so there are no pages to hint
+void video_ctx_prefetch(VideoContext *ctx, const void *ptr, size_t size) {
+    (void)ctx;
+    (void)ptr;
+    (void)size;
+}
+
+void video_ctx_evict(VideoContext *ctx, const void *ptr, size_t size) {
+    (void)ctx;
+    (void)ptr;
+    (void)size;
+}
+#else
+// Apply a paging hint to the part of [ptr, ptr + size) in spilled blocks;
+// heap memory is left alone
+static void spill_advise(VideoContext *ctx, const void *ptr, size_t size, int advice) {
+    if (!size || !video_ctx_spilled(ctx)) return;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)ptr;
+    uintptr_t end = start + size;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (int i = 0; i < ctx->spill_count; i++) {
+        uintptr_t base = (uintptr_t)ctx->spill_spans[i].base;
+        uintptr_t limit = base + ctx->spill_spans[i].size;
+        if (end <= base || start >= limit) continue;
+        uintptr_t first = (start > base ? start : base) & ~(page - 1);
+        uintptr_t last = end < limit ? end : limit;
+        madvise((void *)first, last - first, advice);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void video_ctx_prefetch(VideoContext *ctx, const void *ptr, size_t size) {
+    spill_advise(ctx, ptr, size, MADV_WILLNEED);
+}
+
+void video_ctx_evict(VideoContext *ctx, const void *ptr, size_t size) {
+#ifdef MADV_COLD
+    spill_advise(ctx, ptr, size, MADV_COLD);
+#else
+    // Spilled blocks are shared file mappings, so dropping the pages keeps
+    // their contents in the file
+    spill_advise(ctx, ptr, size, MADV_DONTNEED);
+#endif
+}
+#endif
+
+long video_ctx_max_frames(VideoContext *ctx) {
+    return ctx->max_frames;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double video_ctx_kernel_begin(VideoContext *ctx) {
+    (void)ctx;
+    return now_seconds();
+}
+
+void video_ctx_kernel_end(VideoContext *ctx, double start, long frames) {
+    double elapsed = now_seconds() - start;
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stats.kernel_calls++;
+    ctx->stats.kernel_frames += frames > 0 ? frames : 0;
+    ctx->stats.kernel_seconds += elapsed;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void video_ctx_count_decoded(VideoContext *ctx, long frames) {
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stats.frames_decoded += frames > 0 ? frames : 0;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void video_ctx_count_encoded(VideoContext *ctx, long frames) {
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stats.frames_encoded += frames > 0 ? frames : 0;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void video_ctx_progress(VideoContext *ctx, VideoStage stage, long done, long total) {
+    if (ctx->progress_fn) {
+        ctx->progress_fn(stage, done, total, ctx->progress_user);
+    }
+}
@@ -0,0 +1,287 @@
+#ifndef VIDEO_CONTEXT_H
+#define VIDEO_CONTEXT_H
+
+#include <stddef.h>
+#include <stdarg.h>
+#include "autotune.h"
+
+/**
+ * @brief Library context
+ * Owns everything the library used to keep global: the OpenMP team size and
+ * core partition, the allocator, statistics, ISA dispatch choice, resource
+ * limits and where messages go. Every public function has a _ctx variant
+ * taking a context; the plain functions use video_default_context().
+ *
+ * A context may be used by one call at a time. Concurrent jobs should each
+ * use their own context, e.g. with disjoint CPU partitions.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct VideoContext VideoContext;
+
+typedef enum {
+    VIDEO_ISA_AUTO = 0,     // Best instruction set supported by the CPU
+    VIDEO_ISA_SCALAR = 1,   // Portable C kernels only
+    VIDEO_ISA_AVX2 = 2      // AVX2 kernels (falls back to scalar if unsupported)
+} VideoISA;
+
+typedef enum {
+    VIDEO_LOG_ERROR = 0,
+    VIDEO_LOG_INFO = 1
+} VideoLogLevel;
+
+typedef enum {
+    VIDEO_STAGE_DECODE = 0,
+    VIDEO_STAGE_PROCESS = 1,
+    VIDEO_STAGE_ENCODE = 2
+} VideoStage;
+
+typedef void *(*VideoAllocFn)(size_t size, void *user);
+typedef void (*VideoFreeFn)(void *ptr, void *user);
+typedef void (*VideoLogFn)(VideoLogLevel level, const char *message, void *user);
+typedef void (*VideoProgressFn)(VideoStage stage, long done, long total, void *user);
+
+typedef struct {
+    size_t bytes_live;              // Bytes currently allocated through the context
+    size_t bytes_peak;              // High-water mark of bytes_live
+    unsigned long allocations;      // Number of allocations made
+    unsigned long kernel_calls;     // Processing kernels run
+    unsigned long kernel_frames;    // Frames touched by processing kernels
+    double kernel_seconds;          // Wall time spent in processing kernels
+    unsigned long frames_decoded;   // Frames produced by decoders
+    unsigned long frames_encoded;   // Frames consumed by encoders
+    unsigned long errors;           // Errors reported through the logger
+    size_t bytes_spilled;           // Bytes currently allocated in spill files
+} VideoStats;
+
+/**
+ * @brief Create a context with default settings
+ * Defaults: automatic thread count, no CPU partition, aligned malloc,
+ * messages on stderr/stdout, automatic ISA, no limits.
+ *
+ * @return VideoContext* New context, or NULL on allocation failure
+ */
+VideoContext *video_context_create(void);
+
+/**
+ * @brief Destroy a context created with video_context_create()
+ * Videos allocated through the context must be freed first.
+ *
+ * @param ctx Context to destroy (the default context is ignored)
+ */
+void video_context_destroy(VideoContext *ctx);
+
+/**
+ * @brief Get the process-wide default context used by the plain API
+ *
+ * @return VideoContext* Default context, never NULL
+ */
+VideoContext *video_default_context(void);
+
+/**
+ * @brief Set the number of threads kernels may use
+ *
+ * @param ctx Library context
+ * @param num_threads Thread count, 0 for automatic
+ * @return int 0 on success, -1 on invalid input
+ */
+int video_context_set_threads(VideoContext *ctx, int num_threads);
+
+/**
+ * @brief Restrict the context's threads to CPUs [first_cpu, first_cpu + num_cpus)
+ * Threads pin themselves at the start of each parallel region (Linux only).
+ * Also caps the thread count at num_cpus when no explicit count is set.
+ *
+ * @param ctx Library context
+ * @param first_cpu First CPU of the partition
+ * @param num_cpus Number of CPUs, 0 to remove the partition
+ * @return int 0 on success, -1 on invalid input
+ */
+int video_context_set_cpus(VideoContext *ctx, int first_cpu, int num_cpus);
+
+/**
+ * @brief Replace the allocator
+ * The functions must be thread-safe and return 64-byte aligned memory.
+ * Pass NULL for both to restore the default allocator. Refused while
+ * the context still has blocks allocated, so call it before any video
+ * is decoded or created through ctx.
+ *
+ * @param ctx Library context
+ * @param alloc_fn Allocation function
+ * @param free_fn Matching free function
+ * @param user Passed through to both functions
+ * @return int 0 on success, -1 if blocks are still live or on invalid input
+ */
+int video_context_set_allocator(VideoContext *ctx, VideoAllocFn alloc_fn,
+                                VideoFreeFn free_fn, void *user);
+
+/**
+ * @brief Redirect library messages
+ * Pass NULL to restore the default (errors on stderr, info on stdout).
+ *
+ * @param ctx Library context
+ * @param log_fn Message callback
+ * @param user Passed through to the callback
+ */
+void video_context_set_logger(VideoContext *ctx, VideoLogFn log_fn, void *user);
+
+/**
+ * @brief Select the kernel instruction set
+ *
+ * @param ctx Library context
+ * @param isa Instruction set choice
+ * @return int 0 on success, -1 on invalid input
+ */
+int video_context_set_isa(VideoContext *ctx, VideoISA isa);
+
+/**
+ * @brief Make outputs bit-identical across runs, thread counts and hosts
+ * The kernels never depend on the thread count: they have no reductions.
+ * This pins them to the scalar ISA, whatever video_context_set_isa()
+ * chose, turns off frame and slice threading in the FFmpeg decoder and
+ * encoder, makes colour conversion use its exact C paths and leaves
+ * version strings out of encoded files. Kernels and encoding get slower.
+ *
+ * @param ctx Library context
+ * @param enabled Non-zero for deterministic output
+ */
+void video_context_set_deterministic(VideoContext *ctx, int enabled);
+
+/**
+ * @brief Set resource limits, 0 meaning unlimited
+ *
+ * @param ctx Library context
+ * @param max_bytes Maximum bytes live through the context's allocator
+ * @param max_frames Maximum frames a decoder may produce
+ */
+void video_context_set_limits(VideoContext *ctx, size_t max_bytes, long max_frames);
+
+/**
+ * @brief Keep freed blocks for reuse by later allocations
+ * Blocks of 64 KB and more are pooled up to max_bytes and handed to
+ * allocations needing between half and all of their size, so a context
+ * that goes through many similar videos (e.g. a batch) stops paying for
+ * fresh pages per video. Pooled blocks do not count as live.
+ *
+ * @param ctx Library context
+ * @param max_bytes Bytes of freed blocks to keep, 0 (the default) to keep none
+ */
+void video_context_set_pool(VideoContext *ctx, size_t max_bytes);
+
+/**
+ * @brief Let allocations over the memory limit spill to disk
+ * Once max_bytes from video_context_set_limits() is reached, allocations of
+ * 1 MB and more (whole videos, frame buffers) are made in scratch files in
+ * dir, mapped into memory, instead of failing. The files are deleted as
+ * they are created and go away when freed. Which of their pages stay in
+ * RAM is up to the OS page cache; the op program, raw decoder and encoder
+ * hint it to read the next chunk of frames ahead and to drop the ones they
+ * are done with first, so a video larger than memory is processed at disk
+ * speed. Spilled bytes count in bytes_spilled, not bytes_live. POSIX only:
+ * on Windows setting a directory fails.
+ *
+ * @param ctx Library context
+ * @param dir Existing directory for the scratch files, NULL to disable spilling
+ * @param max_bytes Maximum bytes spilled at once, 0 for unlimited
+ * @return int 0 on success, -1 on error
+ */
+int video_context_set_spill(VideoContext *ctx, const char *dir, size_t max_bytes);
+
+/**
+ * @brief Override the autotuned kernel parameters for this context
+ *
+ * @param ctx Library context
+ * @param params Parameters to copy, NULL to go back to the autotuned ones
+ */
+void video_context_set_tuning(VideoContext *ctx, const TuneParams *params);
+
+/**
+ * @brief Copy the context's statistics
+ *
+ * @param ctx Library context
+ * @param stats Output statistics
+ */
+void video_context_get_stats(VideoContext *ctx, VideoStats *stats);
+
+/**
+ * @brief Reset all counters except bytes_live
+ *
+ * @param ctx Library context
+ */
+void video_context_reset_stats(VideoContext *ctx);
+
+/**
+ * @brief Receive progress from decoders, encoders and op programs
+ * Called from the thread running the library call, once per frame or chunk
+ * of frames. total may be an estimate while decoding.
+ *
+ * @param ctx Library context
+ * @param progress_fn Progress callback, NULL to disable
+ * @param user Passed through to the callback
+ */
+void video_context_set_progress(VideoContext *ctx, VideoProgressFn progress_fn, void *user);
+
+/**
+ * @brief Ask the call running on the context to stop
+ * Safe to call from any thread. Long-running functions check the flag per
+ * frame or chunk of frames and fail as if an error occurred.
+ *
+ * @param ctx Library context
+ */
+void video_context_cancel(VideoContext *ctx);
+
+/**
+ * @brief Clear a cancellation request so the context can be used again
+ *
+ * @param ctx Library context
+ */
+void video_context_clear_cancel(VideoContext *ctx);
+
+/**
+ * @brief Whether cancellation has been requested
+ *
+ * @param ctx Library context
+ * @return int 1 if cancelled, 0 otherwise
+ */
+int video_context_cancelled(VideoContext *ctx);
+
+/**
+ * @brief Get the last error message reported through the context
+ *
+ * @param ctx Library context
+ * @return const char* Message, empty string if none
+ */
+const char *video_context_last_error(VideoContext *ctx);
+
+/* ---- Used by the library implementation ---- */
+
+void *video_ctx_alloc(VideoContext *ctx, size_t size);
+void *video_ctx_realloc(VideoContext *ctx, void *ptr, size_t size);
+void video_ctx_free(VideoContext *ctx, void *ptr);
+void video_ctx_log(VideoContext *ctx, VideoLogLevel level, const char *fmt, ...);
+void video_ctx_log_errno(VideoContext *ctx, const char *message);
+VideoContext *video_ctx_create_worker(VideoContext *parent, int worker, int num_workers);
+void video_ctx_destroy_worker(VideoContext *parent, VideoContext *worker);
+const TuneParams *video_ctx_tuning(VideoContext *ctx);
+int video_ctx_threads(VideoContext *ctx, size_t total_bytes);
+void video_ctx_enter_thread(VideoContext *ctx);
+int video_ctx_use_avx2(VideoContext *ctx);
+int video_ctx_deterministic(VideoContext *ctx);
+long video_ctx_max_frames(VideoContext *ctx);
+int video_ctx_spilled(VideoContext *ctx);
+void video_ctx_prefetch(VideoContext *ctx, const void *ptr, size_t size);
+void video_ctx_evict(VideoContext *ctx, const void *ptr, size_t size);
+double video_ctx_kernel_begin(VideoContext *ctx);
+void video_ctx_kernel_end(VideoContext *ctx, double start, long frames);
+void video_ctx_count_decoded(VideoContext *ctx, long frames);
+void video_ctx_count_encoded(VideoContext *ctx, long frames);
+void video_ctx_progress(VideoContext *ctx, VideoStage stage, long done, long total);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_CONTEXT_H
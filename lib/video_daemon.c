@@ -0,0 +1,356 @@
+/**
+ * @brief Video processing daemon
+ * Runs jobs submitted over a Unix domain socket through a VideoScheduler
+ * (each slot on its own CPU partition, short jobs first), so web workers do
+ * not each load the library and start their own OpenMP teams.
+ *
+ * Protocol, one line per message, fields separated by tabs:
+ *   client: JOB <input> <output> <program> <codec> <fps>
+ *           PING
+ *   daemon: ACCEPTED
+ *           QUEUED                       waiting for a slot or memory budget
+ *           PROGRESS <stage> <done> <total>
+ *           DONE | CANCELLED | FAILED <message>
+ *           PONG
+ * Closing the connection while a job runs cancels it.
+ *
+ * The socket is created 0600 and only connections from the daemon's own
+ * user are served. Its default path is $XDG_RUNTIME_DIR/filmmaster.sock, or
+ * /tmp/filmmaster-<uid>/filmmaster.sock in a 0700 directory without one;
+ * FILMMASTER_SOCKET or -s override it.
+ *
+ * With -c, results are kept in a content-addressed cache directory (size
+ * budget -C in MB, default unlimited) and repeated jobs are answered from it.
+ * With -k, up to that many MB of op-prefix checkpoints are kept in memory
+ * (spilling to the cache directory if given) so edited chains resume.
+ * With -d, jobs run deterministically (video_context_set_deterministic), so
+ * an output depends only on the input and the job, never on the host load.
+ * With -S and -m, a job bigger than the memory budget spills the excess to
+ * scratch files in that directory (video_context_set_spill).
+ *
+ * Usage: video_daemon [-s socket_path] [-w slots] [-m memory_budget_mb]
+ *                     [-c cache_dir] [-C cache_budget_mb] [-k checkpoint_mb] [-d]
+ *                     [-S spill_dir]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "video_sched.h"
+
+#define SOCKET_NAME "filmmaster.sock"
+#define MAX_REQUEST 8192
+#define POLL_INTERVAL_MS 100
+
+static const char *g_stage_names[] = {"decode", "process", "encode"};
+
+static VideoScheduler *g_sched;
+static VideoCache *g_cache;
+static VideoCheckpoints *g_checkpoints;
+static const char *g_socket_path;
+static char g_default_path[4096];  // Checked against sun_path by open_socket()
+static volatile sig_atomic_t g_stop = 0;
+
+// Read one line into buffer; returns its length, or -1 on EOF/error/overflow
+static int read_line(int fd, char *buffer, size_t size) {
+    size_t length = 0;
+    while (length + 1 < size) {
+        char c;
+        ssize_t n = read(fd, &c, 1);
+        if (n <= 0) return -1;
+        if (c == '\n') {
+            buffer[length] = '\0';
+            return (int)length;
+        }
+        buffer[length++] = c;
+    }
+    return -1;
+}
+
+// Whether the client has hung up (or sent data mid-job, which is not allowed)
+static int client_gone(int fd) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0) return 0;
+    return 1;
+}
+
+// Split on tabs, keeping empty fields (e.g. an empty program)
+static int split_fields(char *line, char **fields, int max_fields) {
+    int count = 0;
+    char *field;
+    if (!*line) return 0;
+    while (count < max_fields && (field = strsep(&line, "\t")) != NULL) {
+        fields[count++] = field;
+    }
+    return count;
+}
+
+static void run_job(int client, char **fields, int num_fields) {
+    if (num_fields < 3) {
+        dprintf(client, "FAILED\tJOB needs at least <input> <output>\n");
+        return;
+    }
+
+    VideoJobSpec spec;
+    spec.input_path = fields[1];
+    spec.output_path = fields[2];
+    spec.program = num_fields > 3 ? fields[3] : "";
+    spec.codec = num_fields > 4 && *fields[4] ? fields[4] : NULL;
+    spec.fps = num_fields > 5 ? atoi(fields[5]) : 0;
+    spec.cache = g_cache;
+    spec.checkpoints = g_checkpoints;
+
+    VideoJob *job = video_scheduler_submit(g_sched, &spec, NULL, NULL);
+    if (!job) {
+        dprintf(client, "FAILED\t%s\n", video_context_last_error(video_default_context()));
+        return;
+    }
+    dprintf(client, "ACCEPTED\n");
+
+    VideoStage last_stage = VIDEO_STAGE_DECODE;
+    long last_done = -1;
+    int reported_queued = 0;
+    VideoJobState state;
+    for (;;) {
+        VideoStage stage;
+        long done, total;
+        state = video_job_poll(job, &stage, &done, &total);
+        if (state != VIDEO_JOB_QUEUED && state != VIDEO_JOB_RUNNING) break;
+
+        if (state == VIDEO_JOB_QUEUED) {
+            if (!reported_queued) dprintf(client, "QUEUED\n");
+            reported_queued = 1;
+        } else if (stage != last_stage || done != last_done) {
+            dprintf(client, "PROGRESS\t%s\t%ld\t%ld\n", g_stage_names[stage], done, total);
+            last_stage = stage;
+            last_done = done;
+        }
+        if (client_gone(client)) {
+            video_job_cancel(job);
+            state = video_job_wait(job);
+            break;
+        }
+        poll(NULL, 0, POLL_INTERVAL_MS);
+    }
+
+    // Free the job (and its slot) before replying so a client's next job
+    // never queues behind its own previous one
+    char error[256];
+    snprintf(error, sizeof(error), "%s", video_job_error(job));
+    video_job_free(job);
+
+    if (state == VIDEO_JOB_DONE) {
+        dprintf(client, "DONE\n");
+    } else if (state == VIDEO_JOB_CANCELLED) {
+        dprintf(client, "CANCELLED\n");
+    } else {
+        dprintf(client, "FAILED\t%s\n", error);
+    }
+}
+
+static void *client_thread(void *arg) {
+    int client = (int)(long)arg;
+    char line[MAX_REQUEST];
+
+    while (read_line(client, line, sizeof(line)) >= 0) {
+        char *fields[6];
+        int num_fields = split_fields(line, fields, 6);
+        if (num_fields == 0) continue;
+
+        if (strcmp(fields[0], "PING") == 0) {
+            dprintf(client, "PONG\n");
+        } else if (strcmp(fields[0], "JOB") == 0) {
+            run_job(client, fields, num_fields);
+        } else {
+            dprintf(client, "FAILED\tUnknown command: %s\n", fields[0]);
+        }
+    }
+
+    close(client);
+    return NULL;
+}
+
+static void handle_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+// $XDG_RUNTIME_DIR is private to the user; without it, make a directory of
+// our own under /tmp, refusing one another user could have planted
+static const char *default_socket_path(void) {
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        snprintf(g_default_path, sizeof(g_default_path), "%s/" SOCKET_NAME, runtime);
+        return g_default_path;
+    }
+
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/filmmaster-%u", (unsigned)geteuid());
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        perror("Error creating socket directory");
+        return NULL;
+    }
+    struct stat st;
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & 077)) {
+        fprintf(stderr, "Error: %s is not a private directory of this user\n", dir);
+        return NULL;
+    }
+    snprintf(g_default_path, sizeof(g_default_path), "%s/" SOCKET_NAME, dir);
+    return g_default_path;
+}
+
+// Only the daemon's user may submit jobs, whatever the socket's mode
+static int peer_allowed(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0) return 0;
+    return cred.uid == geteuid();
+#else
+    (void)fd;
+    return 1;
+#endif
+}
+
+static int open_socket(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Error creating socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    // Owner-only from the start, not just after the chmod
+    mode_t old_mask = umask(0077);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound < 0 || chmod(path, 0600) < 0 || listen(fd, 64) < 0) {
+        perror("Error binding socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    VideoSchedulerConfig config = {2, 0, 0.0, 0, NULL};
+    const char *cache_dir = NULL;
+    size_t cache_budget = 0;
+    size_t checkpoint_budget = 0;
+    const char *env_path = getenv("FILMMASTER_SOCKET");
+    if (env_path && *env_path) g_socket_path = env_path;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:w:m:c:C:k:dS:")) != -1) {
+        switch (opt) {
+        case 's':
+            g_socket_path = optarg;
+            break;
+        case 'w':
+            config.num_slots = atoi(optarg);
+            break;
+        case 'm':
+            config.memory_budget = (size_t)atol(optarg) << 20;
+            break;
+        case 'c':
+            cache_dir = optarg;
+            break;
+        case 'C':
+            cache_budget = (size_t)atol(optarg) << 20;
+            break;
+        case 'k':
+            checkpoint_budget = (size_t)atol(optarg) << 20;
+            break;
+        case 'd':
+            config.deterministic = 1;
+            break;
+        case 'S':
+            config.spill_dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s socket_path] [-w slots] [-m memory_budget_mb]"
+                    " [-c cache_dir] [-C cache_budget_mb] [-k checkpoint_mb] [-d]"
+                    " [-S spill_dir]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    g_sched = video_scheduler_create(&config);
+    if (!g_sched) return 1;
+    if (cache_dir) {
+        g_cache = video_cache_open(cache_dir, cache_budget);
+        if (!g_cache) return 1;
+    }
+    if (checkpoint_budget) {
+        g_checkpoints = video_checkpoints_create(checkpoint_budget, g_cache);
+        if (!g_checkpoints) return 1;
+    }
+
+    // Warm up: measure or load the kernel tuning and calibrate the cost
+    // model before the first job
+    autotune_get();
+    video_cost_model();
+
+    if (!g_socket_path && !(g_socket_path = default_socket_path())) return 1;
+    int server = open_socket(g_socket_path);
+    if (server < 0) return 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("video_daemon listening on %s\n", g_socket_path);
+    fflush(stdout);
+
+    while (!g_stop) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            perror("Error accepting connection");
+            break;
+        }
+        if (!peer_allowed(client)) {
+            fprintf(stderr, "Refused a connection from another user\n");
+            close(client);
+            continue;
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, client_thread, (void *)(long)client) != 0) {
+            perror("Error starting client thread");
+            close(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(server);
+    unlink(g_socket_path);
+    return 0;
+}
@@ -0,0 +1,360 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+// Raw videos can be over 2 GB; 64-bit off_t where it is not already
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "video_files.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+// No <sys/uio.h>, pread or fadvise: read_at() and write_iov() stand in,
+// and the page cache hints are dropped
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#define posix_fadvise(fd, offset, len, advice) ((void)0)
+#else
+#include <sys/uio.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Frame count, channels, height and width, as written by encode()
+#define RAW_HEADER_BYTES (sizeof(long) + 3)
+
+// Bytes per block of frames read at once; two blocks are in memory
+#define REVERSE_BLOCK_BYTES (4u << 20)
+
+// Frames handed to one write_iov() call
+#define WRITE_IOVECS 64
+
+typedef struct {
+    VideoContext *ctx;
+    int fd;
+    size_t frame_bytes;
+    long num_frames;
+    long block_frames;
+    unsigned char *buffers[2];
+    int full[2];                // Buffer holds a block not yet written
+    int stop;                   // Set by the writer to end the reader early
+    int failed;                 // Set by the reader on a read error
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ReverseReader;
+
+static long block_frames(long num_frames, size_t frame_bytes) {
+    long frames = frame_bytes ? (long)(REVERSE_BLOCK_BYTES / frame_bytes) : 1;
+    if (frames > num_frames) frames = num_frames;
+    return frames < 1 ? 1 : frames;
+}
+
+size_t video_reverse_file_memory(long num_frames, size_t frame_bytes) {
+    return 2 * (size_t)block_frames(num_frames, frame_bytes) * frame_bytes;
+}
+
+// Frames [first, first + count) of the input go in block number block,
+// counting from the end of the video
+static void block_range(const ReverseReader *reader, long block, long *first, long *count) {
+    long last = reader->num_frames - block * reader->block_frames;
+    *first = last > reader->block_frames ? last - reader->block_frames : 0;
+    *count = last - *first;
+}
+
+static off_t frame_offset(const ReverseReader *reader, long frame) {
+    return (off_t)RAW_HEADER_BYTES + (off_t)frame * (off_t)reader->frame_bytes;
+}
+
+static ssize_t read_at(int fd, void *data, size_t size, off_t offset) {
+#ifdef _WIN32
+    OVERLAPPED at;
+    memset(&at, 0, sizeof(at));
+    at.Offset = (DWORD)((unsigned long long)offset & 0xffffffffu);
+    at.OffsetHigh = (DWORD)((unsigned long long)offset >> 32);
+    DWORD n;
+    DWORD chunk = size > (1u << 30) ? (1u << 30) : (DWORD)size;
+    if (!ReadFile((HANDLE)_get_osfhandle(fd), data, chunk, &n, &at)) {
+        if (GetLastError() == ERROR_HANDLE_EOF) return 0;
+        errno = EIO;
+        return -1;
+    }
+    return (ssize_t)n;
+#else
+    return pread(fd, data, size, offset);
+#endif
+}
+
+static ssize_t write_iov(int fd, const struct iovec *iov, int count) {
+#ifdef _WIN32
+    // One buffer per call; write_full() carries on with the rest
+    (void)count;
+    size_t size = iov->iov_len > (1u << 30) ? (1u << 30) : iov->iov_len;
+    return write(fd, iov->iov_base, (unsigned int)size);
+#else
+    return writev(fd, iov, count);
+#endif
+}
+
+static int read_full(int fd, unsigned char *data, size_t size, off_t offset) {
+    while (size) {
+        ssize_t n = read_at(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;
+            return -1;
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, struct iovec *iov, int count) {
+    while (count) {
+        ssize_t n = write_iov(fd, iov, count);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        while (count && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (unsigned char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Write a block's frames last to first, straight from the read buffer
+static int write_reversed(int fd, const unsigned char *block, long count, size_t frame_bytes) {
+    struct iovec iov[WRITE_IOVECS];
+    for (long done = 0; done < count;) {
+        int n = count - done < WRITE_IOVECS ? (int)(count - done) : WRITE_IOVECS;
+        for (int i = 0; i < n; i++) {
+            iov[i].iov_base = (void *)(block + (count - 1 - done - i) * frame_bytes);
+            iov[i].iov_len = frame_bytes;
+        }
+        if (write_full(fd, iov, n) != 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+// I/O thread: fills the two buffers alternately with blocks from the end of
+// the input, each as soon as the writer has emptied it
+static void *reader_thread(void *arg) {
+    ReverseReader *reader = (ReverseReader *)arg;
+    long num_blocks = (reader->num_frames + reader->block_frames - 1) / reader->block_frames;
+
+    for (long block = 0; block < num_blocks; block++) {
+        int slot = block & 1;
+        pthread_mutex_lock(&reader->lock);
+        while (reader->full[slot] && !reader->stop) {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        int stop = reader->stop;
+        pthread_mutex_unlock(&reader->lock);
+        if (stop) break;
+
+        long first, count;
+        block_range(reader, block, &first, &count);
+        off_t offset = frame_offset(reader, first);
+        size_t size = count * reader->frame_bytes;
+
+        // Backward reads defeat the kernel's readahead, so ask for the next
+        // block, which lies before this one, while this one is read
+        if (block + 1 < num_blocks) {
+            long next_first, next_count;
+            block_range(reader, block + 1, &next_first, &next_count);
+            posix_fadvise(reader->fd, frame_offset(reader, next_first),
+                          (off_t)next_count * reader->frame_bytes, POSIX_FADV_WILLNEED);
+        }
+        int ok = read_full(reader->fd, reader->buffers[slot], size, offset) == 0;
+        if (!ok) {
+            video_ctx_log_errno(reader->ctx, "Error reading video frames");
+        } else {
+            // Each block is read once; leave the page cache to the rest of
+            // the system
+            posix_fadvise(reader->fd, offset, size, POSIX_FADV_DONTNEED);
+        }
+
+        pthread_mutex_lock(&reader->lock);
+        if (ok) reader->full[slot] = 1; else reader->failed = 1;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+        if (!ok) break;
+    }
+    return NULL;
+}
+
+// Write frames from the reader as it fills its buffers; returns the number
+// of frames written, or -1
+static long write_blocks(ReverseReader *reader, int out) {
+    VideoContext *ctx = reader->ctx;
+    long written = 0;
+    for (long block = 0; written < reader->num_frames; block++) {
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Reverse cancelled after %ld frames\n", written);
+            return -1;
+        }
+
+        int slot = block & 1;
+        pthread_mutex_lock(&reader->lock);
+        while (!reader->full[slot] && !reader->failed) {
+            pthread_cond_wait(&reader->changed, &reader->lock);
+        }
+        int failed = !reader->full[slot];
+        pthread_mutex_unlock(&reader->lock);
+        if (failed) return -1;
+
+        long first, count;
+        block_range(reader, block, &first, &count);
+        if (write_reversed(out, reader->buffers[slot], count, reader->frame_bytes) != 0) {
+            video_ctx_log_errno(ctx, "Error writing video frames");
+            return -1;
+        }
+
+        pthread_mutex_lock(&reader->lock);
+        reader->full[slot] = 0;
+        pthread_cond_broadcast(&reader->changed);
+        pthread_mutex_unlock(&reader->lock);
+
+        written += count;
+        video_ctx_progress(ctx, VIDEO_STAGE_ENCODE, written, reader->num_frames);
+    }
+    return written;
+}
+
+static long reverse_frames(VideoContext *ctx, int in, int out, long num_frames,
+                           size_t frame_bytes) {
+    ReverseReader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.ctx = ctx;
+    reader.fd = in;
+    reader.frame_bytes = frame_bytes;
+    reader.num_frames = num_frames;
+    reader.block_frames = block_frames(num_frames, frame_bytes);
+
+    size_t block_bytes = reader.block_frames * frame_bytes;
+    reader.buffers[0] = (unsigned char *)video_ctx_alloc(ctx, block_bytes);
+    reader.buffers[1] = (unsigned char *)video_ctx_alloc(ctx, block_bytes);
+    if (!reader.buffers[0] || !reader.buffers[1]) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error allocating reverse buffers\n");
+        video_ctx_free(ctx, reader.buffers[0]);
+        video_ctx_free(ctx, reader.buffers[1]);
+        return -1;
+    }
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.changed, NULL);
+
+    long written = -1;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reader_thread, &reader) != 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error starting reverse I/O thread\n");
+    } else {
+        written = write_blocks(&reader, out);
+
+        pthread_mutex_lock(&reader.lock);
+        reader.stop = 1;
+        pthread_cond_broadcast(&reader.changed);
+        pthread_mutex_unlock(&reader.lock);
+        pthread_join(thread, NULL);
+    }
+
+    pthread_cond_destroy(&reader.changed);
+    pthread_mutex_destroy(&reader.lock);
+    video_ctx_free(ctx, reader.buffers[0]);
+    video_ctx_free(ctx, reader.buffers[1]);
+    return written;
+}
+
+int video_reverse_file(VideoContext *ctx, const char *input, const char *output) {
+    if (!ctx) ctx = video_default_context();
+    if (!input || !output) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to video_reverse_file function.\n");
+        return -1;
+    }
+
+    int in = open(input, O_RDONLY | O_BINARY);
+    if (in < 0) {
+        video_ctx_log_errno(ctx, "Error opening file");
+        return -1;
+    }
+
+    unsigned char header[RAW_HEADER_BYTES];
+    struct stat in_stat;
+    if (read_full(in, header, sizeof(header), 0) != 0 || fstat(in, &in_stat) != 0) {
+        video_ctx_log_errno(ctx, "Error reading video header");
+        close(in);
+        return -1;
+    }
+    long num_frames;
+    memcpy(&num_frames, header, sizeof(long));
+    size_t frame_bytes = (size_t)header[sizeof(long)] * header[sizeof(long) + 1] *
+                         header[sizeof(long) + 2];
+    off_t data_bytes = in_stat.st_size - (off_t)RAW_HEADER_BYTES;
+    if (num_frames < 0 || (frame_bytes && data_bytes / (off_t)frame_bytes < num_frames)) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "%s is not a raw video of %ld frames\n",
+                      input, num_frames);
+        close(in);
+        return -1;
+    }
+
+    // Opening the output truncates it, which would destroy the input
+    struct stat out_stat;
+    if (stat(output, &out_stat) == 0 && out_stat.st_dev == in_stat.st_dev &&
+        out_stat.st_ino == in_stat.st_ino) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Cannot reverse %s into itself\n", input);
+        close(in);
+        return -1;
+    }
+    int out = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (out < 0) {
+        video_ctx_log_errno(ctx, "Error opening output file");
+        close(in);
+        return -1;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_RANDOM);
+
+    struct iovec iov = {header, sizeof(header)};
+    long written = 0;
+    if (write_full(out, &iov, 1) != 0) {
+        video_ctx_log_errno(ctx, "Error writing video header");
+        written = -1;
+    } else if (num_frames && frame_bytes) {
+        written = reverse_frames(ctx, in, out, num_frames, frame_bytes);
+    }
+
+    close(in);
+    int regular = fstat(out, &out_stat) == 0 && S_ISREG(out_stat.st_mode);
+    if (close(out) != 0 && written >= 0) {
+        video_ctx_log_errno(ctx, "Error writing video frames");
+        written = -1;
+    }
+    if (written < 0) {
+        // Do not leave a truncated video that looks complete by its header
+        if (regular) unlink(output);
+        return -1;
+    }
+
+    video_ctx_count_decoded(ctx, num_frames);
+    video_ctx_count_encoded(ctx, num_frames);
+    return 0;
+}
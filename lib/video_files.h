@@ -0,0 +1,47 @@
+#ifndef VIDEO_FILES_H
+#define VIDEO_FILES_H
+
+#include <stddef.h>
+#include "video_context.h"
+
+/**
+ * @brief Out-of-core operations on raw (.bin) video files
+ * These go file to file through fixed-size buffers instead of decoding the
+ * video, so they work on videos larger than memory and run at the speed of
+ * the disk.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Reverse the frames of a raw video file into another file
+ * Blocks of frames are read from the end of the input on an I/O thread,
+ * one block ahead of the frames being written forward to the output, so
+ * reading and writing overlap. Memory use is video_reverse_file_memory()
+ * whatever the length of the video. Progress is reported as frames written
+ * (stage VIDEO_STAGE_ENCODE); cancelling the context stops between blocks.
+ * On failure or cancellation the partial output is removed.
+ *
+ * @param ctx Library context (allocator, logger, progress), or NULL for the default
+ * @param input Raw video to read
+ * @param output Raw video to write, replaced if it exists; must not be the input
+ * @return int 0 on success, -1 on error or cancellation
+ */
+int video_reverse_file(VideoContext *ctx, const char *input, const char *output);
+
+/**
+ * @brief Bytes of buffers video_reverse_file() uses for a video
+ *
+ * @param num_frames Frames in the video
+ * @param frame_bytes Bytes per frame, all channels
+ * @return size_t Buffer bytes
+ */
+size_t video_reverse_file_memory(long num_frames, size_t frame_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_FILES_H
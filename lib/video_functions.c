@@ -4,29 +4,214 @@
 #include <string.h>
 #include <immintrin.h>
 #include <pthread.h>
+#include <sys/stat.h>
 #include "video_functions.h"
+#include "video_kernels.h"
+
+// map_video_S maps files with mmap; on Windows it reads them instead
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 
 #define CLAMP(value, min, max) \
     ((value) < (min) ? (min) : ((value) > (max) ? (max) : (value)))
 
-Video *decode(const char *filename) {
+// Bytes decode_S reads between progress reports and cancellation checks
+#define DECODE_CHUNK_BYTES (8u << 20)
+
+void scale_plane_tiled(unsigned char *data, size_t size, float scale_factor,
+size_t tile_bytes, size_t prefetch_distance) {
+    /**
+     * @brief Scales one channel plane in unrolled tiles, prefetching
+     *        prefetch_distance bytes ahead. Both come from the autotuner.
+     * @param data Pointer to the plane data.
+     * @param size Number of bytes in the plane.
+     * @param scale_factor Factor to scale the values.
+     * @param tile_bytes Bytes per unrolled tile.
+     * @param prefetch_distance Prefetch distance in bytes, 0 disables it.
+     */
+    size_t i = 0;
+    for (; i + tile_bytes <= size; i += tile_bytes) {
+        if (prefetch_distance) {
+            // One prefetch per cache line of the tile
+            for (size_t p = 0; p < tile_bytes; p += 64) {
+                __builtin_prefetch(&data[i + prefetch_distance + p], 0, 1);
+            }
+        }
+
+        for (size_t j = 0; j < tile_bytes; j++) {
+            float scaled_value = data[i + j] * scale_factor;
+            data[i + j] = CLAMP(scaled_value, 0.0f, 255.0f);
+        }
+    }
+
+    for (; i < size; i++) {
+        float scaled_value = data[i] * scale_factor;
+        data[i] = CLAMP(scaled_value, 0.0f, 255.0f);
+    }
+}
+
+void clip_plane_scalar(unsigned char *data, size_t size,
+unsigned char min_value, unsigned char max_value) {
+    /**
+     * @brief Clips one channel plane to [min_value, max_value], portable C.
+     * @param data Pointer to the plane data.
+     * @param size Number of bytes in the plane.
+     * @param min_value Minimum value for clipping.
+     * @param max_value Maximum value for clipping.
+     */
+    for (size_t i = 0; i < size; i++) {
+        data[i] = CLAMP(data[i], min_value, max_value);
+    }
+}
+
+VIDEO_TARGET_AVX2
+void clip_plane_avx2(unsigned char *data, size_t size,
+unsigned char min_value, unsigned char max_value, int streaming) {
+    /**
+     * @brief Clips one channel plane to [min_value, max_value] with AVX2.
+     * @param data Pointer to the plane data.
+     * @param size Number of bytes in the plane.
+     * @param min_value Minimum value for clipping.
+     * @param max_value Maximum value for clipping.
+     * @param streaming 1 to bypass the cache with non-temporal stores.
+     */
+    __m256i min_val_vec = _mm256_set1_epi8(min_value);
+    __m256i max_val_vec = _mm256_set1_epi8(max_value);
+    size_t i = 0;
+
+    if (streaming) {
+        // Non-temporal stores need 32-byte alignment
+        for (; i < size && ((uintptr_t)&data[i] & 31); i++) {
+            data[i] = CLAMP(data[i], min_value, max_value);
+        }
+        for (; i + 31 < size; i += 32) {
+            __m256i pixels = _mm256_load_si256((__m256i *)&data[i]);
+            pixels = _mm256_min_epu8(_mm256_max_epu8(pixels, min_val_vec),
+            max_val_vec);
+            _mm256_stream_si256((__m256i *)&data[i], pixels);
+        }
+        _mm_sfence();
+    } else {
+        for (; i + 31 < size; i += 32) {
+            __m256i pixels = _mm256_loadu_si256((__m256i *)&data[i]);
+            pixels = _mm256_min_epu8(_mm256_max_epu8(pixels, min_val_vec),
+            max_val_vec);
+            _mm256_storeu_si256((__m256i *)&data[i], pixels);
+        }
+    }
+
+    for (; i < size; i++) {
+        data[i] = CLAMP(data[i], min_value, max_value);
+    }
+}
+
+VIDEO_TARGET_AVX2
+static inline __m256i scale_32_avx2(const unsigned char *src, __m256 factor_vec) {
+    // Widen 4x8 pixels to float, scale, clamp in float like the scalar CLAMP
+    // (out-of-range floats would convert to INT_MIN), then truncate
+    const __m256 lo = _mm256_setzero_ps();
+    const __m256 hi = _mm256_set1_ps(255.0f);
+    __m256i i0 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i *)&src[0]))), factor_vec), lo), hi));
+    __m256i i1 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i *)&src[8]))), factor_vec), lo), hi));
+    __m256i i2 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i *)&src[16]))), factor_vec), lo), hi));
+    __m256i i3 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(
+        _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i *)&src[24]))), factor_vec), lo), hi));
+
+    // Lanes are already in [0, 255]; pack, then undo the per-lane interleave
+    __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(i0, i1),
+                                         _mm256_packus_epi32(i2, i3));
+    return _mm256_permutevar8x32_epi32(packed,
+                                       _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+VIDEO_TARGET_AVX2
+void scale_plane_avx2(unsigned char *data, size_t size, float scale_factor,
+int streaming) {
+    /**
+     * @brief Scales one channel plane with AVX2. Results match the scalar
+     *        kernel for finite factors (clamp to [0, 255] in float, then
+     *        truncate); NaN products become 0.
+     * @param data Pointer to the plane data.
+     * @param size Number of bytes in the plane.
+     * @param scale_factor Factor to scale the values.
+     * @param streaming 1 to bypass the cache with non-temporal stores.
+     */
+    __m256 factor_vec = _mm256_set1_ps(scale_factor);
+    size_t i = 0;
+
+    if (streaming) {
+        for (; i < size && ((uintptr_t)&data[i] & 31); i++) {
+            float scaled_value = data[i] * scale_factor;
+            data[i] = CLAMP(scaled_value, 0.0f, 255.0f);
+        }
+        for (; i + 31 < size; i += 32) {
+            _mm256_stream_si256((__m256i *)&data[i],
+                                scale_32_avx2(&data[i], factor_vec));
+        }
+        _mm_sfence();
+    } else {
+        for (; i + 31 < size; i += 32) {
+            _mm256_storeu_si256((__m256i *)&data[i],
+                                scale_32_avx2(&data[i], factor_vec));
+        }
+    }
+
+    for (; i < size; i++) {
+        float scaled_value = data[i] * scale_factor;
+        data[i] = CLAMP(scaled_value, 0.0f, 255.0f);
+    }
+}
+
+static void clip_plane(VideoContext *ctx, unsigned char *data, size_t size,
+unsigned char min_value, unsigned char max_value, int streaming) {
+    // ISA dispatch for one plane
+    if (video_ctx_use_avx2(ctx)) {
+        clip_plane_avx2(data, size, min_value, max_value, streaming);
+    } else {
+        clip_plane_scalar(data, size, min_value, max_value);
+    }
+}
+
+static void scale_plane(VideoContext *ctx, unsigned char *data, size_t size,
+float scale_factor, int streaming) {
+    if (video_ctx_use_avx2(ctx)) {
+        scale_plane_avx2(data, size, scale_factor, streaming);
+    } else {
+        const TuneParams *tune = video_ctx_tuning(ctx);
+        scale_plane_tiled(data, size, scale_factor, tune->tile_bytes,
+                          tune->prefetch_distance);
+    }
+}
+
+Video *decode_ctx(VideoContext *ctx, const char *filename) {
     /**
      * @brief Decodes a video file into a Video structure.
      * 
+     * @param ctx Library context.
      * @param filename Path to the video file.
      * @return Pointer to a Video structure containing the video
      *         data, or NULL if an error occurred.
      */
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        perror("Error opening file");
+        video_ctx_log_errno(ctx, "Error opening file");
         return NULL;
     }
 
-    Video *video = (Video *)_mm_malloc(sizeof(Video), 64);
+    Video *video = (Video *)video_ctx_alloc(ctx, sizeof(Video));
     if (!video) {
-        perror("Error allocating memory for Video");
+        video_ctx_log_errno(ctx, "Error allocating memory for Video");
         fclose(file);
         return NULL;
     }
@@ -35,8 +220,16 @@ Video *decode(const char *filename) {
         fread(&video->channels, sizeof(unsigned char), 1, file) != 1 ||
         fread(&video->height, sizeof(unsigned char), 1, file) != 1 ||
         fread(&video->width, sizeof(unsigned char), 1, file) != 1) {
-        perror("Error reading video header");
-        free(video);
+        video_ctx_log_errno(ctx, "Error reading video header");
+        video_ctx_free(ctx, video);
+        fclose(file);
+        return NULL;
+    }
+
+    if (video_ctx_max_frames(ctx) && video->num_frames > video_ctx_max_frames(ctx)) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Video has %ld frames, limit is %ld.\n",
+        video->num_frames, video_ctx_max_frames(ctx));
+        video_ctx_free(ctx, video);
         fclose(file);
         return NULL;
     }
@@ -44,44 +237,46 @@ Video *decode(const char *filename) {
     size_t frame_size = video->channels * video->height * video->width;
     size_t total_size = frame_size * video->num_frames;
 
-    video->data = (unsigned char *)_mm_malloc(total_size, 64);
+    video->data = (unsigned char *)video_ctx_alloc(ctx, total_size);
     if (!video->data) {
-        perror("Error allocating memory for frame data");
-        free(video);
+        video_ctx_log_errno(ctx, "Error allocating memory for frame data");
+        video_ctx_free(ctx, video);
         fclose(file);
         return NULL;
     }
 
     if (fread(video->data, 1, total_size, file) != total_size) {
-        perror("Error reading frame data");
-        free(video->data);
-        free(video);
+        video_ctx_log_errno(ctx, "Error reading frame data");
+        video_ctx_free(ctx, video->data);
+        video_ctx_free(ctx, video);
         fclose(file);
         return NULL;
     }
 
     fclose(file);
+    video_ctx_count_decoded(ctx, video->num_frames);
     return video;
 }
 
-SVideo *decode_S(const char *filename) {
+SVideo *decode_S_ctx(VideoContext *ctx, const char *filename) {
     /**
      * @brief Decodes a video file into a contiguous memory block
      *        -S mode
      * 
+     * @param ctx Library context.
      * @param filename Path to the video file.
      * @return Pointer to a SVideo structure containing the video
      *         data, or NULL if an error occurred.
      */
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        perror("Error opening file");
+        video_ctx_log_errno(ctx, "Error opening file");
         return NULL;
     }
 
-    SVideo *svideo = (SVideo *)_mm_malloc(sizeof(SVideo),64);
+    SVideo *svideo = (SVideo *)video_ctx_alloc(ctx, sizeof(SVideo));
     if (!svideo) {
-        perror("Error allocating memory for SVideo");
+        video_ctx_log_errno(ctx, "Error allocating memory for SVideo");
         fclose(file);
         return NULL;
     }
@@ -90,8 +285,16 @@ SVideo *decode_S(const char *filename) {
         fread(&svideo->channels, sizeof(unsigned char), 1, file) != 1 ||
         fread(&svideo->height, sizeof(unsigned char), 1, file) != 1 ||
         fread(&svideo->width, sizeof(unsigned char), 1, file) != 1) {
-        perror("Error reading video header");
-        free(svideo);
+        video_ctx_log_errno(ctx, "Error reading video header");
+        video_ctx_free(ctx, svideo);
+        fclose(file);
+        return NULL;
+    }
+
+    if (video_ctx_max_frames(ctx) && svideo->num_frames > video_ctx_max_frames(ctx)) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Video has %ld frames, limit is %ld.\n",
+        svideo->num_frames, video_ctx_max_frames(ctx));
+        video_ctx_free(ctx, svideo);
         fclose(file);
         return NULL;
     }
@@ -108,10 +311,10 @@ SVideo *decode_S(const char *filename) {
         num_frames * num_channels * sizeof(Channel) +
         total_channel_data_size;
 
-    unsigned char *memory_block = (unsigned char *)_mm_malloc(total_size,64);
+    unsigned char *memory_block = (unsigned char *)video_ctx_alloc(ctx, total_size);
     if (!memory_block) {
-        perror("Error allocating contiguous memory block");
-        free(svideo);
+        video_ctx_log_errno(ctx, "Error allocating contiguous memory block");
+        video_ctx_free(ctx, svideo);
         fclose(file);
         return NULL;
     }
@@ -133,39 +336,65 @@ num_frames * num_channels * sizeof(Channel);
             frame->channels[channel_idx].data = data_block +
             frame_idx * num_channels * frame_size +
             channel_idx * frame_size;
+            frame->channels[channel_idx].ref = NULL;
         }
     }
 
-    if (fread(data_block, 1, total_channel_data_size, file)
-    != total_channel_data_size) {
-        perror("Error reading channel data");
-        free(memory_block);
-        free(svideo);
-        fclose(file);
-        return NULL;
+    // Read in chunks of frames so progress and cancellation are seen
+    // while large videos load
+    size_t frame_bytes = num_channels * frame_size;
+    long chunk_frames = frame_bytes ? (long)(DECODE_CHUNK_BYTES / frame_bytes) : num_frames;
+    if (chunk_frames < 1) chunk_frames = 1;
+
+    for (long first = 0; first < num_frames; first += chunk_frames) {
+        long count = num_frames - first < chunk_frames ? num_frames - first : chunk_frames;
+        size_t chunk_size = count * frame_bytes;
+
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Decoding cancelled after %ld frames\n", first);
+            video_ctx_free(ctx, memory_block);
+            video_ctx_free(ctx, svideo);
+            fclose(file);
+            return NULL;
+        }
+
+        if (fread(data_block + first * frame_bytes, 1, chunk_size, file) != chunk_size) {
+            video_ctx_log_errno(ctx, "Error reading channel data");
+            video_ctx_free(ctx, memory_block);
+            video_ctx_free(ctx, svideo);
+            fclose(file);
+            return NULL;
+        }
+
+        // Frames read into a spilled block are not needed again until
+        // processing, so let them go to disk before anything else
+        video_ctx_evict(ctx, data_block + first * frame_bytes, chunk_size);
+        video_ctx_progress(ctx, VIDEO_STAGE_DECODE, first + count, num_frames);
     }
 
     fclose(file);
+    video_ctx_count_decoded(ctx, svideo->num_frames);
     return svideo;
 }
 
-MVideo *decode_M(const char *filename) {
+MVideo *decode_M_ctx(VideoContext *ctx, const char *filename) {
     /**
      * @brief Decodes a video file into a Video structure.
      * 
+     * @param ctx Library context.
      * @param filename Path to the video file.
      * @return Pointer to a Video structure containing the video
      *         data, or NULL if an error occurred.
      */
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        perror("Error opening file");
+        video_ctx_log_errno(ctx, "Error opening file");
         return NULL;
     }
 
-    MVideo *video = (MVideo *)_mm_malloc(sizeof(MVideo),64);
+    MVideo *video = (MVideo *)video_ctx_alloc(ctx, sizeof(MVideo));
     if (!video) {
-        perror("Error allocating memory for Video");
+        video_ctx_log_errno(ctx, "Error allocating memory for Video");
         fclose(file);
         return NULL;
     }
@@ -174,8 +403,16 @@ MVideo *decode_M(const char *filename) {
         fread(&video->channels, sizeof(unsigned char), 1, file) != 1 ||
         fread(&video->height, sizeof(unsigned char), 1, file) != 1 ||
         fread(&video->width, sizeof(unsigned char), 1, file) != 1) {
-        perror("Error reading video header");
-        free(video);
+        video_ctx_log_errno(ctx, "Error reading video header");
+        video_ctx_free(ctx, video);
+        fclose(file);
+        return NULL;
+    }
+
+    if (video_ctx_max_frames(ctx) && video->num_frames > video_ctx_max_frames(ctx)) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Video has %ld frames, limit is %ld.\n",
+        video->num_frames, video_ctx_max_frames(ctx));
+        video_ctx_free(ctx, video);
         fclose(file);
         return NULL;
     }
@@ -183,84 +420,533 @@ MVideo *decode_M(const char *filename) {
     size_t frame_size = video->channels * video->height * video->width;
     size_t total_size = frame_size * video->num_frames;
 
-    video->data = (unsigned char *)_mm_malloc(total_size,64);
+    video->data = (unsigned char *)video_ctx_alloc(ctx, total_size);
     if (!video->data) {
-        perror("Error allocating memory for frame data");
-        free(video);
+        video_ctx_log_errno(ctx, "Error allocating memory for frame data");
+        video_ctx_free(ctx, video);
         fclose(file);
         return NULL;
     }
 
     if (fread(video->data, 1, total_size, file) != total_size) {
-        perror("Error reading frame data");
-        free(video->data);
-        free(video);
+        video_ctx_log_errno(ctx, "Error reading frame data");
+        video_ctx_free(ctx, video->data);
+        video_ctx_free(ctx, video);
         fclose(file);
         return NULL;
     }
 
     fclose(file);
+    video_ctx_count_decoded(ctx, video->num_frames);
     return video;
 }
 
-void free_video(Video *video) {
+void free_video_ctx(VideoContext *ctx, Video *video) {
     /**
      * @brief Frees memory allocated for a Video structure.
      * 
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      */
     if (video) {
-        free(video->data);
-        free(video);
+        video_ctx_free(ctx, video->data);
+        video_ctx_free(ctx, video);
     }
 }
 
-void free_video_S(SVideo *video) {
+// Planes shared between videos by snapshot_video_S. A video either owns
+// all its planes (they sit in its frames block, refs are NULL) or refers
+// to every plane through a share count; planes live in blocks that are
+// freed once none of their planes is used. map_video_S's blocks are file
+// mappings, unmapped instead.
+typedef struct PlaneBlock PlaneBlock;
+
+struct VideoPlaneRef {
+    unsigned int count;         // Videos using the plane
+    PlaneBlock *block;
+};
+
+struct PlaneBlock {
+    long live;                  // Planes in the block still used
+    VideoContext *ctx;          // Context the block was allocated from
+    void *memory;               // Plane data, freed with the block
+    size_t mapped;              // Bytes of file mapped at memory, 0 if allocated
+    VideoPlaneRef refs[];
+};
+
+static PlaneBlock *plane_block_create(VideoContext *ctx, long num_planes, void *memory) {
+    PlaneBlock *block = (PlaneBlock *)video_ctx_alloc(ctx,
+        sizeof(PlaneBlock) + num_planes * sizeof(VideoPlaneRef));
+    if (!block) return NULL;
+
+    block->live = num_planes;
+    block->ctx = ctx;
+    block->memory = memory;
+    block->mapped = 0;
+    for (long i = 0; i < num_planes; i++) {
+        block->refs[i].count = 1;
+        block->refs[i].block = block;
+    }
+    return block;
+}
+
+static void plane_release(VideoPlaneRef *ref) {
+    if (__atomic_sub_fetch(&ref->count, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    PlaneBlock *block = ref->block;
+    if (__atomic_sub_fetch(&block->live, 1, __ATOMIC_ACQ_REL) != 0) return;
+    if (block->mapped) {
+#ifndef _WIN32
+        munmap(block->memory, block->mapped);
+#endif
+    } else {
+        video_ctx_free(block->ctx, block->memory);
+    }
+    video_ctx_free(block->ctx, block);
+}
+
+void retain_plane_S(VideoPlaneRef *ref) {
+    if (ref) __atomic_add_fetch(&ref->count, 1, __ATOMIC_RELAXED);
+}
+
+void release_plane_S(VideoPlaneRef *ref) {
+    if (ref) plane_release(ref);
+}
+
+static Frame *frame_arrays_alloc(VideoContext *ctx, long num_frames,
+unsigned char num_channels) {
+    // Frame and Channel arrays without plane data
+    Frame *frames = (Frame *)video_ctx_alloc(ctx,
+        num_frames * (sizeof(Frame) + num_channels * sizeof(Channel)));
+    if (!frames) return NULL;
+
+    Channel *channels = (Channel *)(frames + num_frames);
+    for (long frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+        frames[frame_idx].channels = channels + frame_idx * num_channels;
+    }
+    return frames;
+}
+
+static int unshare_channel(VideoContext *ctx, SVideo *video, unsigned char channel) {
+    /**
+     * @brief Copies the planes of a channel that other videos still use
+     *        into a new block, so a kernel can write the channel in place.
+     * @return 0 on success, -1 if the copies could not be allocated.
+     */
+    long num_frames = video->num_frames;
+    long *shared = (long *)video_ctx_alloc(ctx, num_frames * sizeof(long));
+    if (!shared && num_frames) {
+        video_ctx_log_errno(ctx, "Error allocating shared plane list");
+        return -1;
+    }
+
+    long num_shared = 0;
+    for (long frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+        VideoPlaneRef *ref = video->frames[frame_idx].channels[channel].ref;
+        if (ref && __atomic_load_n(&ref->count, __ATOMIC_ACQUIRE) > 1) {
+            shared[num_shared++] = frame_idx;
+        }
+    }
+    if (!num_shared) {
+        video_ctx_free(ctx, shared);
+        return 0;
+    }
+
+    size_t plane_size = (size_t)video->height * video->width;
+    unsigned char *memory = (unsigned char *)video_ctx_alloc(ctx, num_shared * plane_size);
+    PlaneBlock *block = memory ? plane_block_create(ctx, num_shared, memory) : NULL;
+    if (!block) {
+        video_ctx_log_errno(ctx, "Error allocating copies of shared planes");
+        video_ctx_free(ctx, memory);
+        video_ctx_free(ctx, shared);
+        return -1;
+    }
+
+    #pragma omp parallel num_threads(video_ctx_threads(ctx, num_shared * plane_size))
+    {
+        video_ctx_enter_thread(ctx);
+
+        #pragma omp for
+        for (long i = 0; i < num_shared; i++) {
+            const Channel *plane = &video->frames[shared[i]].channels[channel];
+            memcpy(memory + i * plane_size, plane->data, plane_size);
+        }
+    }
+
+    for (long i = 0; i < num_shared; i++) {
+        Channel *plane = &video->frames[shared[i]].channels[channel];
+        plane_release(plane->ref);
+        plane->data = memory + i * plane_size;
+        plane->ref = &block->refs[i];
+    }
+
+    video_ctx_free(ctx, shared);
+    return 0;
+}
+
+SVideo *snapshot_video_S_ctx(VideoContext *ctx, SVideo *video) {
+    /**
+     * @brief Takes a copy-on-write snapshot of a SVideo. The snapshot
+     *        shares every plane with the video, so it costs O(frames);
+     *        a kernel writing to a plane that is still shared copies that
+     *        plane first. Free the snapshot with free_video_S.
+     *        The video is given new frame arrays the first time, so
+     *        pointers into video->frames must not be kept across a call.
+     *        Planes copied by a kernel come from that kernel's context,
+     *        which must outlive the videos using them.
+     * @param ctx Library context the video was allocated from.
+     * @param video Pointer to the SVideo structure to snapshot.
+     * @return Pointer to the snapshot, or NULL if an error occurred.
+     */
+    if (!video || !video->frames) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to snapshot_video_S function.\n");
+        return NULL;
+    }
+
+    long num_frames = video->num_frames;
+    unsigned char num_channels = video->channels;
+    long num_owned = 0;
+    for (long frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+        for (unsigned char channel_idx = 0; channel_idx < num_channels; channel_idx++) {
+            num_owned += video->frames[frame_idx].channels[channel_idx].ref == NULL;
+        }
+    }
+
+    SVideo *snapshot = (SVideo *)video_ctx_alloc(ctx, sizeof(SVideo));
+    Frame *snapshot_frames = frame_arrays_alloc(ctx, num_frames, num_channels);
+    // Owned planes sit in the video's frames block, which becomes a shared
+    // block of planes; the video gets frame arrays of its own
+    Frame *video_frames = num_owned ?
+        frame_arrays_alloc(ctx, num_frames, num_channels) : video->frames;
+    PlaneBlock *block = num_owned ?
+        plane_block_create(ctx, num_owned, video->frames) : NULL;
+    if (!snapshot || !snapshot_frames || !video_frames || (num_owned && !block)) {
+        video_ctx_log_errno(ctx, "Error allocating memory for SVideo snapshot");
+        video_ctx_free(ctx, snapshot);
+        video_ctx_free(ctx, snapshot_frames);
+        if (video_frames != video->frames) video_ctx_free(ctx, video_frames);
+        video_ctx_free(ctx, block);
+        return NULL;
+    }
+
+    long next_owned = 0;
+    for (long frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+        for (unsigned char channel_idx = 0; channel_idx < num_channels; channel_idx++) {
+            Channel plane = video->frames[frame_idx].channels[channel_idx];
+            if (!plane.ref) plane.ref = &block->refs[next_owned++];
+            __atomic_add_fetch(&plane.ref->count, 1, __ATOMIC_RELAXED);
+
+            video_frames[frame_idx].channels[channel_idx] = plane;
+            snapshot_frames[frame_idx].channels[channel_idx] = plane;
+        }
+    }
+
+    *snapshot = *video;
+    snapshot->frames = snapshot_frames;
+    video->frames = video_frames;
+    return snapshot;
+}
+
+void free_video_S_ctx(VideoContext *ctx, SVideo *video) {
     /**
      * @brief Frees memory allocated for a SVideo structure.
+     *        Planes shared with snapshots are freed with their last user.
      * 
+     * @param ctx Library context.
      * @param video Pointer to the SVideo structure.
      */
     if (!video) return;
 
-    free(video->frames);
-    free(video);
+    if (video->frames) {
+        for (long frame_idx = 0; frame_idx < video->num_frames; frame_idx++) {
+            for (unsigned char channel_idx = 0; channel_idx < video->channels; channel_idx++) {
+                VideoPlaneRef *ref = video->frames[frame_idx].channels[channel_idx].ref;
+                if (ref) plane_release(ref);
+            }
+        }
+    }
+    video_ctx_free(ctx, video->frames);
+    video_ctx_free(ctx, video);
 }
 
-void free_video_M(MVideo *video) {
+SVideo *copy_video_S_ctx(VideoContext *ctx, const SVideo *video) {
+    /**
+     * @brief Copies a SVideo into a new contiguous memory block, with the
+     *        frames in their current order.
+     *
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure to copy.
+     * @return Pointer to the copy, or NULL if an error occurred.
+     */
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to copy_video_S function.\n");
+        return NULL;
+    }
+
+    long num_frames = video->num_frames;
+    unsigned char num_channels = video->channels;
+    size_t frame_size = (size_t)video->height * video->width;
+    size_t total_size =
+        num_frames * sizeof(Frame) +
+        num_frames * num_channels * sizeof(Channel) +
+        num_frames * num_channels * frame_size;
+
+    SVideo *copy = (SVideo *)video_ctx_alloc(ctx, sizeof(SVideo));
+    unsigned char *memory_block = (unsigned char *)video_ctx_alloc(ctx, total_size);
+    if (!copy || !memory_block) {
+        video_ctx_log_errno(ctx, "Error allocating memory for SVideo copy");
+        video_ctx_free(ctx, copy);
+        video_ctx_free(ctx, memory_block);
+        return NULL;
+    }
+
+    *copy = *video;
+    copy->frames = (Frame *)memory_block;
+    Channel *channels_block = (Channel *)(memory_block + num_frames * sizeof(Frame));
+    unsigned char *data_block = (unsigned char *)(channels_block + num_frames * num_channels);
+
+    // Planes are copied through the frame pointers, as reverses and swaps
+    // reorder the pointers rather than the data
+    #pragma omp parallel num_threads(video_ctx_threads(ctx, total_size))
+    {
+        video_ctx_enter_thread(ctx);
+
+        #pragma omp for
+        for (long frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+            Frame *frame = &copy->frames[frame_idx];
+            frame->channels = channels_block + frame_idx * num_channels;
+            for (unsigned char channel_idx = 0; channel_idx < num_channels; channel_idx++) {
+                unsigned char *plane = data_block +
+                    (frame_idx * num_channels + channel_idx) * frame_size;
+                memcpy(plane, video->frames[frame_idx].channels[channel_idx].data, frame_size);
+                frame->channels[channel_idx].data = plane;
+                frame->channels[channel_idx].ref = NULL;
+            }
+        }
+    }
+
+    return copy;
+}
+
+SVideo *proxy_video_S_ctx(VideoContext *ctx, const SVideo *video, int max_side,
+                          long frame_step, long max_frames) {
+    /**
+     * @brief Builds a small stand-in for a SVideo, for previews: every
+     *        frame_step-th frame, at most max_frames of them, each
+     *        box-filtered down by the smallest whole factor that fits
+     *        max_side. Pixel (x, y) of the proxy covers pixels
+     *        [x * factor, (x + 1) * factor) of the source, so regions
+     *        scale by dividing by the factor.
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure to shrink.
+     * @param max_side Longest side of a proxy frame, 0 to keep the size.
+     * @param frame_step Source frames per proxy frame, at least 1.
+     * @param max_frames Most frames to keep, 0 for no limit.
+     * @return Pointer to the proxy, in one contiguous block, or NULL if an
+     *         error occurred.
+     */
+    if (!video || max_side < 0 || frame_step < 1 || max_frames < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to proxy_video_S function.\n");
+        return NULL;
+    }
+
+    int side = video->width > video->height ? video->width : video->height;
+    int factor = max_side && side > max_side ? (side + max_side - 1) / max_side : 1;
+    unsigned char width = video->width / factor > 0 ? video->width / factor : 1;
+    unsigned char height = video->height / factor > 0 ? video->height / factor : 1;
+    long num_frames = (video->num_frames + frame_step - 1) / frame_step;
+    if (max_frames && num_frames > max_frames) num_frames = max_frames;
+
+    unsigned char num_channels = video->channels;
+    size_t frame_size = (size_t)height * width;
+    size_t total_size =
+        num_frames * sizeof(Frame) +
+        num_frames * num_channels * sizeof(Channel) +
+        num_frames * num_channels * frame_size;
+
+    SVideo *proxy = (SVideo *)video_ctx_alloc(ctx, sizeof(SVideo));
+    unsigned char *memory_block = (unsigned char *)video_ctx_alloc(ctx, total_size ? total_size : 1);
+    if (!proxy || !memory_block) {
+        video_ctx_log_errno(ctx, "Error allocating memory for SVideo proxy");
+        video_ctx_free(ctx, proxy);
+        video_ctx_free(ctx, memory_block);
+        return NULL;
+    }
+
+    proxy->num_frames = num_frames;
+    proxy->channels = num_channels;
+    proxy->height = height;
+    proxy->width = width;
+    proxy->frames = (Frame *)memory_block;
+    Channel *channels_block = (Channel *)(memory_block + num_frames * sizeof(Frame));
+    unsigned char *data_block = (unsigned char *)(channels_block + num_frames * num_channels);
+
+    #pragma omp parallel num_threads(video_ctx_threads(ctx, total_size * factor * factor))
+    {
+        video_ctx_enter_thread(ctx);
+
+        #pragma omp for
+        for (long frame_idx = 0; frame_idx < num_frames; frame_idx++) {
+            const Frame *source = &video->frames[frame_idx * frame_step];
+            Frame *frame = &proxy->frames[frame_idx];
+            frame->channels = channels_block + frame_idx * num_channels;
+            for (unsigned char channel_idx = 0; channel_idx < num_channels; channel_idx++) {
+                const unsigned char *in = source->channels[channel_idx].data;
+                unsigned char *plane = data_block +
+                    (frame_idx * num_channels + channel_idx) * frame_size;
+                frame->channels[channel_idx].data = plane;
+                frame->channels[channel_idx].ref = NULL;
+                if (factor == 1) {
+                    memcpy(plane, in, frame_size);
+                    continue;
+                }
+                for (int y = 0; y < height; y++) {
+                    int y0 = y * factor;
+                    int y1 = y0 + factor < video->height ? y0 + factor : video->height;
+                    for (int x = 0; x < width; x++) {
+                        int x0 = x * factor;
+                        int x1 = x0 + factor < video->width ? x0 + factor : video->width;
+                        unsigned int sum = 0;
+                        for (int sy = y0; sy < y1; sy++) {
+                            const unsigned char *row = in + (size_t)sy * video->width;
+                            for (int sx = x0; sx < x1; sx++) sum += row[sx];
+                        }
+                        unsigned int area = (unsigned int)((y1 - y0) * (x1 - x0));
+                        plane[(size_t)y * width + x] = (unsigned char)((sum + area / 2) / area);
+                    }
+                }
+            }
+        }
+    }
+
+    return proxy;
+}
+
+SVideo *map_video_S_ctx(VideoContext *ctx, const char *filename) {
+    /**
+     * @brief Maps a raw video file as a SVideo instead of reading it.
+     *        The planes point into a private mapping of the file, so
+     *        pages are read on first use and shared with the page cache,
+     *        and with every other process mapping the file, until a
+     *        kernel writes them, which copies just those pages. The file
+     *        must not be truncated or rewritten in place while mapped;
+     *        replacing or unlinking it is safe.
+     * @param ctx Library context.
+     * @param filename Path to the video file.
+     *        Windows has no mmap, so there the file is read with decode_S.
+     * @return Pointer to the SVideo, to free with free_video_S, or NULL
+     *         if an error occurred.
+     */
+#ifdef _WIN32
+    return decode_S_ctx(ctx, filename);
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        video_ctx_log_errno(ctx, "Error opening file");
+        return NULL;
+    }
+
+    unsigned char header[sizeof(long) + 3];
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        video_ctx_log_errno(ctx, "Error reading video header");
+        close(fd);
+        return NULL;
+    }
+
+    SVideo head;
+    memcpy(&head.num_frames, header, sizeof(long));
+    head.channels = header[sizeof(long)];
+    head.height = header[sizeof(long) + 1];
+    head.width = header[sizeof(long) + 2];
+    size_t plane_size = (size_t)head.height * head.width;
+    long num_planes = head.num_frames * head.channels;
+    if (head.num_frames < 0 || (plane_size && (size_t)(st.st_size - sizeof(header)) /
+                                              plane_size < (size_t)num_planes)) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "%s is not a raw video of %ld frames\n",
+                      filename, head.num_frames);
+        close(fd);
+        return NULL;
+    }
+    if (video_ctx_max_frames(ctx) && head.num_frames > video_ctx_max_frames(ctx)) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Video has %ld frames, limit is %ld.\n",
+        head.num_frames, video_ctx_max_frames(ctx));
+        close(fd);
+        return NULL;
+    }
+
+    size_t mapped = (size_t)st.st_size;
+    unsigned char *memory = (unsigned char *)mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        video_ctx_log_errno(ctx, "Error mapping video file");
+        return NULL;
+    }
+
+    SVideo *svideo = (SVideo *)video_ctx_alloc(ctx, sizeof(SVideo));
+    Frame *frames = frame_arrays_alloc(ctx, head.num_frames, head.channels);
+    PlaneBlock *block = num_planes ? plane_block_create(ctx, num_planes, memory) : NULL;
+    if (!svideo || !frames || (num_planes && !block)) {
+        video_ctx_log_errno(ctx, "Error allocating memory for SVideo");
+        video_ctx_free(ctx, svideo);
+        video_ctx_free(ctx, frames);
+        video_ctx_free(ctx, block);
+        munmap(memory, mapped);
+        return NULL;
+    }
+    if (block) block->mapped = mapped; else munmap(memory, mapped);
+
+    *svideo = head;
+    svideo->frames = frames;
+    for (long frame_idx = 0; frame_idx < head.num_frames; frame_idx++) {
+        for (unsigned char channel_idx = 0; channel_idx < head.channels; channel_idx++) {
+            long plane = frame_idx * head.channels + channel_idx;
+            frames[frame_idx].channels[channel_idx].data = memory + sizeof(header) +
+                                                           plane * plane_size;
+            frames[frame_idx].channels[channel_idx].ref = &block->refs[plane];
+        }
+    }
+    return svideo;
+#endif
+}
+
+void free_video_M_ctx(VideoContext *ctx, MVideo *video) {
     /**
      * @brief Frees memory allocated for a MVideo structure.
      * 
+     * @param ctx Library context.
      * @param video Pointer to the MVideo structure.
      */
     if (!video) return;
 
     //  printf("Freeing video->data\n"); debug
     if (video->data) {
-        free(video->data);
+        video_ctx_free(ctx, video->data);
         video->data = NULL;
     }
 
     //  printf("Freeing MVideo struct\n"); debug
-    free(video);
+    video_ctx_free(ctx, video);
 }
 
-int encode(const char *filename, const Video *video) {
+int encode_ctx(VideoContext *ctx, const char *filename, const Video *video) {
     /**
      * @brief Encodes a Video structure into a video file.
      *        -O mode, no optimisation
+     * @param ctx Library context.
      * @param filename Path to the output video file.
      * @param video Pointer to the Video structure.
      * @return 0 if successful, -1 if an error occurred.
      */
     if (!filename || !video) {
-        fprintf(stderr, "Invalid input to encode function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to encode function.\n");
         return -1;
     }
 
     FILE *file = fopen(filename, "wb");
     if (!file) {
-        perror("Error opening file for writing");
+        video_ctx_log_errno(ctx, "Error opening file for writing");
         return -1;
     }
 
@@ -268,7 +954,7 @@ int encode(const char *filename, const Video *video) {
         fwrite(&video->channels, sizeof(unsigned char), 1, file) != 1 ||
         fwrite(&video->height, sizeof(unsigned char), 1, file) != 1 ||
         fwrite(&video->width, sizeof(unsigned char), 1, file) != 1) {
-        perror("Error writing video header");
+        video_ctx_log_errno(ctx, "Error writing video header");
         fclose(file);
         return -1;
     }
@@ -277,31 +963,67 @@ int encode(const char *filename, const Video *video) {
     size_t total_size = frame_size * video->num_frames;
 
     if (fwrite(video->data, 1, total_size, file) != total_size) {
-        perror("Error writing frame data");
+        video_ctx_log_errno(ctx, "Error writing frame data");
         fclose(file);
         return -1;
     }
 
     fclose(file);
+    video_ctx_count_encoded(ctx, video->num_frames);
     return 0;
 }
 
-int encode_S(const char *filename, const SVideo *video) {
+// Apply a hint to the frames' planes, merging planes that follow each other
+// in memory (all of them, for a decoded video) into one range
+static void hint_frames(VideoContext *ctx, const SVideo *video, long first, long count,
+                        void (*hint)(VideoContext *, const void *, size_t)) {
+    if (!video_ctx_spilled(ctx)) return;
+    if (first < 0) first = 0;
+    if (count > video->num_frames - first) count = video->num_frames - first;
+    size_t plane_size = (size_t)video->height * video->width;
+    const unsigned char *start = NULL;
+    size_t size = 0;
+
+    for (long f = first; f < first + count; f++) {
+        for (unsigned char c = 0; c < video->channels; c++) {
+            const unsigned char *data = video->frames[f].channels[c].data;
+            if (start && data == start + size) {
+                size += plane_size;
+                continue;
+            }
+            if (start) hint(ctx, start, size);
+            start = data;
+            size = plane_size;
+        }
+    }
+    if (start) hint(ctx, start, size);
+}
+
+void prefetch_frames_S_ctx(VideoContext *ctx, const SVideo *video, long first, long count) {
+    hint_frames(ctx, video, first, count, video_ctx_prefetch);
+}
+
+void evict_frames_S_ctx(VideoContext *ctx, const SVideo *video, long first, long count) {
+    hint_frames(ctx, video, first, count, video_ctx_evict);
+}
+
+int encode_S_ctx(VideoContext *ctx, const char *filename, const SVideo *video) {
     /**
      * @brief Encodes a SVideo structure into a video file.
      *        -S mode, optimised for runtime
+     * @param ctx Library context.
      * @param filename Path to the output video file.
      * @param video Pointer to the SVideo structure.
      * @return 0 if successful, -1 if an error occurred.
      */
     if (!filename || !video) {
-        fprintf(stderr, "Invalid input to encode function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to encode function.\n");
         return -1;
     }
 
     FILE *file = fopen(filename, "wb");
     if (!file) {
-        perror("Error opening file for writing");
+        video_ctx_log_errno(ctx, "Error opening file for writing");
         return -1;
     }
 
@@ -309,48 +1031,69 @@ int encode_S(const char *filename, const SVideo *video) {
         fwrite(&video->channels, sizeof(unsigned char), 1, file) != 1 ||
         fwrite(&video->height, sizeof(unsigned char), 1, file) != 1 ||
         fwrite(&video->width, sizeof(unsigned char), 1, file) != 1) {
-        perror("Error writing video header");
+        video_ctx_log_errno(ctx, "Error writing video header");
         fclose(file);
         return -1;
     }
 
+    // Read spilled frames a chunk ahead of the writes
+    size_t frame_bytes = (size_t)video->channels * video->height * video->width;
+    long chunk_frames = frame_bytes ? (long)(DECODE_CHUNK_BYTES / frame_bytes) : video->num_frames;
+    if (chunk_frames < 1) chunk_frames = 1;
+
     for (long frame_idx = 0; frame_idx <
     video->num_frames; frame_idx++) {
         const Frame *frame = &video->frames[frame_idx];
 
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Encoding cancelled after %ld frames\n", frame_idx);
+            fclose(file);
+            return -1;
+        }
+
+        if (frame_idx % chunk_frames == 0) {
+            if (frame_idx == 0) prefetch_frames_S_ctx(ctx, video, 0, chunk_frames);
+            prefetch_frames_S_ctx(ctx, video, frame_idx + chunk_frames, chunk_frames);
+            if (frame_idx) evict_frames_S_ctx(ctx, video, frame_idx - chunk_frames, chunk_frames);
+        }
+
         for (unsigned char channel_idx = 0; channel_idx <
         video->channels; channel_idx++) {
             const Channel *channel = &frame->channels[channel_idx];
             size_t channel_size = video->height * video->width;
 
             if (fwrite(channel->data, 1, channel_size, file) != channel_size) {
-                perror("Error writing Channel data");
+                video_ctx_log_errno(ctx, "Error writing Channel data");
                 fclose(file);
                 return -1;
             }
         }
+
+        video_ctx_progress(ctx, VIDEO_STAGE_ENCODE, frame_idx + 1, video->num_frames);
     }
 
     fclose(file);
+    video_ctx_count_encoded(ctx, video->num_frames);
     return 0;
 }
 
-int encode_M(const char *filename, const MVideo *video) {
+int encode_M_ctx(VideoContext *ctx, const char *filename, const MVideo *video) {
     /**
      * @brief Encodes a Video structure into a video file.
      *        -M mode, optimised for memory usage
+     * @param ctx Library context.
      * @param filename Path to the output video file.
      * @param video Pointer to the Video structure.
      * @return 0 if successful, -1 if an error occurred.
      */
     if (!filename || !video) {
-        fprintf(stderr, "Invalid input to encode function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to encode function.\n");
         return -1;
     }
 
     FILE *file = fopen(filename, "wb");
     if (!file) {
-        perror("Error opening file for writing");
+        video_ctx_log_errno(ctx, "Error opening file for writing");
         return -1;
     }
 
@@ -358,7 +1101,7 @@ int encode_M(const char *filename, const MVideo *video) {
         fwrite(&video->channels, sizeof(unsigned char), 1, file) != 1 ||
         fwrite(&video->height, sizeof(unsigned char), 1, file) != 1 ||
         fwrite(&video->width, sizeof(unsigned char), 1, file) != 1) {
-        perror("Error writing video header");
+        video_ctx_log_errno(ctx, "Error writing video header");
         fclose(file);
         return -1;
     }
@@ -367,31 +1110,35 @@ int encode_M(const char *filename, const MVideo *video) {
     size_t total_size = frame_size * video->num_frames;
 
     if (fwrite(video->data, 1, total_size, file) != total_size) {
-        perror("Error writing frame data");
+        video_ctx_log_errno(ctx, "Error writing frame data");
         fclose(file);
         return -1;
     }
 
     fclose(file);
+    video_ctx_count_encoded(ctx, video->num_frames);
     return 0;
 }
 
-void reverse(Video *video) {
+void reverse_ctx(VideoContext *ctx, Video *video) {
     /**
      * @brief Reverses the order of frames in a Video structure.
      *        -O mode, no optimisation
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->data) {
-        fprintf(stderr, "Invalid input to reverse function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to reverse function.\n");
         return;
     }
 
     size_t frame_size = video->channels * video->height * video->width;
 
-    unsigned char *temp = (unsigned char *)_mm_malloc(frame_size, 64);
+    unsigned char *temp = (unsigned char *)video_ctx_alloc(ctx, frame_size);
     if (!temp) {
-        perror("Error allocating memory for reverse function");
+        video_ctx_log_errno(ctx, "Error allocating memory for reverse function");
         return;
     }
 
@@ -405,18 +1152,23 @@ void reverse(Video *video) {
         memcpy(frame2, temp, frame_size);
     }
 
-    free(temp);
+    video_ctx_free(ctx, temp);
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void reverse_S(SVideo *video) {
+void reverse_S_ctx(VideoContext *ctx, SVideo *video) {
     /**
      * @brief Reverses the order of frames in a SVideo structure.
      *        - S mode, optimised for runtime 
      *        in-place reversal
+     * @param ctx Library context.
      * @param video Pointer to the SVideo structure.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->frames) {
-        fprintf(stderr, "Invalid input to reverse_S function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to reverse_S function.\n");
         return;
     }
 
@@ -428,24 +1180,29 @@ void reverse_S(SVideo *video) {
         sizeof(Frame));
         memcpy(&video->frames[video->num_frames - 1 - i], &temp, sizeof(Frame));
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void reverse_M(MVideo *video) {
+void reverse_M_ctx(VideoContext *ctx, MVideo *video) {
     /**
      * @brief Reverses the order of frames in a Video structure.
      *        -M mode, optimised for memory usage
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->data) {
-        fprintf(stderr, "Invalid input to reverse function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to reverse function.\n");
         return;
     }
 
     size_t frame_size = video->channels * video->height * video->width;
 
-    unsigned char *temp = (unsigned char *)_mm_malloc(frame_size, 64);
+    unsigned char *temp = (unsigned char *)video_ctx_alloc(ctx, frame_size);
     if (!temp) {
-        perror("Error allocating memory for reverse function");
+        video_ctx_log_errno(ctx, "Error allocating memory for reverse function");
         return;
     }
 
@@ -459,26 +1216,31 @@ void reverse_M(MVideo *video) {
         memcpy(frame2, temp, frame_size);
     }
 
-    free(temp);
+    video_ctx_free(ctx, temp);
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void swap_channels(Video *video, unsigned char channel1,
+void swap_channels_ctx(VideoContext *ctx, Video *video, unsigned char channel1,
 unsigned char channel2) {
     /**
      * @brief Swaps two channels in a Video structure.
      *        -O mode, no optimisation, flat structure
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      * @param channel1 first channel to swap.
      * @param channel2 second channel to swap.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->data) {
-        fprintf(stderr, "Invalid input to swap_channels function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to swap_channels function.\n");
         return;
     }
 
     // Validate channel indices
     if (channel1 >= video->channels || channel2 >= video->channels) {
-        fprintf(stderr, "Channel indices out of bounds.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Channel indices out of bounds.\n");
         return;
     }
 
@@ -495,24 +1257,29 @@ unsigned char channel2) {
             video->data[offset2 + i] = temp;
         }
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void swap_channels_S(SVideo *video, unsigned char channel1,
+void swap_channels_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel1,
 unsigned char channel2) {
     /**
      * @brief Swaps two channels in a SVideo structure.
      *        -S mode, optimised for runtime, hierarchical
+     * @param ctx Library context.
      * @param video Pointer to the SVideo structure.
      * @param channel1 first channel to swap.
      * @param channel2 second channel to swap.
      */
-    if (channel1 >= video->channels || channel2 >= video->channels) {
-        fprintf(stderr, "Channel indices out of bounds.\n");
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
+    if (!video || !video->frames) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to swap_channel_S function.\n");
         return;
     }
 
-    if (!video || !video->frames) {
-        fprintf(stderr, "Invalid input to swap_channel_S function.\n");
+    if (channel1 >= video->channels || channel2 >= video->channels) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Channel indices out of bounds.\n");
         return;
     }
 
@@ -523,25 +1290,30 @@ unsigned char channel2) {
         video->frames[frame].channels[channel2];
         video->frames[frame].channels[channel2] = temp;
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void swap_channels_M(MVideo *video, unsigned char channel1,
+void swap_channels_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel1,
 unsigned char channel2) {
     /**
      * @brief Swaps two channels in a Video structure.
      *        -M mode, optimised for memory usage
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      * @param channel1 first channel to swap.
      * @param channel2 second channel to swap.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->data) {
-        fprintf(stderr, "Invalid input to swap_channels function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to swap_channels function.\n");
         return;
     }
 
     // Validate channel indices
     if (channel1 >= video->channels || channel2 >= video->channels) {
-        fprintf(stderr, "Channel indices out of bounds.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Channel indices out of bounds.\n");
         return;
     }
 
@@ -558,26 +1330,31 @@ unsigned char channel2) {
             video->data[offset2 + i] = temp;
         }
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void clip_channel(Video *video, unsigned char channel,
+void clip_channel_ctx(VideoContext *ctx, Video *video, unsigned char channel,
 unsigned char min_val, unsigned char max_val) {
     /**
      * @brief Clips the values of a channel in a Video structure to 
      *        specfic range. [min_val, max_val]
      *        -O mode, no optimisation
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      * @param channel Channel index to clip.
      * @param min_val Minimum value for clipping.
      * @param max_val Maximum value for clipping.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->data) {
-        fprintf(stderr, "Invalid input to clip_channel function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel function.\n");
         return;
     }
 
     if (channel >= video->channels) {
-        fprintf(stderr, "Channel index out of bounds.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Channel index out of bounds.\n");
         return;
     }
 
@@ -592,69 +1369,62 @@ unsigned char min_val, unsigned char max_val) {
             channel_data[i] = CLAMP(channel_data[i], min_val, max_val);
         }
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void clip_channel_S(SVideo *video, unsigned char channel,
+void clip_channel_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
 unsigned char min_value, unsigned char max_value) {
     /**
      * @brief Clips the values of a channel in a SVideo structure to
      *        a specific range. [min_value, max_value]
      *        -S mode, optimised for runtime
      *        SIMD utilization
+     * @param ctx Library context.
      * @param video Pointer to the SVideo structure.
      * @param channel Channel index to clip.
      * @param min_value Minimum value for clipping.
      * @param max_value Maximum value for clipping.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || channel >= video->channels) {
-        fprintf(stderr, "Invalid input to clip_channel_SIMD_SVideo.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel_SIMD_SVideo.\n");
         return;
     }
+    if (unshare_channel(ctx, video, channel) != 0) return;
 
-        size_t channel_size = video->height * video->width;
-    __m256i min_val_vec = _mm256_set1_epi8(min_value);
-    __m256i max_val_vec = _mm256_set1_epi8(max_value);
+    size_t channel_size = video->height * video->width;
 
     for (long frame_idx = 0; frame_idx < video->num_frames; frame_idx++) {
         unsigned char *data = video->frames[frame_idx].channels[channel].data;
-        size_t i = 0;
+        clip_plane(ctx, data, channel_size, min_value, max_value, 0);
+    }
 
-        for (; i + 31 < channel_size; i += 32) {
-            // Load 32 pixels into vector
-            __m256i pixels = _mm256_loadu_si256((__m256i *)&data[i]);
-
-            // Clip ALL pixel values simultaneously
-            pixels = _mm256_min_epu8(_mm256_max_epu8(pixels, min_val_vec),
-            max_val_vec);
-
-            // store the clipped pixels back to memory
-            _mm256_storeu_si256((__m256i *)&data[i], pixels);
-        }
-
-        for (; i < channel_size; i++) {
-            data[i] = CLAMP(data[i], min_value, max_value);
-        }
-    }
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void clip_channel_M(MVideo *video, unsigned char channel,
+void clip_channel_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
 unsigned char min_val, unsigned char max_val) {
     /**
      * @brief Clips the values of a channel in a Video structure to 
      *        specfic range. [min_val, max_val]
      *        -M mode, optimised for memory usage
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      * @param channel Channel index to clip.
      * @param min_val Minimum value for clipping.
      * @param max_val Maximum value for clipping.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->data) {
-        fprintf(stderr, "Invalid input to clip_channel function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel function.\n");
         return;
     }
 
     if (channel >= video->channels) {
-        fprintf(stderr, "Channel index out of bounds.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Channel index out of bounds.\n");
         return;
     }
 
@@ -669,24 +1439,29 @@ unsigned char min_val, unsigned char max_val) {
             channel_data[i] = CLAMP(channel_data[i], min_val, max_val);
         }
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void scale_channel(Video *video, unsigned char channel, float scale_factor) {
+void scale_channel_ctx(VideoContext *ctx, Video *video, unsigned char channel, float scale_factor) {
     /**
      * @brief Scales the values of a channel in a Video structure by a
      *        specific factor. [scale_factor]
      *        -O mode, no optimisation
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      * @param channel Channel to scale.
      * @param scale_factor Factor to scale the channel values.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->data) {
-        fprintf(stderr, "Invalid input to scale_channel function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel function.\n");
         return;
     }
 
     if (channel >= video->channels) {
-        fprintf(stderr, "Channel index out of bounds.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Channel index out of bounds.\n");
         return;
     }
 
@@ -702,63 +1477,62 @@ void scale_channel(Video *video, unsigned char channel, float scale_factor) {
             channel_data[i] = (unsigned char)CLAMP(scaled_value, 0.0f, 255.0f);
         }
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void scale_channel_S(SVideo *video, unsigned char channel,
+void scale_channel_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
 float scale_factor) {
     /**
      * @brief Scales the values of a channel in a SVideo structure by a
      *       specific factor. [scale_factor]
      *       -S mode, optimised for runtime
-     *       Loop unrolling and prefetching
+     *       Loop unrolling and prefetching, tuned per host
+     * @param ctx Library context.
      * @param video Pointer to the SVideo structure.
      * @param channel Channel to scale.
      * @param scale_factor Factor to scale the channel values.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || channel >= video->channels) {
-        fprintf(stderr, "Invalid input to scale_channel_S_S function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel_S_S function.\n");
         return;
     }
+    if (unshare_channel(ctx, video, channel) != 0) return;
 
-    for (long frame_idx = 0; frame_idx < video->num_frames; frame_idx++) {
-        Frame *frame = &video->frames[frame_idx];
-        Channel *chan = &frame->channels[channel];
-        size_t channel_size = video->height * video->width;
-        unsigned char *data = chan->data;
-
-        size_t i = 0;
-        for (; i + 31 < channel_size; i += 32) {
-            __builtin_prefetch(&data[i + 32], 0, 1);
-
-            for (size_t j = 0; j < 32; j++) {
-                float scaled_value = data[i + j] * scale_factor;
-                data[i + j] = CLAMP(scaled_value, 0.0f, 255.0f);
-            }
-        }
+    // Tile size and prefetch distance are tuned per host
+    const TuneParams *tune = video_ctx_tuning(ctx);
+    size_t channel_size = video->height * video->width;
 
-        for (; i < channel_size; i++) {
-            float scaled_value = data[i] * scale_factor;
-            data[i] = CLAMP(scaled_value, 0.0f, 255.0f);
-        }
+    for (long frame_idx = 0; frame_idx < video->num_frames; frame_idx++) {
+        unsigned char *data = video->frames[frame_idx].channels[channel].data;
+        scale_plane_tiled(data, channel_size, scale_factor,
+                          tune->tile_bytes, tune->prefetch_distance);
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void scale_channel_M(MVideo *video, unsigned char channel, float scale_factor) {
+void scale_channel_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel, float scale_factor) {
     /**
      * @brief Scales the values of a channel in a Video structure by a
      *        specific factor. [scale_factor]
      *        -M mode, optimised for memory usage
+     * @param ctx Library context.
      * @param video Pointer to the Video structure.
      * @param channel Channel to scale.
      * @param scale_factor Factor to scale the channel values.
      */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || !video->data) {
-        fprintf(stderr, "Invalid input to scale_channel function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel function.\n");
         return;
     }
 
     if (channel >= video->channels) {
-        fprintf(stderr, "Channel index out of bounds.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Channel index out of bounds.\n");
         return;
     }
 
@@ -774,88 +1548,1207 @@ void scale_channel_M(MVideo *video, unsigned char channel, float scale_factor) {
             channel_data[i] = (unsigned char)CLAMP(scaled_value, 0.0f, 255.0f);
         }
     }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void clip_channel_SIMD_S (SVideo *video, unsigned char channel,
+void clip_channel_SIMD_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
 unsigned char min_value, unsigned char max_value) {
+    /**
+     * @brief Clips the values of a channel in a SVideo structure to
+     *        a specific range. [min_value, max_value]
+     *        -S mode, SIMD and OpenMP across frames
+     *        Thread count, chunking and store type tuned per host
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel Channel index to clip.
+     * @param min_value Minimum value for clipping.
+     * @param max_value Maximum value for clipping.
+     */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || channel >= video->channels) {
-        fprintf(stderr, "Invalid input to clip_channel_SIMD_S function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel_SIMD_S function.\n");
         return;
     }
-    #pragma omp parallel for
-    for(int i = 0; i < video->num_frames; i++) {
-        unsigned char *data = video->frames[i].channels[channel].data;
-        size_t channel_size = video->height * video->width;
-        size_t j = 0;
 
-        __m256i min_val_vec = _mm256_set1_epi8(min_value);
-        __m256i max_val_vec = _mm256_set1_epi8(max_value);
+    const TuneParams *tune = video_ctx_tuning(ctx);
+    size_t channel_size = video->height * video->width;
 
-        for (; j + 31 < channel_size; j += 32) {
-            // Load 32 pixels into vector
-            __m256i pixels = _mm256_loadu_si256((__m256i *)&data[j]);
+    // Several planes fit in one chunk: batch them instead of per-frame work
+    if (channel_size < tune->chunk_bytes) {
+        clip_channel_batched_S_ctx(ctx, video, channel, min_value, max_value);
+        return;
+    }
+    if (unshare_channel(ctx, video, channel) != 0) return;
 
-            // Clip ALL pixel values simultaneously
-            pixels = _mm256_min_epu8(_mm256_max_epu8(pixels, min_val_vec),
-            max_val_vec);
+    size_t total_size = channel_size * video->num_frames;
+    int threads = video_ctx_threads(ctx, total_size);
+    int chunk = autotune_chunk_frames(tune, channel_size);
+    int streaming = autotune_use_streaming(tune, total_size);
 
-            // store the clipped pixels back to memory
-            _mm256_storeu_si256((__m256i *)&data[j], pixels);
-        }
+    #pragma omp parallel num_threads(threads)
+    {
+        video_ctx_enter_thread(ctx);
 
-        for (; j < channel_size; j++) {
-            data[j] = CLAMP(data[j], min_value, max_value);
+        #pragma omp for schedule(dynamic, chunk)
+        for (long i = 0; i < video->num_frames; i++) {
+            clip_plane(ctx, video->frames[i].channels[channel].data,
+                       channel_size, min_value, max_value, streaming);
         }
     }
-    
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
 }
 
-void scale_channel_SIMD_S (SVideo *video, unsigned char channel, float scale_factor) {
+void scale_channel_SIMD_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel, float scale_factor) {
+    /**
+     * @brief Scales the values of a channel in a SVideo structure by a
+     *        specific factor. [scale_factor]
+     *        -S mode, SIMD and OpenMP across frames
+     *        Thread count, chunking and store type tuned per host
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel Channel to scale.
+     * @param scale_factor Factor to scale the channel values.
+     */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
     if (!video || channel >= video->channels) {
-        fprintf(stderr, "Invalid input to scale_channel_SIMD_S function.\n");
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel_SIMD_S function.\n");
+        return;
+    }
+
+    const TuneParams *tune = video_ctx_tuning(ctx);
+    size_t channel_size = video->height * video->width;
+
+    // Several planes fit in one chunk: batch them instead of per-frame work
+    if (channel_size < tune->chunk_bytes) {
+        scale_channel_batched_S_ctx(ctx, video, channel, scale_factor);
+        return;
+    }
+    if (unshare_channel(ctx, video, channel) != 0) return;
+
+    size_t total_size = channel_size * video->num_frames;
+    int threads = video_ctx_threads(ctx, total_size);
+    int chunk = autotune_chunk_frames(tune, channel_size);
+    int streaming = autotune_use_streaming(tune, total_size);
+
+    #pragma omp parallel num_threads(threads)
+    {
+        video_ctx_enter_thread(ctx);
+
+        #pragma omp for schedule(dynamic, chunk)
+        for (long i = 0; i < video->num_frames; i++) {
+            scale_plane(ctx, video->frames[i].channels[channel].data,
+                        channel_size, scale_factor, streaming);
+        }
+    }
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
+}
+
+// Channel c of every frame, viewed as a 2D array of planes (rows)
+typedef struct {
+    unsigned char *base;     // First plane when the planes are regularly strided
+    size_t stride;           // Bytes between consecutive planes
+    unsigned char **rows;    // Plane pointers when they are not (after reverse/swap)
+    long num_rows;
+    size_t row_bytes;
+} PlaneSet;
+
+typedef enum { BATCH_CLIP, BATCH_SCALE } BatchKind;
+
+typedef struct {
+    BatchKind kind;
+    int use_avx2;
+    unsigned char min_value;
+    unsigned char max_value;
+    float scale_factor;
+    size_t tile_bytes;
+} BatchOp;
+
+static inline unsigned char *plane_row(const PlaneSet *set, long row) {
+    return set->rows ? set->rows[row] : set->base + row * set->stride;
+}
+
+static int plane_set_init(VideoContext *ctx, PlaneSet *set, SVideo *video,
+unsigned char channel) {
+    set->num_rows = video->num_frames;
+    set->row_bytes = (size_t)video->height * video->width;
+    set->base = video->frames[0].channels[channel].data;
+    set->stride = set->row_bytes;
+    set->rows = NULL;
+
+    // decode_S lays planes out at a fixed stride; detect it so no
+    // per-plane pointers are needed
+    if (video->num_frames > 1) {
+        unsigned char *second = video->frames[1].channels[channel].data;
+        set->stride = (size_t)(second - set->base);
+        if (second <= set->base) set->stride = 0;
+    }
+
+    int regular = set->stride >= set->row_bytes;
+    for (long f = 0; regular && f < video->num_frames; f++) {
+        regular = video->frames[f].channels[channel].data ==
+                  set->base + f * set->stride;
+    }
+    if (regular) return 0;
+
+    set->rows = (unsigned char **)video_ctx_alloc(ctx,
+    set->num_rows * sizeof(unsigned char *));
+    if (!set->rows) {
+        video_ctx_log_errno(ctx, "Error allocating plane pointers");
+        return -1;
+    }
+    for (long f = 0; f < set->num_rows; f++) {
+        set->rows[f] = video->frames[f].channels[channel].data;
+    }
+    return 0;
+}
+
+static inline void batch_op_apply(const BatchOp *op, unsigned char *data,
+size_t size, int streaming) {
+    if (op->kind == BATCH_CLIP) {
+        if (op->use_avx2) {
+            clip_plane_avx2(data, size, op->min_value, op->max_value, streaming);
+        } else {
+            clip_plane_scalar(data, size, op->min_value, op->max_value);
+        }
+    } else if (op->use_avx2) {
+        scale_plane_avx2(data, size, op->scale_factor, streaming);
+    } else {
+        scale_plane_tiled(data, size, op->scale_factor, op->tile_bytes, 0);
+    }
+}
+
+static void batch_run(VideoContext *ctx, const PlaneSet *set, const BatchOp *op) {
+    const TuneParams *tune = video_ctx_tuning(ctx);
+    size_t total_size = set->row_bytes * set->num_rows;
+    int threads = video_ctx_threads(ctx, total_size);
+
+    if (!set->rows && set->stride == set->row_bytes) {
+        // Planes are back to back: one flat array with a single tail
+        int streaming = autotune_use_streaming(tune, total_size);
+        size_t chunk = (tune->chunk_bytes + 31) & ~(size_t)31;
+        long num_chunks = (long)((total_size + chunk - 1) / chunk);
+
+        #pragma omp parallel num_threads(threads)
+        {
+            video_ctx_enter_thread(ctx);
+
+            #pragma omp for schedule(static)
+            for (long c = 0; c < num_chunks; c++) {
+                size_t start = c * chunk;
+                size_t size = start + chunk > total_size ? total_size - start : chunk;
+                batch_op_apply(op, set->base + start, size, streaming);
+            }
+        }
+        return;
+    }
+
+    // Strided: many small planes per chunk, vector bodies in place and
+    // all their tails merged into one staging buffer
+    long rows_per_chunk = autotune_chunk_frames(tune, set->row_bytes);
+    long num_chunks = (set->num_rows + rows_per_chunk - 1) / rows_per_chunk;
+    size_t body = set->row_bytes & ~(size_t)31;
+    size_t tail = set->row_bytes - body;
+
+    #pragma omp parallel num_threads(threads)
+    {
+        video_ctx_enter_thread(ctx);
+        unsigned char *staging = tail ?
+            (unsigned char *)video_ctx_alloc(ctx, rows_per_chunk * tail) : NULL;
+
+        #pragma omp for schedule(static)
+        for (long c = 0; c < num_chunks; c++) {
+            long first = c * rows_per_chunk;
+            long last = first + rows_per_chunk > set->num_rows ?
+                        set->num_rows : first + rows_per_chunk;
+
+            for (long r = first; r < last; r++) {
+                unsigned char *row = plane_row(set, r);
+                if (r + 1 < last) {
+                    __builtin_prefetch(plane_row(set, r + 1), 1, 1);
+                }
+                if (body) batch_op_apply(op, row, body, 0);
+            }
+
+            if (!tail) continue;
+            if (!staging) {
+                // Allocation failed, process the tails where they are
+                for (long r = first; r < last; r++) {
+                    batch_op_apply(op, plane_row(set, r) + body, tail, 0);
+                }
+                continue;
+            }
+
+            size_t used = 0;
+            for (long r = first; r < last; r++, used += tail) {
+                memcpy(staging + used, plane_row(set, r) + body, tail);
+            }
+            batch_op_apply(op, staging, used, 0);
+            used = 0;
+            for (long r = first; r < last; r++, used += tail) {
+                memcpy(plane_row(set, r) + body, staging + used, tail);
+            }
+        }
+
+        video_ctx_free(ctx, staging);
+    }
+}
+
+void clip_channel_batched_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value) {
+    /**
+     * @brief Clips the values of a channel in a SVideo structure to
+     *        a specific range. [min_value, max_value]
+     *        -S mode, frame-batched for small frames
+     *        Treats channel `channel` of all frames as one strided 2D
+     *        array, so each SIMD/thread chunk covers many small planes
+     *        and their tails are processed together.
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel Channel index to clip.
+     * @param min_value Minimum value for clipping.
+     * @param max_value Maximum value for clipping.
+     */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
+    if (!video || !video->frames || channel >= video->channels) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel_batched_S function.\n");
+        return;
+    }
+    if (video->num_frames <= 0) return;
+    if (unshare_channel(ctx, video, channel) != 0) return;
+
+    PlaneSet set;
+    if (plane_set_init(ctx, &set, video, channel) != 0) return;
+
+    BatchOp op = { BATCH_CLIP, video_ctx_use_avx2(ctx), min_value, max_value,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    batch_run(ctx, &set, &op);
+    video_ctx_free(ctx, set.rows);
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
+}
+
+void scale_channel_batched_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+float scale_factor) {
+    /**
+     * @brief Scales the values of a channel in a SVideo structure by a
+     *        specific factor. [scale_factor]
+     *        -S mode, frame-batched for small frames
+     *        Same strided 2D view as clip_channel_batched_S.
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel Channel to scale.
+     * @param scale_factor Factor to scale the channel values.
+     */
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
+    if (!video || !video->frames || channel >= video->channels) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel_batched_S function.\n");
         return;
     }
-    #pragma omp parallel for
-    for(int i = 0; i < video->num_frames; i++) {
-        unsigned char *data = video->frames[i].channels[channel].data;
-        size_t channel_size = video->height * video->width;
-        size_t j = 0;
+    if (video->num_frames <= 0) return;
+    if (unshare_channel(ctx, video, channel) != 0) return;
+
+    PlaneSet set;
+    if (plane_set_init(ctx, &set, video, channel) != 0) return;
+
+    BatchOp op = { BATCH_SCALE, video_ctx_use_avx2(ctx), 0, 255,
+                   scale_factor, video_ctx_tuning(ctx)->tile_bytes };
+    batch_run(ctx, &set, &op);
+    video_ctx_free(ctx, set.rows);
+
+    video_ctx_kernel_end(ctx, kernel_start, video->num_frames);
+}
+
+float video_curve_eval(const VideoCurve *curve, long frame) {
+    /**
+     * @brief Evaluates a keyframed curve at a frame.
+     * @param curve Curve with keys sorted by frame.
+     * @param frame Frame to evaluate at.
+     * @return Value at the frame, 0 for a curve without keys.
+     */
+    if (!curve || curve->num_keys <= 0) return 0.0f;
+    const VideoKeyframe *keys = curve->keys;
+    int last = curve->num_keys - 1;
+    if (frame <= keys[0].frame) return keys[0].value;
+    if (frame >= keys[last].frame) return keys[last].value;
+
+    // Last key at or before the frame
+    int lo = 0, hi = last;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (keys[mid].frame <= frame) lo = mid; else hi = mid;
+    }
+
+    const VideoKeyframe *a = &keys[lo];
+    const VideoKeyframe *b = &keys[lo + 1];
+    float s = (float)(frame - a->frame) / (float)(b->frame - a->frame);
+    switch (a->interp) {
+    case VIDEO_CURVE_HOLD:
+        return a->value;
+    case VIDEO_CURVE_BEZIER:
+        // Control points v0, v0, v1, v1: B(s) = v0 + (v1 - v0)(3s^2 - 2s^3)
+        s = s * s * (3.0f - 2.0f * s);
+        break;
+    case VIDEO_CURVE_LINEAR:
+        break;
+    }
+    return a->value + (b->value - a->value) * s;
+}
+
+static int curve_valid(const VideoCurve *curve) {
+    if (!curve) return 1;
+    if (curve->num_keys <= 0 || !curve->keys) return 0;
+    for (int i = 0; i < curve->num_keys; i++) {
+        if (curve->keys[i].interp < VIDEO_CURVE_HOLD ||
+            curve->keys[i].interp > VIDEO_CURVE_BEZIER) return 0;
+        if (i && curve->keys[i].frame <= curve->keys[i - 1].frame) return 0;
+    }
+    return 1;
+}
+
+// Keyframed parameters of a clip or scale, evaluated per frame; frame f of
+// the video is frame origin + f * step of the curves
+typedef struct {
+    const VideoCurve *min_value;
+    const VideoCurve *max_value;
+    const VideoCurve *scale_factor;
+    long origin;
+    long step;
+} OpCurves;
+
+static void op_curves_at(const OpCurves *curves, long frame, BatchOp *op) {
+    long time = curves->origin + frame * curves->step;
+    if (op->kind == BATCH_CLIP) {
+        if (curves->min_value) {
+            float value = video_curve_eval(curves->min_value, time) + 0.5f;
+            op->min_value = (unsigned char)CLAMP(value, 0.0f, 255.0f);
+        }
+        if (curves->max_value) {
+            float value = video_curve_eval(curves->max_value, time) + 0.5f;
+            op->max_value = (unsigned char)CLAMP(value, 0.0f, 255.0f);
+        }
+    } else if (curves->scale_factor) {
+        op->scale_factor = video_curve_eval(curves->scale_factor, time);
+    }
+}
+
+// Region of interest resolved against a video: frames [first, last) and
+// rows [y, y + height) x columns [x, x + width) of planes `stride` wide
+typedef struct {
+    long first_frame;
+    long last_frame;
+    size_t x, y;
+    size_t width, height;
+    size_t stride;
+    const unsigned char *mask;
+} RoiBounds;
+
+// Planes the ROI kernels write: a SVideo's, or a flat video's at fixed offsets
+typedef struct {
+    Frame *frames;          // SVideo frames, or NULL for a flat video
+    unsigned char *data;    // Flat video data
+    size_t frame_size;
+    size_t plane_size;
+} RoiTarget;
+
+static int roi_resolve(VideoContext *ctx, const VideoROI *roi, long num_frames,
+unsigned char height, unsigned char width, RoiBounds *bounds) {
+    /**
+     * @brief Clips a region to the video. A NULL region is the whole video.
+     * @return 1 if the region has pixels, 0 if it is empty, -1 if invalid.
+     */
+    VideoROI whole = {0, 0, 0, 0, 0, 0, NULL};
+    if (!roi) roi = &whole;
+    if (roi->first_frame < 0 || roi->last_frame < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid frame range in region of interest.\n");
+        return -1;
+    }
 
-        __m256 factor_vec = _mm256_set1_ps(scale_factor);
-        __m256i max_val_vec = _mm256_set1_epi8(255);
-        __m256i zero_vec = _mm256_setzero_si256();
+    bounds->first_frame = roi->first_frame;
+    bounds->last_frame = roi->last_frame && roi->last_frame < num_frames ?
+                         roi->last_frame : num_frames;
+    bounds->x = roi->x < width ? roi->x : width;
+    bounds->y = roi->y < height ? roi->y : height;
+    bounds->width = width - bounds->x;
+    bounds->height = height - bounds->y;
+    if (roi->width && roi->width < bounds->width) bounds->width = roi->width;
+    if (roi->height && roi->height < bounds->height) bounds->height = roi->height;
+    bounds->stride = width;
+    bounds->mask = roi->mask;
 
-        for (; j + 31 < channel_size; j += 32) {
-            // Load 32 pixels into vector
-            __m256i pixels = _mm256_loadu_si256((__m256i *)&data[j]);
+    return bounds->first_frame < bounds->last_frame && bounds->width && bounds->height;
+}
+
+static inline int roi_whole_planes(const RoiBounds *bounds, unsigned char height) {
+    return !bounds->mask && bounds->width == bounds->stride && bounds->height == height;
+}
 
-            // Convert to float
-            __m256 low_bytes = _mm256_cvtepi32_ps(_mm256_unpacklo_epi8(pixels, zero_vec));
-            __m256 high_bytes = _mm256_cvtepi32_ps(_mm256_unpackhi_epi8(pixels, zero_vec));
+static inline unsigned char *roi_plane(const RoiTarget *target, long frame,
+unsigned char channel) {
+    if (target->frames) return target->frames[frame].channels[channel].data;
+    return target->data + frame * target->frame_size + channel * target->plane_size;
+}
 
-            // Scale
-            low_bytes = _mm256_mul_ps(low_bytes, factor_vec);
-            high_bytes = _mm256_mul_ps(high_bytes, factor_vec);
+static void blend_row_scalar(unsigned char *dst, const unsigned char *src,
+const unsigned char *mask, size_t size) {
+    // dst + (src - dst) * mask / 255, rounded; (t + (t >> 8)) >> 8 is
+    // round(t / 255) over the range of t
+    for (size_t i = 0; i < size; i++) {
+        unsigned int t = dst[i] * (255u - mask[i]) + src[i] * mask[i] + 128u;
+        dst[i] = (unsigned char)((t + (t >> 8)) >> 8);
+    }
+}
 
-            // Convert back to int and pack
-            __m256i low_ints = _mm256_cvtps_epi32(low_bytes);
-            __m256i high_ints = _mm256_cvtps_epi32(high_bytes);
-            __m256i scaled_pixels = _mm256_packus_epi32(low_ints, high_ints);
-            scaled_pixels = _mm256_packus_epi16(scaled_pixels, zero_vec);
+VIDEO_TARGET_AVX2
+static void blend_row_avx2(unsigned char *dst, const unsigned char *src,
+const unsigned char *mask, size_t size) {
+    // Same arithmetic as blend_row_scalar in 16-bit lanes, bit-identical
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(255);
+    const __m256i half = _mm256_set1_epi16(128);
+    size_t i = 0;
+
+    for (; i + 31 < size; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+        __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);
+        __m256i m = _mm256_loadu_si256((const __m256i *)&mask[i]);
+
+        // Unpacking and packing interleave lanes the same way, so the
+        // bytes come back in order
+        __m256i halves[2];
+        for (int h = 0; h < 2; h++) {
+            __m256i d16 = h ? _mm256_unpackhi_epi8(d, zero) : _mm256_unpacklo_epi8(d, zero);
+            __m256i s16 = h ? _mm256_unpackhi_epi8(s, zero) : _mm256_unpacklo_epi8(s, zero);
+            __m256i m16 = h ? _mm256_unpackhi_epi8(m, zero) : _mm256_unpacklo_epi8(m, zero);
+            __m256i t = _mm256_add_epi16(
+                _mm256_add_epi16(_mm256_mullo_epi16(d16, _mm256_sub_epi16(full, m16)),
+                                 _mm256_mullo_epi16(s16, m16)), half);
+            halves[h] = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+        }
+        _mm256_storeu_si256((__m256i *)&dst[i], _mm256_packus_epi16(halves[0], halves[1]));
+    }
 
-            // Clip to [0, 255]
-            scaled_pixels = _mm256_min_epu8(scaled_pixels, max_val_vec);
+    blend_row_scalar(dst + i, src + i, mask + i, size - i);
+}
+
+static inline void blend_row(int use_avx2, unsigned char *dst, const unsigned char *src,
+const unsigned char *mask, size_t size) {
+    if (use_avx2) {
+        blend_row_avx2(dst, src, mask, size);
+    } else {
+        blend_row_scalar(dst, src, mask, size);
+    }
+}
+
+static void roi_apply_plane(const BatchOp *op, unsigned char *plane,
+const RoiBounds *bounds, unsigned char *scratch) {
+    // Unmasked full-width rows are one contiguous run
+    if (!bounds->mask && bounds->width == bounds->stride) {
+        batch_op_apply(op, plane + bounds->y * bounds->stride,
+                       bounds->width * bounds->height, 0);
+        return;
+    }
 
-            // Store the scaled pixels back to memory
-            _mm256_storeu_si256((__m256i *)&data[j], scaled_pixels);
+    for (size_t r = bounds->y; r < bounds->y + bounds->height; r++) {
+        unsigned char *row = plane + r * bounds->stride + bounds->x;
+        if (!bounds->mask) {
+            batch_op_apply(op, row, bounds->width, 0);
+            continue;
         }
+        // Masked: run the op on a copy and blend it back by weight
+        memcpy(scratch, row, bounds->width);
+        batch_op_apply(op, scratch, bounds->width, 0);
+        blend_row(op->use_avx2, row, scratch,
+                  bounds->mask + r * bounds->stride + bounds->x, bounds->width);
+    }
+}
 
-        for (; j < channel_size; j++) {
-            float scaled_value = data[j] * scale_factor;
-            data[j] = CLAMP(scaled_value, 0.0f, 255.0f);
+static void roi_swap_plane(int use_avx2, unsigned char *plane1, unsigned char *plane2,
+const RoiBounds *bounds, unsigned char *scratch) {
+    for (size_t r = bounds->y; r < bounds->y + bounds->height; r++) {
+        size_t offset = r * bounds->stride + bounds->x;
+        unsigned char *row1 = plane1 + offset;
+        unsigned char *row2 = plane2 + offset;
+
+        memcpy(scratch, row1, bounds->width);
+        if (bounds->mask) {
+            blend_row(use_avx2, row1, row2, bounds->mask + offset, bounds->width);
+            blend_row(use_avx2, row2, scratch, bounds->mask + offset, bounds->width);
+        } else {
+            memcpy(row1, row2, bounds->width);
+            memcpy(row2, scratch, bounds->width);
+        }
+    }
+}
+
+static void roi_run(VideoContext *ctx, const RoiTarget *target, const RoiBounds *bounds,
+const BatchOp *op, const OpCurves *curves, unsigned char channel, unsigned char channel2) {
+    /**
+     * @brief Applies op to the region of one channel, or swaps the region
+     *        of two channels if op is NULL. Only the region's rows of the
+     *        region's frames are touched, so the cost is proportional to it.
+     *        With curves, op's parameters are re-evaluated for each frame.
+     */
+    long num_frames = bounds->last_frame - bounds->first_frame;
+    size_t region_bytes = bounds->width * bounds->height * (op ? 1 : 2);
+    int use_avx2 = video_ctx_use_avx2(ctx);
+
+    #pragma omp parallel num_threads(video_ctx_threads(ctx, region_bytes * num_frames))
+    {
+        video_ctx_enter_thread(ctx);
+        unsigned char scratch[256];   // One row; frames are at most 255 wide
+
+        #pragma omp for schedule(static)
+        for (long f = bounds->first_frame; f < bounds->last_frame; f++) {
+            if (!op) {
+                roi_swap_plane(use_avx2, roi_plane(target, f, channel),
+                               roi_plane(target, f, channel2), bounds, scratch);
+            } else if (curves) {
+                BatchOp frame_op = *op;
+                op_curves_at(curves, f, &frame_op);
+                roi_apply_plane(&frame_op, roi_plane(target, f, channel), bounds, scratch);
+            } else {
+                roi_apply_plane(op, roi_plane(target, f, channel), bounds, scratch);
+            }
         }
     }
-    
+}
+
+static void roi_flat(VideoContext *ctx, unsigned char *data, long num_frames,
+unsigned char channels, unsigned char height, unsigned char width,
+const BatchOp *op, const OpCurves *curves, unsigned char channel, unsigned char channel2,
+const VideoROI *roi, const char *name) {
+    // Shared by the Video and MVideo variants, which have the same layout
+    double kernel_start = video_ctx_kernel_begin(ctx);
+
+    if (!data || channel >= channels || (!op && channel2 >= channels)) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to %s function.\n", name);
+        return;
+    }
+
+    RoiBounds bounds;
+    if (roi_resolve(ctx, roi, num_frames, height, width, &bounds) <= 0) return;
+    if (!op && channel == channel2) return;
+
+    RoiTarget target = { NULL, data, (size_t)channels * height * width,
+                         (size_t)height * width };
+    roi_run(ctx, &target, &bounds, op, curves, channel, channel2);
+
+    video_ctx_kernel_end(ctx, kernel_start, bounds.last_frame - bounds.first_frame);
+}
+
+static void roi_structured(VideoContext *ctx, SVideo *video, const BatchOp *op,
+const OpCurves *curves, unsigned char channel, unsigned char channel2,
+const VideoROI *roi, const char *name) {
+    if (!video || !video->frames || channel >= video->channels ||
+        (!op && channel2 >= video->channels)) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to %s function.\n", name);
+        return;
+    }
+
+    RoiBounds bounds;
+    if (roi_resolve(ctx, roi, video->num_frames, video->height, video->width, &bounds) <= 0) {
+        return;
+    }
+    if (!op && channel == channel2) return;
+
+    // View of the region's frames; like a program chunk, the kernels only
+    // follow the Frame array
+    SVideo range = *video;
+    range.frames = video->frames + bounds.first_frame;
+    range.num_frames = bounds.last_frame - bounds.first_frame;
+
+    // Whole planes with fixed parameters: the full-video kernels on the
+    // frame range
+    if (!curves && roi_whole_planes(&bounds, video->height)) {
+        if (!op) {
+            swap_channels_S_ctx(ctx, &range, channel, channel2);
+        } else if (op->kind == BATCH_CLIP) {
+            clip_channel_SIMD_S_ctx(ctx, &range, channel, op->min_value, op->max_value);
+        } else {
+            scale_channel_SIMD_S_ctx(ctx, &range, channel, op->scale_factor);
+        }
+        return;
+    }
+
+    double kernel_start = video_ctx_kernel_begin(ctx);
+    if (unshare_channel(ctx, &range, channel) != 0) return;
+    if (!op && unshare_channel(ctx, &range, channel2) != 0) return;
+
+    RoiTarget target = { video->frames, NULL, 0, 0 };
+    roi_run(ctx, &target, &bounds, op, curves, channel, channel2);
+
+    video_ctx_kernel_end(ctx, kernel_start, range.num_frames);
+}
+
+void swap_channels_roi_ctx(VideoContext *ctx, Video *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi) {
+    /**
+     * @brief Swaps two channels within a region of a Video structure.
+     *        With a mask, each pixel moves by its weight towards the
+     *        other channel's value.
+     *        -O mode, flat structure
+     * @param ctx Library context.
+     * @param video Pointer to the Video structure.
+     * @param channel1 first channel to swap.
+     * @param channel2 second channel to swap.
+     * @param roi Region to swap, NULL for the whole video.
+     */
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to swap_channels_roi function.\n");
+        return;
+    }
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, NULL, NULL, channel1, channel2, roi, "swap_channels_roi");
+}
+
+void swap_channels_roi_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi) {
+    /**
+     * @brief Swaps two channels within a region of a SVideo structure.
+     *        Whole planes are swapped by pointer as in swap_channels_S;
+     *        a rectangle or mask swaps the bytes of the region's rows.
+     *        -S mode, hierarchical
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel1 first channel to swap.
+     * @param channel2 second channel to swap.
+     * @param roi Region to swap, NULL for the whole video.
+     */
+    roi_structured(ctx, video, NULL, NULL, channel1, channel2, roi, "swap_channels_roi_S");
+}
+
+void swap_channels_roi_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi) {
+    /**
+     * @brief Swaps two channels within a region of a MVideo structure.
+     *        -M mode, optimised for memory usage
+     * @param ctx Library context.
+     * @param video Pointer to the MVideo structure.
+     * @param channel1 first channel to swap.
+     * @param channel2 second channel to swap.
+     * @param roi Region to swap, NULL for the whole video.
+     */
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to swap_channels_roi_M function.\n");
+        return;
+    }
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, NULL, NULL, channel1, channel2, roi, "swap_channels_roi_M");
+}
+
+void clip_channel_roi_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi) {
+    /**
+     * @brief Clips the values of a channel within a region of a Video
+     *        structure to a specific range. [min_value, max_value]
+     *        -O mode, flat structure
+     * @param ctx Library context.
+     * @param video Pointer to the Video structure.
+     * @param channel Channel index to clip.
+     * @param min_value Minimum value for clipping.
+     * @param max_value Maximum value for clipping.
+     * @param roi Region to clip, NULL for the whole video.
+     */
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel_roi function.\n");
+        return;
+    }
+    BatchOp op = { BATCH_CLIP, video_ctx_use_avx2(ctx), min_value, max_value,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, &op, NULL, channel, channel, roi, "clip_channel_roi");
+}
+
+void clip_channel_roi_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi) {
+    /**
+     * @brief Clips the values of a channel within a region of a SVideo
+     *        structure to a specific range. [min_value, max_value]
+     *        Frame ranges of whole planes run clip_channel_SIMD_S; a
+     *        rectangle or mask iterates only the region's rows, and only
+     *        the region's frames are unshared from snapshots.
+     *        -S mode, SIMD and OpenMP across frames
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel Channel index to clip.
+     * @param min_value Minimum value for clipping.
+     * @param max_value Maximum value for clipping.
+     * @param roi Region to clip, NULL for the whole video.
+     */
+    BatchOp op = { BATCH_CLIP, video_ctx_use_avx2(ctx), min_value, max_value,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_structured(ctx, video, &op, NULL, channel, channel, roi, "clip_channel_roi_S");
+}
+
+void clip_channel_roi_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi) {
+    /**
+     * @brief Clips the values of a channel within a region of a MVideo
+     *        structure to a specific range. [min_value, max_value]
+     *        -M mode, optimised for memory usage
+     * @param ctx Library context.
+     * @param video Pointer to the MVideo structure.
+     * @param channel Channel index to clip.
+     * @param min_value Minimum value for clipping.
+     * @param max_value Maximum value for clipping.
+     * @param roi Region to clip, NULL for the whole video.
+     */
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel_roi_M function.\n");
+        return;
+    }
+    BatchOp op = { BATCH_CLIP, video_ctx_use_avx2(ctx), min_value, max_value,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, &op, NULL, channel, channel, roi, "clip_channel_roi_M");
+}
+
+void scale_channel_roi_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+float scale_factor, const VideoROI *roi) {
+    /**
+     * @brief Scales the values of a channel within a region of a Video
+     *        structure by a specific factor. [scale_factor]
+     *        -O mode, flat structure
+     * @param ctx Library context.
+     * @param video Pointer to the Video structure.
+     * @param channel Channel to scale.
+     * @param scale_factor Factor to scale the channel values.
+     * @param roi Region to scale, NULL for the whole video.
+     */
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel_roi function.\n");
+        return;
+    }
+    BatchOp op = { BATCH_SCALE, video_ctx_use_avx2(ctx), 0, 255,
+                   scale_factor, video_ctx_tuning(ctx)->tile_bytes };
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, &op, NULL, channel, channel, roi, "scale_channel_roi");
+}
+
+void scale_channel_roi_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+float scale_factor, const VideoROI *roi) {
+    /**
+     * @brief Scales the values of a channel within a region of a SVideo
+     *        structure by a specific factor. [scale_factor]
+     *        Same region handling as clip_channel_roi_S.
+     *        -S mode, SIMD and OpenMP across frames
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel Channel to scale.
+     * @param scale_factor Factor to scale the channel values.
+     * @param roi Region to scale, NULL for the whole video.
+     */
+    BatchOp op = { BATCH_SCALE, video_ctx_use_avx2(ctx), 0, 255,
+                   scale_factor, video_ctx_tuning(ctx)->tile_bytes };
+    roi_structured(ctx, video, &op, NULL, channel, channel, roi, "scale_channel_roi_S");
+}
+
+void scale_channel_roi_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+float scale_factor, const VideoROI *roi) {
+    /**
+     * @brief Scales the values of a channel within a region of a MVideo
+     *        structure by a specific factor. [scale_factor]
+     *        -M mode, optimised for memory usage
+     * @param ctx Library context.
+     * @param video Pointer to the MVideo structure.
+     * @param channel Channel to scale.
+     * @param scale_factor Factor to scale the channel values.
+     * @param roi Region to scale, NULL for the whole video.
+     */
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel_roi_M function.\n");
+        return;
+    }
+    BatchOp op = { BATCH_SCALE, video_ctx_use_avx2(ctx), 0, 255,
+                   scale_factor, video_ctx_tuning(ctx)->tile_bytes };
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, &op, NULL, channel, channel, roi, "scale_channel_roi_M");
+}
+
+static int curves_check(VideoContext *ctx, const OpCurves *curves, const char *name) {
+    if (curve_valid(curves->min_value) && curve_valid(curves->max_value) &&
+        curve_valid(curves->scale_factor)) {
+        return 0;
+    }
+    video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid keyframes passed to %s function.\n", name);
+    return -1;
+}
+
+void clip_channel_curve_at_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi,
+long origin, long step) {
+    /**
+     * @brief clip_channel_curve_S with the curves' frame numbering given
+     *        explicitly: frame i of the video is frame origin + i * step.
+     */
+    OpCurves curves = { min_value, max_value, NULL, origin, step };
+    if (curves_check(ctx, &curves, "clip_channel_curve_S") != 0) return;
+    BatchOp op = { BATCH_CLIP, video_ctx_use_avx2(ctx), 0, 255,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_structured(ctx, video, &op, &curves, channel, channel, roi, "clip_channel_curve_S");
+}
+
+void scale_channel_curve_at_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi, long origin, long step) {
+    /**
+     * @brief scale_channel_curve_S with the curve's frame numbering given
+     *        explicitly: frame i of the video is frame origin + i * step.
+     */
+    OpCurves curves = { NULL, NULL, scale_factor, origin, step };
+    if (!scale_factor) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel_curve_S function.\n");
+        return;
+    }
+    if (curves_check(ctx, &curves, "scale_channel_curve_S") != 0) return;
+    BatchOp op = { BATCH_SCALE, video_ctx_use_avx2(ctx), 0, 255,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_structured(ctx, video, &op, &curves, channel, channel, roi, "scale_channel_curve_S");
+}
+
+void clip_channel_curve_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi) {
+    /**
+     * @brief Clips the values of a channel in a Video structure to a range
+     *        that changes over time, in one pass over the frames. The
+     *        bounds are evaluated per frame and rounded.
+     *        -O mode, flat structure
+     * @param ctx Library context.
+     * @param video Pointer to the Video structure.
+     * @param channel Channel index to clip.
+     * @param min_value Minimum value per frame, NULL for 0.
+     * @param max_value Maximum value per frame, NULL for 255.
+     * @param roi Region to clip, NULL for the whole video.
+     */
+    OpCurves curves = { min_value, max_value, NULL, 0, 1 };
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel_curve function.\n");
+        return;
+    }
+    if (curves_check(ctx, &curves, "clip_channel_curve") != 0) return;
+    BatchOp op = { BATCH_CLIP, video_ctx_use_avx2(ctx), 0, 255,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, &op, &curves, channel, channel, roi, "clip_channel_curve");
+}
+
+void clip_channel_curve_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi) {
+    /**
+     * @brief Clips the values of a channel in a SVideo structure to a range
+     *        that changes over time, in one parallel pass over the frames.
+     *        The bounds are evaluated per frame and rounded.
+     *        -S mode, SIMD and OpenMP across frames
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel Channel index to clip.
+     * @param min_value Minimum value per frame, NULL for 0.
+     * @param max_value Maximum value per frame, NULL for 255.
+     * @param roi Region to clip, NULL for the whole video.
+     */
+    clip_channel_curve_at_S_ctx(ctx, video, channel, min_value, max_value, roi, 0, 1);
+}
+
+void clip_channel_curve_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi) {
+    /**
+     * @brief Clips the values of a channel in a MVideo structure to a range
+     *        that changes over time. The bounds are evaluated per frame.
+     *        -M mode, optimised for memory usage
+     * @param ctx Library context.
+     * @param video Pointer to the MVideo structure.
+     * @param channel Channel index to clip.
+     * @param min_value Minimum value per frame, NULL for 0.
+     * @param max_value Maximum value per frame, NULL for 255.
+     * @param roi Region to clip, NULL for the whole video.
+     */
+    OpCurves curves = { min_value, max_value, NULL, 0, 1 };
+    if (!video) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to clip_channel_curve_M function.\n");
+        return;
+    }
+    if (curves_check(ctx, &curves, "clip_channel_curve_M") != 0) return;
+    BatchOp op = { BATCH_CLIP, video_ctx_use_avx2(ctx), 0, 255,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, &op, &curves, channel, channel, roi, "clip_channel_curve_M");
+}
+
+void scale_channel_curve_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi) {
+    /**
+     * @brief Scales the values of a channel in a Video structure by a
+     *        factor that changes over time (fades, animated grades), in
+     *        one pass over the frames.
+     *        -O mode, flat structure
+     * @param ctx Library context.
+     * @param video Pointer to the Video structure.
+     * @param channel Channel to scale.
+     * @param scale_factor Factor per frame.
+     * @param roi Region to scale, NULL for the whole video.
+     */
+    OpCurves curves = { NULL, NULL, scale_factor, 0, 1 };
+    if (!video || !scale_factor) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel_curve function.\n");
+        return;
+    }
+    if (curves_check(ctx, &curves, "scale_channel_curve") != 0) return;
+    BatchOp op = { BATCH_SCALE, video_ctx_use_avx2(ctx), 0, 255,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, &op, &curves, channel, channel, roi, "scale_channel_curve");
+}
+
+void scale_channel_curve_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi) {
+    /**
+     * @brief Scales the values of a channel in a SVideo structure by a
+     *        factor that changes over time (fades, animated grades), in
+     *        one parallel pass over the frames.
+     *        -S mode, SIMD and OpenMP across frames
+     * @param ctx Library context.
+     * @param video Pointer to the SVideo structure.
+     * @param channel Channel to scale.
+     * @param scale_factor Factor per frame.
+     * @param roi Region to scale, NULL for the whole video.
+     */
+    scale_channel_curve_at_S_ctx(ctx, video, channel, scale_factor, roi, 0, 1);
+}
+
+void scale_channel_curve_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi) {
+    /**
+     * @brief Scales the values of a channel in a MVideo structure by a
+     *        factor that changes over time.
+     *        -M mode, optimised for memory usage
+     * @param ctx Library context.
+     * @param video Pointer to the MVideo structure.
+     * @param channel Channel to scale.
+     * @param scale_factor Factor per frame.
+     * @param roi Region to scale, NULL for the whole video.
+     */
+    OpCurves curves = { NULL, NULL, scale_factor, 0, 1 };
+    if (!video || !scale_factor) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to scale_channel_curve_M function.\n");
+        return;
+    }
+    if (curves_check(ctx, &curves, "scale_channel_curve_M") != 0) return;
+    BatchOp op = { BATCH_SCALE, video_ctx_use_avx2(ctx), 0, 255,
+                   1.0f, video_ctx_tuning(ctx)->tile_bytes };
+    roi_flat(ctx, video->data, video->num_frames, video->channels, video->height,
+             video->width, &op, &curves, channel, channel, roi, "scale_channel_curve_M");
+}
+
+// Default-context API, kept for existing callers
+
+Video *decode(const char *filename) {
+    return decode_ctx(video_default_context(), filename);
+}
+
+SVideo *decode_S(const char *filename) {
+    return decode_S_ctx(video_default_context(), filename);
+}
+
+MVideo *decode_M(const char *filename) {
+    return decode_M_ctx(video_default_context(), filename);
+}
+
+int encode(const char *filename, const Video *video) {
+    return encode_ctx(video_default_context(), filename, video);
+}
+
+int encode_S(const char *filename, const SVideo *video) {
+    return encode_S_ctx(video_default_context(), filename, video);
+}
+
+int encode_M(const char *filename, const MVideo *video) {
+    return encode_M_ctx(video_default_context(), filename, video);
+}
+
+void reverse(Video *video) {
+    reverse_ctx(video_default_context(), video);
+}
+
+void reverse_S(SVideo *video) {
+    reverse_S_ctx(video_default_context(), video);
+}
+
+void reverse_M(MVideo *video) {
+    reverse_M_ctx(video_default_context(), video);
+}
+
+void swap_channels(Video *video, unsigned char channel1,
+unsigned char channel2) {
+    swap_channels_ctx(video_default_context(), video, channel1, channel2);
+}
+
+void swap_channels_S(SVideo *video, unsigned char channel1,
+unsigned char channel2) {
+    swap_channels_S_ctx(video_default_context(), video, channel1, channel2);
+}
+
+void swap_channels_M(MVideo *video, unsigned char channel1,
+unsigned char channel2) {
+    swap_channels_M_ctx(video_default_context(), video, channel1, channel2);
+}
+
+void clip_channel(Video *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value) {
+    clip_channel_ctx(video_default_context(), video, channel, min_value, max_value);
+}
+
+void clip_channel_S(SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value) {
+    clip_channel_S_ctx(video_default_context(), video, channel, min_value, max_value);
+}
+
+void clip_channel_M(MVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value) {
+    clip_channel_M_ctx(video_default_context(), video, channel, min_value, max_value);
+}
+
+void clip_channel_SIMD_S(SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value) {
+    clip_channel_SIMD_S_ctx(video_default_context(), video, channel, min_value, max_value);
+}
+
+void scale_channel(Video *video, unsigned char channel,
+float scale_factor) {
+    scale_channel_ctx(video_default_context(), video, channel, scale_factor);
+}
+
+void scale_channel_S(SVideo *video, unsigned char channel,
+float scale_factor) {
+    scale_channel_S_ctx(video_default_context(), video, channel, scale_factor);
+}
+
+void scale_channel_M(MVideo *video, unsigned char channel,
+float scale_factor) {
+    scale_channel_M_ctx(video_default_context(), video, channel, scale_factor);
+}
+
+void scale_channel_SIMD_S(SVideo *video, unsigned char channel,
+float scale_factor) {
+    scale_channel_SIMD_S_ctx(video_default_context(), video, channel, scale_factor);
+}
+
+void clip_channel_batched_S(SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value) {
+    clip_channel_batched_S_ctx(video_default_context(), video, channel, min_value, max_value);
+}
+
+void scale_channel_batched_S(SVideo *video, unsigned char channel,
+float scale_factor) {
+    scale_channel_batched_S_ctx(video_default_context(), video, channel, scale_factor);
+}
+
+void swap_channels_roi(Video *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi) {
+    swap_channels_roi_ctx(video_default_context(), video, channel1, channel2, roi);
+}
+
+void swap_channels_roi_S(SVideo *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi) {
+    swap_channels_roi_S_ctx(video_default_context(), video, channel1, channel2, roi);
+}
+
+void swap_channels_roi_M(MVideo *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi) {
+    swap_channels_roi_M_ctx(video_default_context(), video, channel1, channel2, roi);
+}
+
+void clip_channel_roi(Video *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi) {
+    clip_channel_roi_ctx(video_default_context(), video, channel, min_value, max_value, roi);
+}
+
+void clip_channel_roi_S(SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi) {
+    clip_channel_roi_S_ctx(video_default_context(), video, channel, min_value, max_value, roi);
+}
+
+void clip_channel_roi_M(MVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi) {
+    clip_channel_roi_M_ctx(video_default_context(), video, channel, min_value, max_value, roi);
+}
+
+void scale_channel_roi(Video *video, unsigned char channel,
+float scale_factor, const VideoROI *roi) {
+    scale_channel_roi_ctx(video_default_context(), video, channel, scale_factor, roi);
+}
+
+void scale_channel_roi_S(SVideo *video, unsigned char channel,
+float scale_factor, const VideoROI *roi) {
+    scale_channel_roi_S_ctx(video_default_context(), video, channel, scale_factor, roi);
+}
+
+void scale_channel_roi_M(MVideo *video, unsigned char channel,
+float scale_factor, const VideoROI *roi) {
+    scale_channel_roi_M_ctx(video_default_context(), video, channel, scale_factor, roi);
+}
+
+void clip_channel_curve(Video *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi) {
+    clip_channel_curve_ctx(video_default_context(), video, channel, min_value, max_value, roi);
+}
+
+void clip_channel_curve_S(SVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi) {
+    clip_channel_curve_S_ctx(video_default_context(), video, channel, min_value, max_value, roi);
+}
+
+void clip_channel_curve_M(MVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi) {
+    clip_channel_curve_M_ctx(video_default_context(), video, channel, min_value, max_value, roi);
+}
+
+void scale_channel_curve(Video *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi) {
+    scale_channel_curve_ctx(video_default_context(), video, channel, scale_factor, roi);
+}
+
+void scale_channel_curve_S(SVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi) {
+    scale_channel_curve_S_ctx(video_default_context(), video, channel, scale_factor, roi);
+}
+
+void scale_channel_curve_M(MVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi) {
+    scale_channel_curve_M_ctx(video_default_context(), video, channel, scale_factor, roi);
+}
+
+void free_video(Video *video) {
+    free_video_ctx(video_default_context(), video);
+}
+
+void free_video_S(SVideo *video) {
+    free_video_S_ctx(video_default_context(), video);
+}
+
+void free_video_M(MVideo *video) {
+    free_video_M_ctx(video_default_context(), video);
+}
+
+SVideo *copy_video_S(const SVideo *video) {
+    return copy_video_S_ctx(video_default_context(), video);
+}
+
+SVideo *snapshot_video_S(SVideo *video) {
+    return snapshot_video_S_ctx(video_default_context(), video);
+}
+
+SVideo *proxy_video_S(const SVideo *video, int max_side, long frame_step, long max_frames) {
+    return proxy_video_S_ctx(video_default_context(), video, max_side, frame_step, max_frames);
+}
+
+SVideo *map_video_S(const char *filename) {
+    return map_video_S_ctx(video_default_context(), filename);
 }
 
 // end
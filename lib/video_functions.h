@@ -1,8 +1,9 @@
 #ifndef VEDITOR_NAIVEVIDEO_LIBFILMMASTER2000_H
-#define LIBFILMMASTER2000_H
+#define VEDITOR_NAIVEVIDEO_LIBFILMMASTER2000_H
 
 #include <stddef.h>
 #include <stdint.h>
+#include "video_context.h"
 
 typedef struct {
     long num_frames;          // Number of frames in the video
@@ -12,8 +13,11 @@ typedef struct {
     unsigned char *data;      // Pointer to the pixel data
 } MVideo;
 
+typedef struct VideoPlaneRef VideoPlaneRef;
+
 typedef struct {
     unsigned char *data;
+    VideoPlaneRef *ref;   // Share count once snapshots may share the plane, else NULL
 } Channel;
 
 typedef struct {
@@ -37,6 +41,36 @@ typedef struct {
     unsigned char *data;      // Pointer to the pixel data
 } Video;
 
+// Region of interest for the _roi kernels: a frame range and a rectangle,
+// optionally weighted per pixel by a mask plane
+typedef struct {
+    long first_frame;              // First frame of the range
+    long last_frame;               // One past the last frame, 0 for the end of the video
+    unsigned char x, y;            // Top-left corner of the rectangle
+    unsigned char width, height;   // Rectangle size, 0 for the rest of the frame
+    const unsigned char *mask;     // height x width weights (0 keeps, 255 replaces), or NULL
+} VideoROI;
+
+// Keyframed parameter for the _curve kernels: the value at each frame is
+// interpolated between the keyframes around it, and held before the first
+// and after the last
+typedef enum {
+    VIDEO_CURVE_HOLD = 0,          // Keep the keyframe's value until the next one
+    VIDEO_CURVE_LINEAR = 1,        // Linear to the next keyframe
+    VIDEO_CURVE_BEZIER = 2         // Cubic Bezier with flat handles (ease in and out)
+} VideoCurveInterp;
+
+typedef struct {
+    long frame;                    // Frame the keyframe is on
+    float value;
+    VideoCurveInterp interp;       // Interpolation towards the next keyframe
+} VideoKeyframe;
+
+typedef struct {
+    int num_keys;
+    const VideoKeyframe *keys;     // Sorted by frame, at most one per frame
+} VideoCurve;
+
 typedef struct {
     unsigned char *data;  // Pointer to the channel's data
     size_t start;         // Start index for this thread
@@ -100,7 +134,61 @@ float scale_factor);
 void scale_channel_M(MVideo *video, unsigned char channel,
 float scale_factor);
 
-void scale_channel_SIMD_S (SVideo *video, unsigned char channel);
+void scale_channel_SIMD_S (SVideo *video, unsigned char channel,
+float scale_factor);
+
+void clip_channel_batched_S(SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value);
+
+void scale_channel_batched_S(SVideo *video, unsigned char channel,
+float scale_factor);
+
+void swap_channels_roi(Video *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi);
+
+void swap_channels_roi_S(SVideo *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi);
+
+void swap_channels_roi_M(MVideo *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi);
+
+void clip_channel_roi(Video *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi);
+
+void clip_channel_roi_S(SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi);
+
+void clip_channel_roi_M(MVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi);
+
+void scale_channel_roi(Video *video, unsigned char channel,
+float scale_factor, const VideoROI *roi);
+
+void scale_channel_roi_S(SVideo *video, unsigned char channel,
+float scale_factor, const VideoROI *roi);
+
+void scale_channel_roi_M(MVideo *video, unsigned char channel,
+float scale_factor, const VideoROI *roi);
+
+void clip_channel_curve(Video *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi);
+
+void clip_channel_curve_S(SVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi);
+
+void clip_channel_curve_M(MVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi);
+
+void scale_channel_curve(Video *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi);
+
+void scale_channel_curve_S(SVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi);
+
+void scale_channel_curve_M(MVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi);
+
+float video_curve_eval(const VideoCurve *curve, long frame);
 
 void free_video(Video *video);
 
@@ -108,6 +196,154 @@ void free_video_S(SVideo *video);
 
 void free_video_M(MVideo *video);
 
+SVideo *copy_video_S(const SVideo *video);
+
+SVideo *snapshot_video_S(SVideo *video);
+
+SVideo *proxy_video_S(const SVideo *video, int max_side, long frame_step, long max_frames);
+
+SVideo *map_video_S(const char *filename);
+
+// Context-taking variants; the functions above use video_default_context()
+
+Video *decode_ctx(VideoContext *ctx, const char *filename);
+
+SVideo *decode_S_ctx(VideoContext *ctx, const char *filename);
+
+MVideo *decode_M_ctx(VideoContext *ctx, const char *filename);
+
+int encode_ctx(VideoContext *ctx, const char *filename, const Video *video);
+
+int encode_S_ctx(VideoContext *ctx, const char *filename, const SVideo *video);
+
+int encode_M_ctx(VideoContext *ctx, const char *filename, const MVideo *video);
+
+void reverse_ctx(VideoContext *ctx, Video *video);
+
+void reverse_S_ctx(VideoContext *ctx, SVideo *video);
+
+void reverse_M_ctx(VideoContext *ctx, MVideo *video);
+
+void swap_channels_ctx(VideoContext *ctx, Video *video, unsigned char channel1,
+unsigned char channel2);
+
+void swap_channels_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel1,
+unsigned char channel2);
+
+void swap_channels_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel1,
+unsigned char channel2);
+
+void clip_channel_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value);
+
+void clip_channel_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value);
+
+void clip_channel_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value);
+
+void clip_channel_SIMD_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value);
+
+void scale_channel_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+float scale_factor);
+
+void scale_channel_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+float scale_factor);
+
+void scale_channel_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+float scale_factor);
+
+void scale_channel_SIMD_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+float scale_factor);
+
+void clip_channel_batched_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value);
+
+void scale_channel_batched_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+float scale_factor);
+
+void swap_channels_roi_ctx(VideoContext *ctx, Video *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi);
+
+void swap_channels_roi_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi);
+
+void swap_channels_roi_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel1,
+unsigned char channel2, const VideoROI *roi);
+
+void clip_channel_roi_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi);
+
+void clip_channel_roi_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi);
+
+void clip_channel_roi_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+unsigned char min_value, unsigned char max_value, const VideoROI *roi);
+
+void scale_channel_roi_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+float scale_factor, const VideoROI *roi);
+
+void scale_channel_roi_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+float scale_factor, const VideoROI *roi);
+
+void scale_channel_roi_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+float scale_factor, const VideoROI *roi);
+
+void clip_channel_curve_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi);
+
+void clip_channel_curve_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi);
+
+void clip_channel_curve_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi);
+
+void scale_channel_curve_ctx(VideoContext *ctx, Video *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi);
+
+void scale_channel_curve_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi);
+
+void scale_channel_curve_M_ctx(VideoContext *ctx, MVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi);
+
+void free_video_ctx(VideoContext *ctx, Video *video);
+
+void free_video_S_ctx(VideoContext *ctx, SVideo *video);
+
+void free_video_M_ctx(VideoContext *ctx, MVideo *video);
+
+SVideo *copy_video_S_ctx(VideoContext *ctx, const SVideo *video);
+
+SVideo *snapshot_video_S_ctx(VideoContext *ctx, SVideo *video);
+
+SVideo *proxy_video_S_ctx(VideoContext *ctx, const SVideo *video, int max_side,
+                          long frame_step, long max_frames);
+
+SVideo *map_video_S_ctx(VideoContext *ctx, const char *filename);
+
+// Share counts for zero-copy views (lib/video_buffers.c): a view of a shared
+// plane holds one, so kernels copy the plane and it outlives the view
+void retain_plane_S(VideoPlaneRef *ref);
+
+void release_plane_S(VideoPlaneRef *ref);
+
 void print_memory_usage(const char *flag, void *video);
 
+// Used by op programs, which run chunks of a video with reverses deferred:
+// frame i of the video is frame origin + i * step of the curves
+void clip_channel_curve_at_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+const VideoCurve *min_value, const VideoCurve *max_value, const VideoROI *roi,
+long origin, long step);
+
+void scale_channel_curve_at_S_ctx(VideoContext *ctx, SVideo *video, unsigned char channel,
+const VideoCurve *scale_factor, const VideoROI *roi, long origin, long step);
+
+// Paging hints for frames [first, first + count) of a video, for videos
+// that have spilled to disk (see video_context_set_spill); no-ops otherwise
+void prefetch_frames_S_ctx(VideoContext *ctx, const SVideo *video, long first, long count);
+
+void evict_frames_S_ctx(VideoContext *ctx, const SVideo *video, long first, long count);
+
 #endif   // VEDITOR_NAIVEVIDEO_LIBFILMMASTER2000_H
@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "video_jobs.h"
+#include "video_ops.h"
+#include "video_files.h"
+
+#ifdef VIDEO_WITH_FFMPEG
+#include "video_codec.h"
+#endif
+
+struct VideoJob {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    VideoContext *ctx;
+    int owns_ctx;
+    char *input_path;
+    char *output_path;
+    char *program;
+    char *codec;
+    int fps;
+    VideoJobSpec spec;
+    VideoJobProgressFn progress_fn;
+    void *progress_user;
+    VideoJobHooks hooks;
+    VideoJobState state;
+    VideoStage stage;
+    long done;
+    long total;
+    int cancel_requested;
+    char error[256];
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Whether two paths name the same existing file, e.g. through a link
+static int same_file(const char *a, const char *b) {
+    struct stat a_stat, b_stat;
+    return stat(a, &a_stat) == 0 && stat(b, &b_stat) == 0 &&
+           a_stat.st_dev == b_stat.st_dev && a_stat.st_ino == b_stat.st_ino;
+}
+
+static char *copy_string(const char *text, const char *fallback) {
+    if (!text) text = fallback;
+    return text ? strdup(text) : NULL;
+}
+
+int video_is_standard_format(const char *path) {
+#ifdef VIDEO_WITH_FFMPEG
+    static const char *extensions[] = {".mp4", ".mov", ".avi", ".mkv", ".wmv", ".flv", ".webm"};
+    const char *dot = strrchr(path, '.');
+    if (!dot) return 0;
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strcasecmp(dot, extensions[i]) == 0) return 1;
+    }
+#else
+    (void)path;
+#endif
+    return 0;
+}
+
+static void job_progress(VideoStage stage, long done, long total, void *user) {
+    VideoJob *job = (VideoJob *)user;
+
+    pthread_mutex_lock(&job->lock);
+    job->stage = stage;
+    job->done = done;
+    job->total = total;
+    pthread_mutex_unlock(&job->lock);
+
+    if (job->progress_fn) {
+        job->progress_fn(job, stage, done, total, job->progress_user);
+    }
+    if (job->hooks.checkpoint &&
+        job->hooks.checkpoint(job, stage, done, total, job->hooks.user) != 0) {
+        video_context_cancel(job->ctx);
+    }
+}
+
+static SVideo *job_decode(VideoJob *job) {
+#ifdef VIDEO_WITH_FFMPEG
+    if (video_is_standard_format(job->input_path)) {
+        return decode_standard_video_ctx(job->ctx, job->input_path);
+    }
+#endif
+    return decode_S_ctx(job->ctx, job->input_path);
+}
+
+static int job_encode(VideoJob *job, const SVideo *video) {
+#ifdef VIDEO_WITH_FFMPEG
+    if (video_is_standard_format(job->output_path)) {
+        return encode_standard_video_ctx(job->ctx, job->output_path, video,
+                                         job->codec, job->fps);
+    }
+#endif
+    return encode_S_ctx(job->ctx, job->output_path, video);
+}
+
+static int job_reverse(VideoJob *job) {
+#ifdef VIDEO_WITH_FFMPEG
+    if (video_is_standard_format(job->input_path)) {
+        return reverse_standard_video_ctx(job->ctx, job->input_path, job->output_path,
+                                          job->codec, job->fps);
+    }
+#endif
+    return video_reverse_file(job->ctx, job->input_path, job->output_path);
+}
+
+// Cache key of the job's result, from everything that affects the output file
+static int job_result_key(VideoJob *job, const VideoHash *input, const VideoProgram *program,
+                          char *key) {
+    char profile[256];
+    if (video_is_standard_format(job->output_path)) {
+        snprintf(profile, sizeof(profile), "%s;codec=%s;fps=%d%s",
+                 strrchr(job->output_path, '.'), job->codec, job->fps,
+                 video_ctx_deterministic(job->ctx) ? ";bitexact" : "");
+    } else {
+        snprintf(profile, sizeof(profile), "raw");
+    }
+    return video_cache_key_hashed(job->ctx, input, program, profile, key) == 0;
+}
+
+// Key of the video after the first num_ops ops of the program; a standard
+// format input decodes differently in deterministic mode
+static int job_prefix_key(VideoJob *job, const VideoHash *input, const VideoProgram *program,
+                          int num_ops, char *key) {
+    VideoProgram prefix = {num_ops, program->ops};
+    const char *profile = video_ctx_deterministic(job->ctx) &&
+                          video_is_standard_format(job->input_path)
+                          ? "checkpoint;bitexact" : "checkpoint";
+    return video_cache_key_hashed(job->ctx, input, &prefix, profile, key) == 0;
+}
+
+static void job_checkpoint(VideoJob *job, const VideoHash *input, const VideoProgram *program,
+                           int num_ops, const SVideo *video, double work) {
+    char key[VIDEO_CACHE_KEY_SIZE];
+    if (job_prefix_key(job, input, program, num_ops, key)) {
+        video_checkpoints_save(job->spec.checkpoints, key, video, work);
+    }
+}
+
+// Restore the longest checkpointed prefix of the program; *num_ops is set
+// to the number of ops already applied
+static SVideo *job_restore(VideoJob *job, const VideoHash *input, const VideoProgram *program,
+                           int *num_ops, double *work) {
+    for (int n = program->num_ops; n >= 0; n--) {
+        char key[VIDEO_CACHE_KEY_SIZE];
+        if (!job_prefix_key(job, input, program, n, key)) return NULL;
+        SVideo *video = video_checkpoints_restore(job->spec.checkpoints, job->ctx, key, work);
+        if (video) {
+            video_ctx_log(job->ctx, VIDEO_LOG_INFO, "Resuming %s after %d of %d ops\n",
+                          job->input_path, n, program->num_ops);
+            *num_ops = n;
+            return video;
+        }
+    }
+    return NULL;
+}
+
+// Run ops [first, num_ops) of the program; work is the time spent so far
+// producing the video. With checkpoints, the video is saved before the last
+// op as well as at the end, so changing the last op (the usual edit)
+// resumes one op from the end.
+static int job_run(VideoJob *job, const VideoHash *input, const VideoProgram *program,
+                   int first, SVideo *video, double work) {
+    int checkpoint = input != NULL;
+    int split = checkpoint && program->num_ops - 1 > first ? program->num_ops - 1 : first;
+    VideoProgram head = {split - first, program->ops + first};
+    VideoProgram tail = {program->num_ops - split, program->ops + split};
+
+    double start = now_seconds();
+    if (head.num_ops) {
+        if (video_program_run_S(job->ctx, video, &head) != 0) return -1;
+        if (video_context_cancelled(job->ctx)) return -1;
+        work += now_seconds() - start;
+        job_checkpoint(job, input, program, split, video, work);
+        start = now_seconds();
+    }
+    if (video_program_run_S(job->ctx, video, &tail) != 0) return -1;
+    if (video_context_cancelled(job->ctx)) return -1;
+    if (checkpoint && tail.num_ops) {
+        job_checkpoint(job, input, program, program->num_ops, video,
+                       work + now_seconds() - start);
+    }
+    return 0;
+}
+
+// Decode (or restore from a checkpoint), run the program and encode
+static int job_process(VideoJob *job, const VideoHash *checkpoint_input,
+                       const VideoProgram *program) {
+    int first = 0;
+    double work = 0.0;
+    SVideo *video = NULL;
+    if (checkpoint_input) video = job_restore(job, checkpoint_input, program, &first, &work);
+    if (!video && !video_context_cancelled(job->ctx)) {
+        double start = now_seconds();
+        video = job_decode(job);
+        work = now_seconds() - start;
+        if (video && checkpoint_input) {
+            job_checkpoint(job, checkpoint_input, program, 0, video, work);
+        }
+    }
+
+    int result = -1;
+    if (video && !video_context_cancelled(job->ctx) &&
+        job_run(job, checkpoint_input, program, first, video, work) == 0) {
+        result = job_encode(job, video);
+    }
+
+    if (video) free_video_S_ctx(job->ctx, video);
+    return result;
+}
+
+// What a job computes before it asks for a CPU slot
+typedef struct {
+    VideoProgram *program;
+    VideoHash input;
+    int hashed;                      // input is valid
+    int cached;                      // key is valid
+    char key[VIDEO_CACHE_KEY_SIZE];  // Result cache key
+} JobPlan;
+
+static int job_plan(VideoJob *job, JobPlan *plan) {
+    // Writing the output would destroy the input before it is read, and a
+    // cache hit would replace it outright
+    if (same_file(job->input_path, job->output_path)) {
+        video_ctx_log(job->ctx, VIDEO_LOG_ERROR, "Output %s is the job's input\n",
+                      job->output_path);
+        return -1;
+    }
+    plan->program = video_program_parse(job->ctx, job->program);
+    if (!plan->program) return -1;
+
+    // The result cache and checkpoints are both keyed by the input's
+    // content; if it cannot be hashed the job runs without them
+    VideoCache *cache = job->spec.cache;
+    plan->hashed = (cache || job->spec.checkpoints) &&
+                   video_hash_file(job->ctx, job->input_path, &plan->input) == 0;
+    plan->cached = cache && plan->hashed &&
+                   job_result_key(job, &plan->input, plan->program, plan->key);
+    return 0;
+}
+
+// Copy the result from the cache; returns 1 on a hit
+static int job_fetch(VideoJob *job, const JobPlan *plan) {
+    if (!plan->cached ||
+        video_cache_fetch(job->spec.cache, job->ctx, plan->key, job->output_path) != 1) {
+        return 0;
+    }
+    video_ctx_log(job->ctx, VIDEO_LOG_INFO, "Result of %s found in cache\n", job->input_path);
+    return 1;
+}
+
+static int job_execute(VideoJob *job, const JobPlan *plan) {
+    const VideoProgram *program = plan->program;
+
+    // The output may be a link to a cached file from an earlier hit; write
+    // a new file rather than through the link
+    if (plan->cached) unlink(job->output_path);
+
+    // A reverse between two raw files or two standard format files streams
+    // from one to the other, so it works on inputs larger than memory;
+    // there is no decoded video to checkpoint
+    int result;
+    if (video_program_is_reverse(program) &&
+        video_is_standard_format(job->input_path) == video_is_standard_format(job->output_path)) {
+        result = job_reverse(job);
+    } else {
+        result = job_process(job, job->spec.checkpoints && plan->hashed ? &plan->input : NULL,
+                             program);
+    }
+
+    // A failed store only costs a future recompute
+    if (result == 0 && plan->cached && !video_context_cancelled(job->ctx)) {
+        video_cache_store(job->spec.cache, job->ctx, plan->key, job->output_path);
+    }
+    return result;
+}
+
+static void *job_thread(void *arg) {
+    VideoJob *job = (VideoJob *)arg;
+
+    pthread_mutex_lock(&job->lock);
+    video_context_clear_cancel(job->ctx);
+    int cancelled = job->cancel_requested;
+    pthread_mutex_unlock(&job->lock);
+
+    // Checked before the job writes, while the output still names the input
+    int keep_output = same_file(job->input_path, job->output_path);
+
+    // A cached result or a program that does not parse needs no CPU slot,
+    // so both are settled before admission
+    JobPlan plan = {0};
+    int planned = -1, hit = 0;
+    if (!cancelled) {
+        if (job->hooks.start) job->hooks.start(job, job->hooks.user);
+        planned = job_plan(job, &plan);
+        hit = planned == 0 && job_fetch(job, &plan);
+    }
+    if (!cancelled && planned == 0 && !hit && job->hooks.admit) {
+        cancelled = job->hooks.admit(job, job->hooks.user) != 0;
+    }
+
+    // Whether the job starts is decided under the lock, so a cancel can
+    // never be lost between here and video_job_cancel()
+    pthread_mutex_lock(&job->lock);
+    if (cancelled || job->cancel_requested) {
+        pthread_mutex_unlock(&job->lock);
+        if (hit && !keep_output) remove(job->output_path);
+        video_program_free(job->ctx, plan.program);
+        if (job->hooks.finish) job->hooks.finish(job, job->hooks.user);
+
+        pthread_mutex_lock(&job->lock);
+        job->state = VIDEO_JOB_CANCELLED;
+        pthread_cond_broadcast(&job->finished);
+        pthread_mutex_unlock(&job->lock);
+        return NULL;
+    }
+    job->state = VIDEO_JOB_RUNNING;
+    pthread_mutex_unlock(&job->lock);
+
+    int result = planned;
+    if (planned == 0 && !hit) {
+        video_context_set_progress(job->ctx, job_progress, job);
+        result = job_execute(job, &plan);
+        video_context_set_progress(job->ctx, NULL, NULL);
+    }
+    video_program_free(job->ctx, plan.program);
+    if (job->hooks.finish) job->hooks.finish(job, job->hooks.user);
+
+    pthread_mutex_lock(&job->lock);
+    // Do not leave a partial output behind
+    int cancelled_run = video_context_cancelled(job->ctx);
+    if ((cancelled_run || result != 0) && !keep_output) remove(job->output_path);
+    if (cancelled_run) {
+        job->state = VIDEO_JOB_CANCELLED;
+    } else if (result != 0) {
+        snprintf(job->error, sizeof(job->error), "%s", video_context_last_error(job->ctx));
+        job->state = VIDEO_JOB_FAILED;
+    } else {
+        job->state = VIDEO_JOB_DONE;
+    }
+    video_context_clear_cancel(job->ctx);
+    pthread_cond_broadcast(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static void job_release(VideoJob *job) {
+    if (job->owns_ctx) video_context_destroy(job->ctx);
+    pthread_cond_destroy(&job->finished);
+    pthread_mutex_destroy(&job->lock);
+    free(job->input_path);
+    free(job->output_path);
+    free(job->program);
+    free(job->codec);
+    free(job);
+}
+
+VideoJob *video_job_submit(VideoContext *ctx, const VideoJobSpec *spec,
+                           VideoJobProgressFn progress_fn, void *user) {
+    return video_job_submit_with_hooks(ctx, spec, progress_fn, user, NULL);
+}
+
+VideoJob *video_job_submit_with_hooks(VideoContext *ctx, const VideoJobSpec *spec,
+                                      VideoJobProgressFn progress_fn, void *user,
+                                      const VideoJobHooks *hooks) {
+    if (!spec || !spec->input_path || !spec->output_path) {
+        video_ctx_log(ctx ? ctx : video_default_context(), VIDEO_LOG_ERROR,
+                      "Invalid input to video_job_submit function.\n");
+        return NULL;
+    }
+
+    VideoJob *job = (VideoJob *)calloc(1, sizeof(VideoJob));
+    if (!job) {
+        perror("Error allocating VideoJob");
+        return NULL;
+    }
+
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+    job->ctx = ctx;
+    if (!job->ctx) {
+        job->ctx = video_context_create();
+        job->owns_ctx = 1;
+    }
+    job->input_path = copy_string(spec->input_path, NULL);
+    job->output_path = copy_string(spec->output_path, NULL);
+    job->program = copy_string(spec->program, "");
+    job->codec = copy_string(spec->codec, "libx264");
+    job->fps = spec->fps > 0 ? spec->fps : 30;
+    job->progress_fn = progress_fn;
+    job->progress_user = user;
+    if (hooks) job->hooks = *hooks;
+    job->state = VIDEO_JOB_QUEUED;
+
+    job->spec.input_path = job->input_path;
+    job->spec.output_path = job->output_path;
+    job->spec.program = job->program;
+    job->spec.codec = job->codec;
+    job->spec.fps = job->fps;
+    job->spec.cache = spec->cache;
+    job->spec.checkpoints = spec->checkpoints;
+
+    if (!job->ctx || !job->input_path || !job->output_path || !job->program || !job->codec) {
+        perror("Error allocating VideoJob");
+        job_release(job);
+        return NULL;
+    }
+
+    if (pthread_create(&job->thread, NULL, job_thread, job) != 0) {
+        video_ctx_log(job->ctx, VIDEO_LOG_ERROR, "Error starting job thread\n");
+        job_release(job);
+        return NULL;
+    }
+    return job;
+}
+
+VideoJobState video_job_poll(VideoJob *job, VideoStage *stage, long *done, long *total) {
+    pthread_mutex_lock(&job->lock);
+    VideoJobState state = job->state;
+    if (stage) *stage = job->stage;
+    if (done) *done = job->done;
+    if (total) *total = job->total;
+    pthread_mutex_unlock(&job->lock);
+    return state;
+}
+
+VideoJobState video_job_wait(VideoJob *job) {
+    pthread_mutex_lock(&job->lock);
+    while (job->state == VIDEO_JOB_QUEUED || job->state == VIDEO_JOB_RUNNING) {
+        pthread_cond_wait(&job->finished, &job->lock);
+    }
+    VideoJobState state = job->state;
+    pthread_mutex_unlock(&job->lock);
+    return state;
+}
+
+void video_job_cancel(VideoJob *job) {
+    pthread_mutex_lock(&job->lock);
+    job->cancel_requested = 1;
+    if (job->state == VIDEO_JOB_RUNNING) {
+        video_context_cancel(job->ctx);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+int video_job_cancel_requested(VideoJob *job) {
+    pthread_mutex_lock(&job->lock);
+    int requested = job->cancel_requested;
+    pthread_mutex_unlock(&job->lock);
+    return requested;
+}
+
+VideoContext *video_job_context(VideoJob *job) {
+    return job->ctx;
+}
+
+const VideoJobSpec *video_job_spec(VideoJob *job) {
+    return &job->spec;
+}
+
+const char *video_job_error(VideoJob *job) {
+    return job->error;
+}
+
+void video_job_free(VideoJob *job) {
+    if (!job) return;
+    pthread_join(job->thread, NULL);
+    job_release(job);
+}
@@ -0,0 +1,175 @@
+#ifndef VIDEO_JOBS_H
+#define VIDEO_JOBS_H
+
+#include "video_context.h"
+#include "video_checkpoint.h"
+
+/**
+ * @brief Asynchronous jobs: decode -> op program -> encode on a background thread
+ * Submitting returns immediately with a handle that can be polled, waited on
+ * or cancelled. Cancellation is cooperative and takes effect at the next
+ * frame (decode/encode) or chunk of frames (processing). A job that fails
+ * or is cancelled removes its output. A job whose output is its input (by
+ * device and inode, so through links too) fails without touching it.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct VideoJob VideoJob;
+
+typedef enum {
+    VIDEO_JOB_QUEUED = 0,
+    VIDEO_JOB_RUNNING = 1,
+    VIDEO_JOB_DONE = 2,
+    VIDEO_JOB_FAILED = 3,
+    VIDEO_JOB_CANCELLED = 4
+} VideoJobState;
+
+typedef struct {
+    const char *input_path;     // Raw (.bin) or, with FFmpeg, standard format input
+    const char *output_path;    // Output, format chosen by extension like the input
+    const char *program;        // Op program, see video_ops.h
+    const char *codec;          // Encoder for standard formats, NULL for libx264
+    int fps;                    // Frame rate for standard formats, 0 for 30
+    VideoCache *cache;          // Result cache to reuse and fill, NULL for none
+    VideoCheckpoints *checkpoints;  // Resume from and save op prefixes, NULL for none
+} VideoJobSpec;
+
+/**
+ * @brief Progress callback, called on the job's thread
+ *
+ * @param job Job reporting progress
+ * @param stage Current stage
+ * @param done Frames done in this stage
+ * @param total Frames in this stage (an estimate while decoding)
+ * @param user User pointer given to video_job_submit()
+ */
+typedef void (*VideoJobProgressFn)(VideoJob *job, VideoStage stage, long done,
+                                   long total, void *user);
+
+/**
+ * @brief Hooks letting a scheduler control when a job may use the CPU
+ * All run on the job's thread; hooks that block should poll
+ * video_job_cancel_requested(). Any member may be NULL. Jobs whose result
+ * is in the cache, or whose program does not parse, are never admitted.
+ */
+typedef struct {
+    void (*start)(VideoJob *job, void *user);   // First hook call, before the job reads its input
+    int (*admit)(VideoJob *job, void *user);    // Block until the job may start; non-zero cancels it
+    int (*checkpoint)(VideoJob *job, VideoStage stage, long done, long total,
+                      void *user);              // At each progress report; may block to yield, non-zero cancels the job
+    void (*finish)(VideoJob *job, void *user);  // Last hook call, after the job's last use of the CPU
+    void *user;
+} VideoJobHooks;
+
+/**
+ * @brief Start a job on a new thread
+ * The job uses ctx exclusively until it finishes; pass NULL to give the job
+ * a private context with default settings. The spec is copied.
+ *
+ * @param ctx Library context, or NULL
+ * @param spec Job description
+ * @param progress_fn Optional progress callback
+ * @param user Passed through to the callback
+ * @return VideoJob* Job handle, or NULL if the job could not be started
+ */
+VideoJob *video_job_submit(VideoContext *ctx, const VideoJobSpec *spec,
+                           VideoJobProgressFn progress_fn, void *user);
+
+/**
+ * @brief Start a job whose CPU use is controlled by hooks
+ * Like video_job_submit(); hooks are copied.
+ *
+ * @param ctx Library context, or NULL
+ * @param spec Job description
+ * @param progress_fn Optional progress callback
+ * @param user Passed through to the callback
+ * @param hooks Scheduling hooks, or NULL
+ * @return VideoJob* Job handle, or NULL if the job could not be started
+ */
+VideoJob *video_job_submit_with_hooks(VideoContext *ctx, const VideoJobSpec *spec,
+                                      VideoJobProgressFn progress_fn, void *user,
+                                      const VideoJobHooks *hooks);
+
+/**
+ * @brief Get the context the job runs on
+ *
+ * @param job Job handle
+ * @return VideoContext* The job's context
+ */
+VideoContext *video_job_context(VideoJob *job);
+
+/**
+ * @brief Get the description the job was submitted with
+ *
+ * @param job Job handle
+ * @return const VideoJobSpec* The job's copy of the spec
+ */
+const VideoJobSpec *video_job_spec(VideoJob *job);
+
+/**
+ * @brief Whether video_job_cancel() has been called
+ *
+ * @param job Job handle
+ * @return int 1 if cancellation was requested, 0 otherwise
+ */
+int video_job_cancel_requested(VideoJob *job);
+
+/**
+ * @brief Whether jobs read and write the path with the FFmpeg codec
+ * True for standard container extensions (.mp4, .mov, ...) when the library
+ * is built with FFmpeg; other paths use the raw -S format.
+ *
+ * @param path File path
+ * @return int 1 for standard formats, 0 for the raw format
+ */
+int video_is_standard_format(const char *path);
+
+/**
+ * @brief Get the job's state and progress without blocking
+ *
+ * @param job Job handle
+ * @param stage Output current stage (may be NULL)
+ * @param done Output frames done in the stage (may be NULL)
+ * @param total Output frames in the stage (may be NULL)
+ * @return VideoJobState Current state
+ */
+VideoJobState video_job_poll(VideoJob *job, VideoStage *stage, long *done, long *total);
+
+/**
+ * @brief Block until the job finishes
+ *
+ * @param job Job handle
+ * @return VideoJobState Final state
+ */
+VideoJobState video_job_wait(VideoJob *job);
+
+/**
+ * @brief Request cancellation; returns immediately
+ *
+ * @param job Job handle
+ */
+void video_job_cancel(VideoJob *job);
+
+/**
+ * @brief Get the error message of a failed job
+ *
+ * @param job Job handle
+ * @return const char* Message, empty string if none
+ */
+const char *video_job_error(VideoJob *job);
+
+/**
+ * @brief Wait for the job and release it
+ *
+ * @param job Job handle
+ */
+void video_job_free(VideoJob *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_JOBS_H
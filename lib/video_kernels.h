@@ -0,0 +1,75 @@
+#ifndef VIDEO_KERNELS_H
+#define VIDEO_KERNELS_H
+
+#include <stddef.h>
+
+// AVX2 kernels are compiled for AVX2 individually so the rest of the
+// library runs on any x86-64 CPU; callers check video_cpu_has_avx2() first
+#if defined(__GNUC__)
+#define VIDEO_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define VIDEO_TARGET_AVX2
+#endif
+
+/**
+ * @brief Internal single-plane kernels shared by the -S mode functions
+ * and the autotuner. Not part of the public API.
+ */
+
+/**
+ * @brief Scale a plane with the scalar kernel, in unrolled tiles
+ *
+ * @param data Plane data
+ * @param size Number of bytes in the plane
+ * @param scale_factor Factor to scale the values by
+ * @param tile_bytes Bytes per unrolled tile
+ * @param prefetch_distance Prefetch distance in bytes (0 disables prefetch)
+ */
+void scale_plane_tiled(unsigned char *data, size_t size, float scale_factor,
+                       size_t tile_bytes, size_t prefetch_distance);
+
+/**
+ * @brief Whether the CPU supports AVX2
+ *
+ * @return int 1 if supported, 0 otherwise
+ */
+int video_cpu_has_avx2(void);
+
+/**
+ * @brief Clip a plane to [min_value, max_value] with portable C
+ *
+ * @param data Plane data
+ * @param size Number of bytes in the plane
+ * @param min_value Minimum value
+ * @param max_value Maximum value
+ */
+void clip_plane_scalar(unsigned char *data, size_t size,
+                       unsigned char min_value, unsigned char max_value);
+
+/**
+ * @brief Clip a plane to [min_value, max_value] with AVX2
+ *
+ * @param data Plane data
+ * @param size Number of bytes in the plane
+ * @param min_value Minimum value
+ * @param max_value Maximum value
+ * @param streaming 1 to use non-temporal stores
+ */
+VIDEO_TARGET_AVX2
+void clip_plane_avx2(unsigned char *data, size_t size,
+                     unsigned char min_value, unsigned char max_value,
+                     int streaming);
+
+/**
+ * @brief Scale a plane with AVX2, clamping in float like the scalar kernel
+ *
+ * @param data Plane data
+ * @param size Number of bytes in the plane
+ * @param scale_factor Factor to scale the values by
+ * @param streaming 1 to use non-temporal stores
+ */
+VIDEO_TARGET_AVX2
+void scale_plane_avx2(unsigned char *data, size_t size, float scale_factor,
+                      int streaming);
+
+#endif // VIDEO_KERNELS_H
@@ -0,0 +1,531 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include "video_ops.h"
+
+// Bytes of frame data per fused chunk: large enough to keep every thread
+// busy, small enough that progress and cancellation stay responsive
+#define PROGRAM_STEP_BYTES (4u << 20)
+
+#define MAX_OP_ARGS 6
+
+// Scale factors past this saturate every non-zero pixel anyway
+#define MAX_SCALE_FACTOR 255.0
+
+static int roi_is_whole(const VideoROI *roi) {
+    return !roi->first_frame && !roi->last_frame && !roi->x && !roi->y &&
+           !roi->width && !roi->height;
+}
+
+static int roi_equal(const VideoROI *a, const VideoROI *b) {
+    return a->first_frame == b->first_frame && a->last_frame == b->last_frame &&
+           a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
+
+static int curve_mark_interp(char mark) {
+    switch (mark) {
+    case '#': return VIDEO_CURVE_HOLD;
+    case '=': return VIDEO_CURVE_LINEAR;
+    case '~': return VIDEO_CURVE_BEZIER;
+    }
+    return -1;
+}
+
+static const char curve_marks[] = {'#', '=', '~'};
+
+static int curve_in_range(const VideoCurve *curve, double low, double high) {
+    for (int i = 0; i < curve->num_keys; i++) {
+        if (curve->keys[i].value < low || curve->keys[i].value > high) return 0;
+    }
+    return 1;
+}
+
+// Parse a keyframe list "<frame><mark><value> ..." up to the next ',' into
+// keys; *cursor is left on the ','
+static int parse_curve(char **cursor, VideoKeyframe *keys, int capacity, VideoCurve *curve) {
+    char *p = *cursor;
+    curve->num_keys = 0;
+    curve->keys = keys;
+    for (;;) {
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == ',' || *p == '\0') break;
+        if (curve->num_keys == capacity) return -1;
+
+        char *next;
+        long frame = strtol(p, &next, 10);
+        int interp = curve_mark_interp(*next);
+        if (next == p || interp < 0) return -1;
+        p = next + 1;
+        double value = strtod(p, &next);
+        if (next == p || !isfinite(value)) return -1;
+        p = next;
+        if (curve->num_keys && frame <= keys[curve->num_keys - 1].frame) return -1;
+
+        VideoKeyframe *key = &keys[curve->num_keys++];
+        key->frame = frame;
+        key->value = (float)value;
+        key->interp = (VideoCurveInterp)interp;
+    }
+    *cursor = p;
+    return curve->num_keys ? 0 : -1;
+}
+
+// Parse one entry: returns 0 for an op, 1 for a roi entry (which updates
+// region instead), -1 on error. Keyframes are taken from keys, of which
+// *num_keys of capacity are used.
+static int parse_op(const char *text, size_t length, VideoOp *op, VideoROI *region,
+                    VideoKeyframe *keys, int capacity, int *num_keys) {
+    char *buffer = (char *)malloc(length + 1);
+    if (!buffer) return -1;
+    memcpy(buffer, text, length);
+    buffer[length] = '\0';
+
+    char *name = buffer;
+    char *args = strchr(buffer, ':');
+    if (args) *args++ = '\0';
+
+    // Trim the name
+    while (isspace((unsigned char)*name)) name++;
+    char *end = name + strlen(name);
+    while (end > name && isspace((unsigned char)end[-1])) *--end = '\0';
+
+    // Each argument is a number or a keyframe list
+    double values[MAX_OP_ARGS];
+    VideoCurve curves[MAX_OP_ARGS];
+    int num_values = 0;
+    int result = -1;
+    while (args && *args) {
+        if (num_values == MAX_OP_ARGS) goto done;
+        char *next;
+        values[num_values] = strtod(args, &next);
+        if (next == args || !isfinite(values[num_values])) goto done;
+        curves[num_values].num_keys = 0;
+        if (memchr(curve_marks, *next, sizeof(curve_marks))) {
+            next = args;
+            if (parse_curve(&next, keys + *num_keys, capacity - *num_keys,
+                            &curves[num_values]) != 0) goto done;
+            *num_keys += curves[num_values].num_keys;
+        }
+        num_values++;
+        while (isspace((unsigned char)*next)) next++;
+        if (*next == ',') {
+            next++;
+        } else if (*next != '\0') {
+            goto done;
+        }
+        args = next;
+    }
+
+    // Only clip bounds and scale factors may be keyframed
+    int keyed = 0;
+    for (int i = 0; i < num_values; i++) {
+        if (curves[i].num_keys) keyed |= 1 << i;
+    }
+
+    if (strcmp(name, "roi") == 0) {
+        if (keyed || (num_values != 0 && num_values != 4 && num_values != 6)) goto done;
+        for (int i = 0; i < num_values && i < 4; i++) {
+            if (values[i] < 0 || values[i] > 255) goto done;
+        }
+        if (num_values == 6 && (values[4] < 0 || values[5] < 0 || values[4] > LONG_MAX ||
+                                values[5] > LONG_MAX || (values[5] && values[5] <= values[4]))) {
+            goto done;
+        }
+        memset(region, 0, sizeof(*region));
+        if (num_values >= 4) {
+            region->x = (unsigned char)values[0];
+            region->y = (unsigned char)values[1];
+            region->width = (unsigned char)values[2];
+            region->height = (unsigned char)values[3];
+        }
+        if (num_values == 6) {
+            region->first_frame = (long)values[4];
+            region->last_frame = (long)values[5];
+        }
+        result = 1;
+        goto done;
+    }
+
+    memset(op, 0, sizeof(*op));
+    op->roi = *region;
+    if (strcmp(name, "reverse") == 0 && num_values == 0) {
+        memset(&op->roi, 0, sizeof(op->roi));
+        op->kind = VIDEO_OP_REVERSE;
+    } else if (strcmp(name, "swap") == 0 && num_values == 2 && !keyed) {
+        op->kind = VIDEO_OP_SWAP;
+        if (values[0] < 0 || values[0] > 255 || values[1] < 0 || values[1] > 255) goto done;
+        op->channel = (unsigned char)values[0];
+        op->channel2 = (unsigned char)values[1];
+    } else if (strcmp(name, "clip") == 0 && num_values == 3 && !(keyed & 1)) {
+        op->kind = VIDEO_OP_CLIP;
+        for (int i = 0; i < 3; i++) {
+            if (!curves[i].num_keys && (values[i] < 0 || values[i] > 255)) goto done;
+            if (!curve_in_range(&curves[i], 0, 255)) goto done;
+        }
+        op->channel = (unsigned char)values[0];
+        op->min_value = curves[1].num_keys ? 0 : (unsigned char)values[1];
+        op->max_value = curves[2].num_keys ? 255 : (unsigned char)values[2];
+        op->min_curve = curves[1];
+        op->max_curve = curves[2];
+    } else if (strcmp(name, "scale") == 0 && num_values == 2 && !(keyed & 1)) {
+        op->kind = VIDEO_OP_SCALE;
+        if (values[0] < 0 || values[0] > 255 ||
+            (!curves[1].num_keys && (values[1] < 0 || values[1] > MAX_SCALE_FACTOR)) ||
+            !curve_in_range(&curves[1], 0, MAX_SCALE_FACTOR)) {
+            goto done;
+        }
+        op->channel = (unsigned char)values[0];
+        op->scale_factor = curves[1].num_keys ? 1.0f : (float)values[1];
+        op->scale_curve = curves[1];
+    } else {
+        goto done;
+    }
+    result = 0;
+
+done:
+    free(buffer);
+    return result;
+}
+
+VideoProgram *video_program_parse(VideoContext *ctx, const char *text) {
+    if (!text) text = "";
+
+    // Upper bounds on the number of ops (one more than the separators) and
+    // of keyframes (one per interpolation mark)
+    int capacity = 1;
+    int key_capacity = 0;
+    for (const char *p = text; *p; p++) {
+        if (*p == ';') capacity++;
+        if (memchr(curve_marks, *p, sizeof(curve_marks))) key_capacity++;
+    }
+
+    VideoProgram *program = (VideoProgram *)video_ctx_alloc(ctx, sizeof(VideoProgram) +
+                                                            capacity * sizeof(VideoOp) +
+                                                            key_capacity * sizeof(VideoKeyframe));
+    if (!program) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error allocating op program\n");
+        return NULL;
+    }
+    program->ops = (VideoOp *)(program + 1);
+    program->num_ops = 0;
+    VideoKeyframe *keys = (VideoKeyframe *)(program->ops + capacity);
+    int num_keys = 0;
+
+    VideoROI region;
+    memset(&region, 0, sizeof(region));
+
+    const char *start = text;
+    for (;;) {
+        const char *end = strchr(start, ';');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+
+        // Skip empty entries so "a;;b" and a trailing ';' are accepted
+        size_t skip = 0;
+        while (skip < length && isspace((unsigned char)start[skip])) skip++;
+        if (skip < length) {
+            int parsed = parse_op(start, length, &program->ops[program->num_ops], &region,
+                                  keys, key_capacity, &num_keys);
+            if (parsed < 0) {
+                video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid operation in program: %.*s\n",
+                              (int)length, start);
+                video_ctx_free(ctx, program);
+                return NULL;
+            }
+            if (parsed == 0) program->num_ops++;
+        }
+
+        if (!end) break;
+        start = end + 1;
+    }
+
+    return program;
+}
+
+void video_program_free(VideoContext *ctx, VideoProgram *program) {
+    video_ctx_free(ctx, program);
+}
+
+static void append(char *buffer, size_t size, size_t *length, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(*length < size ? buffer + *length : NULL,
+                            *length < size ? size - *length : 0, format, args);
+    va_end(args);
+    if (written > 0) *length += written;
+}
+
+static void append_text(char *buffer, size_t size, size_t *length, const char *text) {
+    append(buffer, size, length, "%s%s", *length ? ";" : "", text);
+}
+
+// A parameter: its keyframes if it has any, else the value
+static void append_param(char *buffer, size_t size, size_t *length, const VideoCurve *curve,
+                         const char *format, double value) {
+    if (!curve->num_keys) {
+        append(buffer, size, length, format, value);
+        return;
+    }
+    for (int i = 0; i < curve->num_keys; i++) {
+        const VideoKeyframe *key = &curve->keys[i];
+        append(buffer, size, length, "%s%ld%c%.9g", i ? " " : "", key->frame,
+               curve_marks[key->interp], key->value);
+    }
+}
+
+static int op_has_curves(const VideoOp *op) {
+    return op->min_curve.num_keys || op->max_curve.num_keys || op->scale_curve.num_keys;
+}
+
+size_t video_program_format(const VideoProgram *program, char *buffer, size_t size) {
+    size_t length = 0;
+    int reverse_count = 0;
+
+    // Frame ranges and keyframes name frames in the order the op sees
+    // them, so reverses cannot move past them
+    int in_place = 0;
+    for (int i = 0; i < program->num_ops; i++) {
+        const VideoOp *op = &program->ops[i];
+        if (op->kind != VIDEO_OP_REVERSE &&
+            (op->roi.first_frame || op->roi.last_frame || op_has_curves(op))) {
+            in_place = 1;
+        }
+    }
+
+    VideoROI region;
+    memset(&region, 0, sizeof(region));
+
+    for (int i = 0; i < program->num_ops; i++) {
+        const VideoOp *op = &program->ops[i];
+        if (op->kind == VIDEO_OP_REVERSE) {
+            reverse_count++;
+            continue;
+        }
+
+        if (in_place) {
+            if (reverse_count % 2) append_text(buffer, size, &length, "reverse");
+            reverse_count = 0;
+        }
+        if (!roi_equal(&op->roi, &region)) {
+            char roi_text[96];
+            const VideoROI *roi = &op->roi;
+            if (roi_is_whole(roi)) {
+                snprintf(roi_text, sizeof(roi_text), "roi");
+            } else if (roi->first_frame || roi->last_frame) {
+                snprintf(roi_text, sizeof(roi_text), "roi:%d,%d,%d,%d,%ld,%ld", roi->x, roi->y,
+                         roi->width, roi->height, roi->first_frame, roi->last_frame);
+            } else {
+                snprintf(roi_text, sizeof(roi_text), "roi:%d,%d,%d,%d", roi->x, roi->y,
+                         roi->width, roi->height);
+            }
+            append_text(buffer, size, &length, roi_text);
+            region = op->roi;
+        }
+
+        append(buffer, size, &length, "%s", length ? ";" : "");
+        switch (op->kind) {
+        case VIDEO_OP_SWAP:
+            append(buffer, size, &length, "swap:%d,%d",
+                   op->channel < op->channel2 ? op->channel : op->channel2,
+                   op->channel < op->channel2 ? op->channel2 : op->channel);
+            break;
+        case VIDEO_OP_CLIP:
+            append(buffer, size, &length, "clip:%d,", op->channel);
+            append_param(buffer, size, &length, &op->min_curve, "%.0f", op->min_value);
+            append(buffer, size, &length, ",");
+            append_param(buffer, size, &length, &op->max_curve, "%.0f", op->max_value);
+            break;
+        case VIDEO_OP_SCALE:
+            // %.9g round-trips any float exactly
+            append(buffer, size, &length, "scale:%d,", op->channel);
+            append_param(buffer, size, &length, &op->scale_curve, "%.9g", op->scale_factor);
+            break;
+        case VIDEO_OP_REVERSE:
+            break;
+        }
+    }
+
+    if (reverse_count % 2) append_text(buffer, size, &length, "reverse");
+    if (size && length == 0) buffer[0] = '\0';
+    return length;
+}
+
+// A parameter as a curve: its keyframes, or one keyframe holding the value
+static const VideoCurve *param_curve(const VideoCurve *curve, float value, VideoKeyframe *key,
+                                     VideoCurve *constant) {
+    if (curve->num_keys) return curve;
+    key->frame = 0;
+    key->value = value;
+    key->interp = VIDEO_CURVE_HOLD;
+    constant->num_keys = 1;
+    constant->keys = key;
+    return constant;
+}
+
+static void run_frame_op(VideoContext *ctx, SVideo *chunk, long chunk_first, long num_frames,
+                         const VideoOp *op, int reversed) {
+    if (roi_is_whole(&op->roi) && !op_has_curves(op)) {
+        switch (op->kind) {
+        case VIDEO_OP_SWAP:
+            swap_channels_S_ctx(ctx, chunk, op->channel, op->channel2);
+            break;
+        case VIDEO_OP_CLIP:
+            clip_channel_SIMD_S_ctx(ctx, chunk, op->channel, op->min_value, op->max_value);
+            break;
+        case VIDEO_OP_SCALE:
+            scale_channel_SIMD_S_ctx(ctx, chunk, op->channel, op->scale_factor);
+            break;
+        case VIDEO_OP_REVERSE:
+            break;
+        }
+        return;
+    }
+
+    // The op's frames in the video as stored; reverses before it have not
+    // been applied yet, so its range is mirrored after an odd number
+    VideoROI roi = op->roi;
+    long first = roi.first_frame;
+    long last = roi.last_frame && roi.last_frame < num_frames ? roi.last_frame : num_frames;
+    if (reversed) {
+        long mirrored = num_frames - last;
+        last = num_frames - first;
+        first = mirrored;
+    }
+
+    // The part of the range in this chunk, relative to the chunk
+    if (first < chunk_first) first = chunk_first;
+    if (last > chunk_first + chunk->num_frames) last = chunk_first + chunk->num_frames;
+    if (first >= last) return;
+    roi.first_frame = first - chunk_first;
+    roi.last_frame = last - chunk_first;
+
+    // Frame i of the chunk is frame origin + i * step as the op sees it
+    long origin = reversed ? num_frames - 1 - chunk_first : chunk_first;
+    long step = reversed ? -1 : 1;
+    VideoKeyframe keys[2];
+    VideoCurve constants[2];
+
+    switch (op->kind) {
+    case VIDEO_OP_SWAP:
+        swap_channels_roi_S_ctx(ctx, chunk, op->channel, op->channel2, &roi);
+        break;
+    case VIDEO_OP_CLIP:
+        if (op_has_curves(op)) {
+            clip_channel_curve_at_S_ctx(ctx, chunk, op->channel,
+                param_curve(&op->min_curve, op->min_value, &keys[0], &constants[0]),
+                param_curve(&op->max_curve, op->max_value, &keys[1], &constants[1]),
+                &roi, origin, step);
+        } else {
+            clip_channel_roi_S_ctx(ctx, chunk, op->channel, op->min_value, op->max_value, &roi);
+        }
+        break;
+    case VIDEO_OP_SCALE:
+        if (op_has_curves(op)) {
+            scale_channel_curve_at_S_ctx(ctx, chunk, op->channel, &op->scale_curve, &roi,
+                                         origin, step);
+        } else {
+            scale_channel_roi_S_ctx(ctx, chunk, op->channel, op->scale_factor, &roi);
+        }
+        break;
+    case VIDEO_OP_REVERSE:
+        break;
+    }
+}
+
+int video_program_run_S(VideoContext *ctx, SVideo *video, const VideoProgram *program) {
+    if (!video || !program) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to video_program_run_S function.\n");
+        return -1;
+    }
+
+    for (int i = 0; i < program->num_ops; i++) {
+        const VideoOp *op = &program->ops[i];
+        if ((op->kind != VIDEO_OP_REVERSE && op->channel >= video->channels) ||
+            (op->kind == VIDEO_OP_SWAP && op->channel2 >= video->channels)) {
+            video_ctx_log(ctx, VIDEO_LOG_ERROR, "Operation %d uses channel outside the video\n", i);
+            return -1;
+        }
+    }
+
+    int reverse_count = 0;
+    int frame_ops = 0;
+    for (int i = 0; i < program->num_ops; i++) {
+        if (program->ops[i].kind == VIDEO_OP_REVERSE) {
+            reverse_count++;
+        } else {
+            frame_ops++;
+        }
+    }
+
+    size_t frame_bytes = (size_t)video->channels * video->height * video->width;
+    long step = frame_bytes ? (long)(PROGRAM_STEP_BYTES / frame_bytes) : video->num_frames;
+    int threads = video_ctx_threads(ctx, frame_bytes * video->num_frames);
+    if (step < threads) step = threads;
+    if (step < 1) step = 1;
+
+    for (long first = 0; frame_ops && first < video->num_frames; first += step) {
+        if (video_context_cancelled(ctx)) {
+            video_ctx_log(ctx, VIDEO_LOG_INFO, "Processing cancelled after %ld frames\n", first);
+            return -1;
+        }
+
+        // View of frames [first, first + count): the kernels only follow the
+        // Frame array, so offsetting it restricts them to the chunk
+        SVideo chunk = *video;
+        chunk.frames = video->frames + first;
+        chunk.num_frames = video->num_frames - first < step ? video->num_frames - first : step;
+
+        // Spilled videos page in a chunk ahead and page out the chunk done
+        if (first == 0) prefetch_frames_S_ctx(ctx, video, 0, step);
+        prefetch_frames_S_ctx(ctx, video, first + step, step);
+
+        int reversed = 0;
+        for (int i = 0; i < program->num_ops; i++) {
+            const VideoOp *op = &program->ops[i];
+            if (op->kind == VIDEO_OP_REVERSE) {
+                reversed = !reversed;
+            } else {
+                run_frame_op(ctx, &chunk, first, video->num_frames, op, reversed);
+            }
+        }
+
+        evict_frames_S_ctx(ctx, video, first, chunk.num_frames);
+        video_ctx_progress(ctx, VIDEO_STAGE_PROCESS, first + chunk.num_frames, video->num_frames);
+    }
+
+    if (reverse_count % 2) {
+        reverse_S_ctx(ctx, video);
+    }
+    if (!frame_ops) {
+        video_ctx_progress(ctx, VIDEO_STAGE_PROCESS, video->num_frames, video->num_frames);
+    }
+    return 0;
+}
+
+double video_op_coverage(const VideoOp *op, long num_frames, int height, int width) {
+    if (op->kind == VIDEO_OP_REVERSE || num_frames <= 0 || height <= 0 || width <= 0) {
+        return 1.0;
+    }
+
+    const VideoROI *roi = &op->roi;
+    long last = roi->last_frame && roi->last_frame < num_frames ? roi->last_frame : num_frames;
+    long frames = last > roi->first_frame ? last - roi->first_frame : 0;
+    int columns = roi->x < width ? width - roi->x : 0;
+    int rows = roi->y < height ? height - roi->y : 0;
+    if (roi->width && roi->width < columns) columns = roi->width;
+    if (roi->height && roi->height < rows) rows = roi->height;
+
+    return (double)frames / num_frames * ((double)columns * rows / ((double)width * height));
+}
+
+int video_program_is_reverse(const VideoProgram *program) {
+    int reverses = 0;
+    for (int i = 0; i < program->num_ops; i++) {
+        if (program->ops[i].kind != VIDEO_OP_REVERSE) return 0;
+        reverses++;
+    }
+    return reverses & 1;
+}
@@ -0,0 +1,133 @@
+#ifndef VIDEO_OPS_H
+#define VIDEO_OPS_H
+
+#include "video_functions.h"
+
+/**
+ * @brief Op programs: a sequence of processing operations as one value
+ * Written as text, operations separated by ';':
+ *   reverse                   reverse frame order
+ *   swap:<c1>,<c2>            swap two channels
+ *   clip:<c>,<min>,<max>      clip a channel to [min, max]
+ *   scale:<c>,<factor>        scale a channel by factor, in [0, 255]
+ *   roi:<x>,<y>,<w>,<h>[,<first>,<last>]
+ *                             restrict the ops after it to a rectangle and
+ *                             frames [first, last); 0 width, height or last
+ *                             extend to the edge of the video
+ *   roi                       back to the whole video
+ * e.g. "reverse;swap:0,2;roi:32,32,64,64,0,100;clip:1,10,200;roi;scale:2,1.5"
+ * Clip bounds and scale factors may be keyframed: a list of
+ * <frame><mark><value> separated by spaces, where the mark sets the
+ * interpolation to the next keyframe: '=' linear, '~' Bezier ease, '#' hold.
+ * e.g. "scale:0,0=0 24~1 96=1 120=0" fades channel 0 in and out.
+ * Keyframe values obey the same ranges; NaN and infinities are rejected.
+ * Frame ranges and keyframes count frames as they are when the op runs,
+ * after any reverse before it.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    VIDEO_OP_REVERSE = 0,
+    VIDEO_OP_SWAP = 1,
+    VIDEO_OP_CLIP = 2,
+    VIDEO_OP_SCALE = 3
+} VideoOpKind;
+
+typedef struct {
+    VideoOpKind kind;
+    unsigned char channel;      // Channel for clip/scale, first channel for swap
+    unsigned char channel2;     // Second channel for swap
+    unsigned char min_value;    // Clip range
+    unsigned char max_value;
+    float scale_factor;         // Scale factor
+    VideoROI roi;               // Region for swap/clip/scale, all zero for the whole video
+    VideoCurve min_curve;       // Keyframed clip range and scale factor, used
+    VideoCurve max_curve;       // instead of the value above when num_keys > 0
+    VideoCurve scale_curve;
+} VideoOp;
+
+typedef struct {
+    int num_ops;
+    VideoOp *ops;
+} VideoProgram;
+
+/**
+ * @brief Parse an op program
+ *
+ * @param ctx Library context (allocation and error reporting)
+ * @param text Program text, may be empty
+ * @return VideoProgram* Parsed program, or NULL on syntax error
+ */
+VideoProgram *video_program_parse(VideoContext *ctx, const char *text);
+
+/**
+ * @brief Free a program returned by video_program_parse()
+ *
+ * @param ctx Context the program was parsed with
+ * @param program Program to free
+ */
+void video_program_free(VideoContext *ctx, VideoProgram *program);
+
+/**
+ * @brief Write a program in canonical form
+ * Programs with the same effect as run by video_program_run_S() give the
+ * same text: reverses are reduced to their parity and written last (in
+ * place if an op has a frame range or keyframes), swap channels are
+ * ordered, regions are written only where they change and numbers use one
+ * fixed format.
+ * Used as a key for caching results.
+ *
+ * @param program Program to format
+ * @param buffer Output buffer (may be NULL if size is 0)
+ * @param size Size of the buffer
+ * @return size_t Length of the canonical text, excluding the terminator;
+ *         the output was truncated if this is >= size
+ */
+size_t video_program_format(const VideoProgram *program, char *buffer, size_t size);
+
+/**
+ * @brief Run a program on a SVideo in place
+ * Per-frame operations are fused and applied one chunk of frames at a time,
+ * so each chunk is processed by every operation while it is still in cache.
+ * Reverses commute with per-frame operations and are applied once at the end;
+ * frame ranges and keyframes of ops after an odd number of reverses are
+ * mirrored to match. Ops with a region or keyframes run the _roi or _curve
+ * kernels on their part of each chunk.
+ * Reports VIDEO_STAGE_PROCESS progress and checks for cancellation per chunk.
+ *
+ * @param ctx Library context
+ * @param video Video to process
+ * @param program Program to run
+ * @return int 0 on success, -1 on invalid input or cancellation
+ */
+int video_program_run_S(VideoContext *ctx, SVideo *video, const VideoProgram *program);
+
+/**
+ * @brief Fraction of a video's pixels an op touches
+ * Used to scale cost estimates by an op's region.
+ *
+ * @param op Operation
+ * @param num_frames Frames in the video
+ * @param height Frame height
+ * @param width Frame width
+ * @return double Fraction in [0, 1], 1 for ops without a region
+ */
+double video_op_coverage(const VideoOp *op, long num_frames, int height, int width);
+
+/**
+ * @brief Whether a program only reverses frame order
+ * Such programs on raw files can run out of core with video_reverse_file().
+ *
+ * @param program Program
+ * @return int 1 for an odd number of reverses and nothing else, otherwise 0
+ */
+int video_program_is_reverse(const VideoProgram *program);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_OPS_H
@@ -0,0 +1,397 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "video_prepare.h"
+#include "video_jobs.h"
+
+// For lower_priority(), which is Linux-only
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef VIDEO_WITH_FFMPEG
+#include "video_codec.h"
+#endif
+
+struct VideoPrepare {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t finished_cond;
+    VideoContext *parent;
+    VideoContext *ctx;          // Single-threaded worker of parent
+    char *input_path;
+    char *decode_params;
+    VideoPrepareSpec spec;
+    int probed;
+    int width;
+    int height;
+    long num_frames;
+    double fps;
+    int finished;
+    int decoded;
+    long stats_frames;
+    VideoFrameStats *stats;
+    int num_thumbnails;         // Kept, once decoded
+    int thumb_width;
+    int thumb_height;
+    unsigned char *thumbnails;  // num_thumbnails packed RGB24 images
+};
+
+// Preparations decode one at a time, whatever the number of uploads
+static pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_free = PTHREAD_COND_INITIALIZER;
+static int turn_taken = 0;
+
+// Wait for the decode turn; returns 0 if cancelled while waiting
+static int turn_acquire(VideoContext *ctx) {
+    pthread_mutex_lock(&turn_lock);
+    while (turn_taken && !video_context_cancelled(ctx)) {
+        pthread_cond_wait(&turn_free, &turn_lock);
+    }
+    int acquired = !video_context_cancelled(ctx);
+    if (acquired) turn_taken = 1;
+    pthread_mutex_unlock(&turn_lock);
+    return acquired;
+}
+
+static void turn_release(void) {
+    pthread_mutex_lock(&turn_lock);
+    turn_taken = 0;
+    pthread_cond_broadcast(&turn_free);
+    pthread_mutex_unlock(&turn_lock);
+}
+
+// Idle priority, so preparation only takes CPU time nothing else wants;
+// threads the decoder starts inherit it
+static void lower_priority(void) {
+#ifdef __linux__
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+}
+
+static void set_info(VideoPrepare *prep, int width, int height, long num_frames, double fps) {
+    pthread_mutex_lock(&prep->lock);
+    prep->width = width;
+    prep->height = height;
+    prep->num_frames = num_frames;
+    prep->fps = fps;
+    prep->probed = 1;
+    pthread_mutex_unlock(&prep->lock);
+}
+
+static void probe(VideoPrepare *prep) {
+    int width, height;
+    long num_frames;
+#ifdef VIDEO_WITH_FFMPEG
+    if (video_is_standard_format(prep->input_path)) {
+        double fps;
+        if (get_video_info_ctx(prep->ctx, prep->input_path, &width, &height, &num_frames,
+                               &fps) == 0) {
+            set_info(prep, width, height, num_frames, fps);
+        }
+        return;
+    }
+#endif
+    unsigned char header[sizeof(long) + 3];
+    FILE *file = fopen(prep->input_path, "rb");
+    int ok = file && fread(header, 1, sizeof(header), file) == sizeof(header);
+    if (file) fclose(file);
+    if (!ok) {
+        video_ctx_log_errno(prep->ctx, "Error reading video header");
+        return;
+    }
+    memcpy(&num_frames, header, sizeof(long));
+    height = header[sizeof(long) + 1];
+    width = header[sizeof(long) + 2];
+    set_info(prep, width, height, num_frames, 0.0);
+}
+
+// Open the video in the frame server, which indexes its keyframes; the
+// server's count is exact
+static void open_in_server(VideoPrepare *prep) {
+#ifdef VIDEO_WITH_FFMPEG
+    if (!prep->spec.frame_server || !video_is_standard_format(prep->input_path)) return;
+    int width, height;
+    long num_frames;
+    double fps;
+    if (video_frame_server_info(prep->spec.frame_server, prep->input_path, &width, &height,
+                                &num_frames, &fps) == 0) {
+        set_info(prep, width, height, num_frames, fps);
+    }
+#else
+    (void)prep;
+#endif
+}
+
+static SVideo *prepare_decode(VideoPrepare *prep) {
+    if (prep->spec.decoded) {
+        return video_cache_decode_S(prep->spec.decoded, prep->ctx, prep->input_path,
+                                    prep->decode_params);
+    }
+#ifdef VIDEO_WITH_FFMPEG
+    if (video_is_standard_format(prep->input_path)) {
+        return decode_standard_video_ctx(prep->ctx, prep->input_path);
+    }
+#endif
+    return map_video_S_ctx(prep->ctx, prep->input_path);
+}
+
+// Build the preview proxy while the full decode is fresh in the cache
+static void prepare_proxy(VideoPrepare *prep) {
+    if (!prep->spec.decoded || (!prep->spec.proxy_side && !prep->spec.proxy_frames)) return;
+    if (video_context_cancelled(prep->ctx)) return;
+    SVideo *proxy = video_cache_proxy_S(prep->spec.decoded, prep->ctx, prep->input_path,
+                                        prep->decode_params, prep->spec.proxy_side,
+                                        prep->spec.proxy_frames, NULL, NULL);
+    free_video_S_ctx(prep->ctx, proxy);
+}
+
+static VideoFrameStats *frame_stats(const SVideo *video) {
+    VideoFrameStats *stats = (VideoFrameStats *)calloc(video->num_frames ? video->num_frames : 1,
+                                                       sizeof(VideoFrameStats));
+    if (!stats) return NULL;
+
+    size_t plane_size = (size_t)video->height * video->width;
+    int channels = video->channels < 3 ? video->channels : 3;
+    for (long f = 0; f < video->num_frames; f++) {
+        for (int c = 0; c < channels; c++) {
+            const unsigned char *data = video->frames[f].channels[c].data;
+            unsigned long long sum = 0;
+            unsigned char lo = 255, hi = 0;
+            for (size_t i = 0; i < plane_size; i++) {
+                sum += data[i];
+                if (data[i] < lo) lo = data[i];
+                if (data[i] > hi) hi = data[i];
+            }
+            stats[f].mean[c] = plane_size ? (float)sum / plane_size : 0.0f;
+            stats[f].min[c] = plane_size ? lo : 0;
+            stats[f].max[c] = hi;
+        }
+    }
+    return stats;
+}
+
+// Box-filter evenly spaced frames down by a whole factor to fit
+// VIDEO_THUMBNAIL_SIDE, packed as RGB24
+static void make_thumbnails(VideoPrepare *prep, const SVideo *video) {
+    int count = prep->spec.num_thumbnails;
+    if (count <= 0 || video->num_frames <= 0 || !video->width || !video->height) return;
+    if (count > video->num_frames) count = (int)video->num_frames;
+
+    int side = video->width > video->height ? video->width : video->height;
+    int factor = (side + VIDEO_THUMBNAIL_SIDE - 1) / VIDEO_THUMBNAIL_SIDE;
+    int width = video->width / factor > 0 ? video->width / factor : 1;
+    int height = video->height / factor > 0 ? video->height / factor : 1;
+    size_t image_bytes = (size_t)width * height * 3;
+    unsigned char *images = (unsigned char *)malloc(count * image_bytes);
+    if (!images) {
+        video_ctx_log(prep->ctx, VIDEO_LOG_ERROR, "Error allocating thumbnails\n");
+        return;
+    }
+
+    for (int t = 0; t < count; t++) {
+        const Frame *frame = &video->frames[t * video->num_frames / count];
+        unsigned char *image = images + t * image_bytes;
+        for (int c = 0; c < 3; c++) {
+            int source = video->channels == 1 ? 0 : c;
+            if (source >= video->channels) {
+                for (size_t i = c; i < image_bytes; i += 3) image[i] = 0;
+                continue;
+            }
+            const unsigned char *plane = frame->channels[source].data;
+            for (int y = 0; y < height; y++) {
+                int y0 = y * factor;
+                int y1 = y0 + factor < video->height ? y0 + factor : video->height;
+                for (int x = 0; x < width; x++) {
+                    int x0 = x * factor;
+                    int x1 = x0 + factor < video->width ? x0 + factor : video->width;
+                    unsigned int sum = 0;
+                    for (int sy = y0; sy < y1; sy++) {
+                        const unsigned char *row = plane + (size_t)sy * video->width;
+                        for (int sx = x0; sx < x1; sx++) sum += row[sx];
+                    }
+                    unsigned int area = (unsigned int)((y1 - y0) * (x1 - x0));
+                    image[((size_t)y * width + x) * 3 + c] =
+                        (unsigned char)((sum + area / 2) / area);
+                }
+            }
+        }
+    }
+
+    prep->thumb_width = width;
+    prep->thumb_height = height;
+    prep->thumbnails = images;
+    prep->num_thumbnails = count;
+}
+
+static void *prepare_thread(void *arg) {
+    VideoPrepare *prep = (VideoPrepare *)arg;
+    lower_priority();
+
+    probe(prep);
+    if (!video_context_cancelled(prep->ctx)) open_in_server(prep);
+
+    SVideo *video = NULL;
+    if (turn_acquire(prep->ctx)) {
+        video = prepare_decode(prep);
+        if (video) prepare_proxy(prep);
+        turn_release();
+    }
+
+    VideoFrameStats *stats = NULL;
+    if (video && !video_context_cancelled(prep->ctx)) {
+        stats = frame_stats(video);
+        make_thumbnails(prep, video);
+    }
+
+    pthread_mutex_lock(&prep->lock);
+    if (video) {
+        prep->num_frames = video->num_frames;
+        prep->decoded = stats != NULL;
+        prep->stats = stats;
+        prep->stats_frames = video->num_frames;
+    }
+    prep->finished = 1;
+    pthread_cond_broadcast(&prep->finished_cond);
+    pthread_mutex_unlock(&prep->lock);
+
+    free_video_S_ctx(prep->ctx, video);
+    video_ctx_log(prep->ctx, VIDEO_LOG_INFO, "Prepared %s\n", prep->input_path);
+    return NULL;
+}
+
+VideoPrepare *video_prepare_start(VideoContext *ctx, const char *input_path,
+                                  const VideoPrepareSpec *spec) {
+    if (!ctx) ctx = video_default_context();
+    if (!input_path || !spec || spec->num_thumbnails < 0 || spec->proxy_side < 0 ||
+        spec->proxy_frames < 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Invalid input to video_prepare_start function.\n");
+        return NULL;
+    }
+
+    VideoPrepare *prep = (VideoPrepare *)calloc(1, sizeof(VideoPrepare));
+    if (!prep) {
+        video_ctx_log_errno(ctx, "Error allocating VideoPrepare");
+        return NULL;
+    }
+    prep->parent = ctx;
+    prep->spec = *spec;
+    prep->input_path = strdup(input_path);
+    prep->decode_params = spec->decode_params ? strdup(spec->decode_params) : NULL;
+    prep->ctx = video_ctx_create_worker(ctx, 0, 1);
+    if (!prep->input_path || (spec->decode_params && !prep->decode_params) || !prep->ctx) {
+        video_ctx_log_errno(ctx, "Error allocating VideoPrepare");
+        video_ctx_destroy_worker(ctx, prep->ctx);
+        free(prep->decode_params);
+        free(prep->input_path);
+        free(prep);
+        return NULL;
+    }
+    prep->spec.decode_params = prep->decode_params;
+    pthread_mutex_init(&prep->lock, NULL);
+    pthread_cond_init(&prep->finished_cond, NULL);
+
+    if (pthread_create(&prep->thread, NULL, prepare_thread, prep) != 0) {
+        video_ctx_log(ctx, VIDEO_LOG_ERROR, "Error starting preparation thread\n");
+        pthread_cond_destroy(&prep->finished_cond);
+        pthread_mutex_destroy(&prep->lock);
+        video_ctx_destroy_worker(ctx, prep->ctx);
+        free(prep->decode_params);
+        free(prep->input_path);
+        free(prep);
+        return NULL;
+    }
+    return prep;
+}
+
+int video_prepare_done(VideoPrepare *prep) {
+    pthread_mutex_lock(&prep->lock);
+    int finished = prep->finished;
+    pthread_mutex_unlock(&prep->lock);
+    return finished;
+}
+
+int video_prepare_wait(VideoPrepare *prep) {
+    pthread_mutex_lock(&prep->lock);
+    while (!prep->finished) pthread_cond_wait(&prep->finished_cond, &prep->lock);
+    int decoded = prep->decoded;
+    pthread_mutex_unlock(&prep->lock);
+    return decoded ? 0 : -1;
+}
+
+int video_prepare_info(VideoPrepare *prep, int *width, int *height, long *num_frames,
+                       double *fps) {
+    pthread_mutex_lock(&prep->lock);
+    int probed = prep->probed;
+    if (probed) {
+        if (width) *width = prep->width;
+        if (height) *height = prep->height;
+        if (num_frames) *num_frames = prep->num_frames;
+        if (fps) *fps = prep->fps;
+    }
+    pthread_mutex_unlock(&prep->lock);
+    return probed ? 0 : -1;
+}
+
+// Results are written once, before finished is set under the lock, so
+// they can be read without it afterwards
+static int prepared(VideoPrepare *prep) {
+    pthread_mutex_lock(&prep->lock);
+    int ready = prep->finished && prep->decoded;
+    pthread_mutex_unlock(&prep->lock);
+    return ready;
+}
+
+long video_prepare_stats(VideoPrepare *prep, VideoFrameStats *stats, long max_frames) {
+    if (!prepared(prep)) return -1;
+    if (stats) {
+        long count = prep->stats_frames < max_frames ? prep->stats_frames : max_frames;
+        if (count > 0) memcpy(stats, prep->stats, count * sizeof(VideoFrameStats));
+    }
+    return prep->stats_frames;
+}
+
+int video_prepare_thumbnail(VideoPrepare *prep, int index, unsigned char *rgb, size_t size,
+                            int *width, int *height) {
+    if (!prepared(prep) || index < 0 || index >= prep->num_thumbnails) return -1;
+    size_t image_bytes = (size_t)prep->thumb_width * prep->thumb_height * 3;
+    if (width) *width = prep->thumb_width;
+    if (height) *height = prep->thumb_height;
+    if (!rgb) return 0;
+    if (size < image_bytes) {
+        video_ctx_log(prep->parent, VIDEO_LOG_ERROR, "Thumbnail buffer too small\n");
+        return -1;
+    }
+    memcpy(rgb, prep->thumbnails + index * image_bytes, image_bytes);
+    return 0;
+}
+
+void video_prepare_free(VideoPrepare *prep) {
+    if (!prep) return;
+    video_context_cancel(prep->ctx);
+    // Wake the preparation if it is waiting for its decode turn
+    pthread_mutex_lock(&turn_lock);
+    pthread_cond_broadcast(&turn_free);
+    pthread_mutex_unlock(&turn_lock);
+    pthread_join(prep->thread, NULL);
+
+    pthread_cond_destroy(&prep->finished_cond);
+    pthread_mutex_destroy(&prep->lock);
+    video_ctx_destroy_worker(prep->parent, prep->ctx);
+    free(prep->stats);
+    free(prep->thumbnails);
+    free(prep->decode_params);
+    free(prep->input_path);
+    free(prep);
+}
@@ -0,0 +1,126 @@
+#ifndef VIDEO_PREPARE_H
+#define VIDEO_PREPARE_H
+
+#include "video_cache.h"
+
+/**
+ * @brief Background preparation of freshly uploaded videos
+ * Does the work the first interactive request on an upload would
+ * otherwise do while the user waits, starting as soon as the file
+ * arrives: probing its header, opening it in a frame server (which builds
+ * the keyframe index), decoding it into a decoded-video cache along with a
+ * preview proxy, and keeping per-frame statistics and a strip of
+ * thumbnails. Each preparation runs on
+ * a thread of its own at idle priority, and preparations decode one at a
+ * time, so a burst of uploads does not compete with interactive work.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct VideoFrameServer;
+
+typedef struct VideoPrepare VideoPrepare;
+
+typedef struct {
+    VideoCache *decoded;                    // Decoded-video cache to fill, NULL to skip it
+    const char *decode_params;              // params for video_cache_decode_S(), NULL for none
+    struct VideoFrameServer *frame_server;  // Server to open the video in, NULL to skip;
+                                            // FFmpeg builds, standard formats only
+    int num_thumbnails;                     // Evenly spaced thumbnails to keep, 0 for none
+    int proxy_side;                         // Limits of a preview proxy to build in decoded
+    long proxy_frames;                      // (video_cache_proxy_S()); both 0 for none
+} VideoPrepareSpec;
+
+// Statistics of one frame, per channel (entries past the video's channels are 0)
+typedef struct {
+    float mean[3];
+    unsigned char min[3];
+    unsigned char max[3];
+} VideoFrameStats;
+
+// Longest side of a thumbnail; frames are box-filtered down to fit
+#define VIDEO_THUMBNAIL_SIDE 96
+
+/**
+ * @brief Start preparing a video in the background
+ * The preparation runs single-threaded on a context derived from ctx (its
+ * allocator, logger, limits and determinism), which must outlive it. A
+ * step that fails is logged and skipped; the ones after it still run.
+ *
+ * @param ctx Library context, or NULL for the default
+ * @param input_path Video to prepare, raw (.bin) or, with FFmpeg, standard format
+ * @param spec What to prepare; the pointed-to cache and server must outlive the preparation
+ * @return VideoPrepare* Handle to free with video_prepare_free(), or NULL on error
+ */
+VideoPrepare *video_prepare_start(VideoContext *ctx, const char *input_path,
+                                  const VideoPrepareSpec *spec);
+
+/**
+ * @brief Whether the preparation has finished, without blocking
+ *
+ * @param prep Preparation
+ * @return int 1 if finished (or cancelled), 0 while running
+ */
+int video_prepare_done(VideoPrepare *prep);
+
+/**
+ * @brief Wait for the preparation to finish
+ *
+ * @param prep Preparation
+ * @return int 0 if the video was decoded, -1 if decoding failed or was cancelled
+ */
+int video_prepare_wait(VideoPrepare *prep);
+
+/**
+ * @brief Get the video's size and length once it has been probed
+ *
+ * @param prep Preparation
+ * @param width Output width
+ * @param height Output height
+ * @param num_frames Output frame count, exact once decoded and estimated before
+ * @param fps Output frame rate, 0 for raw videos
+ * @return int 0 on success, -1 if the video has not been probed (yet)
+ */
+int video_prepare_info(VideoPrepare *prep, int *width, int *height, long *num_frames,
+                       double *fps);
+
+/**
+ * @brief Copy the per-frame statistics of a finished preparation
+ *
+ * @param prep Preparation
+ * @param stats Output array, or NULL to only count
+ * @param max_frames Entries stats can hold
+ * @return long Frames with statistics, -1 if not finished or not decoded
+ */
+long video_prepare_stats(VideoPrepare *prep, VideoFrameStats *stats, long max_frames);
+
+/**
+ * @brief Copy one thumbnail of a finished preparation as packed RGB24
+ * Thumbnail i is of frame i * num_frames / num_thumbnails; grey videos are
+ * copied to all three channels.
+ *
+ * @param prep Preparation
+ * @param index Thumbnail, below the number kept
+ * @param rgb Output pixels, row by row, or NULL to get the size
+ * @param size Bytes rgb can hold
+ * @param width Output thumbnail width
+ * @param height Output thumbnail height
+ * @return int 0 on success, -1 if not finished, not decoded or out of range
+ */
+int video_prepare_thumbnail(VideoPrepare *prep, int index, unsigned char *rgb, size_t size,
+                            int *width, int *height);
+
+/**
+ * @brief Cancel a preparation, wait for it and free it
+ *
+ * @param prep Preparation, or NULL
+ */
+void video_prepare_free(VideoPrepare *prep);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_PREPARE_H
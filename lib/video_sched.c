@@ -0,0 +1,481 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "video_sched.h"
+#include "video_ops.h"
+#include "video_files.h"
+
+#ifdef VIDEO_WITH_FFMPEG
+#include "video_codec.h"
+#endif
+
+// Calibration video: large enough to time, small enough to stay in cache
+#define CALIBRATE_FRAMES 64
+#define CALIBRATE_CHANNELS 3
+#define CALIBRATE_SIZE 128
+#define CALIBRATE_RUNS 3
+
+// FFmpeg codec costs per decoded byte; measuring them needs a sample file,
+// so these are typical libx264 figures for one core
+#define DEFAULT_DECODE_STANDARD 1.5e-9
+#define DEFAULT_ENCODE_STANDARD 2.0e-8
+
+// How often blocked jobs re-check for cancellation
+#define WAIT_SLICE_NS 50000000L
+
+static VideoCostModel g_model;
+static pthread_once_t g_model_once = PTHREAD_ONCE_INIT;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static SVideo *make_video(VideoContext *ctx, long frames, unsigned char channels,
+                          unsigned char height, unsigned char width) {
+    size_t plane = (size_t)height * width;
+    size_t header = frames * (sizeof(Frame) + channels * sizeof(Channel));
+    SVideo *video = (SVideo *)video_ctx_alloc(ctx, sizeof(SVideo));
+    unsigned char *block = (unsigned char *)video_ctx_alloc(ctx, header + frames * channels * plane);
+    if (!video || !block) {
+        video_ctx_free(ctx, video);
+        video_ctx_free(ctx, block);
+        return NULL;
+    }
+
+    video->num_frames = frames;
+    video->channels = channels;
+    video->height = height;
+    video->width = width;
+    video->frames = (Frame *)block;
+
+    Channel *channel_block = (Channel *)(block + frames * sizeof(Frame));
+    unsigned char *data = block + header;
+    for (long f = 0; f < frames; f++) {
+        video->frames[f].channels = channel_block + f * channels;
+        for (unsigned char c = 0; c < channels; c++) {
+            video->frames[f].channels[c].data = data + (f * channels + c) * plane;
+            video->frames[f].channels[c].ref = NULL;
+        }
+    }
+    for (size_t i = 0; i < frames * channels * plane; i++) {
+        data[i] = (unsigned char)(i * 31 + (i >> 8));
+    }
+    return video;
+}
+
+static double time_op(VideoContext *ctx, SVideo *video, const char *text) {
+    VideoProgram *program = video_program_parse(ctx, text);
+    if (!program) return 0.0;
+
+    double best = 1e30;
+    for (int run = 0; run < CALIBRATE_RUNS; run++) {
+        double start = now_seconds();
+        video_program_run_S(ctx, video, program);
+        double elapsed = now_seconds() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    video_program_free(ctx, program);
+    return best;
+}
+
+static void calibrate_model(void) {
+    VideoCostModel *model = &g_model;
+    model->decode_standard = DEFAULT_DECODE_STANDARD;
+    model->encode_standard = DEFAULT_ENCODE_STANDARD;
+
+    VideoContext *ctx = video_context_create();
+    if (!ctx) return;
+    video_context_set_threads(ctx, 1);
+
+    SVideo *video = make_video(ctx, CALIBRATE_FRAMES, CALIBRATE_CHANNELS,
+                               CALIBRATE_SIZE, CALIBRATE_SIZE);
+    if (!video) {
+        video_context_destroy(ctx);
+        return;
+    }
+
+    double plane_bytes = (double)CALIBRATE_FRAMES * CALIBRATE_SIZE * CALIBRATE_SIZE;
+    model->op_per_frame[VIDEO_OP_REVERSE] = time_op(ctx, video, "reverse") / CALIBRATE_FRAMES;
+    model->op_per_frame[VIDEO_OP_SWAP] = time_op(ctx, video, "swap:0,1") / CALIBRATE_FRAMES;
+    model->op_per_byte[VIDEO_OP_CLIP] = time_op(ctx, video, "clip:0,10,200") / plane_bytes;
+    model->op_per_byte[VIDEO_OP_SCALE] = time_op(ctx, video, "scale:0,1.5") / plane_bytes;
+
+    // The raw format is one sequential read or write, bounded by copying
+    size_t total = (size_t)(plane_bytes * CALIBRATE_CHANNELS);
+    unsigned char *copy = (unsigned char *)malloc(total);
+    if (copy) {
+        // Frame order changed during calibration, so find the data from the block start
+        unsigned char *data = (unsigned char *)video->frames +
+                              CALIBRATE_FRAMES * (sizeof(Frame) + CALIBRATE_CHANNELS * sizeof(Channel));
+        double best = 1e30;
+        for (int run = 0; run < CALIBRATE_RUNS; run++) {
+            double start = now_seconds();
+            memcpy(copy, data, total);
+            double elapsed = now_seconds() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        model->decode_raw = best / total;
+        model->encode_raw = best / total;
+        free(copy);
+    }
+
+    free_video_S_ctx(ctx, video);
+    video_context_destroy(ctx);
+}
+
+const VideoCostModel *video_cost_model(void) {
+    pthread_once(&g_model_once, calibrate_model);
+    return &g_model;
+}
+
+static int read_header(VideoContext *ctx, const char *path, long *frames,
+                       unsigned char *channels, int *height, int *width) {
+#ifdef VIDEO_WITH_FFMPEG
+    if (video_is_standard_format(path)) {
+        double fps;
+        *channels = 3;
+        return get_video_info_ctx(ctx, path, width, height, frames, &fps);
+    }
+#endif
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        video_ctx_log_errno(ctx, "Error opening file");
+        return -1;
+    }
+
+    unsigned char size[2];
+    if (fread(frames, sizeof(long), 1, file) != 1 ||
+        fread(channels, sizeof(unsigned char), 1, file) != 1 ||
+        fread(size, sizeof(unsigned char), 2, file) != 2) {
+        video_ctx_log_errno(ctx, "Error reading video header");
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    *height = size[0];
+    *width = size[1];
+    return 0;
+}
+
+int video_estimate_cost(VideoContext *ctx, const VideoJobSpec *spec, VideoJobCost *cost) {
+    const VideoCostModel *model = video_cost_model();
+    memset(cost, 0, sizeof(*cost));
+    if (!ctx) ctx = video_default_context();
+
+    long frames;
+    unsigned char channels;
+    int height, width;
+    if (read_header(ctx, spec->input_path, &frames, &channels, &height, &width) != 0) {
+        return -1;
+    }
+
+    VideoProgram *program = video_program_parse(ctx, spec->program);
+    if (!program) return -1;
+
+    size_t plane = (size_t)height * width;
+    cost->frames = frames;
+    cost->frame_bytes = plane * channels;
+    cost->memory_bytes = frames * (cost->frame_bytes + sizeof(Frame) + channels * sizeof(Channel));
+    if (video_program_is_reverse(program) &&
+        video_is_standard_format(spec->input_path) == video_is_standard_format(spec->output_path)) {
+        // Streamed file to file, see job_execute()
+#ifdef VIDEO_WITH_FFMPEG
+        if (video_is_standard_format(spec->input_path)) {
+            cost->memory_bytes = reverse_standard_video_memory(width, height, frames);
+        } else
+#endif
+        cost->memory_bytes = video_reverse_file_memory(frames, cost->frame_bytes);
+    }
+
+    double bytes = (double)frames * cost->frame_bytes;
+    cost->decode_seconds = bytes * (video_is_standard_format(spec->input_path) ?
+                                    model->decode_standard : model->decode_raw);
+    cost->encode_seconds = bytes * (video_is_standard_format(spec->output_path) ?
+                                    model->encode_standard : model->encode_raw);
+    for (int i = 0; i < program->num_ops; i++) {
+        // Ops restricted to a region cost in proportion to it
+        VideoOpKind kind = program->ops[i].kind;
+        double coverage = video_op_coverage(&program->ops[i], frames, height, width);
+        cost->process_seconds += coverage * frames * (model->op_per_frame[kind] +
+                                                      plane * model->op_per_byte[kind]);
+    }
+    cost->seconds = cost->decode_seconds + cost->process_seconds + cost->encode_seconds;
+
+    video_program_free(ctx, program);
+    return 0;
+}
+
+typedef struct SchedEntry {
+    struct SchedEntry *next;
+    VideoScheduler *sched;
+    VideoJob *job;
+    VideoJobCost cost;
+    double remaining;       // Estimated seconds of work left
+    double wait_start;      // When the entry last joined the run queue
+    double slice_start;     // When the entry last got a slot
+    int waiting;            // In the run queue
+    int slot;               // Slot it runs on, -1 if none
+    int memory_reserved;
+} SchedEntry;
+
+struct VideoScheduler {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    VideoSchedulerConfig config;
+    int cpus_per_slot;
+    int *slot_busy;
+    size_t memory_reserved;
+    SchedEntry *entries;
+    char *spill_dir;            // Owned copy of config.spill_dir
+};
+
+VideoScheduler *video_scheduler_create(const VideoSchedulerConfig *config) {
+    VideoScheduler *sched = (VideoScheduler *)calloc(1, sizeof(VideoScheduler));
+    if (!sched) {
+        perror("Error allocating VideoScheduler");
+        return NULL;
+    }
+    if (config) sched->config = *config;
+    if (sched->config.spill_dir) {
+        sched->config.spill_dir = sched->spill_dir = strdup(sched->config.spill_dir);
+        if (!sched->spill_dir) {
+            perror("Error allocating VideoScheduler");
+            free(sched);
+            return NULL;
+        }
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    if (sched->config.num_slots <= 0) sched->config.num_slots = 2;
+    if (sched->config.num_slots > cpus) sched->config.num_slots = (int)cpus;
+    if (sched->config.quantum_seconds <= 0) sched->config.quantum_seconds = 0.25;
+    sched->cpus_per_slot = (int)(cpus / sched->config.num_slots);
+
+    sched->slot_busy = (int *)calloc(sched->config.num_slots, sizeof(int));
+    if (!sched->slot_busy) {
+        perror("Error allocating VideoScheduler");
+        free(sched->spill_dir);
+        free(sched);
+        return NULL;
+    }
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->changed, NULL);
+
+    // Calibrate now rather than inside the first job
+    video_cost_model();
+    return sched;
+}
+
+void video_scheduler_destroy(VideoScheduler *sched) {
+    if (!sched) return;
+    if (sched->entries) {
+        fprintf(stderr, "Warning: destroying scheduler with jobs still running\n");
+    }
+    pthread_cond_destroy(&sched->changed);
+    pthread_mutex_destroy(&sched->lock);
+    free(sched->slot_busy);
+    free(sched->spill_dir);
+    free(sched);
+}
+
+// Lower runs first: least work left, minus the time spent waiting so a long
+// job cannot be postponed forever
+static double entry_priority(const SchedEntry *entry, double now) {
+    return entry->remaining - (now - entry->wait_start);
+}
+
+static int entry_fits(const VideoScheduler *sched, const SchedEntry *entry) {
+    if (entry->memory_reserved || !sched->config.memory_budget) return 1;
+    // An oversized job still runs, alone, rather than never
+    if (!sched->memory_reserved) return 1;
+    return sched->memory_reserved + entry->cost.memory_bytes <= sched->config.memory_budget;
+}
+
+// Best admissible entry in the run queue, or NULL
+static SchedEntry *best_waiting(VideoScheduler *sched, double now) {
+    SchedEntry *best = NULL;
+    for (SchedEntry *entry = sched->entries; entry; entry = entry->next) {
+        if (!entry->waiting || !entry_fits(sched, entry)) continue;
+        if (!best || entry_priority(entry, now) < entry_priority(best, now)) {
+            best = entry;
+        }
+    }
+    return best;
+}
+
+// Hand free slots to the best waiting entries; call with the lock held
+static void dispatch(VideoScheduler *sched) {
+    double now = now_seconds();
+    for (int slot = 0; slot < sched->config.num_slots; slot++) {
+        if (sched->slot_busy[slot]) continue;
+
+        SchedEntry *entry = best_waiting(sched, now);
+        if (!entry) break;
+
+        if (!entry->memory_reserved) {
+            sched->memory_reserved += entry->cost.memory_bytes;
+            entry->memory_reserved = 1;
+        }
+        sched->slot_busy[slot] = 1;
+        entry->slot = slot;
+        entry->waiting = 0;
+    }
+    pthread_cond_broadcast(&sched->changed);
+}
+
+// Queue the entry and block until it holds a slot; returns -1 if the job
+// was cancelled while waiting. Call with the lock held.
+static int wait_for_slot(SchedEntry *entry) {
+    VideoScheduler *sched = entry->sched;
+    entry->waiting = 1;
+    entry->wait_start = now_seconds();
+    dispatch(sched);
+
+    while (entry->slot < 0) {
+        if (video_job_cancel_requested(entry->job)) {
+            entry->waiting = 0;
+            return -1;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WAIT_SLICE_NS;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&sched->changed, &sched->lock, &deadline);
+    }
+
+    // Threads re-pin to the slot's cores at their next parallel region
+    video_context_set_cpus(video_job_context(entry->job),
+                           entry->slot * sched->cpus_per_slot, sched->cpus_per_slot);
+    entry->slice_start = now_seconds();
+    return 0;
+}
+
+// Configure the job's context before it computes its cache key
+static void sched_start(VideoJob *job, void *user) {
+    SchedEntry *entry = (SchedEntry *)user;
+    VideoScheduler *sched = entry->sched;
+
+    pthread_mutex_lock(&sched->lock);
+    entry->job = job;
+    VideoContext *ctx = video_job_context(job);
+    video_context_set_deterministic(ctx, sched->config.deterministic);
+    // A job bigger than the whole budget still runs, alone; past the budget
+    // its frames go to disk instead of pushing the machine into swap
+    if (sched->config.spill_dir && sched->config.memory_budget &&
+        entry->cost.memory_bytes > sched->config.memory_budget) {
+        video_context_set_limits(ctx, sched->config.memory_budget, video_ctx_max_frames(ctx));
+        video_context_set_spill(ctx, sched->config.spill_dir, 0);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+static int sched_admit(VideoJob *job, void *user) {
+    (void)job;
+    SchedEntry *entry = (SchedEntry *)user;
+    VideoScheduler *sched = entry->sched;
+
+    pthread_mutex_lock(&sched->lock);
+    int result = wait_for_slot(entry);
+    pthread_mutex_unlock(&sched->lock);
+    return result;
+}
+
+static int sched_checkpoint(VideoJob *job, VideoStage stage, long done, long total,
+                            void *user) {
+    SchedEntry *entry = (SchedEntry *)user;
+    VideoScheduler *sched = entry->sched;
+    double fraction = total > 0 ? (double)done / total : 0.0;
+    if (fraction > 1.0) fraction = 1.0;
+
+    pthread_mutex_lock(&sched->lock);
+    const VideoJobCost *cost = &entry->cost;
+    if (stage == VIDEO_STAGE_DECODE) {
+        entry->remaining = cost->decode_seconds * (1.0 - fraction) +
+                           cost->process_seconds + cost->encode_seconds;
+    } else if (stage == VIDEO_STAGE_PROCESS) {
+        entry->remaining = cost->process_seconds * (1.0 - fraction) + cost->encode_seconds;
+    } else {
+        entry->remaining = cost->encode_seconds * (1.0 - fraction);
+    }
+
+    // Time-slice: after a quantum, give the slot to shorter waiting work.
+    // A job cancelled while waiting to get it back must not run slotless.
+    int result = 0;
+    double now = now_seconds();
+    if (entry->slot >= 0 && now - entry->slice_start >= sched->config.quantum_seconds &&
+        !video_job_cancel_requested(job)) {
+        SchedEntry *best = best_waiting(sched, now);
+        if (best && entry_priority(best, now) < entry->remaining) {
+            sched->slot_busy[entry->slot] = 0;
+            entry->slot = -1;
+            result = wait_for_slot(entry);
+        } else {
+            entry->slice_start = now;
+        }
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return result;
+}
+
+static void sched_finish(VideoJob *job, void *user) {
+    (void)job;
+    SchedEntry *entry = (SchedEntry *)user;
+    VideoScheduler *sched = entry->sched;
+
+    pthread_mutex_lock(&sched->lock);
+    if (entry->slot >= 0) sched->slot_busy[entry->slot] = 0;
+    if (entry->memory_reserved) sched->memory_reserved -= entry->cost.memory_bytes;
+
+    SchedEntry **link = &sched->entries;
+    while (*link && *link != entry) link = &(*link)->next;
+    if (*link) *link = entry->next;
+
+    dispatch(sched);
+    pthread_mutex_unlock(&sched->lock);
+    free(entry);
+}
+
+VideoJob *video_scheduler_submit(VideoScheduler *sched, const VideoJobSpec *spec,
+                                 VideoJobProgressFn progress_fn, void *user) {
+    SchedEntry *entry = (SchedEntry *)calloc(1, sizeof(SchedEntry));
+    if (!entry) {
+        perror("Error allocating scheduler entry");
+        return NULL;
+    }
+    entry->sched = sched;
+    entry->slot = -1;
+
+    if (!spec || !spec->input_path ||
+        video_estimate_cost(video_default_context(), spec, &entry->cost) != 0) {
+        free(entry);
+        return NULL;
+    }
+    entry->remaining = entry->cost.seconds;
+
+    pthread_mutex_lock(&sched->lock);
+    entry->next = sched->entries;
+    sched->entries = entry;
+    pthread_mutex_unlock(&sched->lock);
+
+    VideoJobHooks hooks = {sched_start, sched_admit, sched_checkpoint, sched_finish, entry};
+    VideoJob *job = video_job_submit_with_hooks(NULL, spec, progress_fn, user, &hooks);
+    if (!job) {
+        // The thread never started, so no hook will remove the entry
+        sched_finish(NULL, entry);
+    }
+    return job;
+}
@@ -0,0 +1,102 @@
+#ifndef VIDEO_SCHED_H
+#define VIDEO_SCHED_H
+
+#include "video_jobs.h"
+
+/**
+ * @brief Job cost estimation and fair scheduling
+ * Costs are estimated from the input header (frames x pixels) and per-op
+ * weights calibrated once per process by timing the kernels. The scheduler
+ * admits jobs against a CPU slot count and a memory budget, runs the job
+ * with the least estimated work left first, and makes long jobs yield their
+ * slot at frame-chunk boundaries when shorter work is waiting, so small jobs
+ * are not stuck behind one large upload.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    double decode_raw;          // Seconds per byte to read the raw format
+    double encode_raw;          // Seconds per byte to write the raw format
+    double decode_standard;     // Seconds per decoded byte for FFmpeg formats
+    double encode_standard;     // Seconds per encoded byte for FFmpeg formats
+    double op_per_frame[4];     // Seconds per frame for each VideoOpKind
+    double op_per_byte[4];      // Seconds per plane byte for each VideoOpKind
+} VideoCostModel;
+
+typedef struct {
+    long frames;                // Frames in the input
+    size_t frame_bytes;         // Bytes per decoded frame, all channels
+    size_t memory_bytes;        // Peak memory the job needs
+    double decode_seconds;      // Estimated time per stage on one thread
+    double process_seconds;
+    double encode_seconds;
+    double seconds;             // Sum of the stages
+} VideoJobCost;
+
+typedef struct {
+    int num_slots;              // Jobs on the CPU at once, each on its own cores (0: 2)
+    size_t memory_budget;       // Bytes of decoded video in flight, 0 for unlimited
+    double quantum_seconds;     // Slice after which a long job yields to shorter work (0: 0.25)
+    int deterministic;          // Non-zero to run jobs with video_context_set_deterministic
+    const char *spill_dir;      // Where jobs over memory_budget spill (video_context_set_spill),
+                                // NULL to run them fully in memory
+} VideoSchedulerConfig;
+
+typedef struct VideoScheduler VideoScheduler;
+
+/**
+ * @brief Get the cost model, calibrating the kernel weights on first use
+ * Codec weights for standard formats are fixed defaults, as measuring them
+ * needs a sample file.
+ *
+ * @return const VideoCostModel* Model, never NULL
+ */
+const VideoCostModel *video_cost_model(void);
+
+/**
+ * @brief Estimate a job's cost from its input header and op program
+ *
+ * @param ctx Library context (error reporting), or NULL for the default
+ * @param spec Job description
+ * @param cost Output cost
+ * @return int 0 on success, -1 if the input or program cannot be read
+ */
+int video_estimate_cost(VideoContext *ctx, const VideoJobSpec *spec, VideoJobCost *cost);
+
+/**
+ * @brief Create a scheduler
+ *
+ * @param config Configuration, NULL for defaults
+ * @return VideoScheduler* Scheduler, or NULL on allocation failure
+ */
+VideoScheduler *video_scheduler_create(const VideoSchedulerConfig *config);
+
+/**
+ * @brief Submit a job to run when the scheduler admits it
+ * The job gets its own context, pinned to the cores of whichever slot it
+ * runs on. Jobs whose cost cannot be estimated are rejected.
+ *
+ * @param sched Scheduler
+ * @param spec Job description
+ * @param progress_fn Optional progress callback
+ * @param user Passed through to the callback
+ * @return VideoJob* Job handle (free with video_job_free()), or NULL on error
+ */
+VideoJob *video_scheduler_submit(VideoScheduler *sched, const VideoJobSpec *spec,
+                                 VideoJobProgressFn progress_fn, void *user);
+
+/**
+ * @brief Destroy a scheduler; all its jobs must have been freed
+ *
+ * @param sched Scheduler
+ */
+void video_scheduler_destroy(VideoScheduler *sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_SCHED_H
@@ -5,7 +5,7 @@ echo.
 cd ..\lib
 
 echo Attempting compilation with Visual Studio (cl.exe)...
-cl /LD video_functions.c /Fe:video_functions.dll 2>nul
+cl /LD /O2 /arch:AVX2 /openmp video_functions.c video_context.c autotune.c video_ops.c video_jobs.c video_sched.c video_cache.c video_checkpoint.c video_batch.c video_files.c video_prepare.c /Fe:video_functions.dll 2>nul
 
 if exist video_functions.dll (
     echo SUCCESS: video_functions.dll created successfully!
@@ -16,7 +16,7 @@ if exist video_functions.dll (
 )
 
 echo Visual Studio compiler not found. Trying MinGW-w64...
-gcc -shared -fPIC -o video_functions.dll video_functions.c 2>nul
+gcc -shared -fPIC -O3 -fopenmp -pthread -o video_functions.dll video_functions.c video_context.c autotune.c video_ops.c video_jobs.c video_sched.c video_cache.c video_checkpoint.c video_batch.c video_files.c video_prepare.c 2>nul
 
 if exist video_functions.dll (
     echo SUCCESS: video_functions.dll created successfully with GCC!
@@ -36,9 +36,9 @@ echo - Visual Studio with C++ tools
 echo - MinGW-w64 with GCC
 echo.
 echo You can also manually compile using:
-echo   cl /LD video_functions.c /Fe:video_functions.dll
+echo   cl /LD /O2 /arch:AVX2 /openmp video_functions.c video_context.c autotune.c video_ops.c video_jobs.c video_sched.c video_cache.c video_checkpoint.c video_batch.c video_files.c video_prepare.c /Fe:video_functions.dll
 echo   OR
-echo   gcc -shared -fPIC -o video_functions.dll video_functions.c
+echo   gcc -shared -fPIC -O3 -fopenmp -pthread -o video_functions.dll video_functions.c video_context.c autotune.c video_ops.c video_jobs.c video_sched.c video_cache.c video_checkpoint.c video_batch.c video_files.c video_prepare.c
 
 :end
 echo.
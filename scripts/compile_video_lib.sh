@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# Compile the video processing library on Linux/macOS
+# Builds lib/video_functions_ffmpeg.so when FFmpeg development libraries are
+# found through pkg-config, otherwise lib/video_functions.so (custom format only)
+# Also builds the lib/video_daemon job server and the lib/video_cli batch tool
+# with the same sources
+
+cd "$(dirname "$0")/../lib" || exit 1
+
+SOURCES="video_functions.c video_context.c autotune.c video_ops.c video_jobs.c video_sched.c video_cache.c video_checkpoint.c video_batch.c video_files.c video_prepare.c"
+# No FMA contraction, so float kernels round the same whatever -march says
+CFLAGS="-O3 -fopenmp -pthread -ffp-contract=off"
+
+if pkg-config --exists libavcodec libavformat libavutil libswscale 2>/dev/null; then
+    echo "Compiling video processing library with FFmpeg support..."
+    SOURCES="$SOURCES video_codec.c"
+    CFLAGS="$CFLAGS -DVIDEO_WITH_FFMPEG"
+    LIBS=$(pkg-config --cflags --libs libavcodec libavformat libavutil libswscale)
+    OUTPUT=video_functions_ffmpeg.so
+else
+    echo "FFmpeg not found, compiling custom format library only..."
+    LIBS=""
+    OUTPUT=video_functions.so
+fi
+
+gcc -shared -fPIC $CFLAGS $SOURCES $LIBS -o $OUTPUT
+
+if [ $? -eq 0 ]; then
+    echo "✅ Successfully compiled lib/$OUTPUT"
+else
+    echo "❌ Compilation failed. Please check the error messages above."
+    exit 1
+fi
+
+gcc $CFLAGS $SOURCES video_daemon.c $LIBS -o video_daemon
+
+if [ $? -eq 0 ]; then
+    echo "✅ Successfully compiled lib/video_daemon"
+else
+    echo "❌ Daemon compilation failed. Please check the error messages above."
+    exit 1
+fi
+
+gcc $CFLAGS $SOURCES video_cli.c $LIBS -o video_cli
+
+if [ $? -eq 0 ]; then
+    echo "✅ Successfully compiled lib/video_cli"
+else
+    echo "❌ CLI compilation failed. Please check the error messages above."
+    exit 1
+fi
+
+# Optional CPython extension for zero-copy NumPy access (src/video_wrapper.py)
+if command -v python3-config >/dev/null 2>&1; then
+    PY_OUTPUT=video_buffers$(python3-config --extension-suffix)
+    gcc -shared -fPIC -O3 $(python3-config --includes) video_buffers.c -o $PY_OUTPUT
+
+    if [ $? -eq 0 ]; then
+        echo "✅ Successfully compiled lib/$PY_OUTPUT"
+    else
+        echo "❌ Extension compilation failed. Please check the error messages above."
+        exit 1
+    fi
+else
+    echo "python3-config not found, skipping the video_buffers extension"
+fi
@@ -32,8 +32,8 @@ echo.
 
 cd ..\lib
 
-gcc -shared -O3 ^
-    video_functions.c video_codec.c ^
+gcc -shared -O3 -fopenmp -pthread -DVIDEO_WITH_FFMPEG ^
+    video_functions.c video_codec.c video_context.c autotune.c video_ops.c video_jobs.c video_sched.c video_cache.c video_checkpoint.c video_batch.c video_files.c video_prepare.c ^
     -I"%FFMPEG_PATH%\include" ^
     -L"%FFMPEG_PATH%\lib" ^
     -lavcodec -lavformat -lavutil -lswscale ^
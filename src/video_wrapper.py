@@ -5,9 +5,24 @@ This module provides a Python interface to the C video processing library
 """
 
 import ctypes
-from ctypes import Structure, c_long, c_ubyte, c_int, c_double, POINTER, c_char_p, c_float
+from ctypes import Structure, c_long, c_ubyte, c_int, c_double, POINTER, c_char_p, c_float, c_void_p, c_size_t, c_ulong, CFUNCTYPE
 import os
 import sys
+import queue
+import threading
+import contextlib
+import socket
+
+# Zero-copy NumPy access to video planes (lib/video_buffers.c), built by
+# scripts/compile_video_lib.sh when Python headers are available
+_LIB_DIR = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "lib")
+sys.path.insert(0, _LIB_DIR)
+try:
+    import video_buffers
+except ImportError:
+    video_buffers = None
+finally:
+    sys.path.remove(_LIB_DIR)
 
 # Define the C structures in Python
 class Video(Structure):
@@ -21,7 +36,8 @@ class Video(Structure):
 
 class Channel(Structure):
     _fields_ = [
-        ("data", POINTER(c_ubyte))
+        ("data", POINTER(c_ubyte)),
+        ("ref", c_void_p)
     ]
 
 class Frame(Structure):
@@ -47,10 +63,422 @@ class MVideo(Structure):
         ("data", POINTER(c_ubyte))
     ]
 
+class VideoROI(Structure):
+    _fields_ = [
+        ("first_frame", c_long),
+        ("last_frame", c_long),
+        ("x", c_ubyte),
+        ("y", c_ubyte),
+        ("width", c_ubyte),
+        ("height", c_ubyte),
+        ("mask", POINTER(c_ubyte))
+    ]
+
+def make_roi(x=0, y=0, width=0, height=0, first_frame=0, last_frame=0, mask=None):
+    """
+    Build a region of interest for the swap/clip/scale methods
+    
+    Args:
+        x, y: top-left corner of the rectangle
+        width, height: rectangle size, 0 for the rest of the frame
+        first_frame, last_frame: frames [first_frame, last_frame), 0 for the end
+        mask: optional bytes-like of frame height x width weights, 0 keeps a
+              pixel and 255 replaces it; values in between blend
+        
+    Returns:
+        VideoROI: region, keeping the mask alive
+    """
+    roi = VideoROI(first_frame, last_frame, x, y, width, height, None)
+    if mask is not None:
+        roi._mask = (c_ubyte * len(mask)).from_buffer_copy(mask)
+        roi.mask = ctypes.cast(roi._mask, POINTER(c_ubyte))
+    return roi
+
+# Keyframe interpolation names and their marks in op programs
+CURVE_INTERPS = {'hold': (0, '#'), 'linear': (1, '='), 'bezier': (2, '~')}
+
+class VideoKeyframe(Structure):
+    _fields_ = [
+        ("frame", c_long),
+        ("value", c_float),
+        ("interp", c_int)
+    ]
+
+class VideoCurve(Structure):
+    _fields_ = [
+        ("num_keys", c_int),
+        ("keys", POINTER(VideoKeyframe))
+    ]
+
+def _keyframes(keys):
+    """(frame, value[, interp]) tuples, interp one of CURVE_INTERPS (default 'linear')"""
+    return [(int(key[0]), float(key[1]), key[2] if len(key) > 2 else 'linear') for key in keys]
+
+def make_curve(keys):
+    """
+    Build a keyframed parameter for the clip/scale methods
+    
+    Args:
+        keys: (frame, value) or (frame, value, interp) tuples sorted by frame;
+              interp ('hold', 'linear' or 'bezier') applies up to the next key
+        
+    Returns:
+        VideoCurve: curve, keeping its keyframes alive
+    """
+    keys = _keyframes(keys)
+    array = (VideoKeyframe * len(keys))(*[VideoKeyframe(frame, value, CURVE_INTERPS[interp][0])
+                                          for frame, value, interp in keys])
+    curve = VideoCurve(len(keys), ctypes.cast(array, POINTER(VideoKeyframe)))
+    curve._keys = array
+    return curve
+
+def _param_text(value):
+    """Op program argument: a number, or a keyframe list for a sequence of keys"""
+    if isinstance(value, (list, tuple)):
+        return ' '.join(f"{frame}{CURVE_INTERPS[interp][1]}{value!r}"
+                        for frame, value, interp in _keyframes(value))
+    return repr(float(value))
+
+def _roi_step(roi):
+    """Op program entry setting the region of the ops after it"""
+    if not roi:
+        return 'roi'
+    values = [int(roi.get(key, 0)) for key in ('x', 'y', 'width', 'height')]
+    if roi.get('first_frame') or roi.get('last_frame'):
+        values += [int(roi.get('first_frame', 0)), int(roi.get('last_frame', 0))]
+    return 'roi:' + ','.join(str(value) for value in values)
+
+class VideoStats(Structure):
+    _fields_ = [
+        ("bytes_live", c_size_t),
+        ("bytes_peak", c_size_t),
+        ("allocations", c_ulong),
+        ("kernel_calls", c_ulong),
+        ("kernel_frames", c_ulong),
+        ("kernel_seconds", c_double),
+        ("frames_decoded", c_ulong),
+        ("frames_encoded", c_ulong),
+        ("errors", c_ulong),
+        ("bytes_spilled", c_size_t)
+    ]
+
+# Instruction set choices for VideoContext.set_isa
+ISA_AUTO = 0
+ISA_SCALAR = 1
+ISA_AVX2 = 2
+
+# Library functions that also exist as <name>_ctx(VideoContext *ctx, ...)
+CONTEXT_FUNCTIONS = [
+    'decode', 'decode_S', 'decode_M',
+    'encode', 'encode_S', 'encode_M',
+    'free_video', 'free_video_S', 'free_video_M',
+    'reverse', 'reverse_S', 'reverse_M',
+    'swap_channels', 'swap_channels_S', 'swap_channels_M',
+    'clip_channel', 'clip_channel_S', 'clip_channel_M',
+    'scale_channel', 'scale_channel_S', 'scale_channel_M',
+    'swap_channels_roi', 'swap_channels_roi_S', 'swap_channels_roi_M',
+    'clip_channel_roi', 'clip_channel_roi_S', 'clip_channel_roi_M',
+    'scale_channel_roi', 'scale_channel_roi_S', 'scale_channel_roi_M',
+    'clip_channel_curve', 'clip_channel_curve_S', 'clip_channel_curve_M',
+    'scale_channel_curve', 'scale_channel_curve_S', 'scale_channel_curve_M',
+    'snapshot_video_S', 'map_video_S', 'proxy_video_S'
+]
+
+# Function name suffix for each decode mode
+MODE_SUFFIXES = {'standard': '', 'structured': '_S', 'memory': '_M'}
+STANDARD_CONTEXT_FUNCTIONS = ['get_video_info', 'decode_standard_video', 'encode_standard_video',
+                              'reverse_standard_video', 'decode_standard_video_memory',
+                              'decode_standard_video_stream', 'encode_fragmented_video',
+                              'encode_fragmented_video_stream', 'encode_standard_video_renditions',
+                              'encode_preview_video']
+
+# int read(void *user, unsigned char *buf, int size), for decode_video_stream
+VIDEO_READ_FUNC = CFUNCTYPE(c_int, c_void_p, POINTER(c_ubyte), c_int)
+# int write(void *user, const unsigned char *buf, int size), for encode_video_chunks
+VIDEO_WRITE_FUNC = CFUNCTYPE(c_int, c_void_p, POINTER(c_ubyte), c_int)
+
+class VideoRendition(Structure):
+    """One output of encode_standard_video_renditions"""
+    _fields_ = [
+        ("filename", c_char_p),
+        ("height", c_int),              # 0 for the source height
+        ("bit_rate", c_long),           # 0 for a default scaled by area
+    ]
+
+# Video struct and free function for each decode mode
+VIDEO_TYPES = {
+    'standard': (Video, 'free_video'),
+    'structured': (SVideo, 'free_video_S'),
+    'memory': (MVideo, 'free_video_M')
+}
+
+class VideoJobSpec(Structure):
+    _fields_ = [
+        ("input_path", c_char_p),
+        ("output_path", c_char_p),
+        ("program", c_char_p),
+        ("codec", c_char_p),
+        ("fps", c_int),
+        ("cache", c_void_p),
+        ("checkpoints", c_void_p)
+    ]
+
+# void (*VideoJobProgressFn)(VideoJob *job, VideoStage stage, long done, long total, void *user)
+JOB_PROGRESS_FUNC = CFUNCTYPE(None, c_void_p, c_int, c_long, c_long, c_void_p)
+
+JOB_STATES = ['queued', 'running', 'done', 'failed', 'cancelled']
+JOB_STAGES = ['decode', 'process', 'encode']
+
+def program_from_operations(operations):
+    """
+    Build an op program string from a list of operations as used by the web API
+    
+    Args:
+        operations: list of {'name': ..., 'params': {...}} dicts, each with
+                    an optional 'roi' dict of make_roi() arguments (no mask);
+                    clip bounds and scale factors may be make_curve() key lists
+        
+    Returns:
+        str: program such as "reverse;clip:0,10,200"
+    """
+    steps = []
+    region = None
+    for operation in operations:
+        op_name = operation.get('name')
+        params = operation.get('params', {})
+        
+        roi = operation.get('roi') or None
+        if op_name != 'reverse' and roi != region:
+            steps.append(_roi_step(roi))
+            region = roi
+        
+        if op_name == 'reverse':
+            steps.append('reverse')
+        elif op_name == 'swap_channels':
+            steps.append(f"swap:{int(params.get('channel1', 0))},{int(params.get('channel2', 1))}")
+        elif op_name == 'clip_channel':
+            min_val = params.get('min_val', 0)
+            max_val = params.get('max_val', 255)
+            min_text = _param_text(min_val) if isinstance(min_val, (list, tuple)) else int(min_val)
+            max_text = _param_text(max_val) if isinstance(max_val, (list, tuple)) else int(max_val)
+            steps.append(f"clip:{int(params.get('channel', 0))},{min_text},{max_text}")
+        elif op_name == 'scale_channel':
+            steps.append(f"scale:{int(params.get('channel', 0))},"
+                         f"{_param_text(params.get('scale_factor', 1.0))}")
+        else:
+            raise ValueError(f"Unknown video operation: {op_name}")
+    return ';'.join(steps)
+
+def proxy_operations(operations, step, scale):
+    """
+    The operations rewritten for a proxy from decode_video_proxy(): region
+    rectangles divided by scale, and frame numbers in regions and keyframes
+    divided by step
+    """
+    def proxy_keys(keys):
+        # Keys landing on one proxy frame keep the first
+        kept = {}
+        for frame, value, interp in _keyframes(keys):
+            kept.setdefault(frame // step, (frame // step, value, interp))
+        return [kept[frame] for frame in sorted(kept)]
+    
+    proxied = []
+    for operation in operations:
+        operation = dict(operation)
+        params = dict(operation.get('params', {}))
+        for name, value in params.items():
+            if isinstance(value, (list, tuple)):
+                params[name] = proxy_keys(value)
+        operation['params'] = params
+        if operation.get('roi'):
+            roi = dict(operation['roi'])
+            for key in ('x', 'y'):
+                roi[key] = int(roi.get(key, 0)) // scale
+            for key in ('width', 'height'):
+                if roi.get(key):
+                    roi[key] = max(1, int(roi[key]) // scale)
+            roi['first_frame'] = int(roi.get('first_frame', 0)) // step
+            if roi.get('last_frame'):
+                # Rounded up, so the range keeps the proxy frame it starts on
+                roi['last_frame'] = -(-int(roi['last_frame']) // step)
+            operation['roi'] = roi
+        proxied.append(operation)
+    return proxied
+
+class VideoJobCost(Structure):
+    _fields_ = [
+        ("frames", c_long),
+        ("frame_bytes", c_size_t),
+        ("memory_bytes", c_size_t),
+        ("decode_seconds", c_double),
+        ("process_seconds", c_double),
+        ("encode_seconds", c_double),
+        ("seconds", c_double)
+    ]
+
+class VideoSchedulerConfig(Structure):
+    _fields_ = [
+        ("num_slots", c_int),
+        ("memory_budget", c_size_t),
+        ("quantum_seconds", c_double),
+        ("deterministic", c_int),
+        ("spill_dir", c_char_p)
+    ]
+
+class VideoPrepareSpec(Structure):
+    _fields_ = [
+        ("decoded", c_void_p),
+        ("decode_params", c_char_p),
+        ("frame_server", c_void_p),
+        ("num_thumbnails", c_int),
+        ("proxy_side", c_int),          # preview proxy limits, 0 and 0 for none
+        ("proxy_frames", c_long)
+    ]
+
+class VideoFrameStats(Structure):
+    _fields_ = [
+        ("mean", c_float * 3),
+        ("min", c_ubyte * 3),
+        ("max", c_ubyte * 3)
+    ]
+
+class VideoJob:
+    """
+    Handle to a job running on a library thread (decode -> program -> encode)
+    """
+    def __init__(self, lib, handle, callback=None, on_finish=None):
+        self.lib = lib
+        self.handle = handle
+        self._callback = callback  # keep the ctypes callback alive
+        self._on_finish = on_finish
+    
+    def _finished(self, state):
+        if state >= 2 and self._on_finish is not None:
+            on_finish, self._on_finish = self._on_finish, None
+            on_finish()
+    
+    def poll(self):
+        """Return the job's state and progress without blocking"""
+        stage = c_int()
+        done = c_long()
+        total = c_long()
+        state = self.lib.video_job_poll(self.handle, ctypes.byref(stage),
+                                        ctypes.byref(done), ctypes.byref(total))
+        self._finished(state)
+        return {
+            'state': JOB_STATES[state],
+            'stage': JOB_STAGES[stage.value],
+            'done': done.value,
+            'total': total.value
+        }
+    
+    def wait(self):
+        """Block until the job finishes; returns the final state name"""
+        state = self.lib.video_job_wait(self.handle)
+        self._finished(state)
+        return JOB_STATES[state]
+    
+    def cancel(self):
+        """Ask the job to stop at the next frame or chunk"""
+        self.lib.video_job_cancel(self.handle)
+    
+    @property
+    def error(self):
+        return self.lib.video_job_error(self.handle).decode('utf-8', 'replace')
+    
+    def close(self):
+        """Cancel if still running, wait and release the job"""
+        if self.handle:
+            self.cancel()
+            self.wait()
+            self.lib.video_job_free(self.handle)
+            self.handle = None
+    
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
+class VideoContext:
+    """
+    Library context owning threads, CPU partition, limits and statistics.
+    Use one context per concurrent job; a context may run one call at a time.
+    """
+    def __init__(self, lib, threads=0, first_cpu=0, num_cpus=0):
+        self.lib = lib
+        self.handle = lib.video_context_create()
+        if not self.handle:
+            raise RuntimeError("Could not create video context")
+        if threads:
+            self.set_threads(threads)
+        if num_cpus:
+            self.set_cpus(first_cpu, num_cpus)
+
+    def set_threads(self, num_threads):
+        """Set the kernel thread count, 0 for automatic"""
+        if self.lib.video_context_set_threads(self.handle, num_threads) != 0:
+            raise ValueError(f"Invalid thread count: {num_threads}")
+
+    def set_cpus(self, first_cpu, num_cpus):
+        """Restrict kernels to CPUs [first_cpu, first_cpu + num_cpus), 0 CPUs to remove"""
+        if self.lib.video_context_set_cpus(self.handle, first_cpu, num_cpus) != 0:
+            raise ValueError(f"Invalid CPU partition: {first_cpu}+{num_cpus}")
+
+    def set_isa(self, isa):
+        """Select ISA_AUTO, ISA_SCALAR or ISA_AVX2 kernels"""
+        if self.lib.video_context_set_isa(self.handle, isa) != 0:
+            raise ValueError(f"Invalid ISA: {isa}")
+
+    def set_deterministic(self, enabled=True):
+        """Make outputs bit-identical regardless of thread count or host"""
+        self.lib.video_context_set_deterministic(self.handle, 1 if enabled else 0)
+
+    def set_limits(self, max_bytes=0, max_frames=0):
+        """Limit bytes allocated and frames decoded, 0 meaning unlimited"""
+        self.lib.video_context_set_limits(self.handle, max_bytes, max_frames)
+
+    def set_spill(self, directory, max_bytes=0):
+        """Spill allocations over the memory limit to scratch files in directory (None to stop)"""
+        path = os.fsencode(directory) if directory is not None else None
+        if self.lib.video_context_set_spill(self.handle, path, max_bytes) != 0:
+            raise RuntimeError(f"Could not set spill directory {directory}")
+
+    def stats(self):
+        """Return the context's statistics as a dict"""
+        stats = VideoStats()
+        self.lib.video_context_get_stats(self.handle, ctypes.byref(stats))
+        return {name: getattr(stats, name) for name, _ in VideoStats._fields_}
+
+    def reset_stats(self):
+        self.lib.video_context_reset_stats(self.handle)
+
+    @property
+    def last_error(self):
+        return self.lib.video_context_last_error(self.handle).decode('utf-8', 'replace')
+
+    def close(self):
+        if self.handle:
+            self.lib.video_context_destroy(self.handle)
+            self.handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
 class VideoProcessor:
     def __init__(self, lib_path=None):
         """Initialize the video processor with the C library"""
         self.has_standard_format_support = False
+        self.ctx = None
         
         if lib_path is None:
             # Look for the DLL in the lib folder
@@ -58,8 +486,9 @@ class VideoProcessor:
             lib_dir = os.path.join(os.path.dirname(current_dir), "lib")
             
             # Try FFmpeg-enabled version first
-            ffmpeg_lib_path = os.path.join(lib_dir, "video_functions_ffmpeg.dll")
-            basic_lib_path = os.path.join(lib_dir, "video_functions.dll")
+            lib_ext = ".dll" if sys.platform == "win32" else ".so"
+            ffmpeg_lib_path = os.path.join(lib_dir, "video_functions_ffmpeg" + lib_ext)
+            basic_lib_path = os.path.join(lib_dir, "video_functions" + lib_ext)
             
             if os.path.exists(ffmpeg_lib_path):
                 lib_path = ffmpeg_lib_path
@@ -100,6 +529,14 @@ class VideoProcessor:
             self.lib.decode_standard_video.argtypes = [c_char_p]
             self.lib.decode_standard_video.restype = POINTER(SVideo)
             
+            # SVideo *decode_standard_video_memory(const unsigned char *data, size_t size)
+            self.lib.decode_standard_video_memory.argtypes = [c_char_p, c_size_t]
+            self.lib.decode_standard_video_memory.restype = POINTER(SVideo)
+            
+            # SVideo *decode_standard_video_stream(VideoReadFn read_fn, void *user)
+            self.lib.decode_standard_video_stream.argtypes = [VIDEO_READ_FUNC, c_void_p]
+            self.lib.decode_standard_video_stream.restype = POINTER(SVideo)
+            
             # int encode_standard_video(const char *filename, const SVideo *video, 
             #                          const char *codec_name, int fps)
             self.lib.encode_standard_video.argtypes = [
@@ -109,6 +546,56 @@ class VideoProcessor:
                 c_int
             ]
             self.lib.encode_standard_video.restype = c_int
+            
+            # int encode_fragmented_video(const char *filename, const SVideo *video,
+            #                             const char *codec_name, int fps, double fragment_seconds)
+            self.lib.encode_fragmented_video.argtypes = [
+                c_char_p, POINTER(SVideo), c_char_p, c_int, c_double
+            ]
+            self.lib.encode_fragmented_video.restype = c_int
+            
+            # int encode_preview_video(const char *filename, const SVideo *video,
+            #                          const char *codec_name, int fps)
+            self.lib.encode_preview_video.argtypes = [c_char_p, POINTER(SVideo), c_char_p, c_int]
+            self.lib.encode_preview_video.restype = c_int
+            
+            # int encode_fragmented_video_stream(VideoWriteFn write_fn, void *user,
+            #                                    const SVideo *video, const char *codec_name,
+            #                                    int fps, double fragment_seconds)
+            self.lib.encode_fragmented_video_stream.argtypes = [
+                VIDEO_WRITE_FUNC, c_void_p, POINTER(SVideo), c_char_p, c_int, c_double
+            ]
+            self.lib.encode_fragmented_video_stream.restype = c_int
+            
+            # int encode_standard_video_renditions(const SVideo *video,
+            #                                      const VideoRendition *renditions, int count,
+            #                                      const char *codec_name, int fps,
+            #                                      double segment_seconds,
+            #                                      const char *master_playlist)
+            self.lib.encode_standard_video_renditions.argtypes = [
+                POINTER(SVideo), POINTER(VideoRendition), c_int, c_char_p, c_int, c_double,
+                c_char_p
+            ]
+            self.lib.encode_standard_video_renditions.restype = c_int
+            
+            # int reverse_standard_video(const char *input, const char *output,
+            #                            const char *codec_name, int fps)
+            self.lib.reverse_standard_video.argtypes = [c_char_p, c_char_p, c_char_p, c_int]
+            self.lib.reverse_standard_video.restype = c_int
+            
+            # Frame server for random access
+            self.lib.video_frame_server_create.argtypes = [c_void_p, c_size_t, c_int]
+            self.lib.video_frame_server_create.restype = c_void_p
+            self.lib.video_frame_server_destroy.argtypes = [c_void_p]
+            self.lib.video_frame_server_destroy.restype = None
+            self.lib.video_frame_server_info.argtypes = [
+                c_void_p, c_char_p, POINTER(c_int), POINTER(c_int), POINTER(c_long),
+                POINTER(c_double)
+            ]
+            self.lib.video_frame_server_info.restype = c_int
+            self.lib.video_frame_server_get.argtypes = [c_void_p, c_char_p, c_long,
+                                                        c_void_p, c_size_t]
+            self.lib.video_frame_server_get.restype = c_int
         
         # decode functions (custom format)
         self.lib.decode.argtypes = [c_char_p]
@@ -140,6 +627,17 @@ class VideoProcessor:
         self.lib.free_video_M.argtypes = [POINTER(MVideo)]
         self.lib.free_video_M.restype = None
         
+        self.lib.snapshot_video_S.argtypes = [POINTER(SVideo)]
+        self.lib.snapshot_video_S.restype = POINTER(SVideo)
+        
+        self.lib.map_video_S.argtypes = [c_char_p]
+        self.lib.map_video_S.restype = POINTER(SVideo)
+        
+        # SVideo *proxy_video_S(const SVideo *video, int max_side, long frame_step,
+        #                       long max_frames)
+        self.lib.proxy_video_S.argtypes = [POINTER(SVideo), c_int, c_long, c_long]
+        self.lib.proxy_video_S.restype = POINTER(SVideo)
+        
         # processing functions
         self.lib.reverse.argtypes = [POINTER(Video)]
         self.lib.reverse.restype = None
@@ -179,6 +677,272 @@ class VideoProcessor:
         
         self.lib.scale_channel_M.argtypes = [POINTER(MVideo), c_ubyte, c_float]
         self.lib.scale_channel_M.restype = None
+        
+        # region-of-interest variants take a VideoROI last
+        for mode, suffix in MODE_SUFFIXES.items():
+            video_type = POINTER(VIDEO_TYPES[mode][0])
+            roi_type = POINTER(VideoROI)
+            swap_fn = getattr(self.lib, 'swap_channels_roi' + suffix)
+            swap_fn.argtypes = [video_type, c_ubyte, c_ubyte, roi_type]
+            swap_fn.restype = None
+            clip_fn = getattr(self.lib, 'clip_channel_roi' + suffix)
+            clip_fn.argtypes = [video_type, c_ubyte, c_ubyte, c_ubyte, roi_type]
+            clip_fn.restype = None
+            scale_fn = getattr(self.lib, 'scale_channel_roi' + suffix)
+            scale_fn.argtypes = [video_type, c_ubyte, c_float, roi_type]
+            scale_fn.restype = None
+            curve_type = POINTER(VideoCurve)
+            clip_curve_fn = getattr(self.lib, 'clip_channel_curve' + suffix)
+            clip_curve_fn.argtypes = [video_type, c_ubyte, curve_type, curve_type, roi_type]
+            clip_curve_fn.restype = None
+            scale_curve_fn = getattr(self.lib, 'scale_channel_curve' + suffix)
+            scale_curve_fn.argtypes = [video_type, c_ubyte, curve_type, roi_type]
+            scale_curve_fn.restype = None
+        
+        # context variants take the VideoContext handle first
+        names = CONTEXT_FUNCTIONS
+        if self.has_standard_format_support:
+            names = names + STANDARD_CONTEXT_FUNCTIONS
+        for name in names:
+            plain = getattr(self.lib, name)
+            ctx_fn = getattr(self.lib, name + '_ctx')
+            ctx_fn.argtypes = [c_void_p] + list(plain.argtypes)
+            ctx_fn.restype = plain.restype
+        
+        # context management
+        self.lib.video_context_create.argtypes = []
+        self.lib.video_context_create.restype = c_void_p
+        
+        self.lib.video_default_context.argtypes = []
+        self.lib.video_default_context.restype = c_void_p
+        
+        self.lib.video_context_destroy.argtypes = [c_void_p]
+        self.lib.video_context_destroy.restype = None
+        
+        self.lib.video_context_set_threads.argtypes = [c_void_p, c_int]
+        self.lib.video_context_set_threads.restype = c_int
+        
+        self.lib.video_context_set_cpus.argtypes = [c_void_p, c_int, c_int]
+        self.lib.video_context_set_cpus.restype = c_int
+        
+        self.lib.video_context_set_isa.argtypes = [c_void_p, c_int]
+        self.lib.video_context_set_isa.restype = c_int
+        
+        self.lib.video_context_set_deterministic.argtypes = [c_void_p, c_int]
+        self.lib.video_context_set_deterministic.restype = None
+        
+        self.lib.video_context_set_limits.argtypes = [c_void_p, c_size_t, c_long]
+        self.lib.video_context_set_limits.restype = None
+
+        self.lib.video_context_set_spill.argtypes = [c_void_p, c_char_p, c_size_t]
+        self.lib.video_context_set_spill.restype = c_int
+        
+        self.lib.video_context_get_stats.argtypes = [c_void_p, POINTER(VideoStats)]
+        self.lib.video_context_get_stats.restype = None
+        
+        self.lib.video_context_reset_stats.argtypes = [c_void_p]
+        self.lib.video_context_reset_stats.restype = None
+        
+        self.lib.video_context_last_error.argtypes = [c_void_p]
+        self.lib.video_context_last_error.restype = c_char_p
+        
+        # asynchronous jobs
+        self.lib.video_job_submit.argtypes = [c_void_p, POINTER(VideoJobSpec), JOB_PROGRESS_FUNC, c_void_p]
+        self.lib.video_job_submit.restype = c_void_p
+        
+        self.lib.video_job_poll.argtypes = [c_void_p, POINTER(c_int), POINTER(c_long), POINTER(c_long)]
+        self.lib.video_job_poll.restype = c_int
+        
+        self.lib.video_job_wait.argtypes = [c_void_p]
+        self.lib.video_job_wait.restype = c_int
+        
+        self.lib.video_job_cancel.argtypes = [c_void_p]
+        self.lib.video_job_cancel.restype = None
+        
+        self.lib.video_job_error.argtypes = [c_void_p]
+        self.lib.video_job_error.restype = c_char_p
+        
+        self.lib.video_job_free.argtypes = [c_void_p]
+        self.lib.video_job_free.restype = None
+        
+        # result cache
+        self.lib.video_cache_open.argtypes = [c_char_p, c_size_t]
+        self.lib.video_cache_open.restype = c_void_p
+        
+        self.lib.video_cache_close.argtypes = [c_void_p]
+        self.lib.video_cache_close.restype = None
+        
+        # SVideo *video_cache_decode_S(VideoCache *cache, VideoContext *ctx,
+        #                              const char *input_path, const char *params)
+        self.lib.video_cache_decode_S.argtypes = [c_void_p, c_void_p, c_char_p, c_char_p]
+        self.lib.video_cache_decode_S.restype = POINTER(SVideo)
+        
+        # SVideo *video_cache_proxy_S(VideoCache *cache, VideoContext *ctx,
+        #                             const char *input_path, const char *params,
+        #                             int max_side, long max_frames, long *frame_step,
+        #                             int *scale)
+        self.lib.video_cache_proxy_S.argtypes = [c_void_p, c_void_p, c_char_p, c_char_p, c_int,
+                                                 c_long, POINTER(c_long), POINTER(c_int)]
+        self.lib.video_cache_proxy_S.restype = POINTER(SVideo)
+        
+        # checkpoints
+        self.lib.video_checkpoints_create.argtypes = [c_size_t, c_void_p]
+        self.lib.video_checkpoints_create.restype = c_void_p
+        
+        self.lib.video_checkpoints_destroy.argtypes = [c_void_p]
+        self.lib.video_checkpoints_destroy.restype = None
+        
+        # batches
+        self.lib.video_batch_run.argtypes = [c_void_p, POINTER(c_char_p), POINTER(c_char_p), c_int,
+                                             c_char_p, c_char_p, c_int, POINTER(c_int)]
+        self.lib.video_batch_run.restype = c_int
+        
+        # out-of-core file operations
+        self.lib.video_reverse_file.argtypes = [c_void_p, c_char_p, c_char_p]
+        self.lib.video_reverse_file.restype = c_int
+        
+        # upload preparation
+        self.lib.video_prepare_start.argtypes = [c_void_p, c_char_p, POINTER(VideoPrepareSpec)]
+        self.lib.video_prepare_start.restype = c_void_p
+        
+        self.lib.video_prepare_done.argtypes = [c_void_p]
+        self.lib.video_prepare_done.restype = c_int
+        
+        self.lib.video_prepare_wait.argtypes = [c_void_p]
+        self.lib.video_prepare_wait.restype = c_int
+        
+        self.lib.video_prepare_info.argtypes = [c_void_p, POINTER(c_int), POINTER(c_int),
+                                                POINTER(c_long), POINTER(c_double)]
+        self.lib.video_prepare_info.restype = c_int
+        
+        self.lib.video_prepare_stats.argtypes = [c_void_p, POINTER(VideoFrameStats), c_long]
+        self.lib.video_prepare_stats.restype = c_long
+        
+        self.lib.video_prepare_thumbnail.argtypes = [c_void_p, c_int, c_char_p, c_size_t,
+                                                     POINTER(c_int), POINTER(c_int)]
+        self.lib.video_prepare_thumbnail.restype = c_int
+        
+        self.lib.video_prepare_free.argtypes = [c_void_p]
+        self.lib.video_prepare_free.restype = None
+        
+        # cost estimation and scheduling
+        self.lib.video_estimate_cost.argtypes = [c_void_p, POINTER(VideoJobSpec), POINTER(VideoJobCost)]
+        self.lib.video_estimate_cost.restype = c_int
+        
+        self.lib.video_scheduler_create.argtypes = [POINTER(VideoSchedulerConfig)]
+        self.lib.video_scheduler_create.restype = c_void_p
+        
+        self.lib.video_scheduler_submit.argtypes = [c_void_p, POINTER(VideoJobSpec), JOB_PROGRESS_FUNC, c_void_p]
+        self.lib.video_scheduler_submit.restype = c_void_p
+        
+        self.lib.video_scheduler_destroy.argtypes = [c_void_p]
+        self.lib.video_scheduler_destroy.restype = None
+    
+    def _call(self, name, *args):
+        """Call a library function, through this processor's context if it has one"""
+        if self.ctx is not None:
+            return getattr(self.lib, name + '_ctx')(self.ctx.handle, *args)
+        return getattr(self.lib, name)(*args)
+    
+    def create_context(self, threads=0, first_cpu=0, num_cpus=0):
+        """Create a VideoContext on this processor's library"""
+        return VideoContext(self.lib, threads, first_cpu, num_cpus)
+    
+    def with_context(self, ctx):
+        """
+        Return a processor sharing this library that runs every call through ctx
+        
+        Args:
+            ctx: VideoContext from create_context(), or None for the default context
+        """
+        bound = object.__new__(VideoProcessor)
+        bound.__dict__.update(self.__dict__)
+        bound.ctx = ctx
+        return bound
+    
+    def submit_job(self, input_path, output_path, program='', codec='libx264', fps=30,
+                   progress=None, on_finish=None, cache=None, checkpoints=None):
+        """
+        Run decode -> program -> encode on a library thread
+        
+        Args:
+            input_path: Input video (custom format, or standard with FFmpeg support)
+            output_path: Output video, format chosen by extension
+            program: Op program string, see program_from_operations()
+            codec: Video codec for standard formats
+            fps: Frames per second for standard formats
+            progress: Optional callable(stage, done, total), called from the job's thread
+            on_finish: Optional callable run once the job is seen to have finished
+            cache: Optional ResultCache to reuse and fill
+            checkpoints: Optional CheckpointStore to resume from and fill
+            
+        Returns:
+            VideoJob handle
+        """
+        spec = _job_spec(input_path, output_path, program, codec, fps, cache, checkpoints)
+        callback = _progress_callback(progress)
+        handle = self.lib.video_job_submit(self.ctx.handle if self.ctx else None,
+                                           ctypes.byref(spec), callback, None)
+        if not handle:
+            raise RuntimeError(f"Failed to start job for {input_path}")
+        return VideoJob(self.lib, handle, callback, on_finish)
+    
+    def run_batch(self, input_paths, output_paths, program='', codec='libx264', fps=30):
+        """
+        Run one op program over many clips, scheduled across the thread pool
+        
+        Blocks until all clips are done. Small clips run one per thread and
+        reuse buffers between clips; large ones are split across threads.
+        
+        Returns:
+            list with True for each clip that succeeded
+        """
+        if len(input_paths) != len(output_paths):
+            raise ValueError("Need one output path per input")
+        
+        count = len(input_paths)
+        inputs = (c_char_p * count)(*[path.encode('utf-8') for path in input_paths])
+        outputs = (c_char_p * count)(*[path.encode('utf-8') for path in output_paths])
+        results = (c_int * count)()
+        if self.lib.video_batch_run(self.ctx.handle if self.ctx else None, inputs, outputs, count,
+                                    program.encode('utf-8'), codec.encode('utf-8'), fps,
+                                    results) < 0:
+            raise ValueError(f"Invalid op program: {program}")
+        return [result == 0 for result in results]
+    
+    def reverse_file(self, input_path, output_path, codec='libx264', fps=30):
+        """
+        Reverse a video file into another without loading it
+        
+        Raw files stream blocks of frames through a few MB of buffers;
+        standard formats (with FFmpeg) are decoded a GOP at a time and
+        re-encoded with codec and fps. Either works on videos larger than
+        memory.
+        """
+        if self.has_standard_format_support and self._is_standard_format(input_path):
+            result = self._call('reverse_standard_video', input_path.encode('utf-8'),
+                                output_path.encode('utf-8'), codec.encode('utf-8'), fps)
+        else:
+            result = self.lib.video_reverse_file(self.ctx.handle if self.ctx else None,
+                                                 input_path.encode('utf-8'),
+                                                 output_path.encode('utf-8'))
+        if result != 0:
+            raise RuntimeError(f"Failed to reverse {input_path}")
+    
+    def estimate_cost(self, input_path, output_path, program=''):
+        """
+        Estimate a job's cost from the input header and the op program
+        
+        Returns:
+            dict with frames, frame_bytes, memory_bytes and estimated seconds
+            (decode_seconds, process_seconds, encode_seconds, seconds)
+        """
+        spec = _job_spec(input_path, output_path, program)
+        cost = VideoJobCost()
+        if self.lib.video_estimate_cost(self.ctx.handle if self.ctx else None,
+                                        ctypes.byref(spec), ctypes.byref(cost)) != 0:
+            raise RuntimeError(f"Could not estimate cost for {input_path}")
+        return {name: getattr(cost, name) for name, _ in VideoJobCost._fields_}
     
     def _is_standard_format(self, filename):
         """Check if file is a standard video format"""
@@ -207,7 +971,7 @@ class VideoProcessor:
         num_frames = c_long()
         fps = c_double()
         
-        result = self.lib.get_video_info(
+        result = self._call('get_video_info',
             filename.encode('utf-8'),
             ctypes.byref(width),
             ctypes.byref(height),
@@ -242,18 +1006,125 @@ class VideoProcessor:
         # Auto-detect standard formats and use FFmpeg decoder
         if auto_detect and self.has_standard_format_support and self._is_standard_format(filename):
             # Standard formats always decode to SVideo
-            return self.lib.decode_standard_video(filename_bytes)
+            return self._call('decode_standard_video', filename_bytes)
         
         # Use custom format decoders
         if mode == 'standard':
-            return self.lib.decode(filename_bytes)
+            return self._call('decode', filename_bytes)
         elif mode == 'structured':
-            return self.lib.decode_S(filename_bytes)
+            return self._call('decode_S', filename_bytes)
         elif mode == 'memory':
-            return self.lib.decode_M(filename_bytes)
+            return self._call('decode_M', filename_bytes)
         else:
             raise ValueError("Mode must be 'standard', 'structured', or 'memory'")
     
+    def map_video(self, filename):
+        """
+        Map a raw video file as an SVideo without reading it; pages are
+        shared with other processes mapping the file until edited. Free it
+        with free_video(..., 'structured').
+        """
+        video_ptr = self._call('map_video_S', filename.encode('utf-8'))
+        if not video_ptr:
+            raise RuntimeError(f"Failed to map video: {filename}")
+        return video_ptr
+    
+    def prepare_video(self, filename, decoded_cache=None, frame_server=None, num_thumbnails=0,
+                      params='', proxy=None):
+        """
+        Start preparing a fresh upload in the background, at idle priority:
+        probe it, open it in frame_server (keyframe index), decode it into
+        decoded_cache, along with a preview proxy if proxy is a (max_side,
+        max_frames) pair, and keep per-frame stats and num_thumbnails
+        thumbnails. Returns a PreparedVideo; this processor's context must
+        outlive it.
+        """
+        proxy_side, proxy_frames = proxy or (0, 0)
+        spec = VideoPrepareSpec(decoded_cache.handle if decoded_cache else None,
+                                params.encode('utf-8'),
+                                frame_server.handle if frame_server else None,
+                                num_thumbnails, proxy_side, proxy_frames)
+        handle = self.lib.video_prepare_start(self.ctx.handle if self.ctx else None,
+                                              filename.encode('utf-8'), ctypes.byref(spec))
+        if not handle:
+            raise RuntimeError(f"Could not start preparing {filename}")
+        return PreparedVideo(self.lib, handle)
+    
+    def decode_video_cached(self, cache, filename, params=''):
+        """
+        Decode a video to an SVideo through a DecodedCache, so a video
+        decoded before, by any process sharing the cache directory, is
+        mapped instead of decoded again. Free it with free_video(...,
+        'structured').
+        """
+        video_ptr = self.lib.video_cache_decode_S(cache.handle,
+                                                  self.ctx.handle if self.ctx else None,
+                                                  filename.encode('utf-8'),
+                                                  params.encode('utf-8'))
+        if not video_ptr:
+            raise RuntimeError(f"Failed to decode video: {filename}")
+        return video_ptr
+    
+    def decode_video_proxy(self, cache, filename, max_side, max_frames, params=''):
+        """
+        Get a small stand-in for a video through a DecodedCache: every
+        step-th frame, at most max_frames, box-filtered down to fit max_side.
+        Built once from the cached full decode, then mapped.
+        
+        Returns:
+            (video_ptr, step, scale): SVideo to free with free_video(...,
+            'structured'), source frames per proxy frame and source pixels
+            per proxy pixel
+        """
+        step, scale = c_long(), c_int()
+        video_ptr = self.lib.video_cache_proxy_S(cache.handle,
+                                                 self.ctx.handle if self.ctx else None,
+                                                 filename.encode('utf-8'), params.encode('utf-8'),
+                                                 max_side, max_frames, ctypes.byref(step),
+                                                 ctypes.byref(scale))
+        if not video_ptr:
+            raise RuntimeError(f"Failed to decode video: {filename}")
+        return video_ptr, step.value, scale.value
+    
+    def decode_video_bytes(self, data):
+        """
+        Decode a standard format video held in memory (e.g. an upload not yet
+        saved), without writing it to disk
+        
+        Returns:
+            Pointer to an SVideo structure
+        """
+        if not self.has_standard_format_support:
+            raise RuntimeError("Standard format support not available. Compile with FFmpeg to use this feature.")
+        video_ptr = self._call('decode_standard_video_memory', bytes(data), len(data))
+        if not video_ptr:
+            raise RuntimeError("Failed to decode video from memory")
+        return video_ptr
+    
+    def decode_video_stream(self, stream):
+        """
+        Decode a standard format video from a file-like object as it is read,
+        so decoding can start while the data is still arriving. The input is
+        not seekable: MP4/MOV need their index at the front (faststart).
+        
+        Returns:
+            Pointer to an SVideo structure
+        """
+        if not self.has_standard_format_support:
+            raise RuntimeError("Standard format support not available. Compile with FFmpeg to use this feature.")
+        def read_fn(user, buf, size):
+            try:
+                data = stream.read(size)
+            except Exception:
+                return -1
+            ctypes.memmove(buf, data, len(data))
+            return len(data)
+        callback = VIDEO_READ_FUNC(read_fn)
+        video_ptr = self._call('decode_standard_video_stream', callback, None)
+        if not video_ptr:
+            raise RuntimeError("Failed to decode video stream")
+        return video_ptr
+    
     def encode_video(self, filename, video_ptr, mode='standard', codec='libx264', fps=30, auto_detect=True):
         """
         Encode a video to file
@@ -274,7 +1145,7 @@ class VideoProcessor:
         # Auto-detect standard formats and use FFmpeg encoder
         if auto_detect and self.has_standard_format_support and self._is_standard_format(filename):
             # Standard formats require SVideo structure
-            result = self.lib.encode_standard_video(
+            result = self._call('encode_standard_video',
                 filename_bytes,
                 video_ptr,
                 codec.encode('utf-8'),
@@ -286,58 +1157,586 @@ class VideoProcessor:
         
         # Use custom format encoders
         if mode == 'standard':
-            return self.lib.encode(filename_bytes, video_ptr)
+            return self._call('encode', filename_bytes, video_ptr)
         elif mode == 'structured':
-            return self.lib.encode_S(filename_bytes, video_ptr)
+            return self._call('encode_S', filename_bytes, video_ptr)
         elif mode == 'memory':
-            return self.lib.encode_M(filename_bytes, video_ptr)
+            return self._call('encode_M', filename_bytes, video_ptr)
         else:
             raise ValueError("Mode must be 'standard', 'structured', or 'memory'")
     
+    def encode_video_fragmented(self, filename, video_ptr, codec='libx264', fps=30,
+                                fragment_seconds=1.0):
+        """
+        Encode an SVideo as fragmented MP4, which players can start on after
+        the first fragment (fragment_seconds long) instead of the whole file
+        """
+        if not self.has_standard_format_support:
+            raise RuntimeError("Standard format support not available. Compile with FFmpeg to use this feature.")
+        if self._call('encode_fragmented_video', filename.encode('utf-8'), video_ptr,
+                      codec.encode('utf-8'), fps, fragment_seconds) != 0:
+            raise RuntimeError(f"Failed to encode video: {filename}")
+    
+    def encode_video_preview(self, filename, video_ptr, codec='libx264', fps=30):
+        """Encode an SVideo with the codec's fastest settings, for previews"""
+        if not self.has_standard_format_support:
+            raise RuntimeError("Standard format support not available. Compile with FFmpeg to use this feature.")
+        if self._call('encode_preview_video', filename.encode('utf-8'), video_ptr,
+                      codec.encode('utf-8'), fps) != 0:
+            raise RuntimeError(f"Failed to encode video: {filename}")
+    
+    def encode_video_renditions(self, video_ptr, renditions, codec='libx264', fps=30,
+                                segment_seconds=0.0, master_playlist=None):
+        """
+        Encode an SVideo at several sizes from one pass over its frames.
+        renditions is a list of (filename, height) or (filename, height,
+        bit_rate) tuples; .m3u8/.mpd filenames give HLS/DASH segments of
+        segment_seconds, and master_playlist, if given, is written listing
+        the renditions.
+        """
+        if not self.has_standard_format_support:
+            raise RuntimeError("Standard format support not available. Compile with FFmpeg to use this feature.")
+        specs = (VideoRendition * len(renditions))()
+        for spec, rendition in zip(specs, renditions):
+            spec.filename = rendition[0].encode('utf-8')
+            spec.height = rendition[1]
+            spec.bit_rate = rendition[2] if len(rendition) > 2 else 0
+        master = master_playlist.encode('utf-8') if master_playlist else None
+        if self._call('encode_standard_video_renditions', video_ptr, specs, len(renditions),
+                      codec.encode('utf-8'), fps, segment_seconds, master) != 0:
+            raise RuntimeError("Failed to encode video renditions")
+    
+    def encode_video_chunks(self, video_ptr, codec='libx264', fps=30, fragment_seconds=1.0):
+        """
+        Encode an SVideo as fragmented MP4 on a library thread, yielding the
+        bytes as each fragment is written (e.g. for a streamed HTTP response).
+        Closing the generator early aborts the encode. The video must stay
+        alive until the generator is exhausted or closed.
+        """
+        if not self.has_standard_format_support:
+            raise RuntimeError("Standard format support not available. Compile with FFmpeg to use this feature.")
+        chunks = queue.Queue()
+        closed = threading.Event()
+        def write_fn(user, buf, size):
+            if closed.is_set():
+                return -1
+            chunks.put(ctypes.string_at(buf, size))
+            return size
+        callback = VIDEO_WRITE_FUNC(write_fn)
+        result = []
+        def run():
+            try:
+                result.append(self._call('encode_fragmented_video_stream', callback, None,
+                                         video_ptr, codec.encode('utf-8'), fps,
+                                         fragment_seconds))
+            finally:
+                chunks.put(None)
+        thread = threading.Thread(target=run, daemon=True)
+        thread.start()
+        try:
+            while True:
+                chunk = chunks.get()
+                if chunk is None:
+                    break
+                yield chunk
+        finally:
+            closed.set()
+            thread.join()
+        if not result or result[0] != 0:
+            raise RuntimeError("Failed to encode video stream")
+    
     def free_video(self, video_ptr, mode='standard'):
         """Free video memory"""
         if mode == 'standard':
-            self.lib.free_video(video_ptr)
+            self._call('free_video', video_ptr)
         elif mode == 'structured':
-            self.lib.free_video_S(video_ptr)
+            self._call('free_video_S', video_ptr)
         elif mode == 'memory':
-            self.lib.free_video_M(video_ptr)
+            self._call('free_video_M', video_ptr)
+    
+    def snapshot_video(self, video_ptr, mode='structured'):
+        """
+        Take a copy-on-write snapshot of a video, e.g. for undo or A/B edits
+        
+        The snapshot shares the video's planes until either is edited, then
+        only the edited planes are copied. Free it with free_video().
+        Refused while arrays from frames() are on the video's own planes.
+        """
+        if mode != 'structured':
+            raise ValueError("Snapshots need mode 'structured'")
+        if hasattr(video_ptr, '_frames'):
+            raise ValueError("Videos over NumPy arrays cannot be snapshotted")
+        # The snapshot would take the planes arrays from frames() are on
+        if video_buffers is not None and video_buffers.exports(ctypes.addressof(video_ptr.contents)):
+            raise ValueError("Video has NumPy arrays on its planes; drop them before snapshotting")
+        return self._call('snapshot_video_S', video_ptr)
+    
+    def frames(self, video_ptr, mode='structured', owned=False):
+        """
+        Zero-copy buffer over a video's planes
+        
+        numpy.asarray() of the result is a (frames, channels, height, width)
+        uint8 array on the library's memory, e.g. for image_functions ops.
+        Structured videos export while their planes are evenly strided and
+        not shared with a snapshot; numpy turns a failed export into an
+        object array, so use numpy.asarray(memoryview(buffer)) to get the
+        BufferError instead, or buffer.plane(frame, channel) for one plane
+        (read-only if that plane has been shared with a snapshot; the view
+        keeps it alive after the snapshot and the video are done with it).
+        
+        Args:
+            video_ptr: Video from decode_video() in the same mode
+            mode: 'standard', 'structured' or 'memory'
+            owned: Free the video once the buffer and every array using it
+                   are gone; do not free it yourself then
+        """
+        if video_buffers is None:
+            raise RuntimeError("video_buffers extension not built, run scripts/compile_video_lib.sh")
+        if mode not in VIDEO_TYPES:
+            raise ValueError("Mode must be 'standard', 'structured', or 'memory'")
+        
+        free = ctx = 0
+        if owned:
+            free = ctypes.cast(getattr(self.lib, VIDEO_TYPES[mode][1] + '_ctx'), c_void_p).value
+            ctx = self.ctx.handle if self.ctx is not None else self.lib.video_default_context()
+        retain = ctypes.cast(self.lib.retain_plane_S, c_void_p).value
+        release = ctypes.cast(self.lib.release_plane_S, c_void_p).value
+        return video_buffers.VideoFrames(ctypes.addressof(video_ptr.contents), mode, free, ctx,
+                                         retain, release)
+    
+    def video_from_array(self, array, mode='structured'):
+        """
+        Wrap a writable uint8 (frames, channels, height, width) array as a video, without copying
+        
+        Kernels on the returned pointer write to the array. The pointer keeps
+        the array alive; never pass it to free_video(). 'structured' accepts
+        any frame and channel strides, the other modes need a C-contiguous array.
+        """
+        if video_buffers is None:
+            raise RuntimeError("video_buffers extension not built, run scripts/compile_video_lib.sh")
+        if mode not in VIDEO_TYPES:
+            raise ValueError("Mode must be 'standard', 'structured', or 'memory'")
+        
+        frames = video_buffers.from_array(array, mode)
+        video_ptr = ctypes.cast(frames.address, POINTER(VIDEO_TYPES[mode][0]))
+        video_ptr._frames = frames
+        return video_ptr
     
     def reverse_video(self, video_ptr, mode='standard'):
         """Reverse video frames"""
         if mode == 'standard':
-            self.lib.reverse(video_ptr)
+            self._call('reverse', video_ptr)
         elif mode == 'structured':
-            self.lib.reverse_S(video_ptr)
+            self._call('reverse_S', video_ptr)
         elif mode == 'memory':
-            self.lib.reverse_M(video_ptr)
+            self._call('reverse_M', video_ptr)
     
-    def swap_channels(self, video_ptr, channel1, channel2, mode='standard'):
-        """Swap color channels"""
-        if mode == 'standard':
-            self.lib.swap_channels(video_ptr, channel1, channel2)
+    def swap_channels(self, video_ptr, channel1, channel2, mode='standard', roi=None):
+        """Swap color channels, within roi (from make_roi()) if given"""
+        if roi is not None:
+            self._call('swap_channels_roi' + MODE_SUFFIXES[mode], video_ptr, channel1, channel2,
+                       ctypes.byref(roi))
+        elif mode == 'standard':
+            self._call('swap_channels', video_ptr, channel1, channel2)
         elif mode == 'structured':
-            self.lib.swap_channels_S(video_ptr, channel1, channel2)
+            self._call('swap_channels_S', video_ptr, channel1, channel2)
         elif mode == 'memory':
-            self.lib.swap_channels_M(video_ptr, channel1, channel2)
+            self._call('swap_channels_M', video_ptr, channel1, channel2)
     
-    def clip_channel(self, video_ptr, channel, min_val, max_val, mode='standard'):
-        """Clip channel values to range"""
-        if mode == 'standard':
-            self.lib.clip_channel(video_ptr, channel, min_val, max_val)
+    def clip_channel(self, video_ptr, channel, min_val, max_val, mode='standard', roi=None):
+        """
+        Clip channel values to range, within roi (from make_roi()) if given.
+        Either bound may be a list of make_curve() keys to animate it.
+        """
+        if isinstance(min_val, (list, tuple)) or isinstance(max_val, (list, tuple)):
+            curves = [make_curve(value if isinstance(value, (list, tuple)) else [(0, value, 'hold')])
+                      for value in (min_val, max_val)]
+            self._call('clip_channel_curve' + MODE_SUFFIXES[mode], video_ptr, channel,
+                       ctypes.byref(curves[0]), ctypes.byref(curves[1]),
+                       ctypes.byref(roi) if roi is not None else None)
+        elif roi is not None:
+            self._call('clip_channel_roi' + MODE_SUFFIXES[mode], video_ptr, channel, min_val,
+                       max_val, ctypes.byref(roi))
+        elif mode == 'standard':
+            self._call('clip_channel', video_ptr, channel, min_val, max_val)
         elif mode == 'structured':
-            self.lib.clip_channel_S(video_ptr, channel, min_val, max_val)
+            self._call('clip_channel_S', video_ptr, channel, min_val, max_val)
         elif mode == 'memory':
-            self.lib.clip_channel_M(video_ptr, channel, min_val, max_val)
+            self._call('clip_channel_M', video_ptr, channel, min_val, max_val)
     
-    def scale_channel(self, video_ptr, channel, scale_factor, mode='standard'):
-        """Scale channel values"""
-        if mode == 'standard':
-            self.lib.scale_channel(video_ptr, channel, scale_factor)
+    def scale_channel(self, video_ptr, channel, scale_factor, mode='standard', roi=None):
+        """
+        Scale channel values, within roi (from make_roi()) if given.
+        scale_factor may be a list of make_curve() keys, e.g. a fade.
+        """
+        if isinstance(scale_factor, (list, tuple)):
+            curve = make_curve(scale_factor)
+            self._call('scale_channel_curve' + MODE_SUFFIXES[mode], video_ptr, channel,
+                       ctypes.byref(curve), ctypes.byref(roi) if roi is not None else None)
+        elif roi is not None:
+            self._call('scale_channel_roi' + MODE_SUFFIXES[mode], video_ptr, channel,
+                       scale_factor, ctypes.byref(roi))
+        elif mode == 'standard':
+            self._call('scale_channel', video_ptr, channel, scale_factor)
         elif mode == 'structured':
-            self.lib.scale_channel_S(video_ptr, channel, scale_factor)
+            self._call('scale_channel_S', video_ptr, channel, scale_factor)
         elif mode == 'memory':
-            self.lib.scale_channel_M(video_ptr, channel, scale_factor)
+            self._call('scale_channel_M', video_ptr, channel, scale_factor)
+
+def _job_spec(input_path, output_path, program='', codec='libx264', fps=30, cache=None,
+              checkpoints=None):
+    return VideoJobSpec(input_path.encode('utf-8'), output_path.encode('utf-8'),
+                        program.encode('utf-8'), codec.encode('utf-8'), fps,
+                        cache.handle if cache else None,
+                        checkpoints.handle if checkpoints else None)
+
+def _progress_callback(progress):
+    """Wrap callable(stage, done, total) as a C progress callback (NULL if None)"""
+    if progress is None:
+        return JOB_PROGRESS_FUNC()
+    def callback_fn(job, stage, done, total, user):
+        progress(JOB_STAGES[stage], done, total)
+    return JOB_PROGRESS_FUNC(callback_fn)
+
+class ResultCache:
+    """
+    Content-addressed cache of job results in a local directory, keyed by
+    the input's bytes, the canonical op program and the encode settings.
+    Pass it to submit_job() to answer repeated jobs with a hard link.
+    """
+    def __init__(self, processor, directory, budget_bytes=0):
+        self.lib = processor.lib
+        self.handle = self.lib.video_cache_open(directory.encode('utf-8'), budget_bytes)
+        if not self.handle:
+            raise RuntimeError(f"Could not open result cache in {directory}")
+    
+    def close(self):
+        """Close the cache, keeping its files"""
+        if self.handle:
+            self.lib.video_cache_close(self.handle)
+            self.handle = None
+
+class DecodedCache(ResultCache):
+    """
+    Decoded videos kept as raw files in a local directory, keyed by the
+    input file's identity and the decode parameters, with least-recently-used
+    eviction under budget_bytes. Processes sharing the directory map each
+    other's decodes copy-on-write; see VideoProcessor.decode_video_cached().
+    """
+
+class PreparedVideo:
+    """
+    Background preparation of an upload, from VideoProcessor.prepare_video().
+    Safe to share between threads: close() leaves freeing it to the last
+    reader inside use(), and reads once it is freed find nothing.
+    """
+    def __init__(self, lib, handle):
+        self.lib = lib
+        self.handle = handle
+        self._lock = threading.Lock()
+        self._users = 0
+        self._closing = False
+    
+    @contextlib.contextmanager
+    def use(self):
+        """
+        Keep the preparation alive for the block; yields False if it has
+        already been freed
+        """
+        with self._lock:
+            handle = self.handle
+            if handle:
+                self._users += 1
+        if not handle:
+            yield False
+            return
+        try:
+            yield True
+        finally:
+            with self._lock:
+                self._users -= 1
+                last = self._closing and not self._users
+                if last:
+                    self.handle = None
+            if last:
+                self.lib.video_prepare_free(handle)
+    
+    def done(self):
+        """Whether the preparation has finished, without blocking"""
+        with self.use() as alive:
+            return alive and bool(self.lib.video_prepare_done(self.handle))
+    
+    def wait(self):
+        """Wait for the preparation; True if the video was decoded"""
+        with self.use() as alive:
+            return alive and self.lib.video_prepare_wait(self.handle) == 0
+    
+    def info(self):
+        """Width, height, num_frames and fps as a dict once probed, else None"""
+        width, height, num_frames, fps = c_int(), c_int(), c_long(), c_double()
+        with self.use() as alive:
+            if not alive or self.lib.video_prepare_info(
+                    self.handle, ctypes.byref(width), ctypes.byref(height),
+                    ctypes.byref(num_frames), ctypes.byref(fps)) != 0:
+                return None
+        return {'width': width.value, 'height': height.value,
+                'num_frames': num_frames.value, 'fps': fps.value}
+    
+    def stats(self):
+        """Per-frame channel mean/min/max once finished, else None"""
+        with self.use() as alive:
+            count = self.lib.video_prepare_stats(self.handle, None, 0) if alive else -1
+            if count < 0:
+                return None
+            stats = (VideoFrameStats * max(count, 1))()
+            self.lib.video_prepare_stats(self.handle, stats, count)
+        return [{'mean': list(s.mean), 'min': list(s.min), 'max': list(s.max)}
+                for s in stats[:count]]
+    
+    def thumbnail(self, index):
+        """
+        One thumbnail once finished
+        
+        Returns:
+            (rgb, width, height): packed RGB24 bytes, or None if not available
+        """
+        width, height = c_int(), c_int()
+        with self.use() as alive:
+            if not alive or self.lib.video_prepare_thumbnail(
+                    self.handle, index, None, 0, ctypes.byref(width), ctypes.byref(height)) != 0:
+                return None
+            size = width.value * height.value * 3
+            buffer = ctypes.create_string_buffer(size)
+            if self.lib.video_prepare_thumbnail(self.handle, index, buffer, size, None, None) != 0:
+                return None
+        return buffer.raw, width.value, height.value
+    
+    def close(self):
+        """
+        Cancel the preparation if still running and free it, once no thread
+        is using it
+        """
+        with self._lock:
+            handle = self.handle if not self._closing else None
+            self._closing = True
+            if handle and self._users:
+                return  # the last user frees it
+            self.handle = None
+        if handle:
+            self.lib.video_prepare_free(handle)
+
+class CheckpointStore:
+    """
+    Decoded and partly processed videos kept between jobs, so a job whose
+    op chain extends or edits the end of an earlier one resumes from the
+    longest shared prefix. Spills to a ResultCache when memory runs out.
+    """
+    def __init__(self, processor, memory_budget, spill=None):
+        self.lib = processor.lib
+        self.spill = spill  # keep the spill cache open while the store uses it
+        self.handle = self.lib.video_checkpoints_create(memory_budget,
+                                                        spill.handle if spill else None)
+        if not self.handle:
+            raise RuntimeError("Could not create checkpoint store")
+    
+    def close(self):
+        """Drop the checkpoints held in memory"""
+        if self.handle:
+            self.lib.video_checkpoints_destroy(self.handle)
+            self.handle = None
+
+class FrameServer:
+    """
+    Random access to single frames of standard format videos, for scrubbing.
+    Keeps a few inputs open with a keyframe index and an LRU cache of
+    decoded frames, so after the first access a frame costs at most one
+    GOP's decode. Safe to share between threads.
+    """
+    def __init__(self, processor, cache_bytes=0, max_open=0):
+        if not processor.has_standard_format_support:
+            raise RuntimeError("Standard format support not available. Compile with FFmpeg to use this feature.")
+        self.lib = processor.lib
+        self.handle = self.lib.video_frame_server_create(
+            processor.ctx.handle if processor.ctx else None, cache_bytes, max_open)
+        if not self.handle:
+            raise RuntimeError("Could not create frame server")
+    
+    def info(self, filename):
+        """Return width, height, num_frames (exact) and fps of a video as a dict"""
+        width, height, num_frames, fps = c_int(), c_int(), c_long(), c_double()
+        if self.lib.video_frame_server_info(self.handle, filename.encode('utf-8'),
+                                            ctypes.byref(width), ctypes.byref(height),
+                                            ctypes.byref(num_frames), ctypes.byref(fps)) != 0:
+            raise RuntimeError(f"Could not read video info: {filename}")
+        return {'width': width.value, 'height': height.value,
+                'num_frames': num_frames.value, 'fps': fps.value}
+    
+    def get_frame(self, filename, index):
+        """
+        Decode one frame
+        
+        Returns:
+            (rgb, width, height): packed RGB24 bytes, row by row
+        """
+        info = self.info(filename)
+        size = info['width'] * info['height'] * 3
+        buffer = ctypes.create_string_buffer(size)
+        if self.lib.video_frame_server_get(self.handle, filename.encode('utf-8'), index,
+                                           buffer, size) != 0:
+            raise RuntimeError(f"Could not decode frame {index} of {filename}")
+        return buffer.raw, info['width'], info['height']
+    
+    def close(self):
+        """Close the server's files and free its cache"""
+        if self.handle:
+            self.lib.video_frame_server_destroy(self.handle)
+            self.handle = None
+
+class VideoScheduler:
+    """
+    Admits jobs against CPU slots and a memory budget, shortest estimated
+    work first, with long jobs yielding to shorter ones at chunk boundaries.
+    """
+    def __init__(self, processor, slots=0, memory_budget=0, quantum_seconds=0,
+                 deterministic=False, spill_dir=None):
+        self.processor = processor
+        self.lib = processor.lib
+        config = VideoSchedulerConfig(slots, memory_budget, quantum_seconds,
+                                      1 if deterministic else 0,
+                                      os.fsencode(spill_dir) if spill_dir else None)
+        self.handle = self.lib.video_scheduler_create(ctypes.byref(config))
+        if not self.handle:
+            raise RuntimeError("Could not create video scheduler")
+    
+    def submit_job(self, input_path, output_path, program='', codec='libx264', fps=30,
+                   progress=None, cache=None, checkpoints=None):
+        """Queue a job; arguments as VideoProcessor.submit_job(). Returns a VideoJob."""
+        spec = _job_spec(input_path, output_path, program, codec, fps, cache, checkpoints)
+        callback = _progress_callback(progress)
+        handle = self.lib.video_scheduler_submit(self.handle, ctypes.byref(spec), callback, None)
+        if not handle:
+            raise RuntimeError(f"Failed to schedule job for {input_path}")
+        return VideoJob(self.lib, handle, callback)
+    
+    def close(self):
+        """Destroy the scheduler; all its jobs must have been closed"""
+        if self.handle:
+            self.lib.video_scheduler_destroy(self.handle)
+            self.handle = None
+
+class ContextPool:
+    """
+    Fixed set of contexts with disjoint CPU partitions, so concurrent requests
+    each get their own cores instead of oversubscribing one OpenMP team.
+    """
+    def __init__(self, processor, slots=None, cpus=None, deterministic=False):
+        cpus = cpus or os.cpu_count() or 1
+        slots = max(1, min(slots or cpus, cpus))
+        per_slot = cpus // slots
+        self.processor = processor
+        self.contexts = []
+        self._free = queue.Queue()
+        for i in range(slots):
+            ctx = processor.create_context(first_cpu=i * per_slot, num_cpus=per_slot)
+            if deterministic:
+                ctx.set_deterministic()
+            self.contexts.append(ctx)
+            self._free.put(ctx)
+    
+    @contextlib.contextmanager
+    def processor_for_job(self, timeout=None):
+        """Borrow a context for the duration of a job, as a bound VideoProcessor"""
+        ctx = self._free.get(timeout=timeout)
+        try:
+            yield self.processor.with_context(ctx)
+        finally:
+            self._free.put(ctx)
+    
+    def submit_job(self, *args, **kwargs):
+        """
+        Submit a job on a pooled context, blocking until a slot is free.
+        The context returns to the pool once the job is polled or waited on
+        after finishing, or closed.
+        """
+        ctx = self._free.get()
+        try:
+            return self.processor.with_context(ctx).submit_job(
+                *args, on_finish=lambda: self._free.put(ctx), **kwargs)
+        except Exception:
+            self._free.put(ctx)
+            raise
+    
+    def close(self):
+        for ctx in self.contexts:
+            ctx.close()
+        self.contexts = []
+
+def default_daemon_socket():
+    """The socket lib/video_daemon listens on without -s or FILMMASTER_SOCKET"""
+    runtime = os.environ.get('XDG_RUNTIME_DIR')
+    if runtime:
+        return os.path.join(runtime, 'filmmaster.sock')
+    return f'/tmp/filmmaster-{os.geteuid()}/filmmaster.sock'
+
+class DaemonClient:
+    """
+    Thin client for lib/video_daemon, which runs jobs on its own warm
+    contexts so web workers need not load the library at all. The daemon
+    only serves its own user, so run both as the same one.
+    """
+    def __init__(self, socket_path=None):
+        self.socket_path = (socket_path or os.environ.get('FILMMASTER_SOCKET')
+                            or default_daemon_socket())
+    
+    def _connect(self, timeout):
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.settimeout(timeout)
+        sock.connect(self.socket_path)
+        return sock
+    
+    def ping(self, timeout=5):
+        """Return True if the daemon answers"""
+        try:
+            with self._connect(timeout) as sock:
+                sock.sendall(b"PING\n")
+                return sock.makefile('rb').readline().strip() == b"PONG"
+        except OSError:
+            return False
+    
+    def run_job(self, input_path, output_path, program='', codec='libx264', fps=30,
+                progress=None, timeout=None):
+        """
+        Run a job on the daemon and wait for it
+        
+        Args:
+            input_path, output_path, program, codec, fps: as VideoProcessor.submit_job()
+            progress: Optional callable(stage, done, total)
+            timeout: Seconds to wait for each message, None to wait forever
+            
+        Returns:
+            'done' or 'cancelled'
+            
+        Raises:
+            RuntimeError: If the job fails
+        """
+        fields = ['JOB', input_path, output_path, program, codec, str(fps)]
+        if any('\t' in field or '\n' in field for field in fields):
+            raise ValueError("Job fields may not contain tabs or newlines")
+        
+        with self._connect(timeout) as sock:
+            sock.sendall(('\t'.join(fields) + '\n').encode('utf-8'))
+            for line in sock.makefile('rb'):
+                parts = line.decode('utf-8', 'replace').rstrip('\n').split('\t')
+                if parts[0] == 'PROGRESS':
+                    if progress is not None:
+                        progress(parts[1], int(parts[2]), int(parts[3]))
+                elif parts[0] == 'DONE':
+                    return 'done'
+                elif parts[0] == 'CANCELLED':
+                    return 'cancelled'
+                elif parts[0] == 'FAILED':
+                    raise RuntimeError(parts[1] if len(parts) > 1 else 'Job failed')
+        raise RuntimeError("Video daemon closed the connection")
 
 def is_standard_format(filename):
     """
@@ -8,6 +8,8 @@ import tempfile
 import shutil
 import numpy as np
 import cv2
+import struct
+import uuid
 from pathlib import Path
 import sys
 
@@ -180,6 +182,15 @@ def flask_app():
     shutil.rmtree(test_processed_dir, ignore_errors=True)
 
 
+@pytest.fixture
+def video_upload(flask_app):
+    """Put a small raw video in the upload folder and return its file id."""
+    file_id = str(uuid.uuid4())
+    write_raw_video(os.path.join(flask_app.config['UPLOAD_FOLDER'], f"{file_id}.bin"),
+                    make_video_array(frames=4, height=16, width=24))
+    return file_id
+
+
 @pytest.fixture
 def client(flask_app):
     """Create a test client for the Flask app."""
@@ -281,4 +292,27 @@ def assert_image_valid(img):
     assert img.dtype == np.uint8, f"Image dtype is not uint8, got {img.dtype}"
     assert len(img.shape) in [2, 3], f"Invalid image shape: {img.shape}"
     if len(img.shape) == 3:
-        assert img.shape[2] in [1, 3, 4], f"Invalid number of channels: {img.shape[2]}"
\ No newline at end of file
+        assert img.shape[2] in [1, 3, 4], f"Invalid number of channels: {img.shape[2]}"
+
+
+def make_video_array(frames=2, channels=3, height=7, width=9, seed=0):
+    """Random (frames, channels, height, width) uint8 array; planes are not a multiple of 32 bytes"""
+    rng = np.random.default_rng(seed)
+    return rng.integers(0, 256, (frames, channels, height, width), dtype=np.uint8)
+
+
+def write_raw_video(path, array):
+    """Write a (frames, channels, height, width) array in the library's raw format"""
+    frames, channels, height, width = array.shape
+    with open(path, 'wb') as f:
+        f.write(struct.pack('<qBBB', frames, channels, height, width))
+        f.write(np.ascontiguousarray(array).tobytes())
+    return str(path)
+
+
+def read_raw_video(path):
+    """Read a raw-format file back into a (frames, channels, height, width) array"""
+    with open(path, 'rb') as f:
+        frames, channels, height, width = struct.unpack('<qBBB', f.read(11))
+        data = np.frombuffer(f.read(), dtype=np.uint8)
+    return data.reshape(frames, channels, height, width)
@@ -4,14 +4,17 @@ Tests Flask API endpoints with real file uploads using sample images.
 """
 
 import pytest
+import contextlib
+import ctypes
 import json
 import os
 from io import BytesIO
 from pathlib import Path
 import uuid
+import time
 
 import app
-from video_wrapper import VIDEO_PROCESSING_AVAILABLE
+from video_wrapper import VIDEO_PROCESSING_AVAILABLE, SVideo, PreparedVideo
 
 
 @pytest.mark.integration
@@ -364,6 +367,355 @@ class TestVideoProcessingEndpoint:
             assert expected_op in operation_names
 
 
+@pytest.mark.integration
+@pytest.mark.requires_dll
+class TestVideoJobsEndpoint:
+    """Test asynchronous video jobs (requires DLL)."""
+    
+    @pytest.fixture(autouse=True)
+    def needs_dll(self, video_dll_available):
+        if not video_dll_available:
+            pytest.skip("Video DLL not available")
+    
+    def submit(self, client, file_id):
+        response = client.post('/process_video',
+                               data=json.dumps({'file_id': file_id, 'async': True,
+                                                'operations': [{'name': 'reverse'}]}),
+                               content_type='application/json')
+        assert response.status_code == 202
+        return json.loads(response.data)['job_id']
+    
+    def wait(self, client, job_id):
+        for _ in range(500):
+            status = json.loads(client.get(f'/video_jobs/{job_id}').data)
+            if status['state'] not in ('queued', 'running'):
+                return status
+            time.sleep(0.01)
+        pytest.fail("Video job did not finish")
+    
+    def test_scheduled_video_replaces_earlier_outputs(self, client, flask_app, video_upload):
+        old_output = os.path.join(flask_app.config['PROCESSED_FOLDER'],
+                                  f"{video_upload}_old_processed.mp4")
+        open(old_output, 'wb').close()
+        response = client.post('/process_video',
+                               data=json.dumps({'file_id': video_upload,
+                                                'operations': [{'name': 'reverse'}]}),
+                               content_type='application/json')
+        assert response.status_code == 200
+        output = json.loads(response.data)['processed_file']
+        assert os.listdir(flask_app.config['PROCESSED_FOLDER']) == [output]
+    
+    def test_video_job_poll_and_delete(self, client, video_upload):
+        job_id = self.submit(client, video_upload)
+        status = self.wait(client, job_id)
+        assert status['state'] == 'done'
+        assert status['processed_file'].startswith(video_upload)
+        
+        assert client.delete(f'/video_jobs/{job_id}').status_code == 200
+        assert client.get(f'/video_jobs/{job_id}').status_code == 404
+    
+    def test_finished_video_jobs_expire(self, client, video_upload, monkeypatch):
+        job_id = self.submit(client, video_upload)
+        assert self.wait(client, job_id)['state'] == 'done'
+        
+        monkeypatch.setattr(app, 'VIDEO_JOB_TTL', 0)
+        time.sleep(0.01)
+        app._expire_video_jobs()
+        assert client.get(f'/video_jobs/{job_id}').status_code == 404
+    
+    def test_unpolled_video_jobs_are_cancelled(self, monkeypatch):
+        class RunningJob:
+            cancelled = False
+            def poll(self):
+                return {'state': 'cancelled' if self.cancelled else 'running'}
+            def cancel(self):
+                self.cancelled = True
+            def close(self):
+                pass
+        
+        job = RunningJob()
+        monkeypatch.setattr(app, 'VIDEO_JOB_ABANDON', 0)
+        monkeypatch.setitem(app.video_jobs, 'abandoned',
+                            {'job': job, 'file_id': 'x', 'output': 'x',
+                             'polled': time.monotonic() - 1})
+        app._expire_video_jobs()
+        assert job.cancelled
+        assert 'abandoned' in app.video_jobs
+
+
+@pytest.mark.integration
+class TestVideoPreviewRoutes:
+    """Test previews on the upload's proxy and their full-quality export (requires DLL)."""
+    
+    @pytest.fixture(autouse=True)
+    def needs_dll(self, video_dll_available, tmp_path, monkeypatch):
+        if not video_dll_available:
+            pytest.skip("Video DLL not available")
+        cache = app.DecodedCache(app.video_processor, str(tmp_path / "decoded"))
+        monkeypatch.setattr(app, 'decoded_cache', cache)
+        yield
+        cache.close()
+    
+    def preview(self, client, file_id):
+        return client.post('/process_video',
+                           data=json.dumps({'file_id': file_id, 'preview': True,
+                                            'operations': [{'name': 'reverse'}]}),
+                           content_type='application/json')
+    
+    def export(self, client, preview_id):
+        return client.post('/export_video', data=json.dumps({'preview_id': preview_id}),
+                           content_type='application/json')
+    
+    def test_preview_replaces_earlier_previews(self, client, flask_app, video_upload):
+        old_preview = os.path.join(flask_app.config['PROCESSED_FOLDER'],
+                                   f"{video_upload}_old_preview.mp4")
+        open(old_preview, 'wb').close()
+        response = self.preview(client, video_upload)
+        assert response.status_code == 200
+        output = json.loads(response.data)['processed_file']
+        assert output.endswith('_preview.mp4')
+        assert os.listdir(flask_app.config['PROCESSED_FOLDER']) == [output]
+    
+    def test_export_replays_preview(self, client, video_upload):
+        preview_id = json.loads(self.preview(client, video_upload).data)['preview_id']
+        response = self.export(client, preview_id)
+        assert response.status_code == 202
+        job_id = json.loads(response.data)['job_id']
+        status = TestVideoJobsEndpoint.wait(None, client, job_id)
+        assert status['state'] == 'done'
+        assert status['processed_file'].startswith(video_upload)
+        client.delete(f'/video_jobs/{job_id}')
+    
+    def test_export_unknown_preview(self, client):
+        assert self.export(client, 'missing').status_code == 404
+    
+    def test_preview_without_contexts(self, client, video_upload, monkeypatch):
+        monkeypatch.setattr(app, 'video_contexts', None)
+        assert self.preview(client, video_upload).status_code == 500
+    
+    def test_export_without_scheduler(self, client, video_upload, monkeypatch):
+        preview_id = json.loads(self.preview(client, video_upload).data)['preview_id']
+        monkeypatch.setattr(app, 'video_scheduler', None)
+        assert self.export(client, preview_id).status_code == 500
+
+
+class FakeDaemon:
+    """Stands in for DaemonClient, writing an empty output"""
+    def __init__(self, state='done'):
+        self.state = state
+    
+    def run_job(self, input_path, output_path, program='', **kwargs):
+        open(output_path, 'wb').close()
+        return self.state
+
+
+@pytest.mark.integration
+class TestVideoDaemonRoutes:
+    """Test video requests when they run on the daemon."""
+    
+    def process(self, client, file_id, **extra):
+        return client.post('/process_video',
+                           data=json.dumps(dict({'file_id': file_id,
+                                                 'operations': [{'name': 'reverse'}]}, **extra)),
+                           content_type='application/json')
+    
+    def test_daemon_replaces_earlier_outputs(self, client, flask_app, video_upload, monkeypatch):
+        monkeypatch.setattr(app, 'video_daemon', FakeDaemon())
+        old_output = os.path.join(flask_app.config['PROCESSED_FOLDER'],
+                                  f"{video_upload}_old_processed.mp4")
+        open(old_output, 'wb').close()
+        
+        response = self.process(client, video_upload)
+        assert response.status_code == 200
+        output = json.loads(response.data)['processed_file']
+        assert os.listdir(flask_app.config['PROCESSED_FOLDER']) == [output]
+    
+    def test_daemon_cancelled_job_fails(self, client, video_upload, monkeypatch):
+        monkeypatch.setattr(app, 'video_daemon', FakeDaemon('cancelled'))
+        assert self.process(client, video_upload).status_code == 500
+    
+    def test_async_video_without_scheduler(self, client, video_upload, monkeypatch):
+        monkeypatch.setattr(app, 'video_daemon', FakeDaemon())
+        monkeypatch.setattr(app, 'video_scheduler', None)
+        response = self.process(client, video_upload, **{'async': True})
+        assert response.status_code == 500
+        assert 'need the video library' in json.loads(response.data)['error']
+
+
+class FakeContextPool:
+    """Stands in for ContextPool, counting contexts out on loan"""
+    def __init__(self, processor):
+        self.processor = processor
+        self.borrowed = 0
+    
+    @contextlib.contextmanager
+    def processor_for_job(self, timeout=None):
+        self.borrowed += 1
+        try:
+            yield self.processor
+        finally:
+            self.borrowed -= 1
+
+
+class FakeStreamProcessor:
+    """Stands in for a bound VideoProcessor, emitting two fragments"""
+    has_standard_format_support = True
+    
+    def __init__(self):
+        self.live = 0
+    
+    def decode_video_stream(self, stream):
+        stream.read()
+        self.live += 1
+        return object()
+    
+    def encode_video_chunks(self, video_ptr, fragment_seconds=1):
+        yield b'first'
+        yield b'second'
+    
+    def free_video(self, video_ptr, mode):
+        self.live -= 1
+
+
+@pytest.mark.integration
+class TestVideoStreamRoute:
+    """Test streamed processing releases its context however the response ends."""
+    
+    @pytest.fixture
+    def fakes(self, monkeypatch):
+        processor = FakeStreamProcessor()
+        pool = FakeContextPool(processor)
+        monkeypatch.setattr(app, 'VIDEO_PROCESSING_AVAILABLE', True)
+        monkeypatch.setattr(app, 'video_processor', processor)
+        monkeypatch.setattr(app, 'video_contexts', pool)
+        return processor, pool
+    
+    def stream(self, client):
+        return client.post('/process_video_stream?stream=1', data=b'video',
+                           buffered=False)
+    
+    def test_stream_releases_after_last_fragment(self, client, fakes):
+        processor, pool = fakes
+        response = self.stream(client)
+        assert b''.join(response.response) == b'firstsecond'
+        response.close()
+        assert pool.borrowed == 0 and processor.live == 0
+    
+    def test_stream_releases_when_client_disconnects(self, client, fakes):
+        processor, pool = fakes
+        response = self.stream(client)
+        assert pool.borrowed == 1
+        response.close()  # before reading any fragment
+        assert pool.borrowed == 0 and processor.live == 0
+    
+    def test_stream_without_contexts(self, client, fakes, monkeypatch):
+        monkeypatch.setattr(app, 'video_contexts', None)
+        assert self.stream(client).status_code == 500
+
+
+class FakeRenditionProcessor:
+    """Stands in for a bound VideoProcessor, decoding to an empty 64-line SVideo"""
+    has_standard_format_support = True
+    
+    def __init__(self):
+        self.encoded = None
+        self.fail = False
+    
+    def decode_video(self, path, mode):
+        return ctypes.pointer(SVideo(num_frames=0, channels=3, height=64, width=96))
+    
+    def encode_video_renditions(self, video_ptr, renditions, master_playlist=None):
+        # A playlist and a segment per rendition, as the HLS muxer writes them
+        for path, _ in renditions:
+            for name in (path, path[:-len('.m3u8')] + '0.ts'):
+                with open(name, 'w') as f:
+                    f.write('#EXTM3U\n')
+            if self.fail:
+                raise RuntimeError("Failed to encode video renditions")
+        with open(master_playlist, 'w') as f:
+            f.write('#EXTM3U\n')
+        self.encoded = renditions
+    
+    def free_video(self, video_ptr, mode):
+        pass
+
+
+@pytest.mark.integration
+class TestVideoRenditionsRoute:
+    """Test validation of the requested rendition heights."""
+    
+    @pytest.fixture
+    def processor(self, monkeypatch):
+        processor = FakeRenditionProcessor()
+        monkeypatch.setattr(app, 'VIDEO_PROCESSING_AVAILABLE', True)
+        monkeypatch.setattr(app, 'video_processor', processor)
+        monkeypatch.setattr(app, 'video_contexts', FakeContextPool(processor))
+        monkeypatch.setattr(app, 'decoded_cache', None)
+        return processor
+    
+    def process(self, client, file_id, renditions):
+        return client.post('/process_video',
+                           data=json.dumps({'file_id': file_id, 'operations': [],
+                                            'renditions': renditions}),
+                           content_type='application/json')
+    
+    def test_renditions(self, client, video_upload, processor):
+        response = self.process(client, video_upload, [64, 32])
+        assert response.status_code == 200
+        assert [height for _, height in processor.encoded] == [64, 32]
+        assert json.loads(response.data)['renditions'][1].endswith('_32p.m3u8')
+    
+    @pytest.mark.parametrize('renditions', [[], 32, '32', [0], [-32], [32.5], ['32'],
+                                            [True], [None], [32, 32]])
+    def test_invalid_renditions(self, client, video_upload, processor, renditions):
+        assert self.process(client, video_upload, renditions).status_code == 400
+        assert processor.encoded is None
+    
+    def test_renditions_above_source_height(self, client, video_upload, processor):
+        response = self.process(client, video_upload, [32, 65])
+        assert response.status_code == 400
+        assert 'source height of 64' in json.loads(response.data)['error']
+        assert processor.encoded is None
+    
+    def outputs(self, flask_app, file_id):
+        return sorted(name for name in os.listdir(flask_app.config['PROCESSED_FOLDER'])
+                      if name.startswith(f"{file_id}_"))
+    
+    def test_resubmit_replaces_earlier_renditions(self, client, flask_app, video_upload,
+                                                  processor):
+        processed = os.path.join(flask_app.config['PROCESSED_FOLDER'],
+                                 f"{video_upload}_other_processed.mp4")
+        open(processed, 'w').close()
+        self.process(client, video_upload, [64, 32])
+        response = self.process(client, video_upload, [48])
+        master = json.loads(response.data)['processed_file']
+        base = master[:-len('.m3u8')]
+        assert self.outputs(flask_app, video_upload) == sorted([
+            os.path.basename(processed), master, f"{base}_48p.m3u8", f"{base}_48p0.ts"])
+    
+    def test_failed_encode_leaves_no_files(self, client, flask_app, video_upload, processor):
+        processor.fail = True
+        response = self.process(client, video_upload, [64, 32])
+        assert response.status_code == 500
+        assert self.outputs(flask_app, video_upload) == []
+
+
+@pytest.mark.integration
+class TestPreparedUploadRoutes:
+    """Test the stats and thumbnail routes of prepared uploads."""
+    
+    def test_closed_preparation_is_not_found(self, client, monkeypatch):
+        class FreedLib:
+            def video_prepare_free(self, handle):
+                pass
+        
+        prepared = PreparedVideo(FreedLib(), 1)
+        prepared.close()  # as when a newer upload evicts it mid-request
+        monkeypatch.setitem(app.video_preparations, 'evicted', prepared)
+        assert client.get('/video_stats/evicted').status_code == 404
+        assert client.get('/video_thumbnails/evicted/0').status_code == 404
+
+
 @pytest.mark.integration
 class TestDownloadEndpoint:
     """Test file download endpoint."""
@@ -0,0 +1,988 @@
+"""
+Unit tests for the native video library.
+Tests kernels, programs and file helpers through video_wrapper.py.
+"""
+
+import pytest
+import numpy as np
+import ctypes
+import io
+import os
+import subprocess
+import sys
+import threading
+import time
+from ctypes import (c_char_p, c_int, c_size_t, c_void_p, c_ubyte, c_float, CFUNCTYPE, POINTER,
+                    create_string_buffer)
+
+from video_wrapper import VIDEO_PROCESSING_AVAILABLE, video_processor, SVideo
+import video_wrapper
+from conftest import make_video_array, write_raw_video, read_raw_video
+
+
+pytestmark = pytest.mark.skipif(not VIDEO_PROCESSING_AVAILABLE,
+                                reason="Video library not built")
+
+
+needs_ffmpeg = pytest.mark.skipif(
+    not VIDEO_PROCESSING_AVAILABLE or not video_processor.has_standard_format_support,
+    reason="Video library built without FFmpeg")
+
+
+# Flat frames, each a different grey, survive lossy encoding well enough to
+# check frame order by their means
+GREYS = [30 + 25 * i for i in range(8)]
+
+
+def grey_video_array():
+    return np.stack([np.full((3, 32, 48), grey, dtype=np.uint8) for grey in GREYS])
+
+
+def frame_means(processor, video):
+    """Mean of each frame of an SVideo, freeing it"""
+    try:
+        frames = np.array(processor.frames(video, 'structured'))
+    finally:
+        processor.free_video(video, 'structured')
+    return frames.reshape(len(frames), -1).mean(axis=1)
+
+
+def write_standard_video(path, array):
+    """Encode a (frames, channels, height, width) array to a standard format file"""
+    raw = str(path) + ".bin"
+    video = video_processor.decode_video(write_raw_video(raw, array), 'structured')
+    try:
+        video_processor.encode_video(str(path), video, 'structured')
+    finally:
+        video_processor.free_video(video, 'structured')
+        os.remove(raw)
+    return str(path)
+
+
+@pytest.fixture
+def standard_video(tmp_path):
+    """A short MP4 of flat grey frames, GREYS"""
+    return write_standard_video(tmp_path / "source.mp4", grey_video_array())
+
+
+@pytest.fixture
+def isa_processors():
+    """Processors bound to scalar-only and AVX2 contexts"""
+    scalar_ctx = video_processor.create_context(threads=1)
+    scalar_ctx.set_isa(video_wrapper.ISA_SCALAR)
+    avx2_ctx = video_processor.create_context(threads=1)
+    avx2_ctx.set_isa(video_wrapper.ISA_AVX2)
+    yield video_processor.with_context(scalar_ctx), video_processor.with_context(avx2_ctx)
+    scalar_ctx.close()
+    avx2_ctx.close()
+
+
+class TestKernelISA:
+    """AVX2 kernels must match the scalar kernels"""
+
+    def scale_simd(self, processor, array, channel, factor):
+        fn = processor.lib.scale_channel_SIMD_S_ctx
+        fn.argtypes = [c_void_p, POINTER(SVideo), c_ubyte, c_float]
+        fn.restype = None
+        video = processor.video_from_array(array)
+        fn(processor.ctx.handle, video, channel, factor)
+        return array
+
+    @pytest.mark.parametrize("factor", [0.0, 0.5, 1.0, 1.7, 2.43, 255.0, 1e8, -3.0, float('inf')])
+    def test_scale_matches_scalar(self, isa_processors, factor):
+        scalar, avx2 = isa_processors
+        source = make_video_array(height=11, width=13)
+        source[0, 1] = 105
+        expected = self.scale_simd(scalar, source.copy(), 1, factor)
+        result = self.scale_simd(avx2, source.copy(), 1, factor)
+        np.testing.assert_array_equal(result, expected)
+
+    def test_scale_huge_factor_saturates(self, isa_processors):
+        _, avx2 = isa_processors
+        source = np.full((1, 1, 8, 8), 105, dtype=np.uint8)
+        result = self.scale_simd(avx2, source, 0, 1e8)
+        assert (result == 255).all()
+
+    @pytest.mark.parametrize("bounds", [(0, 255), (40, 200), (128, 128)])
+    def test_clip_matches_scalar(self, isa_processors, bounds):
+        scalar, avx2 = isa_processors
+        source = make_video_array(height=11, width=13, seed=1)
+        expected = source.copy()
+        result = source.copy()
+        scalar.clip_channel(scalar.video_from_array(expected), 2, *bounds, mode='structured')
+        avx2.clip_channel(avx2.video_from_array(result), 2, *bounds, mode='structured')
+        np.testing.assert_array_equal(result, expected)
+        np.testing.assert_array_equal(result[:, 2], np.clip(source[:, 2], *bounds))
+
+
+class TuneParams(ctypes.Structure):
+    """lib/autotune.h TuneParams"""
+    _fields_ = [("tile_bytes", c_size_t), ("prefetch_distance", c_size_t),
+                ("chunk_bytes", c_size_t), ("streaming_stores", c_int),
+                ("small_video_bytes", c_size_t), ("small_video_threads", c_int)]
+
+
+@pytest.fixture
+def batched_processors():
+    """Scalar and AVX2 processors with chunks small enough to split a small video"""
+    contexts = []
+    for isa in (video_wrapper.ISA_SCALAR, video_wrapper.ISA_AVX2):
+        ctx = video_processor.create_context(threads=2)
+        ctx.set_isa(isa)
+        video_processor.lib.video_context_set_tuning.argtypes = [c_void_p, POINTER(TuneParams)]
+        video_processor.lib.video_context_set_tuning(ctx.handle, TuneParams(32, 0, 512, 0, 0, 1))
+        contexts.append(ctx)
+    yield [video_processor.with_context(ctx) for ctx in contexts]
+    for ctx in contexts:
+        ctx.close()
+
+
+class TestBatchedKernels:
+    """Frame-batched clip and scale must match the per-frame scalar kernels"""
+
+    # (channels, frames, arrange, channel to run on): one channel is back to
+    # back, a swap keeps the planes evenly strided, a reverse leaves them at a
+    # negative stride, which takes per-plane pointers
+    LAYOUTS = {
+        'contiguous': (1, 10, lambda p, v: None, 0),
+        'strided': (3, 10, lambda p, v: None, 1),
+        'swapped': (3, 10, lambda p, v: p.swap_channels(v, 0, 2, mode='structured'), 0),
+        'reversed': (3, 10, lambda p, v: p.reverse_video(v, mode='structured'), 2),
+        'single_frame': (3, 1, lambda p, v: None, 1),
+    }
+
+    def run(self, processor, layout, shape, kernel, args, batched):
+        channels, frames, arrange, channel = self.LAYOUTS[layout]
+        array = make_video_array(frames=frames, channels=channels, height=shape[0],
+                                 width=shape[1], seed=3)
+        video = processor.video_from_array(array)
+        arrange(processor, video)
+        if batched:
+            fn = getattr(processor.lib, kernel + '_channel_batched_S_ctx')
+            fn.argtypes = [c_void_p, POINTER(SVideo), c_ubyte] + (
+                [c_ubyte, c_ubyte] if kernel == 'clip' else [c_float])
+            fn.restype = None
+            fn(processor.ctx.handle, video, channel, *args)
+        else:
+            getattr(processor, kernel + '_channel')(video, channel, *args, mode='structured')
+        return array
+
+    @pytest.mark.parametrize("layout", list(LAYOUTS))
+    @pytest.mark.parametrize("shape", [(8, 32), (11, 13)])  # whole vectors, and a tail
+    @pytest.mark.parametrize("kernel,args", [('clip', (40, 200)), ('scale', (1.7,))])
+    def test_matches_scalar(self, batched_processors, layout, shape, kernel, args):
+        expected = self.run(batched_processors[0], layout, shape, kernel, args, batched=False)
+        for processor in batched_processors:
+            result = self.run(processor, layout, shape, kernel, args, batched=True)
+            np.testing.assert_array_equal(result, expected)
+
+
+def format_program(text):
+    """Parse an op program and return its canonical text, or None if it does not parse"""
+    lib = video_processor.lib
+    lib.video_program_parse.argtypes = [c_void_p, c_char_p]
+    lib.video_program_parse.restype = c_void_p
+    lib.video_program_format.argtypes = [c_void_p, c_char_p, c_size_t]
+    lib.video_program_format.restype = c_size_t
+    lib.video_program_free.argtypes = [c_void_p, c_void_p]
+    lib.video_program_free.restype = None
+    ctx = lib.video_default_context()
+    program = lib.video_program_parse(ctx, text.encode('utf-8'))
+    if not program:
+        return None
+    try:
+        buffer = create_string_buffer(lib.video_program_format(program, None, 0) + 1)
+        lib.video_program_format(program, buffer, len(buffer))
+        return buffer.value.decode('utf-8')
+    finally:
+        lib.video_program_free(ctx, program)
+
+
+class TestPrograms:
+    """Op program parsing and canonical formatting"""
+
+    @pytest.mark.parametrize("text", [
+        '', 'reverse', 'swap:0,2;clip:1,10,200;scale:2,1.5',
+        'roi:2,1,3,2,1,3;clip:0,5,250;roi;scale:1,0.5',
+        'scale:0,0=0 24~1 96=1 120=0', 'clip:1,0=10 10#40,200',
+        ' reverse ;; swap: 0 , 1 ;',
+    ])
+    def test_valid_programs_round_trip(self, text):
+        canonical = format_program(text)
+        assert canonical is not None
+        assert format_program(canonical) == canonical
+
+    def test_equivalent_programs_share_canonical_text(self):
+        assert format_program('swap:0,2;scale:1,2') == format_program(' swap:0,2 ; scale:1,2.0;')
+
+    @pytest.mark.parametrize("text", [
+        'bogus', 'swap:0', 'clip:0,10', 'clip:0,-1,200', 'clip:0,10,256', 'scale:0,-1',
+        'scale:0,nan', 'scale:0,inf', 'scale:0,-inf', 'scale:0,1e10', 'scale:0,256',
+        'scale:0,0=0 10=nan', 'scale:0,0=0 10=1e10', 'scale:0,0=-1 10=1',
+        'clip:0,0=0 10=300,255', 'clip:0,10,0=nan', 'roi:nan,0,1,1', 'swap:nan,1',
+        'scale:0,10=1 5=2', 'roi:0,0,1', 'roi:0,0,1,1,5,5',
+    ])
+    def test_invalid_programs_are_rejected(self, text):
+        assert format_program(text) is None
+
+    def test_operations_build_parseable_programs(self):
+        operations = [
+            {'name': 'reverse'},
+            {'name': 'swap_channels', 'params': {'channel1': 0, 'channel2': 2}},
+            {'name': 'clip_channel', 'params': {'channel': 1, 'min_val': 10, 'max_val': 200},
+             'roi': {'x': 1, 'y': 1, 'width': 4, 'height': 4}},
+            {'name': 'scale_channel', 'params': {'channel': 2,
+                                                 'scale_factor': [[0, 0.5], [10, 2.0, 'linear']]}},
+        ]
+        assert format_program(video_wrapper.program_from_operations(operations)) is not None
+
+
+class TestRegionKernels:
+    """ROI and keyframed kernels against NumPy references"""
+
+    def test_clip_inside_roi(self):
+        source = make_video_array(frames=4, height=6, width=8)
+        array = source.copy()
+        roi = video_wrapper.make_roi(x=2, y=1, width=3, height=2, first_frame=1, last_frame=3)
+        video_processor.clip_channel(video_processor.video_from_array(array), 1, 50, 100,
+                                     mode='structured', roi=roi)
+        expected = source.copy()
+        expected[1:3, 1, 1:3, 2:5] = np.clip(source[1:3, 1, 1:3, 2:5], 50, 100)
+        np.testing.assert_array_equal(array, expected)
+
+    def test_swap_inside_roi(self):
+        source = make_video_array(frames=2, height=6, width=8)
+        array = source.copy()
+        roi = video_wrapper.make_roi(x=4, y=3)
+        video_processor.swap_channels(video_processor.video_from_array(array), 0, 2,
+                                      mode='structured', roi=roi)
+        expected = source.copy()
+        expected[:, 0, 3:, 4:] = source[:, 2, 3:, 4:]
+        expected[:, 2, 3:, 4:] = source[:, 0, 3:, 4:]
+        np.testing.assert_array_equal(array, expected)
+
+    def test_masked_scale_blends(self):
+        source = np.full((1, 1, 2, 2), 100, dtype=np.uint8)
+        array = source.copy()
+        roi = video_wrapper.make_roi(mask=bytes([0, 255, 0, 255]))
+        video_processor.scale_channel(video_processor.video_from_array(array), 0, 2.0,
+                                      mode='structured', roi=roi)
+        np.testing.assert_array_equal(array[0, 0], [[100, 200], [100, 200]])
+
+    def test_scale_curve_hold_and_linear(self):
+        source = np.full((5, 1, 4, 4), 100, dtype=np.uint8)
+        array = source.copy()
+        video_processor.scale_channel(video_processor.video_from_array(array), 0,
+                                      [(0, 0.0, 'linear'), (2, 1.0, 'hold'), (4, 2.0, 'hold')],
+                                      mode='structured')
+        assert (array[0] == 0).all()
+        assert (array[1] == 50).all()
+        assert (array[2] == 100).all()
+        assert (array[3] == 100).all()
+        assert (array[4] == 200).all()
+
+    def test_clip_curve_bounds(self):
+        source = make_video_array(frames=3, channels=1, height=4, width=4)
+        array = source.copy()
+        video_processor.clip_channel(video_processor.video_from_array(array), 0,
+                                     [(0, 0, 'hold'), (1, 100, 'hold')], 200, mode='structured')
+        np.testing.assert_array_equal(array[0], np.clip(source[0], 0, 200))
+        np.testing.assert_array_equal(array[1:], np.clip(source[1:], 100, 200))
+
+
+class TestDeterministic:
+    """Deterministic contexts use the scalar kernels"""
+
+    def test_deterministic_matches_scalar(self):
+        with video_processor.create_context(threads=1) as det_ctx, \
+                video_processor.create_context(threads=1) as scalar_ctx:
+            det_ctx.set_isa(video_wrapper.ISA_AVX2)
+            det_ctx.set_deterministic()
+            scalar_ctx.set_isa(video_wrapper.ISA_SCALAR)
+            source = make_video_array(height=11, width=13)
+            results = []
+            for ctx in (det_ctx, scalar_ctx):
+                processor = video_processor.with_context(ctx)
+                array = source.copy()
+                TestKernelISA().scale_simd(processor, array, 0, 1.37)
+                results.append(array)
+            np.testing.assert_array_equal(results[0], results[1])
+
+
+class TestContext:
+    """Context configuration"""
+
+    def test_allocator_refused_while_blocks_live(self, tmp_path):
+        alloc_type = CFUNCTYPE(c_void_p, c_size_t, c_void_p)
+        free_type = CFUNCTYPE(None, c_void_p, c_void_p)
+        lib = video_processor.lib
+        lib.video_context_set_allocator.argtypes = [c_void_p, alloc_type, free_type, c_void_p]
+        lib.video_context_set_allocator.restype = c_int
+        libc = ctypes.CDLL(None)
+        libc.aligned_alloc.argtypes = [c_size_t, c_size_t]
+        libc.aligned_alloc.restype = c_void_p
+        libc.free.argtypes = [c_void_p]
+        allocated = []
+        alloc_fn = alloc_type(lambda size, user: allocated.append(size) or
+                              libc.aligned_alloc(64, (size + 63) // 64 * 64))
+        free_fn = free_type(lambda ptr, user: libc.free(ptr))
+
+        path = write_raw_video(tmp_path / "clip.bin", make_video_array())
+        with video_processor.create_context(threads=1) as ctx:
+            processor = video_processor.with_context(ctx)
+            video = processor.decode_video(path, mode='structured')
+            assert lib.video_context_set_allocator(ctx.handle, alloc_fn, free_fn, None) == -1
+            processor.free_video(video, mode='structured')
+
+            assert lib.video_context_set_allocator(ctx.handle, alloc_fn, free_fn, None) == 0
+            video = processor.decode_video(path, mode='structured')
+            assert allocated
+            processor.free_video(video, mode='structured')
+            assert lib.video_context_set_allocator(ctx.handle, alloc_type(), free_type(), None) == 0
+
+
+    def test_allocations_over_limit_spill(self, tmp_path):
+        source = make_video_array(frames=60, height=200, width=200)
+        input_path = write_raw_video(tmp_path / "in.bin", source)
+        (tmp_path / "spill").mkdir()
+        with video_processor.create_context() as ctx:
+            ctx.set_limits(max_bytes=1 << 20)
+            ctx.set_spill(str(tmp_path / "spill"))
+            processor = video_processor.with_context(ctx)
+            video = processor.decode_video(input_path, 'structured')
+            assert ctx.stats()['bytes_spilled'] >= source.nbytes
+            assert ctx.stats()['bytes_live'] < 1 << 20
+            processor.reverse_video(video, 'structured')
+            processor.encode_video(str(tmp_path / "out.bin"), video, 'structured')
+            processor.free_video(video, 'structured')
+            assert ctx.stats()['bytes_spilled'] == 0
+        assert os.listdir(tmp_path / "spill") == []  # scratch files are unlinked
+        np.testing.assert_array_equal(read_raw_video(tmp_path / "out.bin"), source[::-1])
+
+class TestJobs:
+    """Asynchronous jobs on library threads"""
+
+    def test_job_runs_program(self, tmp_path):
+        source = make_video_array()
+        input_path = write_raw_video(tmp_path / "in.bin", source)
+        output_path = str(tmp_path / "out.bin")
+        job = video_processor.submit_job(input_path, output_path, 'reverse;swap:0,2')
+        try:
+            assert job.wait() == 'done'
+        finally:
+            job.close()
+        np.testing.assert_array_equal(read_raw_video(output_path), source[::-1, ::-1])
+
+    def test_failed_job_removes_output(self, tmp_path):
+        input_path = write_raw_video(tmp_path / "in.bin", make_video_array())
+        output_path = tmp_path / "out.bin"
+        output_path.write_bytes(b"stale")
+        job = video_processor.submit_job(input_path, str(output_path), 'scale:9,2')
+        try:
+            assert job.wait() == 'failed'
+        finally:
+            job.close()
+        assert not output_path.exists()
+
+    def test_failed_job_keeps_output_that_is_input(self, tmp_path):
+        source = make_video_array()
+        input_path = write_raw_video(tmp_path / "in.bin", source)
+        job = video_processor.submit_job(input_path, input_path, 'scale:9,2')
+        try:
+            assert job.wait() == 'failed'
+        finally:
+            job.close()
+        np.testing.assert_array_equal(read_raw_video(input_path), source)
+
+    @pytest.mark.parametrize("program", ['reverse', 'swap:0,2'])
+    def test_job_refuses_output_that_is_input(self, tmp_path, program):
+        source = make_video_array()
+        input_path = write_raw_video(tmp_path / "in.bin", source)
+        os.link(input_path, tmp_path / "link.bin")
+        job = video_processor.submit_job(input_path, str(tmp_path / "link.bin"), program)
+        try:
+            assert job.wait() == 'failed'
+            assert 'input' in job.error
+        finally:
+            job.close()
+        np.testing.assert_array_equal(read_raw_video(input_path), source)
+
+
+class TestBatch:
+    """Batches must give each clip what running the program on it alone gives"""
+
+    PROGRAM = 'reverse;swap:0,2;clip:1,10,200;scale:2,1.5'
+
+    @pytest.fixture
+    def batch_processor(self):
+        # Four threads, and any clip over 4 KB big enough for more than one,
+        # so the large clip runs alone and the rest one per worker
+        with video_processor.create_context(threads=4) as ctx:
+            video_processor.lib.video_context_set_tuning.argtypes = [c_void_p, POINTER(TuneParams)]
+            video_processor.lib.video_context_set_tuning(
+                ctx.handle, TuneParams(32, 0, 64 * 1024, 0, 4096, 1))
+            yield video_processor.with_context(ctx)
+
+    def run_alone(self, path, program):
+        lib = video_processor.lib
+        lib.video_program_parse.argtypes = [c_void_p, c_char_p]
+        lib.video_program_parse.restype = c_void_p
+        lib.video_program_run_S.argtypes = [c_void_p, POINTER(SVideo), c_void_p]
+        lib.video_program_run_S.restype = c_int
+        lib.video_program_free.argtypes = [c_void_p, c_void_p]
+        lib.video_program_free.restype = None
+        ctx = lib.video_default_context()
+        parsed = lib.video_program_parse(ctx, program.encode('utf-8'))
+        video = video_processor.decode_video(path, mode='structured')
+        try:
+            assert lib.video_program_run_S(ctx, video, parsed) == 0
+            return np.array(video_processor.frames(video), copy=True)
+        finally:
+            video_processor.free_video(video, mode='structured')
+            lib.video_program_free(ctx, parsed)
+
+    def test_clips_match_single_runs(self, batch_processor, tmp_path):
+        sources = [make_video_array(frames=24, height=32, width=48, seed=10)]
+        sources += [make_video_array(frames=2 + i, seed=11 + i) for i in range(5)]
+        inputs = [write_raw_video(tmp_path / f"in{i}.bin", source)
+                  for i, source in enumerate(sources)]
+        outputs = [str(tmp_path / f"out{i}.bin") for i in range(len(sources))]
+        assert batch_processor.run_batch(inputs, outputs, self.PROGRAM) == [True] * len(sources)
+        for input_path, output_path in zip(inputs, outputs):
+            np.testing.assert_array_equal(read_raw_video(output_path),
+                                          self.run_alone(input_path, self.PROGRAM))
+
+    def test_failed_clip_leaves_no_output(self, batch_processor, tmp_path):
+        good = write_raw_video(tmp_path / "good.bin", make_video_array())
+        grey = write_raw_video(tmp_path / "grey.bin", make_video_array(channels=1))
+        (tmp_path / "grey_out.bin").write_bytes(b"stale")
+        outputs = [str(tmp_path / "good_out.bin"), str(tmp_path / "grey_out.bin")]
+        assert batch_processor.run_batch([good, grey], outputs, 'swap:0,2') == [True, False]
+        assert os.path.exists(outputs[0])
+        assert not os.path.exists(outputs[1])
+        assert os.path.exists(grey)
+
+
+class TestScheduler:
+    """Jobs admitted against CPU slots and time-sliced"""
+
+    def test_jobs_share_one_slot(self, tmp_path):
+        scheduler = video_wrapper.VideoScheduler(video_processor, slots=1, quantum_seconds=1e-6)
+        long_input = write_raw_video(tmp_path / "long.bin",
+                                     make_video_array(frames=300, height=64, width=64))
+        short_source = make_video_array()
+        short_input = write_raw_video(tmp_path / "short.bin", short_source)
+        try:
+            jobs = [scheduler.submit_job(long_input, str(tmp_path / "long_out.bin"), 'scale:0,1.5')]
+            jobs += [scheduler.submit_job(short_input, str(tmp_path / f"short_{i}.bin"), 'swap:0,2')
+                     for i in range(4)]
+            assert [job.wait() for job in jobs] == ['done'] * 5
+            for i in range(4):
+                np.testing.assert_array_equal(read_raw_video(tmp_path / f"short_{i}.bin"),
+                                              short_source[:, ::-1])
+        finally:
+            for job in jobs:
+                job.close()
+            scheduler.close()
+
+    def test_cache_hit_skips_admission(self, tmp_path):
+        scheduler = video_wrapper.VideoScheduler(video_processor, slots=1)
+        cache = video_wrapper.ResultCache(video_processor, str(tmp_path / "cache"))
+        source = make_video_array()
+        input_path = write_raw_video(tmp_path / "in.bin", source)
+        started, release = threading.Event(), threading.Event()
+        
+        def hold_slot(stage, done, total):
+            started.set()
+            release.wait(10)
+        
+        jobs = []
+        try:
+            jobs.append(scheduler.submit_job(input_path, str(tmp_path / "first.bin"), 'swap:0,2',
+                                             cache=cache))
+            assert jobs[-1].wait() == 'done'
+            
+            jobs.append(scheduler.submit_job(input_path, str(tmp_path / "blocker.bin"),
+                                             'scale:0,1.5', progress=hold_slot))
+            assert started.wait(10)
+            
+            # The only slot is held, so only a cache hit can finish
+            hit = scheduler.submit_job(input_path, str(tmp_path / "hit.bin"), 'swap:0,2',
+                                       cache=cache)
+            jobs.append(hit)
+            deadline = time.monotonic() + 10
+            while hit.poll()['state'] in ('queued', 'running') and time.monotonic() < deadline:
+                time.sleep(0.01)
+            assert hit.poll()['state'] == 'done'
+            np.testing.assert_array_equal(read_raw_video(tmp_path / "hit.bin"), source[:, ::-1])
+        finally:
+            release.set()
+            for job in jobs:
+                job.close()
+            cache.close()
+            scheduler.close()
+
+    def test_cancelled_jobs_leave_no_output(self, tmp_path):
+        scheduler = video_wrapper.VideoScheduler(video_processor, slots=1, quantum_seconds=1e-6)
+        source = write_raw_video(tmp_path / "in.bin",
+                                 make_video_array(frames=300, height=64, width=64))
+        try:
+            jobs = [scheduler.submit_job(source, str(tmp_path / f"out_{i}.bin"), 'scale:0,1.5')
+                    for i in range(3)]
+            for job in jobs:
+                job.cancel()
+            states = [job.wait() for job in jobs]
+            for i, state in enumerate(states):
+                assert state in ('done', 'cancelled')
+                assert (tmp_path / f"out_{i}.bin").exists() == (state == 'done')
+        finally:
+            for job in jobs:
+                job.close()
+            scheduler.close()
+
+
+class TestCheckpoints:
+    """Checkpointed op-chain prefixes shared between jobs"""
+
+    def test_concurrent_jobs_resume_from_checkpoints(self, tmp_path):
+        source = make_video_array(frames=20, height=32, width=32)
+        input_path = write_raw_video(tmp_path / "in.bin", source)
+        # Room for about two videos, so jobs evict each other's checkpoints
+        store = video_wrapper.CheckpointStore(video_processor, 2 * source.nbytes + 4096)
+        programs = ['swap:0,2', 'swap:0,2;clip:1,10,200', 'swap:0,2;scale:1,0.5',
+                    'swap:0,2;clip:1,10,200;swap:1,2']
+        jobs = []
+        try:
+            for round_ in range(3):
+                for i, program in enumerate(programs):
+                    output = str(tmp_path / f"out_{round_}_{i}.bin")
+                    jobs.append((video_processor.submit_job(input_path, output, program,
+                                                            checkpoints=store), output, i))
+            for job, output, i in jobs:
+                assert job.wait() == 'done'
+                expected = source[:, ::-1].copy()
+                if i in (1, 3):
+                    expected[:, 1] = np.clip(expected[:, 1], 10, 200)
+                if i == 2:
+                    expected[:, 1] = (expected[:, 1] * np.float32(0.5)).astype(np.uint8)
+                if i == 3:
+                    expected = expected[:, [0, 2, 1]]
+                np.testing.assert_array_equal(read_raw_video(output), expected)
+        finally:
+            for job, _, _ in jobs:
+                job.close()
+            store.close()
+
+
+class TestSnapshots:
+    """Copy-on-write snapshots and zero-copy plane views"""
+
+    @pytest.fixture
+    def decoded(self, tmp_path):
+        source = make_video_array(frames=3)
+        video = video_processor.decode_video(write_raw_video(tmp_path / "in.bin", source),
+                                             mode='structured')
+        assert video
+        yield source, video
+        video_processor.free_video(video, mode='structured')
+
+    def test_snapshot_keeps_data_after_edit(self, decoded):
+        source, video = decoded
+        snapshot = video_processor.snapshot_video(video)
+        try:
+            video_processor.scale_channel(video, 0, 0.0, mode='structured')
+            video_processor.swap_channels(snapshot, 1, 2, mode='structured')
+            edited = np.asarray(memoryview(video_processor.frames(video).plane(1, 0)))
+            assert (edited == 0).all()
+            for frame in range(3):
+                np.testing.assert_array_equal(
+                    np.asarray(memoryview(video_processor.frames(snapshot).plane(frame, 0))),
+                    source[frame, 0])
+                np.testing.assert_array_equal(
+                    np.asarray(memoryview(video_processor.frames(snapshot).plane(frame, 1))),
+                    source[frame, 2])
+            # Channel 1 is still shared with the snapshot's channel 2
+            np.testing.assert_array_equal(
+                np.asarray(memoryview(video_processor.frames(video).plane(0, 1))), source[0, 1])
+        finally:
+            video_processor.free_video(snapshot, mode='structured')
+
+    def test_shared_plane_is_read_only(self, decoded):
+        source, video = decoded
+        snapshot = video_processor.snapshot_video(video)
+        try:
+            plane = np.asarray(video_processor.frames(video).plane(0, 0))
+            assert not plane.flags.writeable
+            with pytest.raises(BufferError):
+                memoryview(video_processor.frames(video)).cast('B')
+            with pytest.raises(ValueError):
+                plane[:] = 7
+
+            # Kernels copy the plane before writing it
+            video_processor.clip_channel(video, 0, 0, 10, mode='structured')
+            np.testing.assert_array_equal(
+                np.asarray(video_processor.frames(snapshot).plane(0, 0)), source[0, 0])
+            assert np.asarray(video_processor.frames(video).plane(0, 0)).max() <= 10
+        finally:
+            video_processor.free_video(snapshot, mode='structured')
+
+    def test_plane_view_outlives_snapshot(self, tmp_path):
+        source = make_video_array(frames=3)
+        path = write_raw_video(tmp_path / "in.bin", source)
+        with video_processor.create_context() as ctx:
+            processor = video_processor.with_context(ctx)
+            video = processor.decode_video(path, mode='structured')
+            snapshot = processor.snapshot_video(video)
+            plane = np.asarray(processor.frames(video).plane(0, 0))
+            # The kernel moves the video onto a copy, leaving the snapshot
+            # the plane's last owner; the view keeps it alive past the snapshot
+            processor.scale_channel(video, 0, 0.0, mode='structured')
+            processor.free_video(snapshot, mode='structured')
+            processor.free_video(video, mode='structured')
+            assert ctx.stats()['bytes_live'] >= source.nbytes
+            np.testing.assert_array_equal(plane, source[0, 0])
+            del plane
+            assert ctx.stats()['bytes_live'] == 0
+
+    def test_snapshot_refused_while_exported(self, decoded):
+        source, video = decoded
+        array = np.asarray(video_processor.frames(video))
+        with pytest.raises(ValueError):
+            video_processor.snapshot_video(video)
+        del array
+        plane = np.asarray(video_processor.frames(video).plane(1, 2))
+        with pytest.raises(ValueError):
+            video_processor.snapshot_video(video)
+        del plane
+        snapshot = video_processor.snapshot_video(video)
+        assert snapshot
+        video_processor.free_video(snapshot, mode='structured')
+
+    def test_unshared_video_exports_writable(self, decoded):
+        source, video = decoded
+        array = np.asarray(video_processor.frames(video))
+        np.testing.assert_array_equal(array, source)
+        array[0, 0] = 1
+        assert (np.asarray(video_processor.frames(video).plane(0, 0)) == 1).all()
+
+
+class TestReverseFile:
+    """Out-of-core reverse between raw files"""
+
+    @pytest.mark.parametrize("frames", [0, 1, 2, 7, 300])
+    def test_reverse_file(self, tmp_path, frames):
+        source = make_video_array(frames=frames, height=64, width=64)
+        output = tmp_path / "out.bin"
+        video_processor.reverse_file(write_raw_video(tmp_path / "in.bin", source), str(output))
+        np.testing.assert_array_equal(read_raw_video(output), source[::-1])
+
+    def test_reverse_into_itself_is_refused(self, tmp_path):
+        source = make_video_array()
+        path = write_raw_video(tmp_path / "in.bin", source)
+        with pytest.raises(RuntimeError):
+            video_processor.reverse_file(path, path)
+        np.testing.assert_array_equal(read_raw_video(path), source)
+
+    def test_failed_reverse_removes_output(self, tmp_path):
+        # A file size limit makes the writes fail part way through
+        input_path = write_raw_video(tmp_path / "in.bin",
+                                     make_video_array(frames=50, height=64, width=64))
+        output = tmp_path / "out.bin"
+        script = (
+            "import resource, signal, sys\n"
+            "signal.signal(signal.SIGXFSZ, signal.SIG_IGN)\n"
+            "resource.setrlimit(resource.RLIMIT_FSIZE, (65536, 65536))\n"
+            "from video_wrapper import video_processor\n"
+            "try:\n"
+            "    video_processor.reverse_file(sys.argv[1], sys.argv[2])\n"
+            "except RuntimeError:\n"
+            "    sys.exit(3)\n"
+        )
+        result = subprocess.run([sys.executable, "-c", script, input_path, str(output)],
+                                env=dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path)),
+                                capture_output=True)
+        assert result.returncode == 3, result.stderr
+        assert not output.exists()
+
+
+class TestDecodedCache:
+    """Decoded and proxy videos kept by input identity and parameters"""
+
+    @staticmethod
+    def entries(directory):
+        return sorted(name for name in os.listdir(directory) if not name.startswith('.'))
+
+    @needs_ffmpeg
+    def test_long_params_are_keyed_apart(self, tmp_path, standard_video):
+        # Params differing only past the old 256-byte profile buffer
+        cache = video_wrapper.DecodedCache(video_processor, str(tmp_path / "decoded"))
+        try:
+            for suffix in ('a', 'b', 'a'):
+                video = video_processor.decode_video_cached(cache, standard_video,
+                                                            params='x' * 300 + suffix)
+                video_processor.free_video(video, 'structured')
+            assert len(self.entries(tmp_path / "decoded")) == 2
+        finally:
+            cache.close()
+
+    def test_proxy_long_params_are_keyed_apart(self, tmp_path):
+        source = make_video_array(frames=8, height=32, width=32)
+        path = write_raw_video(tmp_path / "in.bin", source)
+        cache = video_wrapper.DecodedCache(video_processor, str(tmp_path / "decoded"))
+        try:
+            for suffix in ('a', 'b', 'a'):
+                video, step, scale = video_processor.decode_video_proxy(
+                    cache, path, 16, 4, params='x' * 300 + suffix)
+                assert (step, scale) == (2, 2)
+                video_processor.free_video(video, 'structured')
+            assert len(self.entries(tmp_path / "decoded")) == 2
+        finally:
+            cache.close()
+
+
+VIDEO_CLI = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))),
+                         "lib", "video_cli")
+
+
+@pytest.mark.skipif(not os.path.exists(VIDEO_CLI), reason="video_cli not built")
+class TestCli:
+    """The batch tool's checks on where outputs go"""
+
+    def run(self, *args):
+        return subprocess.run([VIDEO_CLI, "-p", "reverse", *map(str, args)],
+                              capture_output=True, text=True)
+
+    def test_reverse_one_clip(self, tmp_path):
+        source = make_video_array()
+        input_path = write_raw_video(tmp_path / "in.bin", source)
+        result = self.run("-o", tmp_path / "out.bin", input_path)
+        assert result.returncode == 0, result.stderr
+        np.testing.assert_array_equal(read_raw_video(tmp_path / "out.bin"), source[::-1])
+
+    def test_output_over_input_is_refused(self, tmp_path):
+        source = make_video_array()
+        input_path = write_raw_video(tmp_path / "in.bin", source)
+        os.link(input_path, tmp_path / "link.bin")
+        for args in (["-O", tmp_path], ["-o", tmp_path / "link.bin"]):
+            result = self.run(*args, input_path)
+            assert result.returncode == 1
+            assert "would overwrite input" in result.stderr
+        np.testing.assert_array_equal(read_raw_video(input_path), source)
+
+    def test_duplicate_outputs_are_refused(self, tmp_path):
+        for name in ("a", "b"):
+            (tmp_path / name).mkdir()
+            write_raw_video(tmp_path / name / "clip.bin", make_video_array())
+        (tmp_path / "out").mkdir()
+        result = self.run("-O", tmp_path / "out", tmp_path / "*" / "clip.bin")
+        assert result.returncode == 1
+        assert "would both write" in result.stderr
+        assert os.listdir(tmp_path / "out") == []
+
+
+VIDEO_DAEMON = os.path.join(os.path.dirname(VIDEO_CLI), "video_daemon")
+
+
+@pytest.mark.skipif(not os.path.exists(VIDEO_DAEMON), reason="video_daemon not built")
+class TestDaemon:
+    """Where the daemon's socket goes and who may use it"""
+
+    def test_default_socket_is_private(self, tmp_path, monkeypatch):
+        monkeypatch.setenv("XDG_RUNTIME_DIR", str(tmp_path))
+        monkeypatch.delenv("FILMMASTER_SOCKET", raising=False)
+        daemon = subprocess.Popen([VIDEO_DAEMON, "-w", "1"], stdout=subprocess.DEVNULL,
+                                  stderr=subprocess.DEVNULL)
+        try:
+            client = video_wrapper.DaemonClient()
+            assert client.socket_path == str(tmp_path / "filmmaster.sock")
+            deadline = time.monotonic() + 10
+            while not client.ping(timeout=1) and time.monotonic() < deadline:
+                time.sleep(0.05)
+            assert client.ping()
+            assert os.stat(client.socket_path).st_mode & 0o777 == 0o600
+        finally:
+            daemon.terminate()
+            daemon.wait(timeout=10)
+
+
+class FakePrepareLib:
+    """Stands in for the library's video_prepare_* calls on one handle"""
+    def __init__(self):
+        self.freed = []
+        self.calls = 0
+
+    def video_prepare_done(self, handle):
+        self.calls += 1
+        return 1
+
+    def video_prepare_stats(self, handle, stats, max_frames):
+        assert handle not in self.freed
+        self.calls += 1
+        return 0
+
+    def video_prepare_free(self, handle):
+        self.freed.append(handle)
+
+
+class TestPreparedVideo:
+    """Closing a preparation that other threads are reading"""
+
+    def test_close_waits_for_users(self):
+        lib = FakePrepareLib()
+        prepared = video_wrapper.PreparedVideo(lib, 1)
+        with prepared.use() as alive:
+            assert alive
+            prepared.close()
+            assert lib.freed == []
+            assert prepared.stats() == []  # still readable inside use()
+        assert lib.freed == [1]
+        prepared.close()
+        assert lib.freed == [1]
+
+    def test_reads_after_close_find_nothing(self):
+        lib = FakePrepareLib()
+        prepared = video_wrapper.PreparedVideo(lib, 1)
+        prepared.close()
+        assert lib.freed == [1]
+        with prepared.use() as alive:
+            assert not alive
+        assert prepared.stats() is None
+        assert not prepared.done()
+        assert lib.calls == 0
+
+
+@needs_ffmpeg
+class TestStandardFormats:
+    """FFmpeg decode and encode paths, checked by frame order and size"""
+
+    def test_contexts_decode_concurrently(self, standard_video):
+        expected = frame_means(video_processor, video_processor.decode_video(standard_video,
+                                                                             'structured'))
+        np.testing.assert_allclose(expected, GREYS, atol=4)
+        results = [None] * 4
+
+        def decode(index):
+            with video_processor.create_context(threads=1) as ctx:
+                processor = video_processor.with_context(ctx)
+                results[index] = frame_means(processor,
+                                             processor.decode_video(standard_video, 'structured'))
+
+        threads = [threading.Thread(target=decode, args=(i,)) for i in range(len(results))]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for means in results:
+            np.testing.assert_array_equal(means, expected)
+
+    @pytest.fixture
+    def long_video(self, tmp_path):
+        """40 grey frames, several GOPs at the encoder's default keyframe interval"""
+        greys = np.arange(40) * 5 + 20
+        source = np.stack([np.full((3, 32, 48), grey, dtype=np.uint8) for grey in greys])
+        return write_standard_video(tmp_path / "long.mp4", source), greys
+
+    def test_reverse_spans_several_gops(self, tmp_path, long_video):
+        input_path, greys = long_video
+        output_path = str(tmp_path / "out.mp4")
+        video_processor.reverse_file(input_path, output_path)
+        means = frame_means(video_processor, video_processor.decode_video(output_path,
+                                                                          'structured'))
+        np.testing.assert_allclose(means, greys[::-1], atol=2.5)
+
+    def test_frame_server_seeks_across_gops(self, long_video):
+        path, greys = long_video
+        server = video_wrapper.FrameServer(video_processor, 1 << 20)
+        try:
+            assert server.info(path)['num_frames'] == len(greys)
+            for index in (25, 3, 39, 0, 25):  # backwards, across GOPs and cached
+                rgb, width, height = server.get_frame(path, index)
+                assert (width, height) == (48, 32)
+                assert abs(np.frombuffer(rgb, dtype=np.uint8).mean() - greys[index]) < 2.5
+            with pytest.raises(RuntimeError):
+                server.get_frame(path, len(greys))
+        finally:
+            server.close()
+
+    def test_decode_from_memory(self, standard_video):
+        with open(standard_video, 'rb') as f:
+            data = f.read()
+        from_file = frame_means(video_processor,
+                                video_processor.decode_video(standard_video, 'structured'))
+        from_memory = frame_means(video_processor, video_processor.decode_video_bytes(data))
+        np.testing.assert_array_equal(from_memory, from_file)
+        with pytest.raises(RuntimeError):
+            video_processor.decode_video_bytes(data[:len(data) // 4])
+
+    def test_decode_from_stream(self, tmp_path):
+        # Matroska needs no seeking back to its index, unlike a plain MP4
+        path = write_standard_video(tmp_path / "source.mkv", grey_video_array())
+        with open(path, 'rb') as f:
+            means = frame_means(video_processor, video_processor.decode_video_stream(f))
+        np.testing.assert_allclose(means, GREYS, atol=4)
+
+    def test_fragmented_stream_round_trip(self, standard_video):
+        video = video_processor.decode_video(standard_video, 'structured')
+        try:
+            data = b''.join(video_processor.encode_video_chunks(video, fragment_seconds=0.1))
+        finally:
+            video_processor.free_video(video, 'structured')
+        assert data[4:8] == b'ftyp' and b'moof' in data
+        means = frame_means(video_processor, video_processor.decode_video_stream(io.BytesIO(data)))
+        np.testing.assert_allclose(means, GREYS, atol=4)
+
+    def test_closing_fragment_stream_early(self, standard_video):
+        video = video_processor.decode_video(standard_video, 'structured')
+        try:
+            chunks = video_processor.encode_video_chunks(video, fragment_seconds=0.1)
+            assert next(chunks)
+            chunks.close()  # as a client disconnecting; waits for the encoder to stop
+        finally:
+            video_processor.free_video(video, 'structured')
+
+    def test_renditions_from_one_pass(self, tmp_path, standard_video):
+        video = video_processor.decode_video(standard_video, 'structured')
+        names = ("full.mp4", "half.mp4", "tall.mp4")
+        try:
+            video_processor.encode_video_renditions(
+                video, [(str(tmp_path / name), height) for name, height in zip(names, (32, 16, 100))])
+        finally:
+            video_processor.free_video(video, 'structured')
+        sizes = [video_processor.get_video_info(str(tmp_path / name)) for name in names]
+        # Never upscaled; scaled sizes keep the aspect ratio
+        assert [(info['width'], info['height']) for info in sizes] == [(48, 32), (24, 16), (48, 32)]
+        means = frame_means(video_processor,
+                            video_processor.decode_video(str(tmp_path / "half.mp4"), 'structured'))
+        np.testing.assert_allclose(means, GREYS, atol=4)
+
+    def test_hls_renditions_with_master_playlist(self, tmp_path, standard_video):
+        video = video_processor.decode_video(standard_video, 'structured')
+        try:
+            video_processor.encode_video_renditions(
+                video, [(str(tmp_path / "hi.m3u8"), 32), (str(tmp_path / "lo.m3u8"), 16)],
+                segment_seconds=0.1, master_playlist=str(tmp_path / "master.m3u8"))
+        finally:
+            video_processor.free_video(video, 'structured')
+        master = (tmp_path / "master.m3u8").read_text()
+        assert "RESOLUTION=48x32\nhi.m3u8" in master
+        assert "RESOLUTION=24x16\nlo.m3u8" in master
+        for name in ("hi.m3u8", "lo.m3u8"):
+            assert "#EXTINF" in (tmp_path / name).read_text()
+
+    def test_preview_of_proxy(self, tmp_path, long_video):
+        path, greys = long_video
+        cache = video_wrapper.DecodedCache(video_processor, str(tmp_path / "decoded"))
+        try:
+            proxy, step, scale = video_processor.decode_video_proxy(cache, path, 16, 10)
+        finally:
+            cache.close()
+        assert (step, scale) == (4, 3)
+        assert (proxy.contents.width, proxy.contents.height) == (16, 10)
+        output_path = str(tmp_path / "preview.mp4")
+        try:
+            video_processor.encode_video_preview(output_path, proxy, fps=30 // step)
+        finally:
+            means = frame_means(video_processor, proxy)
+        np.testing.assert_allclose(means, greys[::step], atol=2.5)
+        info = video_processor.get_video_info(output_path)
+        assert (info['width'], info['height'], info['num_frames']) == (16, 10, 10)